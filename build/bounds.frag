@@ -0,0 +1,9 @@
+#version 330 core
+
+// Colour writes are masked off while the boxes are drawn, only the depth test matters
+out vec4 outColor;
+
+void main()
+{
+    outColor = vec4(1.0);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+// The 0..1 cube stretched over an object's bounding box, for the occlusion queries
+layout (location = 0) in vec3 position;
+
+uniform mat4 mvp;
+
+void main()
+{
+    gl_Position = mvp * vec4(position, 1.0);
+}
@@ -0,0 +1,116 @@
+#version 330 core
+
+// The lighting pass of the deferred path: every pixel of the G-buffer is shaded with the lights of
+// its view cluster, the way simple.frag's CLUSTERED variant shades a fragment
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 64
+#endif
+#ifndef CLUSTER_TILES_X
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 12
+#define CLUSTER_SLICES 24
+#endif
+
+struct Light
+{
+    vec3 position;
+    float range;
+    vec3 color;
+};
+
+// Only the ambient strength is read here, the lights come from the clusters
+layout(std140) uniform Lights
+{
+    Light lights[MAX_LIGHTS];
+    float ambientStrength;
+    int lightCount;
+};
+
+out vec4 outColor;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;   // octahedral encoded
+uniform sampler2D gDepth;
+uniform mat4 clipToScene;    // inverse of projection * view * model
+uniform vec3 objectColor;
+uniform vec3 viewPos;
+
+uniform samplerBuffer clusterLightData;      // 2 texels a light, position and range then colour
+uniform usamplerBuffer clusterEntries;       // offset and count of every cluster's lights
+uniform usamplerBuffer clusterLightIndices;
+uniform vec4 clusterScale;  // tiles per pixel x/y, slices per unit of log depth, log of the near plane
+uniform vec4 clusterPlanes; // near, far
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0){
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+int pixelCluster(float windowDepth)
+{
+    float ndcDepth = windowDepth * 2.0 - 1.0;
+    float depth = 2.0 * clusterPlanes.x * clusterPlanes.y
+                / (clusterPlanes.y + clusterPlanes.x - ndcDepth * (clusterPlanes.y - clusterPlanes.x));
+    ivec3 cluster = ivec3(gl_FragCoord.xy * clusterScale.xy, (log(depth) - clusterScale.w) * clusterScale.z);
+    cluster = clamp(cluster, ivec3(0), ivec3(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1, CLUSTER_SLICES - 1));
+    return (cluster.z * CLUSTER_TILES_Y + cluster.y) * CLUSTER_TILES_X + cluster.x;
+}
+
+// Same as in simple.frag
+vec3 shadeLight(vec3 lightPosition, float range, vec3 lightColor, vec3 Pos, vec3 norm, vec3 viewDir)
+{
+    vec3 toLight = lightPosition - Pos;
+    float lightDistance = length(toLight);
+    vec3 lightDir = toLight / lightDistance;
+
+    float attenuation = 1.0;
+    if (range > 0.0){
+        float ratio = lightDistance / range;
+        attenuation = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+        attenuation *= attenuation;
+    }
+
+    //diffuse
+    float diff = max(dot(norm, lightDir), 0.0);
+
+    //specular
+    float specularStrength = 0.9;
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+
+    return (diff + specularStrength * spec) * lightColor * attenuation;
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float windowDepth = texelFetch(gDepth, pixel, 0).r;
+    // Nothing was drawn here, the background stays as cleared
+    if (windowDepth == 1.0){
+        discard;
+    }
+
+    vec3 color = texelFetch(gAlbedo, pixel, 0).rgb;
+    vec3 norm = octDecode(texelFetch(gNormal, pixel, 0).xy);
+    vec4 ndc = vec4(gl_FragCoord.xy / vec2(textureSize(gDepth, 0)), windowDepth, 1.0) * 2.0 - 1.0;
+    vec4 scenePos = clipToScene * ndc;
+    vec3 Pos = scenePos.xyz / scenePos.w;
+    vec3 viewDir = normalize(viewPos - Pos);
+
+    vec3 lighting = vec3(0.0);
+    uvec2 entry = texelFetch(clusterEntries, pixelCluster(windowDepth)).xy;
+    for (uint i = 0u; i < entry.y; i++){
+        int light = int(texelFetch(clusterLightIndices, int(entry.x + i)).r);
+        vec4 positionRange = texelFetch(clusterLightData, 2 * light);
+        vec3 lightColor = texelFetch(clusterLightData, 2 * light + 1).rgb;
+        lighting += shadeLight(positionRange.xyz, positionRange.w, lightColor, Pos, norm, viewDir);
+    }
+
+    // As simple.frag combines them, the diffuse sample scales the lit colour once more
+    vec3 result = (ambientStrength * color + lighting) * objectColor;
+    outColor = vec4(color * result, 1.0);
+}
@@ -0,0 +1,6 @@
+#version 330 core
+
+// The depth pre-pass, drawn with colour writes off. Only the depth the rasterizer computes is kept
+void main()
+{
+}
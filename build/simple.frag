@@ -1,73 +1,240 @@
 #version 330 core
 
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 64
+#endif
+#ifndef MAX_OBJECT_LIGHTS
+#define MAX_OBJECT_LIGHTS 8
+#endif
+
+// A point light, fading to nothing at range (0 reaches everything)
+struct Light
+{
+    vec3 position;
+    float range;
+    vec3 color;
+};
+
+// Every variant reads the scene's lights from the same buffer, see LightsBlock in uniformbuffer.h
+layout(std140) uniform Lights
+{
+    Light lights[MAX_LIGHTS];
+    float ambientStrength;
+    int lightCount;
+};
+
+#ifdef UNIFORM_BLOCKS
+// std140 blocks filled from the uniform ring buffer, see uniformbuffer.h for the C++ side
+layout(std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+layout(std140) uniform Object
+{
+    mat4 model;
+    mat4 mvp;
+    mat4 trans;
+    vec3 objectColor;
+    bool addNormalMap;
+    vec4 atlasRegion;
+    ivec4 objectLights[MAX_OBJECT_LIGHTS / 4];
+    int objectLightCount;
+};
+
+int objectLight(int i)
+{
+    return objectLights[i / 4][i % 4];
+}
+#else
 uniform vec3 objectColor;
+uniform vec3 viewPos;
+uniform bool addNormalMap;
+// Indices into lights of those shading this draw, picked on the CPU
+uniform int objectLights[MAX_OBJECT_LIGHTS];
+uniform int objectLightCount;
+
+int objectLight(int i)
+{
+    return objectLights[i];
+}
+#endif
 
+#ifdef DEFERRED
+// The G-buffer, lit afterwards by deferred.frag, see GBuffer
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec2 outNormal;
+
+// The unit normal folded onto the octahedron |x|+|y|+|z| = 1 and flattened to its xy, the lower
+// half unfolded over the corners
+vec2 octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0){
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return n.xy;
+}
+#else
 out vec4 outColor;
-uniform vec3 lightColor;
-uniform vec3 lightColor2;
-uniform float ambientStrength;
-uniform vec3 viewPos;
+#endif
 
 in vec3 Normal; 
 in vec3 Pos;
 in vec2 Texture;
-in vec3 tLightPos;
-in vec3 tLightPos2;
-in vec3 tViewPos;
-in vec3 tPos;
-uniform vec3 lightPos;
-uniform vec3 lightPos2;
+in mat3 TBN;
 uniform sampler2D ourTexture;
 uniform sampler2D ourTextureMap;
-uniform bool addNormalMap;
 
-void main()
+#ifdef TEXTURE_ATLAS
+// ourTexture/ourTextureMap are shared atlas pages in this variant
+#if defined(INSTANCED)
+// every instance picks its own material's region
+#ifndef MAX_MATERIALS
+#define MAX_MATERIALS 16
+#endif
+uniform vec4 atlasRegions[MAX_MATERIALS];
+flat in int Material;
+#define atlasRegion atlasRegions[Material]
+#elif !defined(UNIFORM_BLOCKS)
+uniform vec4 atlasRegion; // uv scale, uv offset of the material inside the pages
+#endif
+
+vec4 sampleMaterial(sampler2D map, vec2 uv)
 {
+    // fract keeps repeating UVs inside the region, and the gradients of the unwrapped UVs stop
+    // the wrap seams from selecting the smallest mip
+    vec2 gradScale = atlasRegion.xy;
+    return textureGrad(map, atlasRegion.zw + fract(uv) * atlasRegion.xy,
+                       dFdx(uv) * gradScale, dFdy(uv) * gradScale);
+}
+#else
+vec4 sampleMaterial(sampler2D map, vec2 uv)
+{
+    return texture(map, uv);
+}
+#endif
 
-    vec3 color = texture(ourTexture, Texture).rgb;
-    vec3 ambient = ambientStrength * color; //lightColor;
-    vec3 ambient2 = ambientStrength * color; //lightColor2;
-    vec3 norm ;
-    vec3 lightDir;
-    vec3 lightDir2 ;
-    vec3 viewDir;
+#ifdef VIRTUAL_TEXTURE
+// ourTexture/ourTextureMap are the physical page caches in this variant
+uniform sampler2D vtIndirection;
+uniform vec4 vtParams; // virtual size in texels, max mip, page size, page border
+uniform float vtCacheSize;
 
-    //diffuse
-    if (addNormalMap == false){
-        norm = normalize(Normal);
-        lightDir = normalize(lightPos - Pos);
-        lightDir2 = normalize(lightPos2 - Pos);
-        viewDir = normalize(viewPos - Pos);
-    }
-    else{
-        // obtain normal from normal map in range [0,1]
-        norm = texture(ourTextureMap, Texture).rgb;
-        // transform normal vector to range [-1,1]
-        norm = normalize(norm * 2.0 - 1.0);
-        lightDir = normalize(tLightPos - tPos);
-        lightDir2 = normalize(tLightPos2 - tPos);
-        viewDir = normalize(tViewPos - tPos);
+vec2 virtualToPhysical(vec2 uv)
+{
+    vec2 dx = dFdx(uv * vtParams.x);
+    vec2 dy = dFdy(uv * vtParams.x);
+    float mip = clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy)))), 0.0, vtParams.y);
+
+    // the entry points at the requested page, or the closest resident coarser page
+    vec4 entry = floor(textureLod(vtIndirection, fract(uv), mip) * 255.0 + 0.5);
+    float pagesWide = vtParams.x / (vtParams.z * exp2(entry.z));
+    vec2 inPage = fract(fract(uv) * pagesWide);
+    float paddedPageSize = vtParams.z + 2.0 * vtParams.w;
+    return (entry.xy * paddedPageSize + vtParams.w + inPage * vtParams.z) / vtCacheSize;
+}
+#endif
+
+#ifdef CLUSTERED
+// Every light of the scene and the lights of every cluster of the view, see ClusteredLights
+#ifndef CLUSTER_TILES_X
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 12
+#define CLUSTER_SLICES 24
+#endif
+uniform samplerBuffer clusterLightData;      // 2 texels a light, position and range then colour
+uniform usamplerBuffer clusterEntries;       // offset and count of every cluster's lights
+uniform usamplerBuffer clusterLightIndices;
+uniform vec4 clusterScale;  // tiles per pixel x/y, slices per unit of log depth, log of the near plane
+uniform vec4 clusterPlanes; // near, far
+
+int fragmentCluster()
+{
+    float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+    float depth = 2.0 * clusterPlanes.x * clusterPlanes.y
+                / (clusterPlanes.y + clusterPlanes.x - ndcDepth * (clusterPlanes.y - clusterPlanes.x));
+    ivec3 cluster = ivec3(gl_FragCoord.xy * clusterScale.xy, (log(depth) - clusterScale.w) * clusterScale.z);
+    cluster = clamp(cluster, ivec3(0), ivec3(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1, CLUSTER_SLICES - 1));
+    return (cluster.z * CLUSTER_TILES_Y + cluster.y) * CLUSTER_TILES_X + cluster.x;
+}
+#endif
+
+// Diffuse and specular of one light, with a smooth window reaching 0 at range so the CPU can
+// leave the light out beyond it
+vec3 shadeLight(vec3 lightPosition, float range, vec3 lightColor, vec3 norm, vec3 viewDir)
+{
+    vec3 toLight = lightPosition - Pos;
+    float lightDistance = length(toLight);
+    vec3 lightDir = toLight / lightDistance;
+
+    float attenuation = 1.0;
+    if (range > 0.0){
+        float ratio = lightDistance / range;
+        attenuation = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+        attenuation *= attenuation;
     }
 
+    //diffuse
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * lightColor;
-
-    //diffuse2
-    float diff2 = max(dot(norm, lightDir2), 0.0);
-    vec3 diffuse2 = diff2 * lightColor2;
 
     //specular
     float specularStrength = 0.9;
     vec3 reflectDir = reflect(-lightDir, norm);  
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-    vec3 specular = specularStrength * spec * lightColor; 
 
-    //specular2
-    vec3 reflectDir2 = reflect(-lightDir2, norm);  
-    float spec2 = pow(max(dot(viewDir, reflectDir2), 0.0), 32);
-    vec3 specular2 = specularStrength * spec2 * lightColor2; 
+    return (diff + specularStrength * spec) * lightColor * attenuation;
+}
+
+void main()
+{
+
+#ifdef VIRTUAL_TEXTURE
+    vec2 sampleUV = virtualToPhysical(Texture);
+#else
+    vec2 sampleUV = Texture;
+#endif
+    vec4 diffuseSample = sampleMaterial(ourTexture, sampleUV);
+    vec3 color = diffuseSample.rgb;
+    vec3 ambient = ambientStrength * color;
+    vec3 norm;
+
+    //diffuse
+    if (addNormalMap == false){
+        norm = normalize(Normal);
+    }
+    else{
+        // obtain normal from normal map in range [0,1]
+        norm = sampleMaterial(ourTextureMap, sampleUV).rgb;
+        // transform normal vector to range [-1,1], and out of tangent space
+        norm = normalize(TBN * (norm * 2.0 - 1.0));
+    }
+#ifdef DEFERRED
+    outAlbedo = vec4(color, 1.0);
+    outNormal = octEncode(norm);
+#else
+    vec3 viewDir = normalize(viewPos - Pos);
+
+    vec3 lighting = vec3(0.0);
+#ifdef CLUSTERED
+    uvec2 entry = texelFetch(clusterEntries, fragmentCluster()).xy;
+    for (uint i = 0u; i < entry.y; i++){
+        int light = int(texelFetch(clusterLightIndices, int(entry.x + i)).r);
+        vec4 positionRange = texelFetch(clusterLightData, 2 * light);
+        vec3 lightColor = texelFetch(clusterLightData, 2 * light + 1).rgb;
+        lighting += shadeLight(positionRange.xyz, positionRange.w, lightColor, norm, viewDir);
+    }
+#else
+    for (int i = 0; i < objectLightCount; i++){
+        Light light = lights[objectLight(i)];
+        lighting += shadeLight(light.position, light.range, light.color, norm, viewDir);
+    }
+#endif
 
-    vec3 result = (ambient + diffuse + specular + ambient2 + diffuse2 + specular2) * objectColor;
-    outColor = texture(ourTexture, Texture) *vec4(result,1);
+    vec3 result = (ambient + lighting) * objectColor;
+    outColor = diffuseSample *vec4(result,1);
     //outColor = vec4(result,1);
+#endif
 }
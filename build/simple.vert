@@ -1,47 +1,94 @@
 #version 330 core
 
 layout (location = 0) in vec3 position;
+#ifndef DEPTH_ONLY
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texture;
 layout (location = 3) in vec3 tangent;
 layout (location = 4) in vec3 bitangent;
+#endif
 
+#ifdef INSTANCED
+// Per instance attributes, see InstanceData in mesh.h
+layout (location = 5) in mat4 instanceTransform;
+#ifndef DEPTH_ONLY
+layout (location = 9) in float instanceMaterial;
+flat out int Material;
+#endif
+#endif
+
+// The DEPTH_ONLY variant draws the depth pre-pass from the positions alone, and the variants that
+// follow it test for GL_EQUAL depths. Invariance makes every variant compute the exact same ones
+invariant gl_Position;
+
+#ifndef MAX_OBJECT_LIGHTS
+#define MAX_OBJECT_LIGHTS 8
+#endif
+
+#ifdef UNIFORM_BLOCKS
+// std140 blocks filled from the uniform ring buffer, see uniformbuffer.h for the C++ side
+layout(std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+layout(std140) uniform Object
+{
+    mat4 model;
+    mat4 mvp;
+    mat4 trans;
+    vec3 objectColor;
+    bool addNormalMap;
+    vec4 atlasRegion;
+    ivec4 objectLights[MAX_OBJECT_LIGHTS / 4];
+    int objectLightCount;
+};
+#else
 uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
 uniform mat4 mvp;
 uniform mat4 trans;
-uniform vec3 viewPos;
-uniform vec3 lightPos;
-uniform vec3 lightPos2;
+#endif
 
+#ifndef DEPTH_ONLY
+// Pos, Normal and TBN are in the space the objects are placed in, the lights' space. The model
+// matrix is applied once more in front of the view by mvp
 out vec3 Normal;
 out vec3 Pos;
 out vec2 Texture;
-
-out vec3 tLightPos;
-out vec3 tLightPos2;
-out vec3 tViewPos;
-out vec3 tPos;
+out mat3 TBN;
+#endif
 
 void main()
 {
 
-    Normal = mat3(trans) * normal ;
-    vec3 T = normalize(vec3(model * vec4(tangent,   0.0)));
-    vec3 B = normalize(vec3(model * vec4(bitangent, 0.0)));
-    vec3 N = normalize(vec3(model * vec4(Normal,    0.0)));
-    mat3 TBN = transpose(mat3(T, B, N));
+#ifdef INSTANCED
+    // The instance is placed before the object transform, mvp leaves the transform out here
+    mat4 objectTrans = instanceTransform * trans;
+    mat4 objectMvp = mvp * objectTrans;
+#ifndef DEPTH_ONLY
+    Material = int(instanceMaterial);
+#endif
+#else
+    mat4 objectTrans = trans;
+    mat4 objectMvp = mvp;
+#endif
 
-    tLightPos = TBN * lightPos;
-    tLightPos2 = TBN * lightPos2;
-    tViewPos  = TBN * viewPos;
-    tPos  = TBN * vec3(model * vec4(position, 1.0));
+    vec4 modelPos = model * vec4(position, 1.0);
+#ifndef DEPTH_ONLY
+    mat3 placement = mat3(objectTrans) * mat3(model);
+    Pos = vec3(objectTrans * modelPos);
+    Normal = placement * normal;
+    vec3 T = normalize(placement * tangent);
+    vec3 B = normalize(placement * bitangent);
+    vec3 N = normalize(Normal);
+    TBN = mat3(T, B, N);
 
-    Pos = vec3(model *vec4(position, 1.0));
-    Normal = mat3(trans) * normal ;
     Texture = texture;
-    //TextureMap = textureMap;
-    gl_Position = mvp * vec4(Pos,1.0f);
+#endif
+    gl_Position = objectMvp * modelPos;
 
 }
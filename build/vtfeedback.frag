@@ -0,0 +1,19 @@
+#version 330 core
+
+// Writes the virtual texture page each fragment needs: page x, page y, mip, valid
+out vec4 outColor;
+
+in vec2 Texture;
+uniform vec4 vtParams; // virtual size in texels, max mip, page size, page border
+uniform float vtFeedbackBias;
+
+void main()
+{
+    vec2 dx = dFdx(Texture * vtParams.x);
+    vec2 dy = dFdy(Texture * vtParams.x);
+    float mip = floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vtFeedbackBias);
+    mip = clamp(mip, 0.0, vtParams.y);
+
+    vec2 page = floor(fract(Texture) * vtParams.x / (vtParams.z * exp2(mip)));
+    outColor = vec4(page, mip, 255.0) / 255.0;
+}
@@ -0,0 +1,319 @@
+#include <iostream>
+#include <string.h>
+
+#include <algorithm>
+
+#include "atlas.h"
+#include "glstate.h"
+#include "stb_image.h"
+
+using namespace std;
+
+const int ATLAS_CHANNELS = 3;
+
+RectanglePacker::RectanglePacker(int width, int height)
+{
+    binWidth = width;
+    binHeight = height;
+    SkylineNode node = {0, 0, width};
+    skyline.push_back(node);
+}
+
+// Returns the y position the rectangle would sit at if its left edge was placed at the node,
+// or -1 if it doesn't fit there
+int RectanglePacker::fit(int nodeIndex, int width, int height)
+{
+    int x = skyline[nodeIndex].x;
+    if(x + width > binWidth)
+    {
+        return -1;
+    }
+
+    int y = skyline[nodeIndex].y;
+    int widthLeft = width;
+    int i = nodeIndex;
+    while(widthLeft > 0)
+    {
+        y = max(y, skyline[i].y);
+        if(y + height > binHeight)
+        {
+            return -1;
+        }
+        widthLeft -= skyline[i].width;
+        i++;
+    }
+    return y;
+}
+
+bool RectanglePacker::insert(int width, int height, int& x, int& y)
+{
+    int bestIndex = -1;
+    int bestY = binHeight;
+    int bestWidth = binWidth;
+    for(size_t i=0; i<skyline.size(); i++)
+    {
+        int nodeY = fit(i, width, height);
+        if((nodeY >= 0) && ((nodeY < bestY) || ((nodeY == bestY) && (skyline[i].width < bestWidth))))
+        {
+            bestIndex = i;
+            bestY = nodeY;
+            bestWidth = skyline[i].width;
+        }
+    }
+    if(bestIndex < 0)
+    {
+        return false;
+    }
+
+    x = skyline[bestIndex].x;
+    y = bestY;
+
+    SkylineNode node = {x, y + height, width};
+    skyline.insert(skyline.begin() + bestIndex, node);
+
+    // Shrink or remove the nodes now covered by the new one
+    for(size_t i=bestIndex+1; i<skyline.size(); i++)
+    {
+        int overlap = (skyline[i-1].x + skyline[i-1].width) - skyline[i].x;
+        if(overlap <= 0)
+        {
+            break;
+        }
+        skyline[i].x += overlap;
+        skyline[i].width -= overlap;
+        if(skyline[i].width > 0)
+        {
+            break;
+        }
+        skyline.erase(skyline.begin() + i);
+        i--;
+    }
+
+    // Merge neighbours at the same height
+    for(size_t i=0; i+1<skyline.size(); i++)
+    {
+        if(skyline[i].y == skyline[i+1].y)
+        {
+            skyline[i].width += skyline[i+1].width;
+            skyline.erase(skyline.begin() + i + 1);
+            i--;
+        }
+    }
+    return true;
+}
+
+TextureAtlas::TextureAtlas(int pageSize, int padding)
+{
+    this->pageSize = pageSize;
+    this->padding = padding;
+}
+
+TextureAtlas::~TextureAtlas()
+{
+    // NOTE: The GL textures are released in clear(), which needs to be called while the
+    //       context is still alive
+}
+
+int TextureAtlas::addMaterial(const char* diffuseFilename, const char* normalFilename)
+{
+    diffuseFilenames.push_back(diffuseFilename);
+    normalFilenames.push_back(normalFilename);
+    return diffuseFilenames.size() - 1;
+}
+
+bool TextureAtlas::isBuilt()
+{
+    return !diffusePages.empty();
+}
+
+int TextureAtlas::pageCount()
+{
+    return diffusePages.size();
+}
+
+int TextureAtlas::materialCount()
+{
+    return entries.size();
+}
+
+const AtlasEntry& TextureAtlas::entry(int material)
+{
+    return entries[material];
+}
+
+// Copies an image into a page, surrounding it with `padding` texels of wrapped texels
+static void blitWithGutter(unsigned char* page, int pageSize, const unsigned char* image,
+                           int width, int height, int x, int y, int padding)
+{
+    for(int row=-padding; row<height+padding; row++)
+    {
+        int sourceRow = ((row % height) + height) % height;
+        unsigned char* out = &page[((size_t)(y + row)*pageSize + (x - padding))*ATLAS_CHANNELS];
+        for(int col=-padding; col<width+padding; col++)
+        {
+            int sourceCol = ((col % width) + width) % width;
+            memcpy(out, &image[((size_t)sourceRow*width + sourceCol)*ATLAS_CHANNELS], ATLAS_CHANNELS);
+            out += ATLAS_CHANNELS;
+        }
+    }
+}
+
+static GLuint uploadPage(const unsigned char* pixels, int pageSize, int padding)
+{
+    int maxLevel = 0;
+    while((1 << (maxLevel+1)) <= padding)
+    {
+        maxLevel++;
+    }
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glState.bindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, pageSize, pageSize, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    return texture;
+}
+
+bool TextureAtlas::build()
+{
+    clear();
+
+    int materials = diffuseFilenames.size();
+    vector<unsigned char*> diffuseImages(materials, (unsigned char*)NULL);
+    vector<unsigned char*> normalImages(materials, (unsigned char*)NULL);
+    entries.assign(materials, AtlasEntry());
+    vector<int> order;
+    for(int i=0; i<materials; i++)
+    {
+        int channels;
+        AtlasEntry& entry = entries[i];
+        diffuseImages[i] = stbi_load(diffuseFilenames[i], &entry.width, &entry.height, &channels, ATLAS_CHANNELS);
+        if(!diffuseImages[i])
+        {
+            cout << "Failed to load texture " << diffuseFilenames[i] << endl;
+            entry.page = -1;
+            continue;
+        }
+
+        int normalWidth, normalHeight;
+        normalImages[i] = stbi_load(normalFilenames[i], &normalWidth, &normalHeight, &channels, ATLAS_CHANNELS);
+        if(normalImages[i] && ((normalWidth != entry.width) || (normalHeight != entry.height)))
+        {
+            cout << "Normal map " << normalFilenames[i] << " doesn't match the size of "
+                 << diffuseFilenames[i] << ", using a flat normal map" << endl;
+            stbi_image_free(normalImages[i]);
+            normalImages[i] = NULL;
+        }
+        order.push_back(i);
+    }
+
+    // NOTE: Packing the tallest rectangles first gives the skyline packer far less waste
+    sort(order.begin(), order.end(), [this](int a, int b) { return entries[a].height > entries[b].height; });
+
+    vector<RectanglePacker> packers;
+    for(size_t i=0; i<order.size(); i++)
+    {
+        AtlasEntry& entry = entries[order[i]];
+        // Round the padded size up to the padding, so every region starts on a texel boundary
+        // at every mip level we keep
+        int paddedWidth = ((entry.width + 2*padding + padding - 1) / padding) * padding;
+        int paddedHeight = ((entry.height + 2*padding + padding - 1) / padding) * padding;
+        if((paddedWidth > pageSize) || (paddedHeight > pageSize))
+        {
+            cout << "Texture " << diffuseFilenames[order[i]] << " is too large for the atlas" << endl;
+            entry.page = -1;
+            continue;
+        }
+
+        entry.page = -1;
+        for(size_t page=0; (page<packers.size()) && (entry.page < 0); page++)
+        {
+            if(packers[page].insert(paddedWidth, paddedHeight, entry.x, entry.y))
+            {
+                entry.page = page;
+            }
+        }
+        if(entry.page < 0)
+        {
+            packers.push_back(RectanglePacker(pageSize, pageSize));
+            packers.back().insert(paddedWidth, paddedHeight, entry.x, entry.y);
+            entry.page = packers.size() - 1;
+        }
+        entry.x += padding;
+        entry.y += padding;
+        entry.uvScaleOffset = glm::vec4((float)entry.width / pageSize, (float)entry.height / pageSize,
+                                        (float)entry.x / pageSize, (float)entry.y / pageSize);
+    }
+
+    // Flat normal for materials without a (matching) normal map
+    vector<unsigned char> flatNormal;
+    vector<unsigned char> diffusePixels((size_t)pageSize * pageSize * ATLAS_CHANNELS);
+    vector<unsigned char> normalPixels((size_t)pageSize * pageSize * ATLAS_CHANNELS);
+    for(size_t page=0; page<packers.size(); page++)
+    {
+        fill(diffusePixels.begin(), diffusePixels.end(), 0);
+        fill(normalPixels.begin(), normalPixels.end(), 0);
+        for(int i=0; i<materials; i++)
+        {
+            AtlasEntry& entry = entries[i];
+            if(entry.page != (int)page)
+            {
+                continue;
+            }
+            blitWithGutter(&diffusePixels[0], pageSize, diffuseImages[i], entry.width, entry.height,
+                           entry.x, entry.y, padding);
+
+            const unsigned char* normal = normalImages[i];
+            if(!normal)
+            {
+                flatNormal.resize((size_t)entry.width * entry.height * ATLAS_CHANNELS);
+                for(size_t texel=0; texel<flatNormal.size(); texel+=ATLAS_CHANNELS)
+                {
+                    flatNormal[texel] = 128;
+                    flatNormal[texel+1] = 128;
+                    flatNormal[texel+2] = 255;
+                }
+                normal = &flatNormal[0];
+            }
+            blitWithGutter(&normalPixels[0], pageSize, normal, entry.width, entry.height,
+                           entry.x, entry.y, padding);
+        }
+        diffusePages.push_back(uploadPage(&diffusePixels[0], pageSize, padding));
+        normalPages.push_back(uploadPage(&normalPixels[0], pageSize, padding));
+    }
+
+    for(int i=0; i<materials; i++)
+    {
+        stbi_image_free(diffuseImages[i]);
+        stbi_image_free(normalImages[i]);
+    }
+
+    cout << "Packed " << materials << " materials into " << diffusePages.size() << " atlas pages of "
+         << pageSize << "x" << pageSize << endl;
+    return !diffusePages.empty();
+}
+
+void TextureAtlas::clear()
+{
+    if(!diffusePages.empty())
+    {
+        glState.deleteTextures(diffusePages.size(), &diffusePages[0]);
+        glState.deleteTextures(normalPages.size(), &normalPages[0]);
+    }
+    diffusePages.clear();
+    normalPages.clear();
+}
+
+void TextureAtlas::bind(int material, int diffuseUnit, int normalUnit)
+{
+    int page = max(entries[material].page, 0);
+    glState.bindTexture(diffuseUnit, GL_TEXTURE_2D, diffusePages[page]);
+    glState.bindTexture(normalUnit, GL_TEXTURE_2D, normalPages[page]);
+}
@@ -0,0 +1,85 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <GL/glew.h>
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+// NOTE: Skyline bottom-left rectangle packer, places each rectangle at the lowest position
+//       along the current skyline which it fits in
+class RectanglePacker
+{
+public:
+    RectanglePacker(int width, int height);
+
+    bool insert(int width, int height, int& x, int& y);
+
+private:
+    struct SkylineNode
+    {
+        int x;
+        int y;
+        int width;
+    };
+
+    int fit(int nodeIndex, int width, int height);
+
+    int binWidth;
+    int binHeight;
+    std::vector<SkylineNode> skyline;
+};
+
+struct AtlasEntry
+{
+    int page;
+    int x;
+    int y;
+    int width;
+    int height;
+
+    // xy: scale, zw: offset, maps the material's [0,1] UVs onto its region of the page
+    glm::vec4 uvScaleOffset;
+};
+
+// NOTE: Packs many diffuse/normal map pairs into shared atlas pages. Both maps of a material are
+//       placed at the same position in the diffuse and normal pages, so a single scale/offset
+//       addresses both.
+//
+//       Every region gets a gutter of `padding` texels filled with wrapped texels (the regular
+//       textures use GL_REPEAT), and regions are aligned to the padding, which must be a power of 2.
+//       Mip levels are limited to log2(padding), so that even at the smallest mip every region is
+//       still surrounded by a gutter of at least one texel and never bleeds into its neighbours
+class TextureAtlas
+{
+public:
+    TextureAtlas(int pageSize=4096, int padding=8);
+    ~TextureAtlas();
+
+    // Queues a material for packing, returns its index in the atlas
+    int addMaterial(const char* diffuseFilename, const char* normalFilename);
+
+    // Loads, packs and uploads every queued material. The pages are created through the currently
+    // active texture unit
+    bool build();
+    void clear();
+    bool isBuilt();
+
+    int pageCount();
+    int materialCount();
+    const AtlasEntry& entry(int material);
+
+    // Binds the pages holding the material to the given texture units
+    void bind(int material, int diffuseUnit, int normalUnit);
+
+private:
+    int pageSize;
+    int padding;
+    std::vector<const char*> diffuseFilenames;
+    std::vector<const char*> normalFilenames;
+    std::vector<AtlasEntry> entries;
+    std::vector<GLuint> diffusePages;
+    std::vector<GLuint> normalPages;
+};
+
+#endif
@@ -0,0 +1,414 @@
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "SDL.h"
+#include "bufferarena.h"
+#include "glstate.h"
+#include "mesh.h"
+
+using namespace std;
+
+// The buffers never shrink, and start out this large
+const int ARENA_MIN_VERTICES = 1 << 16;
+const int ARENA_MIN_INDICES = 3 << 16;
+
+RangeAllocator::RangeAllocator()
+{
+    totalCapacity = 0;
+    usedUnits = 0;
+}
+
+void RangeAllocator::reset(int capacity)
+{
+    freeRanges.clear();
+    if(capacity > 0)
+    {
+        freeRanges[0] = capacity;
+    }
+    totalCapacity = capacity;
+    usedUnits = 0;
+}
+
+int RangeAllocator::allocate(int size)
+{
+    map<int, int>::iterator best = freeRanges.end();
+    for(map<int, int>::iterator range=freeRanges.begin(); range!=freeRanges.end(); range++)
+    {
+        if((range->second >= size) && ((best == freeRanges.end()) || (range->second < best->second)))
+        {
+            best = range;
+        }
+    }
+    if(best == freeRanges.end())
+    {
+        return -1;
+    }
+
+    int offset = best->first;
+    int remaining = best->second - size;
+    freeRanges.erase(best);
+    if(remaining > 0)
+    {
+        freeRanges[offset + size] = remaining;
+    }
+    usedUnits += size;
+    return offset;
+}
+
+void RangeAllocator::release(int offset, int size)
+{
+    if(size <= 0)
+    {
+        return;
+    }
+    usedUnits -= size;
+
+    // Merged with the free range ending where it starts, and the one starting where it ends
+    map<int, int>::iterator next = freeRanges.lower_bound(offset);
+    if(next != freeRanges.begin())
+    {
+        map<int, int>::iterator previous = next;
+        previous--;
+        if(previous->first + previous->second == offset)
+        {
+            offset = previous->first;
+            size += previous->second;
+            freeRanges.erase(previous);
+        }
+    }
+    if((next != freeRanges.end()) && (next->first == offset + size))
+    {
+        size += next->second;
+        freeRanges.erase(next);
+    }
+    freeRanges[offset] = size;
+}
+
+int RangeAllocator::capacity()
+{
+    return totalCapacity;
+}
+
+int RangeAllocator::used()
+{
+    return usedUnits;
+}
+
+int RangeAllocator::freeRangeCount()
+{
+    return freeRanges.size();
+}
+
+int RangeAllocator::largestFreeRange()
+{
+    int largest = 0;
+    for(map<int, int>::iterator range=freeRanges.begin(); range!=freeRanges.end(); range++)
+    {
+        largest = max(largest, range->second);
+    }
+    return largest;
+}
+
+// An interleaved vertex, compared bit for bit
+struct ArenaVertex
+{
+    float values[ARENA_VERTEX_FLOATS];
+
+    bool operator==(const ArenaVertex& other) const
+    {
+        return memcmp(values, other.values, sizeof(values)) == 0;
+    }
+};
+
+struct ArenaVertexHash
+{
+    size_t operator()(const ArenaVertex& vertex) const
+    {
+        // FNV-1a over the bytes
+        const unsigned char* bytes = (const unsigned char*)vertex.values;
+        size_t hash = 2166136261u;
+        for(size_t i=0; i<sizeof(vertex.values); i++)
+        {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+};
+
+BufferArena::BufferArena()
+{
+    defragmentations = 0;
+    bytesMoved = 0;
+    defragmentMs = 0.0;
+    verticesMerged = 0;
+    vertexBuffer = 0;
+    indexBuffer = 0;
+    vao = 0;
+    depthVao = 0;
+}
+
+void BufferArena::destroy()
+{
+    if(vao)
+    {
+        glState.deleteBuffers(1, &vertexBuffer);
+        glState.deleteBuffers(1, &indexBuffer);
+        glState.deleteVertexArrays(1, &vao);
+        glState.deleteVertexArrays(1, &depthVao);
+    }
+    *this = BufferArena();
+}
+
+int BufferArena::add(GeometryData& geometry)
+{
+    int count = geometry.vertexCount();
+    if(count == 0)
+    {
+        return -1;
+    }
+
+    // The attributes interleaved in the order of ARENA_VERTEX_FLOATS, each vertex once
+    const float* sources[5] = {(const float*)geometry.vertexData(), (const float*)geometry.normalData(),
+                               (const float*)geometry.textureCoordData(), (const float*)geometry.tangentData(),
+                               (const float*)geometry.bitangentData()};
+    const int components[5] = {3, 3, 2, 3, 3};
+    vector<ArenaVertex> vertices;
+    vector<GLuint> indices(count);
+    unordered_map<ArenaVertex, GLuint, ArenaVertexHash> unique;
+    unique.reserve(count);
+    for(int i=0; i<count; i++)
+    {
+        ArenaVertex vertex;
+        float* value = vertex.values;
+        for(int attribute=0; attribute<5; attribute++)
+        {
+            for(int component=0; component<components[attribute]; component++)
+            {
+                *value++ = sources[attribute][i*components[attribute] + component];
+            }
+        }
+        pair<unordered_map<ArenaVertex, GLuint, ArenaVertexHash>::iterator, bool> inserted =
+            unique.insert(make_pair(vertex, (GLuint)vertices.size()));
+        if(inserted.second)
+        {
+            vertices.push_back(vertex);
+        }
+        indices[i] = inserted.first->second;
+    }
+    verticesMerged += count - vertices.size();
+
+    Allocation allocation;
+    allocation.vertexCount = vertices.size();
+    allocation.indexCount = count;
+    allocation.baseVertex = vertexRanges.allocate(allocation.vertexCount);
+    allocation.firstIndex = indexRanges.allocate(allocation.indexCount);
+    if((allocation.baseVertex < 0) || (allocation.firstIndex < 0))
+    {
+        vertexRanges.release(allocation.baseVertex, (allocation.baseVertex >= 0) ? allocation.vertexCount : 0);
+        indexRanges.release(allocation.firstIndex, (allocation.firstIndex >= 0) ? allocation.indexCount : 0);
+
+        // Packing alone is enough when the free space adds up, the buffers double otherwise
+        int vertexCapacity = max(vertexRanges.capacity(), ARENA_MIN_VERTICES);
+        int indexCapacity = max(indexRanges.capacity(), ARENA_MIN_INDICES);
+        while(vertexCapacity < vertexRanges.used() + allocation.vertexCount)
+        {
+            vertexCapacity *= 2;
+        }
+        while(indexCapacity < indexRanges.used() + allocation.indexCount)
+        {
+            indexCapacity *= 2;
+        }
+        relocate(vertexCapacity, indexCapacity);
+        allocation.baseVertex = vertexRanges.allocate(allocation.vertexCount);
+        allocation.firstIndex = indexRanges.allocate(allocation.indexCount);
+    }
+
+    // Through the copy target, binding the element array buffer would change the bound vertex array
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)allocation.baseVertex * sizeof(ArenaVertex),
+                    vertices.size() * sizeof(ArenaVertex), &vertices[0]);
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)allocation.firstIndex * sizeof(GLuint),
+                    indices.size() * sizeof(GLuint), &indices[0]);
+
+    int handle = allocations.size();
+    if(!freeHandles.empty())
+    {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+        allocations[handle] = allocation;
+    }
+    else
+    {
+        allocations.push_back(allocation);
+    }
+    return handle;
+}
+
+void BufferArena::remove(int handle)
+{
+    if((handle < 0) || (allocations[handle].vertexCount == 0))
+    {
+        return;
+    }
+    Allocation& allocation = allocations[handle];
+    vertexRanges.release(allocation.baseVertex, allocation.vertexCount);
+    indexRanges.release(allocation.firstIndex, allocation.indexCount);
+    allocation.vertexCount = 0;
+    allocation.indexCount = 0;
+    freeHandles.push_back(handle);
+}
+
+void BufferArena::defragment()
+{
+    if(vao)
+    {
+        relocate(vertexRanges.capacity(), indexRanges.capacity());
+    }
+}
+
+void BufferArena::relocate(int newVertexCapacity, int newIndexCapacity)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    GLuint newBuffers[2];
+    glGenBuffers(2, newBuffers);
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, newBuffers[0]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newVertexCapacity * sizeof(ArenaVertex), NULL, GL_STATIC_DRAW);
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, newBuffers[1]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newIndexCapacity * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+
+    // The meshes go one after the other in the order of their handles, their indices are relative
+    // to their first vertex and are copied unchanged
+    int vertexEnd = 0;
+    int indexEnd = 0;
+    for(size_t i=0; i<allocations.size(); i++)
+    {
+        Allocation& allocation = allocations[i];
+        if(allocation.vertexCount == 0)
+        {
+            continue;
+        }
+        glState.bindBuffer(GL_COPY_READ_BUFFER, vertexBuffer);
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, newBuffers[0]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)allocation.baseVertex * sizeof(ArenaVertex),
+                            (GLintptr)vertexEnd * sizeof(ArenaVertex), allocation.vertexCount * sizeof(ArenaVertex));
+        glState.bindBuffer(GL_COPY_READ_BUFFER, indexBuffer);
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, newBuffers[1]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)allocation.firstIndex * sizeof(GLuint),
+                            (GLintptr)indexEnd * sizeof(GLuint), allocation.indexCount * sizeof(GLuint));
+        bytesMoved += allocation.vertexCount * sizeof(ArenaVertex) + allocation.indexCount * sizeof(GLuint);
+        allocation.baseVertex = vertexEnd;
+        allocation.firstIndex = indexEnd;
+        vertexEnd += allocation.vertexCount;
+        indexEnd += allocation.indexCount;
+    }
+
+    if(vertexBuffer)
+    {
+        glState.deleteBuffers(1, &vertexBuffer);
+        glState.deleteBuffers(1, &indexBuffer);
+        defragmentations++;
+    }
+    vertexBuffer = newBuffers[0];
+    indexBuffer = newBuffers[1];
+    vertexRanges.reset(newVertexCapacity);
+    vertexRanges.allocate(vertexEnd);
+    indexRanges.reset(newIndexCapacity);
+    indexRanges.allocate(indexEnd);
+    bindBuffers();
+    defragmentMs += (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+void BufferArena::bindBuffers()
+{
+    if(!vao)
+    {
+        glGenVertexArrays(1, &vao);
+        glGenVertexArrays(1, &depthVao);
+    }
+
+    GLuint locations[5] = {POSITION_LOCATION, NORMAL_LOCATION, TEXTURE_LOCATION, TANGENT_LOCATION, BITANGENT_LOCATION};
+    int components[5] = {3, 3, 2, 3, 3};
+    GLuint arrays[2] = {vao, depthVao};
+    for(int array=0; array<2; array++)
+    {
+        glState.bindVertexArray(arrays[array]);
+        glState.bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        int offset = 0;
+        // The depth only array reads the positions alone
+        int attributeCount = (arrays[array] == depthVao) ? 1 : 5;
+        for(int i=0; i<attributeCount; i++)
+        {
+            glVertexAttribPointer(locations[i], components[i], GL_FLOAT, false, sizeof(ArenaVertex),
+                                  (void*)(offset*sizeof(float)));
+            glEnableVertexAttribArray(locations[i]);
+            offset += components[i];
+        }
+    }
+    glState.bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void BufferArena::draw(int handle)
+{
+    if(handle < 0)
+    {
+        return;
+    }
+    const Allocation& allocation = allocations[handle];
+    glDrawElementsBaseVertex(GL_TRIANGLES, allocation.indexCount, GL_UNSIGNED_INT,
+                             (void*)(allocation.firstIndex*sizeof(GLuint)), allocation.baseVertex);
+}
+
+GLuint BufferArena::vertexArray()
+{
+    return vao;
+}
+
+GLuint BufferArena::depthVertexArray()
+{
+    return depthVao;
+}
+
+int BufferArena::indexCount(int handle)
+{
+    return (handle >= 0) ? allocations[handle].indexCount : 0;
+}
+
+int BufferArena::meshCount()
+{
+    return allocations.size() - freeHandles.size();
+}
+
+int BufferArena::vertexCapacity()
+{
+    return vertexRanges.capacity();
+}
+
+int BufferArena::verticesUsed()
+{
+    return vertexRanges.used();
+}
+
+int BufferArena::indexCapacity()
+{
+    return indexRanges.capacity();
+}
+
+int BufferArena::indicesUsed()
+{
+    return indexRanges.used();
+}
+
+int BufferArena::freeRangeCount()
+{
+    return vertexRanges.freeRangeCount();
+}
+
+float BufferArena::fragmentation()
+{
+    int freeVertices = vertexRanges.capacity() - vertexRanges.used();
+    return (freeVertices > 0) ? 1.0f - (float)vertexRanges.largestFreeRange() / freeVertices : 0.0f;
+}
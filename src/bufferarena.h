@@ -0,0 +1,106 @@
+#ifndef BUFFER_ARENA_H
+#define BUFFER_ARENA_H
+
+#include <GL/glew.h>
+
+#include <map>
+#include <vector>
+
+#include "geometry.h"
+
+// Floats of an interleaved arena vertex: position, normal, texture coordinates, tangent, bitangent
+const int ARENA_VERTEX_FLOATS = 14;
+
+// NOTE: Hands out ranges of [0, capacity), best fit, and merges a released range with the free
+//       ones it touches. Nothing ever moves here, compacting is up to the owner of the ranges
+class RangeAllocator
+{
+public:
+    RangeAllocator();
+
+    // Forgets every range, all of [0, capacity) is free again
+    void reset(int capacity);
+    // The offset of a free range of size units, -1 if none is large enough
+    int allocate(int size);
+    void release(int offset, int size);
+
+    int capacity();
+    int used();
+    int freeRangeCount();
+    int largestFreeRange();
+
+private:
+    std::map<int, int> freeRanges; // Size by offset, never adjacent to one another
+    int totalCapacity;
+    int usedUnits;
+};
+
+// NOTE: One vertex buffer and one index buffer shared by many meshes, with a single vertex array
+//       reading them. Every mesh is indexed when it's added (identical vertices are merged) and
+//       gets a range of each buffer. Its indices start at 0 whatever its range, and a draw adds
+//       its first vertex with glDrawElementsBaseVertex, so going from one mesh to the next binds
+//       nothing and moving a mesh only copies its data.
+//
+//       Removed meshes leave holes that later meshes are fitted into. When a mesh doesn't fit
+//       into any hole, the meshes are packed to the start of new buffers with
+//       glCopyBufferSubData, without reading anything back, and the buffers grow when packing
+//       isn't enough. Meshes are referred to by handle, their ranges change when they're packed
+class BufferArena
+{
+public:
+    BufferArena();
+
+    void destroy();
+
+    // Returns the handle of the mesh, -1 for an empty geometry. The buffers are created by the
+    // first mesh
+    int add(GeometryData& geometry);
+    void remove(int handle);
+    // Packs the meshes to the start of the buffers, keeping their size
+    void defragment();
+
+    // Draws a mesh with vertexArray() or depthVertexArray() bound, nothing for handle -1
+    void draw(int handle);
+    // The depth only one reads just the positions, for the depth pre-pass
+    GLuint vertexArray();
+    GLuint depthVertexArray();
+    int indexCount(int handle);
+
+    int meshCount();
+    int vertexCapacity();
+    int verticesUsed();
+    int indexCapacity();
+    int indicesUsed();
+    int freeRangeCount();
+    // Of the free vertices, the part outside the largest free range. 0 when they're all in one
+    float fragmentation();
+
+    int defragmentations;      // Packs, with or without growing
+    long long bytesMoved;      // Copied by them
+    double defragmentMs;       // Spent in them, CPU side
+    int verticesMerged;        // Dropped by the indexing, identical to another vertex of the mesh
+
+private:
+    struct Allocation
+    {
+        int baseVertex;
+        int vertexCount;
+        int firstIndex;
+        int indexCount;
+    };
+
+    // Packs the meshes into new buffers of the given capacities
+    void relocate(int newVertexCapacity, int newIndexCapacity);
+    void bindBuffers();
+
+    std::vector<Allocation> allocations; // By handle, vertexCount 0 when removed
+    std::vector<int> freeHandles;
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+    GLuint vertexBuffer;
+    GLuint indexBuffer;
+    GLuint vao;
+    GLuint depthVao;
+};
+
+#endif
@@ -0,0 +1,498 @@
+#include <iostream>
+#include <stdlib.h>
+#include <float.h>
+
+#include <algorithm>
+
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include "SDL.h"
+#include "bvh.h"
+
+using namespace std;
+
+const int MAX_LEAF_OBJECTS = 4;
+const int ALL_PLANES = 0x3F;
+
+static float surfaceArea(const glm::vec3& min, const glm::vec3& max)
+{
+    glm::vec3 size = max - min;
+    return 2.0f * (size.x*size.y + size.y*size.z + size.z*size.x);
+}
+
+// Slab test, the entry distance is clamped to 0 when the ray starts inside the box
+static bool rayHitsBox(const glm::vec3& origin, const glm::vec3& inverseDirection, const glm::vec3& min,
+                       const glm::vec3& max, float maxDistance, float& entry)
+{
+    float enter = 0.0f;
+    float exit = maxDistance;
+    for(int axis=0; axis<3; axis++)
+    {
+        float t0 = (min[axis] - origin[axis]) * inverseDirection[axis];
+        float t1 = (max[axis] - origin[axis]) * inverseDirection[axis];
+        if(t0 > t1)
+        {
+            swap(t0, t1);
+        }
+        enter = std::max(enter, t0);
+        exit = std::min(exit, t1);
+        if(enter > exit)
+        {
+            return false;
+        }
+    }
+    entry = enter;
+    return true;
+}
+
+static float distanceSquared(const glm::vec3& point, const glm::vec3& min, const glm::vec3& max)
+{
+    glm::vec3 outside = glm::max(glm::max(min - point, point - max), glm::vec3(0.0f));
+    return glm::dot(outside, outside);
+}
+
+SceneBVH::SceneBVH()
+{
+    rebuildInterval = 600;
+    rebuildThreshold = 1.5f;
+    lastRebuilt = false;
+    lastUpdateMs = 0.0;
+    lastNodesVisited = 0;
+    refitsSinceBuild = 0;
+    builtSurfaceAreaRatio = 0.0f;
+}
+
+int SceneBVH::nodeCount()
+{
+    return nodes.size();
+}
+
+int SceneBVH::objectCount()
+{
+    return indices.size();
+}
+
+void SceneBVH::build(const vector<Bounds>& objectBounds)
+{
+    int count = objectBounds.size();
+    indices.resize(count);
+    centroids.resize(count);
+    leafMins.resize(count);
+    leafMaxs.resize(count);
+    for(int i=0; i<count; i++)
+    {
+        indices[i] = i;
+        centroids[i] = (objectBounds[i].min + objectBounds[i].max) * 0.5f;
+    }
+
+    nodes.clear();
+    nodes.reserve(2 * (count / MAX_LEAF_OBJECTS + 1));
+    nodes.push_back(BVHNode());
+    nodes[0].min = nodes[0].max = glm::vec3(0.0f);
+    nodes[0].first = 0;
+    nodes[0].count = 0;
+    if(count > 0)
+    {
+        buildNode(0, 0, count, objectBounds);
+    }
+    refitsSinceBuild = 0;
+    builtSurfaceAreaRatio = surfaceAreaRatio();
+}
+
+void SceneBVH::buildNode(int node, int begin, int end, const vector<Bounds>& objectBounds)
+{
+    glm::vec3 centroidMin = centroids[indices[begin]];
+    glm::vec3 centroidMax = centroidMin;
+    for(int i=begin+1; i<end; i++)
+    {
+        centroidMin = glm::min(centroidMin, centroids[indices[i]]);
+        centroidMax = glm::max(centroidMax, centroids[indices[i]]);
+    }
+    glm::vec3 size = centroidMax - centroidMin;
+    int axis = (size.x > size.y) ? ((size.x > size.z) ? 0 : 2) : ((size.y > size.z) ? 1 : 2);
+
+    // Objects all at the same spot can't be split, they share one (larger) leaf
+    if((end - begin <= MAX_LEAF_OBJECTS) || (size[axis] <= 0.0f))
+    {
+        nodes[node].first = begin;
+        nodes[node].count = end - begin;
+        nodes[node].min = objectBounds[indices[begin]].min;
+        nodes[node].max = objectBounds[indices[begin]].max;
+        for(int i=begin; i<end; i++)
+        {
+            leafMins[i] = objectBounds[indices[i]].min;
+            leafMaxs[i] = objectBounds[indices[i]].max;
+            nodes[node].min = glm::min(nodes[node].min, leafMins[i]);
+            nodes[node].max = glm::max(nodes[node].max, leafMaxs[i]);
+        }
+        return;
+    }
+
+    int middle = begin + (end - begin) / 2;
+    nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end,
+                [&](uint32_t a, uint32_t b){ return centroids[a][axis] < centroids[b][axis]; });
+
+    int left = nodes.size();
+    nodes.push_back(BVHNode());
+    nodes.push_back(BVHNode());
+    nodes[node].first = left;
+    nodes[node].count = 0;
+    buildNode(left, begin, middle, objectBounds);
+    buildNode(left + 1, middle, end, objectBounds);
+    nodes[node].min = glm::min(nodes[left].min, nodes[left + 1].min);
+    nodes[node].max = glm::max(nodes[left].max, nodes[left + 1].max);
+}
+
+void SceneBVH::refitLeaves(const vector<Bounds>& objectBounds)
+{
+    for(size_t i=0; i<indices.size(); i++)
+    {
+        leafMins[i] = objectBounds[indices[i]].min;
+        leafMaxs[i] = objectBounds[indices[i]].max;
+    }
+}
+
+void SceneBVH::refit(const vector<Bounds>& objectBounds)
+{
+    if(indices.empty())
+    {
+        return;
+    }
+    refitLeaves(objectBounds);
+    for(int node=nodes.size()-1; node>=0; node--)
+    {
+        BVHNode& current = nodes[node];
+        if(current.count > 0)
+        {
+            current.min = leafMins[current.first];
+            current.max = leafMaxs[current.first];
+            for(int i=current.first+1; i<current.first+current.count; i++)
+            {
+                current.min = glm::min(current.min, leafMins[i]);
+                current.max = glm::max(current.max, leafMaxs[i]);
+            }
+        }
+        else
+        {
+            current.min = glm::min(nodes[current.first].min, nodes[current.first + 1].min);
+            current.max = glm::max(nodes[current.first].max, nodes[current.first + 1].max);
+        }
+    }
+    refitsSinceBuild++;
+}
+
+// The summed area of every node relative to the root's, which is what the cost of a query grows
+// with. Relative so that scaling the whole scene doesn't look like the tree degrading
+float SceneBVH::surfaceAreaRatio()
+{
+    float rootArea = surfaceArea(nodes[0].min, nodes[0].max);
+    if(rootArea <= 0.0f)
+    {
+        return 0.0f;
+    }
+    float total = 0.0f;
+    for(size_t i=0; i<nodes.size(); i++)
+    {
+        total += surfaceArea(nodes[i].min, nodes[i].max);
+    }
+    return total / rootArea;
+}
+
+void SceneBVH::update(const vector<Bounds>& objectBounds)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    lastRebuilt = (objectBounds.size() != indices.size()) || nodes.empty() || (refitsSinceBuild >= rebuildInterval);
+    if(!lastRebuilt)
+    {
+        refit(objectBounds);
+        lastRebuilt = surfaceAreaRatio() > builtSurfaceAreaRatio * rebuildThreshold;
+    }
+    if(lastRebuilt)
+    {
+        build(objectBounds);
+    }
+    lastUpdateMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+void SceneBVH::cull(FrustumCuller& frustum, vector<uint32_t>& visible)
+{
+    lastNodesVisited = 0;
+    if(indices.empty())
+    {
+        return;
+    }
+
+    // Pairs of a node and the planes it still has to be tested against
+    stack.clear();
+    stack.push_back(0);
+    stack.push_back(ALL_PLANES);
+    while(!stack.empty())
+    {
+        int planeMask = stack.back();
+        stack.pop_back();
+        const BVHNode& node = nodes[stack.back()];
+        stack.pop_back();
+        lastNodesVisited++;
+
+        if(planeMask && !frustum.intersects(node.min, node.max, planeMask))
+        {
+            continue;
+        }
+        if(node.count == 0)
+        {
+            stack.push_back(node.first);
+            stack.push_back(planeMask);
+            stack.push_back(node.first + 1);
+            stack.push_back(planeMask);
+            continue;
+        }
+        for(int i=node.first; i<node.first+node.count; i++)
+        {
+            int objectMask = planeMask;
+            if(!objectMask || frustum.intersects(leafMins[i], leafMaxs[i], objectMask))
+            {
+                visible.push_back(indices[i]);
+            }
+        }
+    }
+}
+
+int SceneBVH::raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance)
+{
+    // The boxes are all there is to hit
+    distance = FLT_MAX;
+    return raycast(origin, direction, distance, [](int, float entry, float& distance)
+    {
+        distance = entry;
+        return true;
+    });
+}
+
+int SceneBVH::raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, const RayObjectTest& test)
+{
+    lastNodesVisited = 0;
+    int hit = -1;
+    if(indices.empty())
+    {
+        return hit;
+    }
+
+    glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    stack.clear();
+    stack.push_back(0);
+    while(!stack.empty())
+    {
+        const BVHNode& node = nodes[stack.back()];
+        stack.pop_back();
+        lastNodesVisited++;
+
+        float entry;
+        if(!rayHitsBox(origin, inverseDirection, node.min, node.max, distance, entry))
+        {
+            continue;
+        }
+        if(node.count > 0)
+        {
+            for(int i=node.first; i<node.first+node.count; i++)
+            {
+                if(rayHitsBox(origin, inverseDirection, leafMins[i], leafMaxs[i], distance, entry) && test(indices[i], entry, distance))
+                {
+                    hit = indices[i];
+                }
+            }
+            continue;
+        }
+
+        // The closer child goes on top, so it is searched first and can shorten the other
+        int closer = node.first;
+        int further = node.first + 1;
+        float closerEntry, furtherEntry;
+        bool closerHit = rayHitsBox(origin, inverseDirection, nodes[closer].min, nodes[closer].max, distance, closerEntry);
+        bool furtherHit = rayHitsBox(origin, inverseDirection, nodes[further].min, nodes[further].max, distance, furtherEntry);
+        if(closerHit && furtherHit && (furtherEntry < closerEntry))
+        {
+            swap(closer, further);
+        }
+        if(furtherHit)
+        {
+            stack.push_back(further);
+        }
+        if(closerHit)
+        {
+            stack.push_back(closer);
+        }
+    }
+    return hit;
+}
+
+int SceneBVH::nearest(const glm::vec3& point, float& distance)
+{
+    lastNodesVisited = 0;
+    int closest = -1;
+    float bestSquared = FLT_MAX;
+    if(indices.empty())
+    {
+        distance = FLT_MAX;
+        return closest;
+    }
+
+    stack.clear();
+    stack.push_back(0);
+    while(!stack.empty())
+    {
+        const BVHNode& node = nodes[stack.back()];
+        stack.pop_back();
+        lastNodesVisited++;
+
+        if(distanceSquared(point, node.min, node.max) >= bestSquared)
+        {
+            continue;
+        }
+        if(node.count > 0)
+        {
+            for(int i=node.first; i<node.first+node.count; i++)
+            {
+                float objectSquared = distanceSquared(point, leafMins[i], leafMaxs[i]);
+                if(objectSquared < bestSquared)
+                {
+                    bestSquared = objectSquared;
+                    closest = indices[i];
+                }
+            }
+            continue;
+        }
+
+        int closer = node.first;
+        int further = node.first + 1;
+        if(distanceSquared(point, nodes[further].min, nodes[further].max) < distanceSquared(point, nodes[closer].min, nodes[closer].max))
+        {
+            swap(closer, further);
+        }
+        stack.push_back(further);
+        stack.push_back(closer);
+    }
+    distance = sqrt(bestSquared);
+    return closest;
+}
+
+static double elapsedMs(Uint64 start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static float randomFloat(float low, float high)
+{
+    return low + (high - low) * (rand() / (float)RAND_MAX);
+}
+
+void SceneBVH::runBenchmark(int objectCount)
+{
+    const int BUILD_RUNS = 5;
+    const int REFIT_RUNS = 20;
+    const int VIEW_COUNT = 8;
+    const int QUERY_COUNT = 10000;
+
+    // Boxes of 1 to 4 units scattered through a 200 unit cube
+    srand(1);
+    vector<Bounds> bounds(objectCount);
+    for(int i=0; i<objectCount; i++)
+    {
+        glm::vec3 center(randomFloat(-100.0f, 100.0f), randomFloat(-100.0f, 100.0f), randomFloat(-100.0f, 100.0f));
+        glm::vec3 extent(randomFloat(0.5f, 2.0f), randomFloat(0.5f, 2.0f), randomFloat(0.5f, 2.0f));
+        bounds[i].min = center - extent;
+        bounds[i].max = center + extent;
+        bounds[i].center = center;
+        bounds[i].radius = glm::length(extent);
+    }
+    cout << "BVH benchmark, " << objectCount << " objects" << endl;
+
+    SceneBVH bvh;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for(int run=0; run<BUILD_RUNS; run++)
+    {
+        bvh.build(bounds);
+    }
+    cout << "\tBuild: " << elapsedMs(start) / BUILD_RUNS << " ms, " << bvh.nodeCount() << " nodes" << endl;
+
+    // A tenth of the objects drift a little every frame
+    double refitMs = 0.0;
+    int rebuilds = 0;
+    for(int run=0; run<REFIT_RUNS; run++)
+    {
+        for(int i=0; i<objectCount/10; i++)
+        {
+            Bounds& moved = bounds[rand() % objectCount];
+            glm::vec3 offset(randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f));
+            moved.min += offset;
+            moved.max += offset;
+            moved.center += offset;
+        }
+        bvh.update(bounds);
+        refitMs += bvh.lastUpdateMs;
+        rebuilds += bvh.lastRebuilt ? 1 : 0;
+    }
+    cout << "\tRefit: " << refitMs / REFIT_RUNS << " ms (" << rebuilds << " of " << REFIT_RUNS
+         << " updates rebuilt)" << endl;
+
+    // Looking out from the centre in a ring of directions, against the flat SIMD culler
+    FrustumCuller frustum;
+    frustum.resize(objectCount);
+    for(int i=0; i<objectCount; i++)
+    {
+        frustum.setBounds(i, bounds[i]);
+    }
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    double bvhMs = 0.0;
+    double flatMs = 0.0;
+    long long bvhVisible = 0;
+    long long flatVisible = 0;
+    long long nodesVisited = 0;
+    vector<uint32_t> visible;
+    for(int view=0; view<VIEW_COUNT; view++)
+    {
+        float angle = view * 6.2831853f / VIEW_COUNT;
+        glm::vec3 target(cos(angle), 0.2f, sin(angle));
+        frustum.setFrustum(projection * glm::lookAt(glm::vec3(0.0f), target, glm::vec3(0.0f, 1.0f, 0.0f)));
+
+        visible.clear();
+        start = SDL_GetPerformanceCounter();
+        bvh.cull(frustum, visible);
+        bvhMs += elapsedMs(start);
+        bvhVisible += visible.size();
+        nodesVisited += bvh.lastNodesVisited;
+
+        visible.clear();
+        start = SDL_GetPerformanceCounter();
+        frustum.cull(0, objectCount, visible);
+        flatMs += elapsedMs(start);
+        flatVisible += visible.size();
+    }
+    cout << "\tFrustum: " << bvhMs / VIEW_COUNT << " ms hierarchical (" << bvhVisible / VIEW_COUNT << " visible, "
+         << nodesVisited / VIEW_COUNT << " nodes visited), " << flatMs / VIEW_COUNT << " ms flat ("
+         << flatVisible / VIEW_COUNT << " visible)" << endl;
+
+    int hits = 0;
+    nodesVisited = 0;
+    start = SDL_GetPerformanceCounter();
+    for(int i=0; i<QUERY_COUNT; i++)
+    {
+        glm::vec3 direction(randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f));
+        float distance;
+        hits += (bvh.raycast(glm::vec3(0.0f), direction, distance) >= 0) ? 1 : 0;
+        nodesVisited += bvh.lastNodesVisited;
+    }
+    cout << "\tRays: " << elapsedMs(start) * 1000.0 / QUERY_COUNT << " us per ray, " << hits << " of "
+         << QUERY_COUNT << " hit, " << nodesVisited / QUERY_COUNT << " nodes visited" << endl;
+
+    nodesVisited = 0;
+    start = SDL_GetPerformanceCounter();
+    for(int i=0; i<QUERY_COUNT; i++)
+    {
+        glm::vec3 point(randomFloat(-120.0f, 120.0f), randomFloat(-120.0f, 120.0f), randomFloat(-120.0f, 120.0f));
+        float distance;
+        bvh.nearest(point, distance);
+        nodesVisited += bvh.lastNodesVisited;
+    }
+    cout << "\tNearest: " << elapsedMs(start) * 1000.0 / QUERY_COUNT << " us per query, "
+         << nodesVisited / QUERY_COUNT << " nodes visited" << endl;
+}
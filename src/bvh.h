@@ -0,0 +1,89 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdint.h>
+
+#include <glm/glm/glm.hpp>
+
+#include <functional>
+#include <vector>
+
+#include "geometry.h"
+#include "culling.h"
+
+// 32 bytes, two to a cache line
+struct BVHNode
+{
+    glm::vec3 min;
+    int first;  // Leaf: first entry of its objects in the index array, inner: the left child
+    glm::vec3 max;
+    int count;  // Objects in a leaf, 0 for inner nodes
+};
+
+// Tests a ray against an object found in the hierarchy, see SceneBVH::raycast
+typedef std::function<bool(int object, float entry, float& distance)> RayObjectTest;
+
+// NOTE: A bounding volume hierarchy over the world boxes of the scene objects. The nodes live in
+//       one flat array, the root first and both children of a node allocated together after it,
+//       so the right child is always first + 1 and a reverse walk over the array visits children
+//       before their parents.
+//
+//       The tree is built top down, splitting at the median of the longest axis of the centroids.
+//       When objects move the tree is only refit (the node boxes recomputed bottom up, keeping
+//       the topology), which loosens it over time. It is rebuilt when the object count changes,
+//       every rebuildInterval refits, or when the summed surface area of the nodes has grown by
+//       rebuildThreshold over what it was after the last build
+class SceneBVH
+{
+public:
+    SceneBVH();
+
+    // The bounds are indexed by object
+    void build(const std::vector<Bounds>& objectBounds);
+    void refit(const std::vector<Bounds>& objectBounds);
+    // Refits or rebuilds, whichever is due
+    void update(const std::vector<Bounds>& objectBounds);
+
+    // Appends the objects whose boxes intersect the frustum, whole subtrees inside it are taken
+    // without testing their objects
+    void cull(FrustumCuller& frustum, std::vector<uint32_t>& visible);
+    // The first object box along the ray, -1 if none. The direction doesn't need to be normalized,
+    // distance is in units of it
+    int raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance);
+    // The first object along the ray by test, which is called with every object whose box the ray
+    // enters before distance (nearer boxes first as far as the tree allows) and returns whether
+    // the object itself is hit, shortening distance to the hit. distance limits the search on input
+    int raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, const RayObjectTest& test);
+    // The object whose box is closest to the point (0 inside it), -1 for an empty tree
+    int nearest(const glm::vec3& point, float& distance);
+
+    int nodeCount();
+    int objectCount();
+
+    int rebuildInterval;
+    float rebuildThreshold;
+
+    // Of the last update, and the nodes visited by the last query
+    bool lastRebuilt;
+    double lastUpdateMs;
+    int lastNodesVisited;
+
+    // Times building, refitting and querying objectCount random boxes, no window needed
+    static void runBenchmark(int objectCount);
+
+private:
+    void buildNode(int node, int begin, int end, const std::vector<Bounds>& objectBounds);
+    void refitLeaves(const std::vector<Bounds>& objectBounds);
+    float surfaceAreaRatio();
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> indices;       // Objects in leaf order
+    std::vector<glm::vec3> leafMins;     // The object boxes in leaf order
+    std::vector<glm::vec3> leafMaxs;
+    std::vector<glm::vec3> centroids;    // By object, only used while building
+    std::vector<int> stack;
+    int refitsSinceBuild;
+    float builtSurfaceAreaRatio;
+};
+
+#endif
@@ -0,0 +1,420 @@
+#include <iostream>
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include "SDL.h"
+#include "clusteredlights.h"
+#include "glstate.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTER_SSE
+#endif
+
+using namespace std;
+
+const int CLUSTER_TILES = CLUSTER_TILES_X * CLUSTER_TILES_Y;
+
+// Below this waking another worker to move the lights into view space costs more than it saves
+const int MIN_LIGHTS_PER_WORKER = 256;
+
+// Light data, cluster entries and light indices, in the order of the texture units
+const GLenum CLUSTER_FORMATS[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+
+// The squared distance along one axis from a position to count intervals, count a multiple of 4
+static void squaredDistances(const float* minEdges, const float* maxEdges, float position, int count, float* squared)
+{
+#if defined(CLUSTER_SSE)
+    __m128 center = _mm_set1_ps(position);
+    __m128 zero = _mm_setzero_ps();
+    for(int i=0; i<count; i+=4)
+    {
+        __m128 below = _mm_sub_ps(_mm_loadu_ps(minEdges + i), center);
+        __m128 above = _mm_sub_ps(center, _mm_loadu_ps(maxEdges + i));
+        __m128 distance = _mm_max_ps(_mm_max_ps(below, above), zero);
+        _mm_storeu_ps(squared + i, _mm_mul_ps(distance, distance));
+    }
+#else
+    for(int i=0; i<count; i++)
+    {
+        float distance = max(max(minEdges[i] - position, position - maxEdges[i]), 0.0f);
+        squared[i] = distance * distance;
+    }
+#endif
+}
+
+ClusteredLights::ClusteredLights()
+{
+    lastBuildMs = 0.0;
+    lastLightsInView = 0;
+    lastClustersLit = 0;
+    lastMaxClusterLights = 0;
+    lastIndexCount = 0;
+    nearPlane = 0.1f;
+    farPlane = 100.0f;
+    clusterEntries.assign(2*CLUSTER_COUNT, 0);
+    for(int i=0; i<3; i++)
+    {
+        buffers[i] = 0;
+        textures[i] = 0;
+    }
+}
+
+void ClusteredLights::setThreadCount(int threadCount)
+{
+    pool.create(threadCount);
+    workerLists.resize(pool.threadCount());
+}
+
+int ClusteredLights::threadCount()
+{
+    return pool.threadCount();
+}
+
+const vector<uint32_t>& ClusteredLights::clusters()
+{
+    return clusterEntries;
+}
+
+const vector<uint32_t>& ClusteredLights::lightIndices()
+{
+    return indices;
+}
+
+void ClusteredLights::build(const vector<SceneLight>& lights, const glm::mat4& lightsToView, const glm::mat4& projection,
+                            float nearPlane, float farPlane)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    if(workerLists.empty())
+    {
+        setThreadCount(1);
+    }
+    this->nearPlane = nearPlane;
+    this->farPlane = farPlane;
+
+    // NOTE: A view space position at depth z is at x = ndcX * z / projection[0][0], so a tile's
+    //       box over a slice spans its edges at the slice's near and far depths
+    float logRatio = log(farPlane / nearPlane);
+    for(int slice=0; slice<=CLUSTER_SLICES; slice++)
+    {
+        sliceDepths[slice] = nearPlane * exp(logRatio * slice / CLUSTER_SLICES);
+    }
+    float scaleX = 1.0f / projection[0][0];
+    float scaleY = 1.0f / projection[1][1];
+    for(int slice=0; slice<CLUSTER_SLICES; slice++)
+    {
+        float nearDepth = sliceDepths[slice];
+        float farDepth = sliceDepths[slice + 1];
+        for(int x=0; x<CLUSTER_TILES_X; x++)
+        {
+            float left = (-1.0f + 2.0f * x / CLUSTER_TILES_X) * scaleX;
+            float right = (-1.0f + 2.0f * (x + 1) / CLUSTER_TILES_X) * scaleX;
+            tileMinX[slice][x] = min(left * nearDepth, left * farDepth);
+            tileMaxX[slice][x] = max(right * nearDepth, right * farDepth);
+        }
+        for(int y=0; y<CLUSTER_TILES_Y; y++)
+        {
+            float bottom = (-1.0f + 2.0f * y / CLUSTER_TILES_Y) * scaleY;
+            float top = (-1.0f + 2.0f * (y + 1) / CLUSTER_TILES_Y) * scaleY;
+            tileMinY[slice][y] = min(bottom * nearDepth, bottom * farDepth);
+            tileMaxY[slice][y] = max(top * nearDepth, top * farDepth);
+        }
+    }
+
+    int lightCount = lights.size();
+    lightX.resize(lightCount);
+    lightY.resize(lightCount);
+    lightDepth.resize(lightCount);
+    lightRadius.resize(lightCount);
+    lightFirstSlice.resize(lightCount);
+    lightLastSlice.resize(lightCount);
+    lightData.resize(8*lightCount);
+    float slicesPerLog = CLUSTER_SLICES / logRatio;
+    pool.run(lightCount, [&](int, int begin, int end)
+    {
+        for(int i=begin; i<end; i++)
+        {
+            const SceneLight& light = lights[i];
+            glm::vec3 position(lightsToView * glm::vec4(light.position, 1.0f));
+            float radius = (light.range > 0.0f) ? light.range : numeric_limits<float>::infinity();
+            lightX[i] = position.x;
+            lightY[i] = position.y;
+            lightDepth[i] = -position.z;
+            lightRadius[i] = radius;
+
+            float nearest = lightDepth[i] - radius;
+            float furthest = lightDepth[i] + radius;
+            lightFirstSlice[i] = 0;
+            lightLastSlice[i] = -1;
+            if((furthest > nearPlane) && (nearest < farPlane))
+            {
+                lightFirstSlice[i] = (nearest <= nearPlane) ? 0 : min((int)(log(nearest / nearPlane) * slicesPerLog), CLUSTER_SLICES - 1);
+                lightLastSlice[i] = (furthest >= farPlane) ? CLUSTER_SLICES - 1 : (int)(log(furthest / nearPlane) * slicesPerLog);
+            }
+
+            float* data = &lightData[8*i];
+            data[0] = light.position.x;
+            data[1] = light.position.y;
+            data[2] = light.position.z;
+            data[3] = light.range;
+            data[4] = light.color.x;
+            data[5] = light.color.y;
+            data[6] = light.color.z;
+            data[7] = 0.0f;
+        }
+    }, MIN_LIGHTS_PER_WORKER);
+
+    // Workers left without slices aren't run, their lists are emptied here
+    for(size_t i=0; i<workerLists.size(); i++)
+    {
+        workerLists[i].indices.clear();
+        workerLists[i].firstSlice = 0;
+        workerLists[i].endSlice = 0;
+        workerLists[i].maxClusterLights = 0;
+    }
+    pool.run(CLUSTER_SLICES, [&](int worker, int begin, int end)
+    {
+        WorkerLists& lists = workerLists[worker];
+        lists.firstSlice = begin;
+        lists.endSlice = end;
+        for(int slice=begin; slice<end; slice++)
+        {
+            fillSlice(slice, lists);
+        }
+    });
+
+    // The workers' offsets start at 0, their lists are concatenated in slice order
+    indices.clear();
+    lastMaxClusterLights = 0;
+    for(size_t i=0; i<workerLists.size(); i++)
+    {
+        const WorkerLists& lists = workerLists[i];
+        uint32_t base = indices.size();
+        for(int cluster=lists.firstSlice*CLUSTER_TILES; cluster<lists.endSlice*CLUSTER_TILES; cluster++)
+        {
+            clusterEntries[2*cluster] += base;
+        }
+        indices.insert(indices.end(), lists.indices.begin(), lists.indices.end());
+        lastMaxClusterLights = max(lastMaxClusterLights, lists.maxClusterLights);
+    }
+
+    lastLightsInView = 0;
+    for(int i=0; i<lightCount; i++)
+    {
+        lastLightsInView += (lightLastSlice[i] >= lightFirstSlice[i]) ? 1 : 0;
+    }
+    lastClustersLit = 0;
+    for(int cluster=0; cluster<CLUSTER_COUNT; cluster++)
+    {
+        lastClustersLit += (clusterEntries[2*cluster + 1] > 0) ? 1 : 0;
+    }
+    lastIndexCount = indices.size();
+    lastBuildMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// Lists the lights reaching every cluster of a slice, grouped by cluster with a counting sort
+void ClusteredLights::fillSlice(int slice, WorkerLists& lists)
+{
+    float nearDepth = sliceDepths[slice];
+    float farDepth = sliceDepths[slice + 1];
+    float distancesX[CLUSTER_TILES_X];
+    float distancesY[CLUSTER_TILES_Y];
+    lists.pairs.clear();
+    int lightCount = lightX.size();
+    for(int light=0; light<lightCount; light++)
+    {
+        if((slice < lightFirstSlice[light]) || (slice > lightLastSlice[light]))
+        {
+            continue;
+        }
+        float depth = lightDepth[light];
+        float distanceZ = max(max(nearDepth - depth, depth - farDepth), 0.0f);
+        float remaining = lightRadius[light] * lightRadius[light] - distanceZ * distanceZ;
+        if(remaining <= 0.0f)
+        {
+            continue;
+        }
+
+        squaredDistances(tileMinX[slice], tileMaxX[slice], lightX[light], CLUSTER_TILES_X, distancesX);
+        squaredDistances(tileMinY[slice], tileMaxY[slice], lightY[light], CLUSTER_TILES_Y, distancesY);
+        for(int y=0; y<CLUSTER_TILES_Y; y++)
+        {
+            if(distancesY[y] >= remaining)
+            {
+                continue;
+            }
+            float rowRemaining = remaining - distancesY[y];
+            for(int x=0; x<CLUSTER_TILES_X; x+=4)
+            {
+#if defined(CLUSTER_SSE)
+                int mask = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(distancesX + x), _mm_set1_ps(rowRemaining)));
+#else
+                int mask = 0;
+                for(int lane=0; lane<4; lane++)
+                {
+                    mask |= (distancesX[x + lane] < rowRemaining) ? (1 << lane) : 0;
+                }
+#endif
+                for(int lane=0; mask != 0; lane++, mask >>= 1)
+                {
+                    if(mask & 1)
+                    {
+                        lists.pairs.push_back(y*CLUSTER_TILES_X + x + lane);
+                        lists.pairs.push_back(light);
+                    }
+                }
+            }
+        }
+    }
+
+    lists.counts.assign(CLUSTER_TILES, 0);
+    for(size_t i=0; i<lists.pairs.size(); i+=2)
+    {
+        lists.counts[lists.pairs[i]]++;
+    }
+    uint32_t offset = lists.indices.size();
+    for(int tile=0; tile<CLUSTER_TILES; tile++)
+    {
+        int cluster = slice*CLUSTER_TILES + tile;
+        uint32_t count = lists.counts[tile];
+        clusterEntries[2*cluster] = offset;
+        clusterEntries[2*cluster + 1] = count;
+        lists.maxClusterLights = max(lists.maxClusterLights, (int)count);
+        lists.counts[tile] = offset;
+        offset += count;
+    }
+    lists.indices.resize(offset);
+    for(size_t i=0; i<lists.pairs.size(); i+=2)
+    {
+        lists.indices[lists.counts[lists.pairs[i]]++] = lists.pairs[i + 1];
+    }
+}
+
+void ClusteredLights::create()
+{
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    for(int i=0; i<3; i++)
+    {
+        glState.bindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+        glState.bindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, CLUSTER_FORMATS[i], buffers[i]);
+    }
+}
+
+void ClusteredLights::destroy()
+{
+    glState.deleteTextures(3, textures);
+    glState.deleteBuffers(3, buffers);
+    for(int i=0; i<3; i++)
+    {
+        buffers[i] = 0;
+        textures[i] = 0;
+    }
+}
+
+// Everything is respecified every frame, orphaning the storage the last frame's draws still read.
+// An empty buffer texture isn't allowed, so there's always room for one texel
+static void uploadBuffer(GLuint buffer, const void* data, size_t bytes)
+{
+    glState.bindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, max(bytes, (size_t)16), NULL, GL_STREAM_DRAW);
+    if(bytes > 0)
+    {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+    }
+}
+
+void ClusteredLights::upload()
+{
+    uploadBuffer(buffers[0], lightData.empty() ? NULL : &lightData[0], lightData.size()*sizeof(float));
+    uploadBuffer(buffers[1], &clusterEntries[0], clusterEntries.size()*sizeof(uint32_t));
+    uploadBuffer(buffers[2], indices.empty() ? NULL : &indices[0], indices.size()*sizeof(uint32_t));
+}
+
+void ClusteredLights::bind(ShaderProgram& program, int firstUnit, int width, int height)
+{
+    for(int i=0; i<3; i++)
+    {
+        glState.bindTexture(firstUnit + i, GL_TEXTURE_BUFFER, textures[i]);
+    }
+    program.set(program.uniformLocation("clusterLightData"), firstUnit);
+    program.set(program.uniformLocation("clusterEntries"), firstUnit + 1);
+    program.set(program.uniformLocation("clusterLightIndices"), firstUnit + 2);
+    // The fragment's tile and slice are its window position and log depth, scaled and offset
+    program.set(program.uniformLocation("clusterScale"), glm::vec4((float)CLUSTER_TILES_X / width,
+                (float)CLUSTER_TILES_Y / height, CLUSTER_SLICES / log(farPlane / nearPlane), log(nearPlane)));
+    program.set(program.uniformLocation("clusterPlanes"), glm::vec4(nearPlane, farPlane, 0.0f, 0.0f));
+}
+
+void ClusteredLights::runBenchmark(int lightCount, int frameCount)
+{
+    // Lights just above a 40 x 40 floor in front of the camera, the same as build/lights.scene
+    vector<SceneLight> lights(lightCount);
+    vector<glm::vec3> basePositions(lightCount);
+    srand(1);
+    for(int i=0; i<lightCount; i++)
+    {
+        basePositions[i] = glm::vec3((rand() % 2001 - 1000) * 0.02f, -1.0f + (rand() % 101) * 0.005f,
+                                     -10.0f + (rand() % 2001 - 1000) * 0.02f);
+        lights[i].color = glm::vec3(1.0f);
+        lights[i].range = 2.5f;
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 3.0f, 8.0f), glm::vec3(0.0f, -1.0f, -10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+
+    int maxThreads = thread::hardware_concurrency();
+    maxThreads = (maxThreads < 1) ? 1 : maxThreads;
+    cout << "Clustered lights benchmark, " << lightCount << " lights, " << CLUSTER_TILES_X << "x" << CLUSTER_TILES_Y
+         << "x" << CLUSTER_SLICES << " clusters, " << frameCount << " frames, up to " << maxThreads << " threads" << endl;
+
+    ClusteredLights clustered;
+    double singleThreadMs = 0.0;
+    for(int threads=1; ; threads=min(threads*2, maxThreads))
+    {
+        clustered.setThreadCount(threads);
+        double buildTotal = 0.0;
+        long long indexTotal = 0;
+        long long litTotal = 0;
+        int maxClusterLights = 0;
+        for(int frame=-1; frame<frameCount; frame++)
+        {
+            // Every light circles around its own spot, so the assignment changes every frame
+            for(int i=0; i<lightCount; i++)
+            {
+                float angle = frame * 0.05f + i;
+                lights[i].position = basePositions[i] + glm::vec3(cos(angle), 0.0f, sin(angle)) * 0.5f;
+            }
+            clustered.build(lights, view, projection, 0.1f, 100.0f);
+            // The first frame only warms up the threads and the lists
+            if(frame >= 0)
+            {
+                buildTotal += clustered.lastBuildMs;
+                indexTotal += clustered.lastIndexCount;
+                litTotal += clustered.lastClustersLit;
+                maxClusterLights = max(maxClusterLights, clustered.lastMaxClusterLights);
+            }
+        }
+
+        double frameMs = buildTotal / frameCount;
+        if(threads == 1)
+        {
+            singleThreadMs = frameMs;
+        }
+        cout << "\t" << threads << " threads: " << frameMs << " ms per frame, " << singleThreadMs / frameMs << "x, "
+             << litTotal / frameCount << " clusters lit, " << (litTotal > 0 ? (double)indexTotal / litTotal : 0.0)
+             << " lights per lit cluster (at most " << maxClusterLights << ")" << endl;
+        if(threads >= maxThreads)
+        {
+            break;
+        }
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <GL/glew.h>
+#include <glm/glm/glm.hpp>
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "lights.h"
+#include "shaderprogram.h"
+#include "workerpool.h"
+
+// Size of the cluster grid, also defined in simple.frag (CLUSTERED variant) and deferred.frag
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 12;
+const int CLUSTER_SLICES = 24;
+const int CLUSTER_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+
+// NOTE: Clustered light assignment. The view frustum is split into screen tiles and, along the
+//       depth, into slices growing exponentially from the near plane, and every light is listed
+//       in the clusters its range reaches. A fragment then only shades the lights of its own
+//       cluster, however many the scene holds and however large the object it belongs to.
+//
+//       The assignment runs on a worker pool with each worker filling a contiguous range of
+//       slices. A light is tested against a slice's clusters through their view space boxes,
+//       whose distance to the light separates into one term per axis: the x and y terms are
+//       computed for a whole row of tiles at a time with SSE, and the clusters they leave in
+//       range are then found with one compare per 4 tiles.
+//
+//       The results go to the GPU in three buffer textures: the lights (2 RGBA32F texels each,
+//       position and range then colour), the clusters (an RG32UI offset and count each) and the
+//       light indices the clusters point into. Lights without a range are in every cluster
+class ClusteredLights
+{
+public:
+    ClusteredLights();
+
+    void setThreadCount(int threadCount);
+    int threadCount();
+
+    // Assigns the lights to the clusters. lightsToView takes them into view space, projection is
+    // a symmetric perspective projection between the near and far planes
+    void build(const std::vector<SceneLight>& lights, const glm::mat4& lightsToView, const glm::mat4& projection,
+               float nearPlane, float farPlane);
+
+    // The GL side is separate, so the assignment can be benchmarked without a context
+    void create();
+    void destroy();
+    // Uploads the lights and clusters of the last build
+    void upload();
+    // Binds the buffer textures to three units from firstUnit and sets the CLUSTERED variant's
+    // uniforms of a bound program, for a viewport of width x height pixels
+    void bind(ShaderProgram& program, int firstUnit, int width, int height);
+
+    // Of the last build, an offset into lightIndices() and a count for every cluster, x first
+    // then y then the slice
+    const std::vector<uint32_t>& clusters();
+    const std::vector<uint32_t>& lightIndices();
+
+    double lastBuildMs;
+    int lastLightsInView;       // Reaching into the depth range of the clusters
+    int lastClustersLit;        // With at least one light
+    int lastMaxClusterLights;
+    int lastIndexCount;
+
+    // Assigns lightCount moving lights over a floor with every thread count up to the number of
+    // cores, no window needed
+    static void runBenchmark(int lightCount, int frameCount=200);
+
+private:
+    struct WorkerLists
+    {
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> pairs;   // Tile and light of every hit in the slice being filled
+        std::vector<uint32_t> counts;  // Per tile of the slice
+        int firstSlice;
+        int endSlice;
+        int maxClusterLights;
+    };
+
+    void fillSlice(int slice, WorkerLists& lists);
+
+    WorkerPool pool;
+    std::vector<WorkerLists> workerLists;
+
+    // The lights in view space, structure of arrays, and the slices each one reaches (an empty
+    // range when it's outside the frustum's depth)
+    std::vector<float> lightX;
+    std::vector<float> lightY;
+    std::vector<float> lightDepth;
+    std::vector<float> lightRadius;
+    std::vector<int> lightFirstSlice;
+    std::vector<int> lightLastSlice;
+
+    // Edges of the clusters' view space boxes per slice, and the slices' depths
+    float sliceDepths[CLUSTER_SLICES + 1];
+    float tileMinX[CLUSTER_SLICES][CLUSTER_TILES_X];
+    float tileMaxX[CLUSTER_SLICES][CLUSTER_TILES_X];
+    float tileMinY[CLUSTER_SLICES][CLUSTER_TILES_Y];
+    float tileMaxY[CLUSTER_SLICES][CLUSTER_TILES_Y];
+    float nearPlane;
+    float farPlane;
+
+    std::vector<uint32_t> clusterEntries;
+    std::vector<uint32_t> indices;
+    std::vector<float> lightData;
+
+    GLuint buffers[3];
+    GLuint textures[3];
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include <math.h>
+
+#include "culling.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULL_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CULL_SSE
+#endif
+
+using namespace std;
+
+FrustumCuller::FrustumCuller()
+{
+    setFrustum(glm::mat4(1.0f));
+}
+
+int FrustumCuller::batchWidth()
+{
+#if defined(CULL_AVX)
+    return 8;
+#elif defined(CULL_SSE)
+    return 4;
+#else
+    return 1;
+#endif
+}
+
+// Gribb/Hartmann, each plane is the sum or difference of the fourth row with one of the others
+void FrustumCuller::setFrustum(const glm::mat4& viewProjection)
+{
+    for(int plane=0; plane<6; plane++)
+    {
+        int row = plane / 2;
+        float sign = (plane % 2 == 0) ? 1.0f : -1.0f;
+        for(int i=0; i<4; i++)
+        {
+            planes[plane][i] = viewProjection[i][3] + sign * viewProjection[i][row];
+        }
+        float length = sqrt(planes[plane][0]*planes[plane][0] + planes[plane][1]*planes[plane][1] +
+                      planes[plane][2]*planes[plane][2]);
+        for(int i=0; i<4; i++)
+        {
+            planes[plane][i] /= (length > 0.0f) ? length : 1.0f;
+        }
+        for(int i=0; i<3; i++)
+        {
+            absPlanes[plane][i] = fabs(planes[plane][i]);
+        }
+    }
+}
+
+void FrustumCuller::resize(int count)
+{
+    centerX.resize(count);
+    centerY.resize(count);
+    centerZ.resize(count);
+    extentX.resize(count);
+    extentY.resize(count);
+    extentZ.resize(count);
+    radius.resize(count);
+}
+
+int FrustumCuller::size()
+{
+    return centerX.size();
+}
+
+Bounds transformBounds(const Bounds& bounds, const glm::mat4& transform)
+{
+    Bounds result;
+    glm::vec3 boxCenter = (bounds.min + bounds.max) * 0.5f;
+    glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+    glm::vec3 center = glm::vec3(transform * glm::vec4(boxCenter, 1.0f));
+
+    // The box stays axis aligned by enclosing the transformed one, its extents along each axis
+    // are the absolute rows of the transform applied to the local extents
+    float maxScaleSquared = 0.0f;
+    glm::vec3 placedExtent;
+    for(int axis=0; axis<3; axis++)
+    {
+        placedExtent[axis] = fabs(transform[0][axis]) * extent.x + fabs(transform[1][axis]) * extent.y +
+                             fabs(transform[2][axis]) * extent.z;
+        glm::vec3 column = glm::vec3(transform[axis]);
+        maxScaleSquared = max(maxScaleSquared, glm::dot(column, column));
+    }
+    result.min = center - placedExtent;
+    result.max = center + placedExtent;
+    result.center = center;
+    result.radius = bounds.radius * sqrt(maxScaleSquared);
+    return result;
+}
+
+void FrustumCuller::setBounds(int index, const Bounds& bounds, const glm::mat4& transform)
+{
+    setBounds(index, transformBounds(bounds, transform));
+}
+
+void FrustumCuller::setBounds(int index, const Bounds& placedBounds)
+{
+    glm::vec3 extent = (placedBounds.max - placedBounds.min) * 0.5f;
+    centerX[index] = placedBounds.center.x;
+    centerY[index] = placedBounds.center.y;
+    centerZ[index] = placedBounds.center.z;
+    extentX[index] = extent.x;
+    extentY[index] = extent.y;
+    extentZ[index] = extent.z;
+    radius[index] = placedBounds.radius;
+}
+
+bool FrustumCuller::intersects(const glm::vec3& min, const glm::vec3& max, int& planeMask)
+{
+    glm::vec3 center = (min + max) * 0.5f;
+    glm::vec3 extent = (max - min) * 0.5f;
+    for(int plane=0; plane<6; plane++)
+    {
+        if(!(planeMask & (1 << plane)))
+        {
+            continue;
+        }
+        float distance = center.x*planes[plane][0] + center.y*planes[plane][1] + center.z*planes[plane][2] + planes[plane][3];
+        float boxRadius = extent.x*absPlanes[plane][0] + extent.y*absPlanes[plane][1] + extent.z*absPlanes[plane][2];
+        if(distance + boxRadius < 0.0f)
+        {
+            return false;
+        }
+        if(distance - boxRadius >= 0.0f)
+        {
+            planeMask &= ~(1 << plane);
+        }
+    }
+    return true;
+}
+
+void FrustumCuller::cull(int begin, int end, vector<uint32_t>& visible)
+{
+    int i = begin;
+#if defined(CULL_AVX)
+    const __m256 zero = _mm256_setzero_ps();
+    for(; i + 8 <= end; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(&centerX[i]);
+        __m256 cy = _mm256_loadu_ps(&centerY[i]);
+        __m256 cz = _mm256_loadu_ps(&centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&extentX[i]);
+        __m256 ey = _mm256_loadu_ps(&extentY[i]);
+        __m256 ez = _mm256_loadu_ps(&extentZ[i]);
+        __m256 r = _mm256_loadu_ps(&radius[i]);
+        __m256 outside = zero;
+        for(int plane=0; plane<6; plane++)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(planes[plane][0])),
+                                                          _mm256_mul_ps(cy, _mm256_set1_ps(planes[plane][1]))),
+                                            _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(planes[plane][2])),
+                                                          _mm256_set1_ps(planes[plane][3])));
+            __m256 boxRadius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(absPlanes[plane][0])),
+                                                           _mm256_mul_ps(ey, _mm256_set1_ps(absPlanes[plane][1]))),
+                                             _mm256_mul_ps(ez, _mm256_set1_ps(absPlanes[plane][2])));
+            __m256 extent = _mm256_min_ps(boxRadius, r);
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, extent), zero, _CMP_LT_OQ));
+        }
+        int mask = ~_mm256_movemask_ps(outside);
+        for(int lane=0; lane<8; lane++)
+        {
+            if(mask & (1 << lane))
+            {
+                visible.push_back(i + lane);
+            }
+        }
+    }
+#elif defined(CULL_SSE)
+    const __m128 zero = _mm_setzero_ps();
+    for(; i + 4 <= end; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&centerX[i]);
+        __m128 cy = _mm_loadu_ps(&centerY[i]);
+        __m128 cz = _mm_loadu_ps(&centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&extentX[i]);
+        __m128 ey = _mm_loadu_ps(&extentY[i]);
+        __m128 ez = _mm_loadu_ps(&extentZ[i]);
+        __m128 r = _mm_loadu_ps(&radius[i]);
+        __m128 outside = zero;
+        for(int plane=0; plane<6; plane++)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes[plane][0])),
+                                                    _mm_mul_ps(cy, _mm_set1_ps(planes[plane][1]))),
+                                         _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(planes[plane][2])),
+                                                    _mm_set1_ps(planes[plane][3])));
+            __m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(absPlanes[plane][0])),
+                                                     _mm_mul_ps(ey, _mm_set1_ps(absPlanes[plane][1]))),
+                                          _mm_mul_ps(ez, _mm_set1_ps(absPlanes[plane][2])));
+            __m128 extent = _mm_min_ps(boxRadius, r);
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, extent), zero));
+        }
+        int mask = ~_mm_movemask_ps(outside);
+        for(int lane=0; lane<4; lane++)
+        {
+            if(mask & (1 << lane))
+            {
+                visible.push_back(i + lane);
+            }
+        }
+    }
+#endif
+
+    // What's left over from the batches
+    for(; i<end; i++)
+    {
+        bool outside = false;
+        for(int plane=0; (plane<6) && !outside; plane++)
+        {
+            float distance = centerX[i]*planes[plane][0] + centerY[i]*planes[plane][1] +
+                             centerZ[i]*planes[plane][2] + planes[plane][3];
+            float boxRadius = extentX[i]*absPlanes[plane][0] + extentY[i]*absPlanes[plane][1] +
+                              extentZ[i]*absPlanes[plane][2];
+            outside = (distance + min(boxRadius, radius[i])) < 0.0f;
+        }
+        if(!outside)
+        {
+            visible.push_back(i);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <stdint.h>
+
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+#include "geometry.h"
+
+// The box enclosing the transformed box, and the sphere grown by the largest scale of the transform
+Bounds transformBounds(const Bounds& bounds, const glm::mat4& transform);
+
+// NOTE: Tests bounding volumes against the 6 planes of a view frustum. The volumes are kept as
+//       structure of arrays (a box centre and extents, and a sphere radius per object) so that
+//       one SIMD register holds a coordinate of 8 objects with AVX, or 4 with SSE2, and each
+//       plane is tested against the whole batch at once. The sphere shares the box's centre, so
+//       an object is outside a plane when its distance is below minus the smaller of its sphere
+//       radius and the box's projected radius.
+//
+//       The width is chosen at compile time, building with -mavx enables the 8 wide path
+class FrustumCuller
+{
+public:
+    FrustumCuller();
+
+    // Extracts the planes of a view projection matrix, the bounds are then given in the space
+    // the matrix projects from
+    void setFrustum(const glm::mat4& viewProjection);
+
+    void resize(int count);
+    int size();
+    // Places an object's local bounds with its transform
+    void setBounds(int index, const Bounds& bounds, const glm::mat4& transform);
+    void setBounds(int index, const Bounds& placedBounds);
+
+    // Appends the indices in [begin, end) whose bounds intersect the frustum. Different ranges can
+    // be culled (and have their bounds set) from different threads
+    void cull(int begin, int end, std::vector<uint32_t>& visible);
+
+    // Tests a single box, for hierarchies. Planes the box is entirely inside of are cleared from
+    // the mask (bit n for plane n) so the box's children don't need to test them again
+    bool intersects(const glm::vec3& min, const glm::vec3& max, int& planeMask);
+
+    // Objects tested at once, 8, 4 or 1
+    static int batchWidth();
+
+private:
+    float planes[6][4];
+    float absPlanes[6][3];
+
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> extentX;
+    std::vector<float> extentY;
+    std::vector<float> extentZ;
+    std::vector<float> radius;
+};
+
+#endif
@@ -0,0 +1,350 @@
+#include <iostream>
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include "SDL.h"
+#include "drawlist.h"
+
+using namespace std;
+
+// Below this waking another worker costs more than it saves
+const int MIN_OBJECTS_PER_WORKER = 1024;
+
+const float DRAW_LIST_FAR_PLANE = 100.0f;
+
+DrawListBuilder::DrawListBuilder()
+{
+    lastBuildMs = 0.0;
+    lastMergeMs = 0.0;
+    lastCullNsPerObject = 0.0;
+    lastVisibleCount = 0;
+    lastHierarchyUpdateMs = 0.0;
+    lastNodesVisited = 0;
+    lastOccludedCount = 0;
+    lastOccluderTriangles = 0;
+    lastOcclusionMs = 0.0;
+    useHierarchy = false;
+    useOcclusion = false;
+    occlusionActive = false;
+    hierarchyRevision = -1;
+}
+
+void DrawListBuilder::setThreadCount(int threadCount)
+{
+    pool.create(threadCount);
+    lists.resize(pool.threadCount());
+    visibleLists.resize(pool.threadCount());
+    cullTicks.resize(pool.threadCount());
+    occlusionTicks.resize(pool.threadCount());
+    occludedCounts.resize(pool.threadCount());
+}
+
+int DrawListBuilder::threadCount()
+{
+    return pool.threadCount();
+}
+
+const glm::mat4& DrawListBuilder::objectTransform(int object)
+{
+    return transforms[object];
+}
+
+const glm::mat4& DrawListBuilder::objectMvp(int object)
+{
+    return mvps[object];
+}
+
+const ObjectLights& DrawListBuilder::objectLights(int object)
+{
+    return objectLightLists[object];
+}
+
+void DrawListBuilder::setLights(const vector<SceneLight>& lights)
+{
+    this->lights = lights;
+}
+
+void DrawListBuilder::addCommand(vector<DrawCommand>& list, const SceneObject& object, int index, const Bounds& bounds,
+                                 const glm::mat4& model, const glm::mat4& viewModel, const glm::vec3& cameraPos,
+                                 RenderQueue& queue)
+{
+    mvps[index] = viewModel * transforms[index];
+    selectLights(lights, bounds.min, bounds.max, objectLightLists[index]);
+    glm::vec3 position = glm::vec3(model * transforms[index][3]);
+    float depth = glm::length(position - cameraPos) / DRAW_LIST_FAR_PLANE;
+    DrawCommand command;
+    command.key = queue.makeKey(0, 0, object.material, object.mesh, depth);
+    command.object = index;
+    list.push_back(command);
+}
+
+void DrawListBuilder::rasterizeOccluders(Scene& scene, const glm::mat4& model, const glm::mat4& viewModel, const glm::mat4& transform)
+{
+    const vector<int>& occluders = scene.occluders();
+    occlusion.begin(viewModel);
+    for(size_t i=0; i<occluders.size(); i++)
+    {
+        const SceneObject& object = scene.object(occluders[i]);
+        GeometryData& geometry = scene.geometry(object.mesh);
+        occlusion.addOccluder((const float*)geometry.vertexData(), geometry.vertexCount(),
+                              viewModel * object.transform * transform * model);
+    }
+    occlusion.rasterize(pool);
+}
+
+void DrawListBuilder::removeOccluded(int worker, vector<uint32_t>& visible, const vector<Bounds>& bounds)
+{
+    if(!occlusionActive)
+    {
+        return;
+    }
+    Uint64 testStart = SDL_GetPerformanceCounter();
+    size_t kept = 0;
+    for(size_t i=0; i<visible.size(); i++)
+    {
+        if(occlusion.isVisible(bounds[visible[i]].min, bounds[visible[i]].max))
+        {
+            visible[kept++] = visible[i];
+        }
+    }
+    occludedCounts[worker] = visible.size() - kept;
+    visible.resize(kept);
+    occlusionTicks[worker] = SDL_GetPerformanceCounter() - testStart;
+}
+
+// NOTE: Each worker only writes its own lists and its own slice of the matrices and bounds, and
+//       reads the scene and queue (for the key layout) which don't change during the build
+void DrawListBuilder::cullFlat(Scene& scene, const vector<Bounds>& meshBounds, const glm::mat4& model, const glm::mat4& viewModel,
+                               const glm::mat4& transform, const glm::vec3& cameraPos, RenderQueue& queue)
+{
+    placedBounds.resize(scene.objectCount());
+    pool.run(scene.objectCount(), [&](int worker, int begin, int end)
+    {
+        for(int i=begin; i<end; i++)
+        {
+            const SceneObject& object = scene.object(i);
+            transforms[i] = object.transform * transform;
+            placedBounds[i] = transformBounds(meshBounds[object.mesh], transforms[i] * model);
+            culler.setBounds(i, placedBounds[i]);
+        }
+
+        Uint64 cullStart = SDL_GetPerformanceCounter();
+        vector<uint32_t>& visible = visibleLists[worker];
+        visible.clear();
+        culler.cull(begin, end, visible);
+        cullTicks[worker] = SDL_GetPerformanceCounter() - cullStart;
+
+        vector<DrawCommand>& list = lists[worker];
+        list.clear();
+        removeOccluded(worker, visible, placedBounds);
+        for(size_t v=0; v<visible.size(); v++)
+        {
+            addCommand(list, scene.object(visible[v]), visible[v], placedBounds[visible[v]], model, viewModel,
+                       cameraPos, queue);
+        }
+    }, MIN_OBJECTS_PER_WORKER);
+}
+
+SceneBVH& DrawListBuilder::updateHierarchy(Scene& scene, const vector<Bounds>& meshBounds, const glm::mat4& model,
+                                           const glm::mat4& transform)
+{
+    // NOTE: An object's matrix is its own transform after the shared transform * model, so its
+    //       bounds are the mesh bounds placed by the shared part (once per mesh) and then by its own
+    int objectCount = scene.objectCount();
+    glm::mat4 shared = transform * model;
+    lastHierarchyUpdateMs = 0.0;
+    if((shared != hierarchyTransform) || (scene.objectRevision() != hierarchyRevision) || ((int)objectBounds.size() != objectCount))
+    {
+        placedMeshBounds.resize(meshBounds.size());
+        for(size_t mesh=0; mesh<meshBounds.size(); mesh++)
+        {
+            placedMeshBounds[mesh] = transformBounds(meshBounds[mesh], shared);
+        }
+        objectBounds.resize(objectCount);
+        pool.run(objectCount, [&](int, int begin, int end)
+        {
+            for(int i=begin; i<end; i++)
+            {
+                const SceneObject& object = scene.object(i);
+                objectBounds[i] = transformBounds(placedMeshBounds[object.mesh], object.transform);
+            }
+        }, MIN_OBJECTS_PER_WORKER);
+        hierarchy.update(objectBounds);
+        lastHierarchyUpdateMs = hierarchy.lastUpdateMs;
+        hierarchyTransform = shared;
+        hierarchyRevision = scene.objectRevision();
+    }
+    return hierarchy;
+}
+
+void DrawListBuilder::cullHierarchy(Scene& scene, const vector<Bounds>& meshBounds, const glm::mat4& model, const glm::mat4& viewModel,
+                                    const glm::mat4& transform, const glm::vec3& cameraPos, RenderQueue& queue)
+{
+    updateHierarchy(scene, meshBounds, model, transform);
+
+    Uint64 cullStart = SDL_GetPerformanceCounter();
+    visibleObjects.clear();
+    hierarchy.cull(culler, visibleObjects);
+    cullTicks[0] = SDL_GetPerformanceCounter() - cullStart;
+    lastNodesVisited = hierarchy.lastNodesVisited;
+
+    pool.run(visibleObjects.size(), [&](int worker, int begin, int end)
+    {
+        vector<uint32_t>& visible = visibleLists[worker];
+        visible.assign(visibleObjects.begin() + begin, visibleObjects.begin() + end);
+        removeOccluded(worker, visible, objectBounds);
+
+        vector<DrawCommand>& list = lists[worker];
+        list.clear();
+        for(size_t v=0; v<visible.size(); v++)
+        {
+            int i = visible[v];
+            const SceneObject& object = scene.object(i);
+            transforms[i] = object.transform * transform;
+            addCommand(list, object, i, objectBounds[i], model, viewModel, cameraPos, queue);
+        }
+    }, MIN_OBJECTS_PER_WORKER);
+}
+
+void DrawListBuilder::build(Scene& scene, const vector<Bounds>& meshBounds, const glm::mat4& model, const glm::mat4& viewModel,
+                            const glm::mat4& transform, const glm::vec3& cameraPos, RenderQueue& queue)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    int objectCount = scene.objectCount();
+    transforms.resize(objectCount);
+    mvps.resize(objectCount);
+    objectLightLists.resize(objectCount);
+    culler.resize(objectCount);
+    if(lists.empty())
+    {
+        setThreadCount(1);
+    }
+
+    // NOTE: The shaders place the vertices with model before the object's matrices (the mvp
+    //       leaves model out), so the bounds are moved by trans * model and tested against the
+    //       frustum of the view model matrix
+    culler.setFrustum(viewModel);
+    occlusionActive = useOcclusion && !scene.occluders().empty();
+    if(occlusionActive)
+    {
+        rasterizeOccluders(scene, model, viewModel, transform);
+    }
+    if(useHierarchy)
+    {
+        cullHierarchy(scene, meshBounds, model, viewModel, transform, cameraPos, queue);
+    }
+    else
+    {
+        cullFlat(scene, meshBounds, model, viewModel, transform, cameraPos, queue);
+    }
+
+    Uint64 mergeStart = SDL_GetPerformanceCounter();
+    Uint64 cullTotal = 0;
+    Uint64 occlusionTotal = 0;
+    lastOccludedCount = 0;
+    queue.clear();
+    for(size_t i=0; i<lists.size(); i++)
+    {
+        queue.append(lists[i]);
+        lists[i].clear();
+        cullTotal += cullTicks[i];
+        cullTicks[i] = 0;
+        occlusionTotal += occlusionTicks[i];
+        occlusionTicks[i] = 0;
+        lastOccludedCount += occludedCounts[i];
+        occludedCounts[i] = 0;
+    }
+    lastOccluderTriangles = occlusionActive ? occlusion.triangleCount : 0;
+    lastOcclusionMs = occlusionActive ? occlusion.lastRasterizeMs + occlusionTotal * 1000.0 / SDL_GetPerformanceFrequency() : 0.0;
+    Uint64 end = SDL_GetPerformanceCounter();
+    lastVisibleCount = queue.size();
+    lastCullNsPerObject = (objectCount > 0) ? cullTotal * 1000000000.0 / SDL_GetPerformanceFrequency() / objectCount : 0.0;
+    lastMergeMs = (end - mergeStart) * 1000.0 / SDL_GetPerformanceFrequency();
+    lastBuildMs = (end - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+void DrawListBuilder::runBenchmark(int objectCount, int frameCount)
+{
+    // Objects scattered through a box around the view, over 4 meshes (unit cubes here, as there
+    // is no GL to load the real ones into) and 5 materials
+    Scene scene;
+    Bounds cubeBounds;
+    cubeBounds.min = glm::vec3(-1.0f);
+    cubeBounds.max = glm::vec3(1.0f);
+    cubeBounds.center = glm::vec3(0.0f);
+    cubeBounds.radius = sqrt(3.0f);
+    vector<Bounds> meshBounds(4, cubeBounds);
+    srand(1);
+    for(int i=0; i<objectCount; i++)
+    {
+        glm::vec3 position((rand() % 2001 - 1000) * 0.05f, (rand() % 2001 - 1000) * 0.05f, -(rand() % 2001) * 0.05f);
+        scene.addObject(rand() % 4, glm::translate(glm::mat4(1.0f), position), rand() % 5);
+    }
+
+    glm::vec3 cameraPos(0.0f, 0.0f, 3.0f);
+    glm::mat4 view = glm::lookAt(cameraPos, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, DRAW_LIST_FAR_PLANE);
+    glm::mat4 transform = glm::scale(glm::mat4(1.0f), glm::vec3(0.5f, 0.5f, 0.5f));
+
+    int maxThreads = thread::hardware_concurrency();
+    maxThreads = (maxThreads < 1) ? 1 : maxThreads;
+    cout << "Draw list benchmark, " << objectCount << " objects, " << frameCount << " frames, up to "
+         << maxThreads << " threads, culling " << FrustumCuller::batchWidth() << " objects at a time" << endl;
+
+    DrawListBuilder builder;
+    RenderQueue queue;
+    double singleThreadMs = 0.0;
+    int threads = 1;
+    while(true)
+    {
+        builder.setThreadCount(threads);
+        double buildTotal = 0.0;
+        double mergeTotal = 0.0;
+        double sortTotal = 0.0;
+        double cullTotal = 0.0;
+        long long visibleTotal = 0;
+        for(int frame=-1; frame<frameCount; frame++)
+        {
+            // The model turns every frame like the demo's pan, so every matrix and key changes
+            glm::mat4 model = glm::rotate(glm::mat4(1.0f), glm::radians(frame * 0.5f), glm::vec3(0.0f, 1.0f, 0.0f));
+            builder.build(scene, meshBounds, model, projection * view * model, transform, cameraPos, queue);
+            queue.sort();
+            // The first frame only warms up the threads and the lists
+            if(frame >= 0)
+            {
+                buildTotal += builder.lastBuildMs;
+                mergeTotal += builder.lastMergeMs;
+                sortTotal += queue.lastSortMs;
+                cullTotal += builder.lastCullNsPerObject;
+                visibleTotal += builder.lastVisibleCount;
+            }
+        }
+
+        double frameMs = (buildTotal + sortTotal) / frameCount;
+        if((threads == 1) && !builder.useHierarchy)
+        {
+            singleThreadMs = frameMs;
+        }
+        cout << "\t" << threads << " threads" << (builder.useHierarchy ? ", hierarchy" : "") << ": " << buildTotal / frameCount << " ms build (" << mergeTotal / frameCount
+             << " ms merge), " << sortTotal / frameCount << " ms sort, " << frameMs << " ms per frame, "
+             << singleThreadMs / frameMs << "x, " << visibleTotal / frameCount << " visible, "
+             << cullTotal / frameCount << " ns culling per object" << endl;
+
+        // A last pass culls through the hierarchy with every thread. The model turning every frame
+        // makes it refit every frame, its worst case
+        if(builder.useHierarchy)
+        {
+            break;
+        }
+        if(threads >= maxThreads)
+        {
+            builder.useHierarchy = true;
+            continue;
+        }
+        threads = min(threads*2, maxThreads);
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef DRAW_LIST_H
+#define DRAW_LIST_H
+
+#include <glm/glm/glm.hpp>
+
+#include "SDL.h"
+
+#include <vector>
+
+#include "scene.h"
+#include "renderqueue.h"
+#include "workerpool.h"
+#include "culling.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "lights.h"
+
+// NOTE: Builds the frame's draw commands for the scene objects. The objects are split across a
+//       worker pool, each worker composes the matrices of its objects and builds their sort keys
+//       into its own command list, and the lists are then merged into the render queue in worker
+//       order (so an unsorted queue keeps the scene order). Objects outside the view frustum are
+//       culled by the workers before their keys are built.
+//
+//       With useHierarchy the objects are culled through a SceneBVH instead, and the workers only
+//       process the visible ones. The tree is refit when objects move or the shared object
+//       transform changes, and left alone otherwise.
+//
+//       With useOcclusion the scene's occluders are first rasterized by an OcclusionCuller, and
+//       objects which pass the frustum test are also tested against its depth pyramid.
+//
+//       The workers also pick the lights of every visible object from its placed bounds, see
+//       selectLights(). Nothing here touches GL, submission stays on the GL thread
+class DrawListBuilder
+{
+public:
+    DrawListBuilder();
+
+    void setThreadCount(int threadCount);
+    int threadCount();
+
+    bool useHierarchy;
+    bool useOcclusion;
+
+    // The lights the objects are shaded by, in the space of the placed bounds
+    void setLights(const std::vector<SceneLight>& lights);
+
+    // Clears the queue and fills it with one command per visible object, the queue isn't sorted.
+    // meshBounds holds the bounds of every mesh the objects use
+    void build(Scene& scene, const std::vector<Bounds>& meshBounds, const glm::mat4& model, const glm::mat4& viewModel,
+               const glm::mat4& transform, const glm::vec3& cameraPos, RenderQueue& queue);
+
+    // Refits or rebuilds the hierarchy if objects moved or the shared transforms changed since it
+    // was last used, and returns it for other queries than culling. Its boxes are placed by
+    // object.transform * transform * model, without the model matrix in front of the view
+    SceneBVH& updateHierarchy(Scene& scene, const std::vector<Bounds>& meshBounds, const glm::mat4& model,
+                              const glm::mat4& transform);
+
+    // Results of the last build, by object index (only valid for visible objects)
+    const glm::mat4& objectTransform(int object);
+    const glm::mat4& objectMvp(int object);
+    const ObjectLights& objectLights(int object);
+
+    // Times of the last build in ms, the merge is included in the build time
+    double lastBuildMs;
+    double lastMergeMs;
+    // Culling time of the last build summed over the workers, per object tested, in ns
+    double lastCullNsPerObject;
+    int lastVisibleCount;
+    // Of the hierarchy, when used
+    double lastHierarchyUpdateMs;
+    int lastNodesVisited;
+    // Of the occlusion culling, when used. The time is the rasterization plus the tests summed
+    // over the workers
+    int lastOccludedCount;
+    int lastOccluderTriangles;
+    double lastOcclusionMs;
+
+    // Builds and sorts the draw lists of objectCount objects with every thread count up to the
+    // number of cores, no window needed
+    static void runBenchmark(int objectCount, int frameCount=100);
+
+private:
+    void cullFlat(Scene& scene, const std::vector<Bounds>& meshBounds, const glm::mat4& model, const glm::mat4& viewModel,
+                  const glm::mat4& transform, const glm::vec3& cameraPos, RenderQueue& queue);
+    void cullHierarchy(Scene& scene, const std::vector<Bounds>& meshBounds, const glm::mat4& model, const glm::mat4& viewModel,
+                       const glm::mat4& transform, const glm::vec3& cameraPos, RenderQueue& queue);
+    void rasterizeOccluders(Scene& scene, const glm::mat4& model, const glm::mat4& viewModel, const glm::mat4& transform);
+    // Drops the objects hidden by the occluders from a worker's visible list, keeping the order
+    void removeOccluded(int worker, std::vector<uint32_t>& visible, const std::vector<Bounds>& bounds);
+    // Computes the mvp, the lights and the key of a visible object with its transform already set.
+    // bounds are the object's placed bounds
+    void addCommand(std::vector<DrawCommand>& list, const SceneObject& object, int index, const Bounds& bounds,
+                    const glm::mat4& model, const glm::mat4& viewModel, const glm::vec3& cameraPos, RenderQueue& queue);
+
+    WorkerPool pool;
+    std::vector<std::vector<DrawCommand> > lists;
+    std::vector<std::vector<uint32_t> > visibleLists;
+    std::vector<Uint64> cullTicks;
+    std::vector<Uint64> occlusionTicks;
+    std::vector<int> occludedCounts;
+    FrustumCuller culler;
+    std::vector<glm::mat4> transforms;
+    std::vector<glm::mat4> mvps;
+    std::vector<SceneLight> lights;
+    std::vector<ObjectLights> objectLightLists;
+
+    OcclusionCuller occlusion;
+    bool occlusionActive;
+    std::vector<Bounds> placedBounds;  // Of the flat culling
+
+    SceneBVH hierarchy;
+    std::vector<Bounds> objectBounds;
+    std::vector<Bounds> placedMeshBounds;
+    std::vector<uint32_t> visibleObjects;
+    glm::mat4 hierarchyTransform;
+    int hierarchyRevision;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "framepacer.h"
+
+using namespace std;
+
+static double countsToMs(Uint64 counts)
+{
+    return counts * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+FramePacer::FramePacer()
+{
+    mode = LOOP_VSYNC;
+    targetFrameMs = 1000.0 / 60.0;
+    polling = false;
+    eventsThisIteration = false;
+    animating = false;
+    frameStart = SDL_GetPerformanceCounter();
+    resetStats();
+}
+
+const char* FramePacer::modeName(LoopMode mode)
+{
+    switch(mode)
+    {
+    case LOOP_VSYNC:
+        return "vsync";
+    case LOOP_ON_DEMAND:
+        return "on-demand";
+    case LOOP_LIMITED:
+        return "limited";
+    case LOOP_UNCAPPED:
+        return "uncapped";
+    default:
+        return "unknown";
+    }
+}
+
+void FramePacer::setMode(LoopMode mode)
+{
+    this->mode = mode;
+    // The limiter does its own waiting, vsync on top of it would round every frame up to a refresh
+    SDL_GL_SetSwapInterval(((mode == LOOP_VSYNC) || (mode == LOOP_ON_DEMAND)) ? 1 : 0);
+    frameStart = SDL_GetPerformanceCounter();
+    resetStats();
+}
+
+LoopMode FramePacer::getMode()
+{
+    return mode;
+}
+
+void FramePacer::setTargetFrameTime(double ms)
+{
+    // It's converted to performance counter ticks every frame, which has to stay in range, a
+    // minute per frame is already far past anything useful
+    if(!std::isfinite(ms))
+    {
+        return;
+    }
+    targetFrameMs = min(max(ms, 0.0), 60000.0);
+}
+
+bool FramePacer::nextEvent(SDL_Event& event, bool animating)
+{
+    if(!polling)
+    {
+        polling = true;
+        eventsThisIteration = false;
+        this->animating = animating;
+        if((mode == LOOP_ON_DEMAND) && !animating)
+        {
+            // NOTE: The timeout only bounds how stale the stats' CPU usage can get, an idle
+            //       wakeup doesn't render
+            if(SDL_WaitEventTimeout(&event, 1000))
+            {
+                eventsThisIteration = true;
+                return true;
+            }
+            polling = false;
+            return false;
+        }
+    }
+
+    if(SDL_PollEvent(&event))
+    {
+        eventsThisIteration = true;
+        return true;
+    }
+    polling = false;
+    return false;
+}
+
+bool FramePacer::shouldRender()
+{
+    return (mode != LOOP_ON_DEMAND) || eventsThisIteration || animating;
+}
+
+void FramePacer::inputReceived(const SDL_Event& event)
+{
+    // Inputs older than the last latch were already sampled by that frame
+    bool input = (event.type == SDL_KEYDOWN) || (event.type == SDL_MOUSEBUTTONDOWN);
+    if(input && !pendingInputTime && (event.common.timestamp > lastLatchTicks))
+    {
+        pendingInputTime = event.common.timestamp;
+    }
+}
+
+void FramePacer::framePresented(Uint32 latchTicks, Uint32 latchedInputTicks)
+{
+    frameCount++;
+    if(latchedInputTicks && (!pendingInputTime || (latchedInputTicks < pendingInputTime)))
+    {
+        pendingInputTime = latchedInputTicks;
+    }
+    if(!latchTicks)
+    {
+        latchTicks = SDL_GetTicks();
+    }
+    lastLatchTicks = latchTicks;
+
+    if(pendingInputTime && (pendingInputTime <= latchTicks))
+    {
+        double latency = (double)(SDL_GetTicks() - pendingInputTime);
+        latencyTotalMs += latency;
+        latencyToLatchMs += (double)(latchTicks - pendingInputTime);
+        latencyMaxMs = (latency > latencyMaxMs) ? latency : latencyMaxMs;
+        latencySamples++;
+        pendingInputTime = 0;
+    }
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    if(mode == LOOP_LIMITED)
+    {
+        Uint64 targetCounts = (Uint64)(targetFrameMs * SDL_GetPerformanceFrequency() / 1000.0);
+        Uint64 deadline = frameStart + targetCounts;
+        if(now < deadline)
+        {
+            double remainingMs = countsToMs(deadline - now);
+            if(remainingMs > 2.0)
+            {
+                SDL_Delay((Uint32)(remainingMs - 2.0));
+            }
+            while(SDL_GetPerformanceCounter() < deadline)
+            {
+            }
+            // Step from the deadline rather than from now, so the errors don't accumulate
+            frameStart = deadline;
+        }
+        else
+        {
+            // A late frame starts a new schedule instead of rushing the next ones to catch up
+            frameStart = now;
+        }
+    }
+    else
+    {
+        frameStart = now;
+    }
+}
+
+void FramePacer::resetStats()
+{
+    pendingInputTime = 0;
+    lastLatchTicks = 0;
+    latencySamples = 0;
+    latencyTotalMs = 0.0;
+    latencyToLatchMs = 0.0;
+    latencyMaxMs = 0.0;
+    frameCount = 0;
+    statsStart = SDL_GetPerformanceCounter();
+    cpuStart = clock();
+}
+
+void FramePacer::printStats()
+{
+    double wallMs = countsToMs(SDL_GetPerformanceCounter() - statsStart);
+    double cpuMs = (clock() - cpuStart) * 1000.0 / CLOCKS_PER_SEC;
+    cout << "Loop mode " << modeName(mode) << " over " << wallMs / 1000.0 << " s:" << endl;
+    cout << "\t" << frameCount << " frames (" << frameCount * 1000.0 / wallMs << " fps), CPU usage "
+         << 100.0 * cpuMs / wallMs << "%" << endl;
+    if(latencySamples)
+    {
+        cout << "\tInput to present latency: " << latencyTotalMs / latencySamples << " ms average, "
+             << latencyMaxMs << " ms max over " << latencySamples << " inputs" << endl;
+        cout << "\t\t" << latencyToLatchMs / latencySamples << " ms until sampled, "
+             << (latencyTotalMs - latencyToLatchMs) / latencySamples << " ms from sampling to the swap" << endl;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include "SDL.h"
+
+#include <time.h>
+
+enum LoopMode
+{
+    LOOP_VSYNC,     // Render every iteration, the swap blocks on vsync
+    LOOP_ON_DEMAND, // Sleep in SDL_WaitEventTimeout until something changes
+    LOOP_LIMITED,   // No vsync, each frame is padded out to an exact frame time
+    LOOP_UNCAPPED,  // No vsync and no waiting, for benchmarking
+    LOOP_MODE_COUNT
+};
+
+// NOTE: Decides when the main loop renders and how long it waits in between, and keeps the
+//       statistics to compare the modes: CPU usage of the process over wall time, and the time
+//       from an input event to the swap of the first frame which includes it. That latency is
+//       split at the point the frame sampled its input (the latch): the time the input waited to
+//       be picked up, and the time from there to the swap.
+//
+//       The limiter sleeps until shortly before the deadline and spins for the rest, SDL_Delay
+//       alone oversleeps by up to a scheduler tick
+class FramePacer
+{
+public:
+    FramePacer();
+
+    void setMode(LoopMode mode);
+    LoopMode getMode();
+    // Clamped to [0, 60000], infinite or NaN times are ignored
+    void setTargetFrameTime(double ms);
+
+    // Returns an event to handle through event, and whether there was one. In LOOP_ON_DEMAND this
+    // blocks until an event arrives unless animating, and false then means nothing needs drawing
+    bool nextEvent(SDL_Event& event, bool animating);
+    // Whether the frame should be rendered this iteration
+    bool shouldRender();
+
+    // Call for every input event, and after every swap with the SDL time (ms) the frame sampled its
+    // input, and the time of the oldest input it sampled without it having been handled as an
+    // event yet (0 if none, only the low latency mode samples input directly)
+    void inputReceived(const SDL_Event& event);
+    void framePresented(Uint32 latchTicks=0, Uint32 latchedInputTicks=0);
+
+    void printStats();
+    void resetStats();
+
+    static const char* modeName(LoopMode mode);
+
+private:
+    LoopMode mode;
+    double targetFrameMs;
+    bool polling;             // Inside the event loop of an iteration
+    bool eventsThisIteration;
+    bool animating;
+    Uint64 frameStart;
+
+    Uint32 pendingInputTime; // SDL timestamp (ms) of the oldest input not yet presented, 0 if none
+    Uint32 lastLatchTicks;
+    int latencySamples;
+    double latencyTotalMs;
+    double latencyToLatchMs;
+    double latencyMaxMs;
+    int frameCount;
+    Uint64 statsStart;
+    clock_t cpuStart;
+};
+
+#endif
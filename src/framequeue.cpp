@@ -0,0 +1,47 @@
+#include "SDL.h"
+#include "framequeue.h"
+
+FrameQueue::FrameQueue()
+{
+    limit = 1;
+}
+
+void FrameQueue::setLimit(int frames)
+{
+    limit = (frames < 1) ? 1 : frames;
+}
+
+int FrameQueue::getLimit()
+{
+    return limit;
+}
+
+double FrameQueue::waitForSlot()
+{
+    Uint64 waitStart = SDL_GetPerformanceCounter();
+    while((int)fences.size() >= limit)
+    {
+        GLenum result = glClientWaitSync(fences[0], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while((result != GL_ALREADY_SIGNALED) && (result != GL_CONDITION_SATISFIED) && (result != GL_WAIT_FAILED))
+        {
+            result = glClientWaitSync(fences[0], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+        glDeleteSync(fences[0]);
+        fences.erase(fences.begin());
+    }
+    return (SDL_GetPerformanceCounter() - waitStart) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+void FrameQueue::frameSubmitted()
+{
+    fences.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+}
+
+void FrameQueue::clear()
+{
+    for(size_t i=0; i<fences.size(); i++)
+    {
+        glDeleteSync(fences[i]);
+    }
+    fences.clear();
+}
@@ -0,0 +1,32 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <GL/glew.h>
+
+#include <vector>
+
+// NOTE: Caps how many frames the driver may queue ahead of the GPU. A fence is placed after each
+//       swap, and before starting a frame the CPU waits on the fence of the frame `limit` frames
+//       back. With a limit of 1 a frame is only started once the previous one has been executed,
+//       so whatever input it samples is shown as soon as possible
+class FrameQueue
+{
+public:
+    FrameQueue();
+
+    void setLimit(int frames);
+    int getLimit();
+
+    // Waits until fewer than limit frames are in flight, returns the time waited in ms
+    double waitForSlot();
+    // Call after the swap
+    void frameSubmitted();
+    // Deletes the outstanding fences, needed before the context is destroyed
+    void clear();
+
+private:
+    int limit;
+    std::vector<GLsync> fences; // Oldest first
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include <iostream>
+
+#include "gbuffer.h"
+#include "glstate.h"
+
+using namespace std;
+
+enum GBufferTexture
+{
+    GBUFFER_ALBEDO = 0,
+    GBUFFER_NORMAL,
+    GBUFFER_DEPTH
+};
+
+GBuffer::GBuffer()
+{
+    firstUnit = 0;
+    width = 0;
+    height = 0;
+    framebuffer = 0;
+    textures[0] = textures[1] = textures[2] = 0;
+    emptyVao = 0;
+}
+
+void GBuffer::create(int firstUnit, int width, int height)
+{
+    this->firstUnit = firstUnit;
+    this->width = width;
+    this->height = height;
+    glGenTextures(3, textures);
+    glGenFramebuffers(1, &framebuffer);
+    glGenVertexArrays(1, &emptyVao);
+    allocate();
+}
+
+void GBuffer::resize(int width, int height)
+{
+    if((width != this->width) || (height != this->height))
+    {
+        this->width = width;
+        this->height = height;
+        allocate();
+    }
+}
+
+void GBuffer::allocate()
+{
+    // Read back one texel per pixel with texelFetch, never filtered
+    const GLint internalFormats[3] = {GL_RGBA8, GL_RG16F, GL_DEPTH_COMPONENT24};
+    const GLenum formats[3] = {GL_RGBA, GL_RG, GL_DEPTH_COMPONENT};
+    const GLenum types[3] = {GL_UNSIGNED_BYTE, GL_HALF_FLOAT, GL_UNSIGNED_INT};
+    for(int i=0; i<3; i++)
+    {
+        glState.bindTexture(firstUnit + i, GL_TEXTURE_2D, textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0, formats[i], types[i], NULL);
+    }
+
+    glState.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[GBUFFER_ALBEDO], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, textures[GBUFFER_NORMAL], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[GBUFFER_DEPTH], 0);
+    const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        cout << "G-buffer framebuffer is incomplete" << endl;
+    }
+    glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GBuffer::destroy()
+{
+    if(framebuffer)
+    {
+        glState.deleteFramebuffers(1, &framebuffer);
+        glState.deleteTextures(3, textures);
+        glState.deleteVertexArrays(1, &emptyVao);
+        framebuffer = 0;
+    }
+}
+
+void GBuffer::begin()
+{
+    glState.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void GBuffer::bindTextures()
+{
+    for(int i=0; i<3; i++)
+    {
+        glState.bindTexture(firstUnit + i, GL_TEXTURE_2D, textures[i]);
+    }
+}
+
+GLuint GBuffer::fullscreenVertexArray()
+{
+    return emptyVao;
+}
@@ -0,0 +1,46 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <GL/glew.h>
+
+// NOTE: Geometry buffer of the deferred shading path. The geometry is drawn once into three
+//       screen sized textures, and the lights are then accumulated by a fullscreen pass reading
+//       them back, so a pixel's lighting costs the same however many triangles were drawn over it:
+//
+//         albedo  RGBA8   the diffuse sample (alpha unused)
+//         normal  RG16F   the bump mapped normal, octahedral encoded, in the lights' space
+//         depth   DEPTH24 the position is reconstructed from it
+//
+//       8 bytes of colour and 3 of depth a pixel, where a position and an unencoded normal
+//       would take 24 more
+class GBuffer
+{
+public:
+    GBuffer();
+
+    // The textures are kept bound to three units from firstUnit, albedo, normal then depth
+    void create(int firstUnit, int width, int height);
+    // Reallocates the attachments when the drawable size changed, does nothing otherwise
+    void resize(int width, int height);
+    void destroy();
+
+    // Binds the framebuffer as the target of the geometry that follows
+    void begin();
+    // Binds the textures to their units again, for the lighting pass
+    void bindTextures();
+    // The empty vertex array a fullscreen triangle is drawn with, its corners come from gl_VertexID
+    GLuint fullscreenVertexArray();
+
+    int firstUnit;
+    int width;
+    int height;
+
+private:
+    void allocate();
+
+    GLuint framebuffer;
+    GLuint textures[3];
+    GLuint emptyVao;
+};
+
+#endif
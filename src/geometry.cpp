@@ -1,6 +1,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <algorithm>
 
 #include <math.h>
 
@@ -20,6 +21,10 @@ using namespace std;
 
 // NOTE: There is currently no support for mtl material references or anything like that,
 //       just load whatever texture you want to use manually
+//
+//       Several of the models only have positions. Those faces get a flat normal and texture
+//       coordinates box projected along the normal's major axis, so that every mesh can be drawn
+//       with the same bump-mapped shaders
 
 enum OBJDataType
 {
@@ -228,8 +233,53 @@ void GeometryData::loadFromOBJFile(string filename)
             }
         }
 
+        if(!hasNormals || !hasTextureCoords)
+        {
+            float* corners = &vertices[vertices.size() - 9];
+            float edge1[3] = {corners[3] - corners[0], corners[4] - corners[1], corners[5] - corners[2]};
+            float edge2[3] = {corners[6] - corners[0], corners[7] - corners[1], corners[8] - corners[2]};
+            float faceNormal[3] = {edge1[1]*edge2[2] - edge1[2]*edge2[1],
+                                   edge1[2]*edge2[0] - edge1[0]*edge2[2],
+                                   edge1[0]*edge2[1] - edge1[1]*edge2[0]};
+            float normalLength = sqrt(faceNormal[0]*faceNormal[0] +
+                                      faceNormal[1]*faceNormal[1] +
+                                      faceNormal[2]*faceNormal[2]);
+            if(normalLength > 0.0f)
+            {
+                faceNormal[0] /= normalLength;
+                faceNormal[1] /= normalLength;
+                faceNormal[2] /= normalLength;
+            }
+
+            // The texture plane is spanned by the two axes other than the normal's largest one
+            int majorAxis = 0;
+            for(int i=1; i<3; i++)
+            {
+                if(fabs(faceNormal[i]) > fabs(faceNormal[majorAxis]))
+                {
+                    majorAxis = i;
+                }
+            }
+            int uAxis = (majorAxis + 1) % 3;
+            int vAxis = (majorAxis + 2) % 3;
+
+            for(int vertIndex=0; vertIndex<3; vertIndex++)
+            {
+                if(!hasNormals)
+                {
+                    normals.push_back(faceNormal[0]);
+                    normals.push_back(faceNormal[1]);
+                    normals.push_back(faceNormal[2]);
+                }
+                if(!hasTextureCoords)
+                {
+                    textureCoords.push_back(corners[3*vertIndex + uAxis]);
+                    textureCoords.push_back(corners[3*vertIndex + vAxis]);
+                }
+            }
+        }
+
         // Compute the (bi)tangent for the face, and add it for each vertex
-        if(hasTextureCoords && hasNormals)
         {
             int vertexStartIndex = vertices.size() - 9;
             int uvStartIndex = textureCoords.size() - 6;
@@ -248,7 +298,10 @@ void GeometryData::loadFromOBJFile(string filename)
             float deltaU2 = texCoords[4] - texCoords[0];
             float deltaV2 = texCoords[5] - texCoords[1];
 
-            float inverseDet = 1.0f / (deltaU1*deltaV2 - deltaU2*deltaV1);
+            // NOTE: Degenerate faces (zero area in texture space) get an arbitrary unit basis,
+            //       the face is invisible or the normal map stretched to a line either way
+            float det = deltaU1*deltaV2 - deltaU2*deltaV1;
+            float inverseDet = (det != 0.0f) ? 1.0f / det : 0.0f;
 
             float tangentX = inverseDet * (deltaV2*deltaX1 - deltaV1*deltaX2);
             float tangentY = inverseDet * (deltaV2*deltaY1 - deltaV1*deltaY2);
@@ -265,12 +318,24 @@ void GeometryData::loadFromOBJFile(string filename)
                                          bitangentY*bitangentY +
                                          bitangentZ*bitangentZ);
 
-            tangentX /= tangentLength;
-            tangentY /= tangentLength;
-            tangentZ /= tangentLength;
-            bitangentX /= bitangentLength;
-            bitangentY /= bitangentLength;
-            bitangentZ /= bitangentLength;
+            if((tangentLength > 0.0f) && (bitangentLength > 0.0f))
+            {
+                tangentX /= tangentLength;
+                tangentY /= tangentLength;
+                tangentZ /= tangentLength;
+                bitangentX /= bitangentLength;
+                bitangentY /= bitangentLength;
+                bitangentZ /= bitangentLength;
+            }
+            else
+            {
+                tangentX = 1.0f;
+                tangentY = 0.0f;
+                tangentZ = 0.0f;
+                bitangentX = 0.0f;
+                bitangentY = 1.0f;
+                bitangentZ = 0.0f;
+            }
 
             // NOTE: Each vertex in the face gets the same (bi)tangent pair
             for(int vertIndex=0; vertIndex<3; vertIndex++)
@@ -286,9 +351,66 @@ void GeometryData::loadFromOBJFile(string filename)
         }
     }
 
+    computeBounds();
     cout << "Successfully loaded an OBJ with " << vertices.size()/3 << " vertices " << endl;
 }
 
+void GeometryData::append(GeometryData& source, const glm::mat4& transform)
+{
+    glm::mat3 linear(transform);
+    const vector<float>* sourceVectors[3] = {&source.normals, &source.tangents, &source.bitangents};
+    vector<float>* vectors[3] = {&normals, &tangents, &bitangents};
+    for(size_t i=0; i<source.vertices.size(); i+=3)
+    {
+        glm::vec4 position = transform * glm::vec4(source.vertices[i], source.vertices[i+1], source.vertices[i+2], 1.0f);
+        vertices.push_back(position.x);
+        vertices.push_back(position.y);
+        vertices.push_back(position.z);
+        for(int attribute=0; attribute<3; attribute++)
+        {
+            const vector<float>& from = *sourceVectors[attribute];
+            glm::vec3 direction = linear * glm::vec3(from[i], from[i+1], from[i+2]);
+            vectors[attribute]->push_back(direction.x);
+            vectors[attribute]->push_back(direction.y);
+            vectors[attribute]->push_back(direction.z);
+        }
+    }
+    textureCoords.insert(textureCoords.end(), source.textureCoords.begin(), source.textureCoords.end());
+}
+
+void GeometryData::computeBounds()
+{
+    objectBounds.min = glm::vec3(0.0f);
+    objectBounds.max = glm::vec3(0.0f);
+    if(!vertices.empty())
+    {
+        objectBounds.min = glm::vec3(vertices[0], vertices[1], vertices[2]);
+        objectBounds.max = objectBounds.min;
+    }
+    for(size_t i=0; i<vertices.size(); i+=3)
+    {
+        glm::vec3 position(vertices[i], vertices[i+1], vertices[i+2]);
+        objectBounds.min = glm::min(objectBounds.min, position);
+        objectBounds.max = glm::max(objectBounds.max, position);
+    }
+
+    // NOTE: Centring the sphere on the box isn't the tightest sphere, but it lets the culler
+    //       test both volumes against a plane with a single distance
+    objectBounds.center = (objectBounds.min + objectBounds.max) * 0.5f;
+    float radiusSquared = 0.0f;
+    for(size_t i=0; i<vertices.size(); i+=3)
+    {
+        glm::vec3 offset = glm::vec3(vertices[i], vertices[i+1], vertices[i+2]) - objectBounds.center;
+        radiusSquared = max(radiusSquared, glm::dot(offset, offset));
+    }
+    objectBounds.radius = sqrt(radiusSquared);
+}
+
+const Bounds& GeometryData::bounds()
+{
+    return objectBounds;
+}
+
 int GeometryData::vertexCount()
 {
     return vertices.size()/3;
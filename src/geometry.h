@@ -4,6 +4,8 @@
 #include <vector>
 #include <string>
 
+#include <glm/glm/glm.hpp>
+
 struct FaceData
 {
     int vertexIndex[3];
@@ -11,10 +13,22 @@ struct FaceData
     int normalIndex[3];
 };
 
+// Object space bounding volumes of a mesh, the sphere is centred on the box
+struct Bounds
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 center;
+    float radius;
+};
+
 class GeometryData
 {
 public:
     void loadFromOBJFile(std::string filename);
+    // Adds the vertices of another mesh placed by transform, the normals, tangents and bitangents
+    // by its upper 3x3 as the shaders place them. computeBounds() has to follow the last one
+    void append(GeometryData& source, const glm::mat4& transform);
 
     int vertexCount();
 
@@ -24,7 +38,13 @@ public:
     void* tangentData();
     void* bitangentData();
 
+    // Computed when the file is loaded
+    const Bounds& bounds();
+    void computeBounds();
+
 private:
+    Bounds objectBounds;
+
     std::vector<float> vertices;
     std::vector<float> textureCoords;
     std::vector<float> normals;
@@ -0,0 +1,362 @@
+#include "glstate.h"
+
+GLStateCache glState;
+
+// Marks a binding nothing has been set through the cache yet
+const GLuint UNKNOWN_BINDING = 0xFFFFFFFF;
+
+const GLenum BUFFER_TARGETS[STATE_BUFFER_TARGETS] = {
+    GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_PIXEL_PACK_BUFFER,
+    GL_PIXEL_UNPACK_BUFFER, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GL_TEXTURE_BUFFER
+};
+const GLenum TEXTURE_TARGETS[STATE_TEXTURE_TARGETS] = {
+    GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER
+};
+const GLenum CAPABILITIES[STATE_CAPABILITIES] = {
+    GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST, GL_STENCIL_TEST, GL_RASTERIZER_DISCARD
+};
+
+GLStateCache::GLStateCache()
+{
+    filtering = true;
+    invalidate();
+    resetCounters();
+}
+
+void GLStateCache::invalidate()
+{
+    program = UNKNOWN_BINDING;
+    vao = UNKNOWN_BINDING;
+    drawFramebuffer = UNKNOWN_BINDING;
+    readFramebuffer = UNKNOWN_BINDING;
+    activeUnit = UNKNOWN_BINDING;
+    for(int i=0; i<STATE_BUFFER_TARGETS; i++)
+    {
+        buffers[i] = UNKNOWN_BINDING;
+    }
+    for(int i=0; i<STATE_UNIFORM_BINDINGS; i++)
+    {
+        uniformBuffers[i] = UNKNOWN_BINDING;
+        uniformOffsets[i] = 0;
+        uniformSizes[i] = 0;
+    }
+    for(int unit=0; unit<STATE_TEXTURE_UNITS; unit++)
+    {
+        for(int i=0; i<STATE_TEXTURE_TARGETS; i++)
+        {
+            textures[unit][i] = UNKNOWN_BINDING;
+        }
+        samplers[unit] = UNKNOWN_BINDING;
+    }
+    for(int i=0; i<STATE_CAPABILITIES; i++)
+    {
+        capabilities[i] = UNKNOWN_BINDING;
+    }
+}
+
+void GLStateCache::setFiltering(bool enabled)
+{
+    filtering = enabled;
+}
+
+bool GLStateCache::isFiltering()
+{
+    return filtering;
+}
+
+void GLStateCache::resetCounters()
+{
+    issuedCount = 0;
+    filteredCount = 0;
+}
+
+// Updates the cached value, returns true if the call can be dropped
+bool GLStateCache::redundant(GLuint& cached, GLuint value)
+{
+    if(cached == value)
+    {
+        filteredCount++;
+        if(filtering)
+        {
+            return true;
+        }
+    }
+    cached = value;
+    issuedCount++;
+    return false;
+}
+
+int GLStateCache::bufferTargetIndex(GLenum target)
+{
+    for(int i=0; i<STATE_BUFFER_TARGETS; i++)
+    {
+        if(BUFFER_TARGETS[i] == target)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int GLStateCache::textureTargetIndex(GLenum target)
+{
+    for(int i=0; i<STATE_TEXTURE_TARGETS; i++)
+    {
+        if(TEXTURE_TARGETS[i] == target)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int GLStateCache::capabilityIndex(GLenum capability)
+{
+    for(int i=0; i<STATE_CAPABILITIES; i++)
+    {
+        if(CAPABILITIES[i] == capability)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void GLStateCache::useProgram(GLuint program)
+{
+    if(!redundant(this->program, program))
+    {
+        glUseProgram(program);
+    }
+}
+
+void GLStateCache::bindVertexArray(GLuint vao)
+{
+    if(!redundant(this->vao, vao))
+    {
+        glBindVertexArray(vao);
+        // The element array binding is part of the vertex array
+        buffers[bufferTargetIndex(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN_BINDING;
+    }
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+    int index = bufferTargetIndex(target);
+    if(index < 0)
+    {
+        issuedCount++;
+        glBindBuffer(target, buffer);
+    }
+    else if(!redundant(buffers[index], buffer))
+    {
+        glBindBuffer(target, buffer);
+    }
+}
+
+void GLStateCache::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    if((target != GL_UNIFORM_BUFFER) || (index >= (GLuint)STATE_UNIFORM_BINDINGS))
+    {
+        issuedCount++;
+        glBindBufferRange(target, index, buffer, offset, size);
+        int generic = bufferTargetIndex(target);
+        if(generic >= 0)
+        {
+            buffers[generic] = buffer;
+        }
+        return;
+    }
+
+    if((uniformBuffers[index] == buffer) && (uniformOffsets[index] == offset) && (uniformSizes[index] == size))
+    {
+        filteredCount++;
+        if(filtering)
+        {
+            return;
+        }
+    }
+    uniformBuffers[index] = buffer;
+    uniformOffsets[index] = offset;
+    uniformSizes[index] = size;
+    // The indexed bind also binds the generic target
+    buffers[bufferTargetIndex(GL_UNIFORM_BUFFER)] = buffer;
+    issuedCount++;
+    glBindBufferRange(target, index, buffer, offset, size);
+}
+
+void GLStateCache::bindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    if(target == GL_FRAMEBUFFER)
+    {
+        if((drawFramebuffer == framebuffer) && (readFramebuffer == framebuffer))
+        {
+            filteredCount++;
+            if(filtering)
+            {
+                return;
+            }
+        }
+        drawFramebuffer = framebuffer;
+        readFramebuffer = framebuffer;
+        issuedCount++;
+        glBindFramebuffer(target, framebuffer);
+    }
+    else if(!redundant((target == GL_READ_FRAMEBUFFER) ? readFramebuffer : drawFramebuffer, framebuffer))
+    {
+        glBindFramebuffer(target, framebuffer);
+    }
+}
+
+void GLStateCache::activeTexture(int unit)
+{
+    if(!redundant(activeUnit, unit))
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+void GLStateCache::bindTexture(GLenum target, GLuint texture)
+{
+    int index = textureTargetIndex(target);
+    if((index < 0) || (activeUnit >= (GLuint)STATE_TEXTURE_UNITS))
+    {
+        issuedCount++;
+        glBindTexture(target, texture);
+        if(index >= 0)
+        {
+            // The unit is unknown, so is whatever is bound to any unit now
+            for(int unit=0; unit<STATE_TEXTURE_UNITS; unit++)
+            {
+                textures[unit][index] = UNKNOWN_BINDING;
+            }
+        }
+    }
+    else if(!redundant(textures[activeUnit][index], texture))
+    {
+        glBindTexture(target, texture);
+    }
+}
+
+void GLStateCache::bindTexture(int unit, GLenum target, GLuint texture)
+{
+    activeTexture(unit);
+    bindTexture(target, texture);
+}
+
+void GLStateCache::bindSampler(int unit, GLuint sampler)
+{
+    if(unit >= STATE_TEXTURE_UNITS)
+    {
+        issuedCount++;
+        glBindSampler(unit, sampler);
+    }
+    else if(!redundant(samplers[unit], sampler))
+    {
+        glBindSampler(unit, sampler);
+    }
+}
+
+void GLStateCache::enable(GLenum capability)
+{
+    int index = capabilityIndex(capability);
+    if(index < 0)
+    {
+        issuedCount++;
+        glEnable(capability);
+    }
+    else if(!redundant(capabilities[index], 1))
+    {
+        glEnable(capability);
+    }
+}
+
+void GLStateCache::disable(GLenum capability)
+{
+    int index = capabilityIndex(capability);
+    if(index < 0)
+    {
+        issuedCount++;
+        glDisable(capability);
+    }
+    else if(!redundant(capabilities[index], 0))
+    {
+        glDisable(capability);
+    }
+}
+
+void GLStateCache::deleteProgram(GLuint program)
+{
+    // NOTE: A program in use is only flagged for deletion and stays bound, its name isn't reused
+    //       until it is unbound, so the cached binding stays right
+    glDeleteProgram(program);
+}
+
+void GLStateCache::deleteVertexArrays(GLsizei count, const GLuint* vaos)
+{
+    for(GLsizei i=0; i<count; i++)
+    {
+        if(vao == vaos[i])
+        {
+            vao = 0;
+            buffers[bufferTargetIndex(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN_BINDING;
+        }
+    }
+    glDeleteVertexArrays(count, vaos);
+}
+
+void GLStateCache::deleteBuffers(GLsizei count, const GLuint* buffers)
+{
+    for(GLsizei i=0; i<count; i++)
+    {
+        for(int target=0; target<STATE_BUFFER_TARGETS; target++)
+        {
+            if(this->buffers[target] == buffers[i])
+            {
+                this->buffers[target] = 0;
+            }
+        }
+        for(int index=0; index<STATE_UNIFORM_BINDINGS; index++)
+        {
+            if(uniformBuffers[index] == buffers[i])
+            {
+                uniformBuffers[index] = 0;
+            }
+        }
+    }
+    glDeleteBuffers(count, buffers);
+}
+
+void GLStateCache::deleteFramebuffers(GLsizei count, const GLuint* framebuffers)
+{
+    for(GLsizei i=0; i<count; i++)
+    {
+        if(drawFramebuffer == framebuffers[i])
+        {
+            drawFramebuffer = 0;
+        }
+        if(readFramebuffer == framebuffers[i])
+        {
+            readFramebuffer = 0;
+        }
+    }
+    glDeleteFramebuffers(count, framebuffers);
+}
+
+void GLStateCache::deleteTextures(GLsizei count, const GLuint* textures)
+{
+    for(GLsizei i=0; i<count; i++)
+    {
+        for(int unit=0; unit<STATE_TEXTURE_UNITS; unit++)
+        {
+            for(int target=0; target<STATE_TEXTURE_TARGETS; target++)
+            {
+                if(this->textures[unit][target] == textures[i])
+                {
+                    this->textures[unit][target] = 0;
+                }
+            }
+        }
+    }
+    glDeleteTextures(count, textures);
+}
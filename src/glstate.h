@@ -0,0 +1,80 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/glew.h>
+
+const int STATE_TEXTURE_UNITS = 16;
+const int STATE_BUFFER_TARGETS = 8;
+const int STATE_TEXTURE_TARGETS = 5;
+const int STATE_UNIFORM_BINDINGS = 16;
+const int STATE_CAPABILITIES = 6;
+
+// NOTE: Shadow of the binding state of the context. Every bind goes through here, and a call that
+//       would bind what is already bound is dropped. Bindings nothing has set yet are unknown
+//       and always issued, and targets/units outside the ones tracked pass straight through.
+//
+//       The cache is only correct if all binds and deletes go through it. Code that touches the
+//       state some other way has to call invalidate() afterwards. With filtering switched off
+//       every call is issued, but the counters still show what would have been dropped
+class GLStateCache
+{
+public:
+    GLStateCache();
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void bindFramebuffer(GLenum target, GLuint framebuffer);
+    // unit is the index, not GL_TEXTURE0 + index
+    void activeTexture(int unit);
+    void bindTexture(GLenum target, GLuint texture);
+    // Leaves unit active even when the bind itself is dropped, callers edit the texture after it
+    void bindTexture(int unit, GLenum target, GLuint texture);
+    void bindSampler(int unit, GLuint sampler);
+    void enable(GLenum capability);
+    void disable(GLenum capability);
+
+    // Deleting an object unbinds it, and GL may hand its name out again
+    void deleteProgram(GLuint program);
+    void deleteVertexArrays(GLsizei count, const GLuint* vaos);
+    void deleteBuffers(GLsizei count, const GLuint* buffers);
+    void deleteFramebuffers(GLsizei count, const GLuint* framebuffers);
+    void deleteTextures(GLsizei count, const GLuint* textures);
+
+    // Forgets all of the state, every next bind is issued
+    void invalidate();
+
+    void setFiltering(bool enabled);
+    bool isFiltering();
+    void resetCounters();
+
+    // Calls made through the cache since the last reset, issued to GL or dropped as redundant
+    int issuedCount;
+    int filteredCount;
+
+private:
+    bool redundant(GLuint& cached, GLuint value);
+    int bufferTargetIndex(GLenum target);
+    int textureTargetIndex(GLenum target);
+    int capabilityIndex(GLenum capability);
+
+    bool filtering;
+    GLuint program;
+    GLuint vao;
+    GLuint buffers[STATE_BUFFER_TARGETS];
+    GLuint uniformBuffers[STATE_UNIFORM_BINDINGS];
+    GLintptr uniformOffsets[STATE_UNIFORM_BINDINGS];
+    GLsizeiptr uniformSizes[STATE_UNIFORM_BINDINGS];
+    GLuint drawFramebuffer;
+    GLuint readFramebuffer;
+    GLuint activeUnit;
+    GLuint textures[STATE_TEXTURE_UNITS][STATE_TEXTURE_TARGETS];
+    GLuint samplers[STATE_TEXTURE_UNITS];
+    GLuint capabilities[STATE_CAPABILITIES]; // 0/1, or unknown
+};
+
+// The state cache of the (only) GL context, to be used from the GL thread
+extern GLStateCache glState;
+
+#endif
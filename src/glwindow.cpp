@@ -1,5 +1,8 @@
 #include <iostream>
+#include <string>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 
 #include "SDL.h"
 #include <GL/glew.h>
@@ -11,6 +14,7 @@
 
 #include "glwindow.h"
 #include "geometry.h"
+#include "glstate.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -46,7 +50,7 @@ void glPrintError(const char* label="Unlabelled Error Checkpoint", bool alwaysPr
     }
 }
 
-GLuint loadShader(const char* shaderFilename, GLenum shaderType)
+GLuint loadShader(const char* shaderFilename, GLenum shaderType, const char* defines="")
 {
     FILE* shaderFile = fopen(shaderFilename, "r");
     if(!shaderFile)
@@ -63,8 +67,14 @@ GLuint loadShader(const char* shaderFilename, GLenum shaderType)
     shaderText[readCount] = '\0';
     fclose(shaderFile);
 
+    // NOTE: Shader variants are selected with #defines, which have to come after the #version line
+    string source = shaderText;
+    size_t versionEnd = source.find('\n');
+    source.insert((versionEnd == string::npos) ? source.size() : versionEnd+1, defines);
+    const char* sourceText = source.c_str();
+
     GLuint shader = glCreateShader(shaderType);
-    glShaderSource(shader, 1, (const char**)&shaderText, NULL);
+    glShaderSource(shader, 1, &sourceText, NULL);
     glCompileShader(shader);
 
     delete[] shaderText;
@@ -73,10 +83,11 @@ GLuint loadShader(const char* shaderFilename, GLenum shaderType)
 }
 
 GLuint loadShaderProgram(const char* vertShaderFilename,
-                       const char* fragShaderFilename)
+                       const char* fragShaderFilename,
+                       const char* defines="")
 {
-    GLuint vertShader = loadShader(vertShaderFilename, GL_VERTEX_SHADER);
-    GLuint fragShader = loadShader(fragShaderFilename, GL_FRAGMENT_SHADER);
+    GLuint vertShader = loadShader(vertShaderFilename, GL_VERTEX_SHADER, defines);
+    GLuint fragShader = loadShader(fragShaderFilename, GL_FRAGMENT_SHADER, defines);
 
     GLuint program = glCreateProgram();
     glAttachShader(program, vertShader);
@@ -99,13 +110,64 @@ GLuint loadShaderProgram(const char* vertShaderFilename,
     return program;
 }
 
+// Size of the atlasRegions array of the instanced shaders, MAX_MATERIALS in simple.frag
+const int MAX_INSTANCE_MATERIALS = 16;
+
+// Units 0 and 1 hold the regular diffuse/normal maps, the other texturing modes get their own
+// units so switching between them doesn't require rebinding
+const int VIRTUAL_TEXTURE_UNIT = 2;
+const int ATLAS_DIFFUSE_UNIT = 5;
+const int ATLAS_NORMAL_UNIT = 6;
+const int CLUSTER_FIRST_UNIT = 7; // And the next two, see ClusteredLights::bind()
+const int GBUFFER_FIRST_UNIT = 10; // Albedo, normal and depth
+
+// Of the projection, which the clustered lights slice the view between
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+
+// Lays the stress test copies out on a cube grid behind the object
+static void buildObjectOffsets(int extraCount, vector<glm::mat4>& offsets)
+{
+    const float spacing = 2.5f;
+    offsets.assign(1, glm::mat4(1.0f));
+    int side = (int)ceil(cbrt((double)extraCount));
+    for(int i=0; i<extraCount; i++)
+    {
+        float x = (i % side) - (side - 1)*0.5f;
+        float y = ((i / side) % side) - (side - 1)*0.5f;
+        float z = i / (side*side) + 2;
+        offsets.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(x, y, -z)*spacing));
+    }
+}
+
+void SimpleProgram::load(const char* vertFilename, const char* fragFilename, const char* defines)
+{
+    program.reflect(loadShaderProgram(vertFilename, fragFilename, defines));
+    objectColor = program.uniformLocation("objectColor");
+    viewPos = program.uniformLocation("viewPos");
+    objectLights = program.uniformLocation("objectLights");
+    objectLightCount = program.uniformLocation("objectLightCount");
+    addNormalMap = program.uniformLocation("addNormalMap");
+    model = program.uniformLocation("model");
+    mvp = program.uniformLocation("mvp");
+    trans = program.uniformLocation("trans");
+    ourTexture = program.uniformLocation("ourTexture");
+    ourTextureMap = program.uniformLocation("ourTextureMap");
+    atlasRegion = program.uniformLocation("atlasRegion");
+    atlasRegions = program.uniformLocation("atlasRegions");
+    clipToScene = program.uniformLocation("clipToScene");
+    virtualTexture.lookUp(program);
+    // Every variant reads the lights from the same buffer
+    program.bindUniformBlock("Lights", LIGHTS_BLOCK_BINDING);
+}
+
 OpenGLWindow::OpenGLWindow()
 {
 }
 
 GLuint OpenGLWindow::loadTexture(const char* filename, GLuint textureID){
     
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    glState.bindTexture(GL_TEXTURE_2D, textureID);
 
     // set the texture wrapping/filtering options (on the currently bound texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
@@ -126,7 +188,120 @@ GLuint OpenGLWindow::loadTexture(const char* filename, GLuint textureID){
     return textureID;
 }
 
-void OpenGLWindow::initGL()
+// Loads an image into a new texture the first time it is asked for, and returns the same texture
+// after that
+GLuint OpenGLWindow::textureFile(const string& filename)
+{
+    map<string, GLuint>::iterator loaded = textureFiles.find(filename);
+    if(loaded != textureFiles.end())
+    {
+        return loaded->second;
+    }
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glState.activeTexture(0);
+    loadTexture(filename.c_str(), texture);
+    textureFiles[filename] = texture;
+    return texture;
+}
+
+// Adds an OBJ file to the scene the first time it is asked for, returns its mesh index
+int OpenGLWindow::loadMesh(const string& objFilename)
+{
+    map<string, int>::iterator loaded = meshFiles.find(objFilename);
+    if(loaded != meshFiles.end())
+    {
+        return loaded->second;
+    }
+    int mesh = scene.addMesh(objFilename.c_str());
+    meshFiles[objFilename] = mesh;
+    return mesh;
+}
+
+int OpenGLWindow::materialCount()
+{
+    return sceneFile.materials.size();
+}
+
+void OpenGLWindow::loadMaterial(int material)
+{
+    this->currentMaterial = material;
+    this->diffuseFilename = sceneFile.materials[material].diffuseFile.c_str();
+    this->normalFilename = sceneFile.materials[material].normalFile.c_str();
+
+    // NOTE: With the atlas every material is already resident, switching only changes the
+    //       region we sample from. Without it the images are decoded the first time a material
+    //       is used, switching back to it only binds its textures again
+    if(!useTextureAtlas)
+    {
+        diffuseMap = textureFile(diffuseFilename);
+        normalMap = textureFile(normalFilename);
+        glState.bindTexture(0, GL_TEXTURE_2D, diffuseMap);
+        glState.bindTexture(1, GL_TEXTURE_2D, normalMap);
+        glState.useProgram(shader.program.id);
+        shader.program.set(shader.ourTexture, 0);
+        shader.program.set(shader.ourTextureMap, 1);
+    }
+
+    if(useVirtualTexture && !openVirtualTexture())
+    {
+        useVirtualTexture = false;
+    }
+}
+
+// Replaces the extension of an image filename with the page file extension
+static string pageFilename(const char* imageFilename)
+{
+    string filename = imageFilename;
+    return filename.substr(0, filename.find_last_of('.')) + ".vtp";
+}
+
+bool OpenGLWindow::openVirtualTexture()
+{
+    // NOTE: Tiling is meant to be done offline (see --build-pages), but if the page files
+    //       don't exist yet we build them here so that every material can be viewed
+    string diffusePages = pageFilename(diffuseFilename);
+    string normalPages = pageFilename(normalFilename);
+    const char* images[2] = {diffuseFilename, normalFilename};
+    string pages[2] = {diffusePages, normalPages};
+    for(int i=0; i<2; i++)
+    {
+        FILE* existing = fopen(pages[i].c_str(), "rb");
+        if(existing)
+        {
+            fclose(existing);
+        }
+        else if(!VirtualTexture::buildPageFile(images[i], pages[i].c_str()))
+        {
+            return false;
+        }
+    }
+
+    // The regular diffuse/normal maps stay bound to texture units 0 and 1
+    vector<const char*> pageFilenames;
+    pageFilenames.push_back(diffusePages.c_str());
+    pageFilenames.push_back(normalPages.c_str());
+    return virtualTexture.open(pageFilenames, VIRTUAL_TEXTURE_UNIT);
+}
+
+// Opens the current material's virtual texture and checks that page uploads reach the caches
+bool OpenGLWindow::runVirtualTextureCheck()
+{
+    if(!virtualTexture.isOpen() && !openVirtualTexture())
+    {
+        return false;
+    }
+    bool passed = virtualTexture.checkPageUploads();
+    cout << "Virtual texture page uploads " << (passed ? "passed" : "failed") << endl;
+    return passed;
+}
+
+bool OpenGLWindow::isAnimating()
+{
+    return useVirtualTexture;
+}
+
+void OpenGLWindow::initGL(bool hidden, const char* sceneFilename)
 {
     // We need to first specify what type of OpenGL context we need before we can create the window
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
@@ -136,7 +311,7 @@ void OpenGLWindow::initGL()
 
     sdlWin = SDL_CreateWindow("OpenGL Prac 1",
                               SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                              640, 480, SDL_WINDOW_OPENGL);
+                              640, 480, SDL_WINDOW_OPENGL | (hidden ? SDL_WINDOW_HIDDEN : 0));
     if(!sdlWin)
     {
         SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "Error", "Unable to create window", 0);
@@ -164,309 +339,1077 @@ void OpenGLWindow::initGL()
     cout << "\tVersion: " << glGetString(GL_VERSION) << endl;
     cout << "\tGLSL Version: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
+    glState.enable(GL_DEPTH_TEST);
+    glState.enable(GL_CULL_FACE);
     glCullFace(GL_BACK);
     glClearColor(0,0,0,1);
 
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    this->extraImage = false;
+    this->showInstances = false;
+    this->lowLatency = false;
+    this->lastLatchTime = SDL_GetPerformanceCounter();
+    setWorkerThreads(thread::hardware_concurrency());
     
+    sceneFile.load(sceneFilename);
+    if((int)sceneFile.lights.size() > MAX_LIGHTS)
+    {
+        cout << "Scene " << sceneFile.filename << " has " << sceneFile.lights.size() << " lights, only the first "
+             << MAX_LIGHTS << " are used without clustered (F4) or deferred (F5) shading" << endl;
+    }
+    this->lightsRevision = 0;
+    this->uploadedLightsRevision = -1;
     resetVariables();
+    frameStats = FrameStats();
     // Note that this path is relative to your working directory
     // when running the program (IE if you run from within build
     // then you need to place these files in build as well)
-    shader = loadShaderProgram("simple.vert", "simple.frag");
-    glUseProgram(shader);
-
-    int vertexLoc = glGetAttribLocation(shader, "position");
-    int normalLoc = glGetAttribLocation(shader, "normal");
-    int textureLoc = glGetAttribLocation(shader, "texture");
-
-    int tangentLoc = 3;
-    glBindAttribLocation(shader,tangentLoc, "tangent");
-    int bitangentLoc = 4;
-    glBindAttribLocation(shader,bitangentLoc, "bitangent");
-
-
-    glGenTextures(2, textures);
-    glActiveTexture(GL_TEXTURE0);
-    diffuseMap = loadTexture("metal.jpg",textures[0]);
-    glActiveTexture(GL_TEXTURE1);
-    normalMap = loadTexture("metal_normal.jpg",textures[1]);
-    glUniform1i(glGetUniformLocation(shader, "ourTexture"), 0); 
-    glUniform1i(glGetUniformLocation(shader, "ourTextureMap"), 1); 
-
-    std::cout << textureLoc << " " << bitangentLoc << std::endl;
-    this->object = GeometryData();
-    object.GeometryData::loadFromOBJFile("objFiles/suzanne.obj");
-    //this->object2 = GeometryData();
-    //object2.GeometryData::loadFromOBJFile("objFiles/suzanne.obj");
-
-
-    glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, object.vertexCount()*sizeof(float)*3, object.vertexData(), GL_STATIC_DRAW);
-    glVertexAttribPointer(vertexLoc, 3, GL_FLOAT, false, 0, 0);
-    glEnableVertexAttribArray(vertexLoc);
-
-    //normal buffer
-    glGenBuffers(1, &normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, object.vertexCount()*sizeof(float)*3, object.normalData(), GL_STATIC_DRAW);
-    glVertexAttribPointer(normalLoc, 3, GL_FLOAT, false, 0, 0);
-    glEnableVertexAttribArray(normalLoc);
-
-    //binding textures
-    glGenBuffers(1, &textureBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, textureBuffer);
-    glBufferData(GL_ARRAY_BUFFER, object.vertexCount()*sizeof(float)*3, object.textureCoordData(), GL_STATIC_DRAW);
-    glVertexAttribPointer(textureLoc, 2, GL_FLOAT, false,0, (void*)(0 * sizeof(float)));
-    glEnableVertexAttribArray(textureLoc);
-
-    //binding tangent
-    glGenBuffers(1, &tangentBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-    glBufferData(GL_ARRAY_BUFFER, object.vertexCount()*sizeof(float)*3, object.tangentData(), GL_STATIC_DRAW);
-    glVertexAttribPointer(tangentLoc, 3, GL_FLOAT, false,0, (void*)(0 * sizeof(float)));
-    glEnableVertexAttribArray(tangentLoc);
-
-    //binding bitangent
-    glGenBuffers(1, &bitangentBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, bitangentBuffer);
-    glBufferData(GL_ARRAY_BUFFER, object.vertexCount()*sizeof(float)*3, object.bitangentData(), GL_STATIC_DRAW);
-    glVertexAttribPointer(bitangentLoc, 3, GL_FLOAT, false,0, (void*)(0 * sizeof(float)));
-    glEnableVertexAttribArray(bitangentLoc);
-
-
-    //glGenBuffers(1, &vertexBuffer2);
-    //glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer2);
-    //glBufferData(GL_ARRAY_BUFFER, object2.vertexCount()*sizeof(float)*3, object2.vertexData(), GL_STATIC_DRAW);
-    //glVertexAttribPointer(vertexLoc, 3, GL_FLOAT, false, 0, 0);
+    shader.load("simple.vert", "simple.frag");
+    glState.useProgram(shader.program.id);
+
+    virtualTextureShader.load("simple.vert", "simple.frag", "#define VIRTUAL_TEXTURE\n");
+    feedbackShader.load("simple.vert", "vtfeedback.frag");
+    atlasShader.load("simple.vert", "simple.frag", "#define TEXTURE_ATLAS\n");
+    this->useVirtualTexture = false;
+    this->useTextureAtlas = false;
+
+    uniformBlockShader.load("simple.vert", "simple.frag", "#define UNIFORM_BLOCKS\n");
+    uniformBlockShader.program.bindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+    uniformBlockShader.program.bindUniformBlock("Object", OBJECT_BLOCK_BINDING);
+    glState.useProgram(uniformBlockShader.program.id);
+    uniformBlockShader.program.set(uniformBlockShader.ourTexture, 0);
+    uniformBlockShader.program.set(uniformBlockShader.ourTextureMap, 1);
+    uniformRing.create(64*1024);
+    if(!uniformRing.isPersistent())
+    {
+        cout << "GL_ARB_buffer_storage not available, the uniform ring buffer is mapped every frame" << endl;
+    }
+    glGenBuffers(1, &lightsBuffer);
+    glState.bindBuffer(GL_UNIFORM_BUFFER, lightsBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightsBlock), NULL, GL_DYNAMIC_DRAW);
+    this->useUniformBlocks = false;
+    this->stressObjectCount = 0;
+
+    instancedShader.load("simple.vert", "simple.frag", "#define INSTANCED\n");
+    instancedAtlasShader.load("simple.vert", "simple.frag", "#define INSTANCED\n#define TEXTURE_ATLAS\n");
+    glState.useProgram(instancedShader.program.id);
+    instancedShader.program.set(instancedShader.ourTexture, 0);
+    instancedShader.program.set(instancedShader.ourTextureMap, 1);
+
+    clusteredShader.load("simple.vert", "simple.frag", "#define CLUSTERED\n");
+    instancedClusteredShader.load("simple.vert", "simple.frag", "#define INSTANCED\n#define CLUSTERED\n");
+    SimpleProgram* clusteredPrograms[2] = {&clusteredShader, &instancedClusteredShader};
+    for(int i=0; i<2; i++)
+    {
+        glState.useProgram(clusteredPrograms[i]->program.id);
+        clusteredPrograms[i]->program.set(clusteredPrograms[i]->ourTexture, 0);
+        clusteredPrograms[i]->program.set(clusteredPrograms[i]->ourTextureMap, 1);
+    }
+    clusteredLights.create();
+    this->useClusteredShading = false;
+
+    deferredShader.load("simple.vert", "simple.frag", "#define DEFERRED\n");
+    instancedDeferredShader.load("simple.vert", "simple.frag", "#define INSTANCED\n#define DEFERRED\n");
+    SimpleProgram* deferredPrograms[2] = {&deferredShader, &instancedDeferredShader};
+    for(int i=0; i<2; i++)
+    {
+        glState.useProgram(deferredPrograms[i]->program.id);
+        deferredPrograms[i]->program.set(deferredPrograms[i]->ourTexture, 0);
+        deferredPrograms[i]->program.set(deferredPrograms[i]->ourTextureMap, 1);
+    }
+    deferredLightShader.load("deferred.vert", "deferred.frag");
+    glState.useProgram(deferredLightShader.program.id);
+    deferredLightShader.program.set(deferredLightShader.program.uniformLocation("gAlbedo"), GBUFFER_FIRST_UNIT);
+    deferredLightShader.program.set(deferredLightShader.program.uniformLocation("gNormal"), GBUFFER_FIRST_UNIT + 1);
+    deferredLightShader.program.set(deferredLightShader.program.uniformLocation("gDepth"), GBUFFER_FIRST_UNIT + 2);
+    int drawableWidth, drawableHeight;
+    SDL_GL_GetDrawableSize(sdlWin, &drawableWidth, &drawableHeight);
+    gBuffer.create(GBUFFER_FIRST_UNIT, drawableWidth, drawableHeight);
+    this->useDeferredShading = false;
+
+    depthShader.load("simple.vert", "depth.frag", "#define DEPTH_ONLY\n");
+    instancedDepthShader.load("simple.vert", "depth.frag", "#define INSTANCED\n#define DEPTH_ONLY\n");
+    this->useDepthPrepass = false;
+    this->depthPrepassed = false;
+    pipelineStats.create();
+    if(!pipelineStats.isSupported())
+    {
+        cout << "GL_ARB_pipeline_statistics_query not available, no shader invocation counts" << endl;
+    }
+    this->useStaticBatching = false;
+    this->useBufferArena = false;
+    this->lastShared = glm::mat4(1.0f);
+
+    boundsShader.load("bounds.vert", "bounds.frag");
+    occlusionQueries.create();
+    this->useQueries = false;
+
+    loadMaterial(0);
+
+    // The model's OBJ file is parsed once, also when scene objects share it
+    this->modelMesh = loadMesh(sceneFile.meshFiles[sceneFile.model]);
+    this->object = scene.geometry(modelMesh);
+    objectMesh.upload(object);
+    populateScene();
+    glState.bindVertexArray(objectMesh.vao);
+
     glPrintError("Setup complete", true);
 }
 
 void OpenGLWindow::render()
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  
-
-    int colorLoc = glGetUniformLocation(shader, "objectColor");
-    glUniform3f(colorLoc,r,g,b);
-    int lightColorLoc = glGetUniformLocation(shader, "lightColor");
-    glUniform3f(lightColorLoc,1.0f, 0.0f, 0.0f);
-
-    int lightColorLoc2 = glGetUniformLocation(shader, "lightColor2");
-    glUniform3f(lightColorLoc2,0.0f, 0.0f, 1.0f);
-
-    int lightPos = glGetUniformLocation(shader, "lightPos");
-    glUniform3f(lightPos,lightx,lighty,lightz);
-
-    int lightPos2 = glGetUniformLocation(shader, "lightPos2");
-    glUniform3f(lightPos2,lightx2,lighty2,lightz2);
-    //glUniform3f(lightPos2,lightx2,lighty2,lightz2);
-
-    int ambient = glGetUniformLocation(shader, "ambientStrength");
-    glUniform1f(ambient, 0.1f);
-
-    int viewPos = glGetUniformLocation(shader, "viewPos");
-    glUniform3fv(viewPos,1,&cameraPos[0]);
-
-    glUniform1i(glGetUniformLocation(shader, "addNormalMap"), addNormalMap);
-
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::rotate(model, glm::radians(this->pan), rotateDirection); 
-    unsigned int modelLoc = glGetUniformLocation(shader, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, &model[0][0]);
-
-    float radius = 10.0f;
-    glm::mat4 view = glm::mat4(1.0f);
-    // note that we're translating the scene in the reverse direction of where we want to move
-    view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-
-    glm::mat4 projection;
-    projection = glm::perspective(glm::radians(this->radian), 800.0f / 600.0f, 0.1f, 100.0f); //change distance from camera
-
-    //matrix to do a translation
-    glm::mat4 trans = glm::mat4(1.0f);
-    trans = glm::translate(trans, glm::vec3(transx,transy,transz)); //x,y,z
-    //x y z matrics to do rotations
-    glm::mat4 rotatex = glm::mat4(1.0f);
-    rotatex = glm::rotate(rotatex,glm::radians(this->rx),glm::vec3(1.0f,0.0f,0.0f));
-    glm::mat4 rotatey = glm::mat4(1.0f);
-    rotatey = glm::rotate(rotatey,glm::radians(this->ry),glm::vec3(0.0f,1.0f,0.0f));
-    glm::mat4 rotatez = glm::mat4(1.0f);
-    rotatez = glm::rotate(rotatez,glm::radians(this->rz),glm::vec3(0.0f,0.0f,1.0f));
-    //matrix to do scaling
-    glm::mat4 scale = glm::mat4(1.0f);
-    scale = glm::scale(scale,glm::vec3(s,s,s));
-   
-    glm::mat4 MVP = projection * view * model;  
-
-    MVP = MVP*trans * rotatex * rotatey * rotatez * scale;  
-    unsigned int MVPLoc = glGetUniformLocation(shader, "mvp");
-    glUniformMatrix4fv(MVPLoc, 1, GL_FALSE, &MVP[0][0]);
-
-    glm::mat4 transform = trans * rotatex * rotatey * rotatez * scale;
-    unsigned int transLoc = glGetUniformLocation(shader, "trans");
-    glUniformMatrix4fv(transLoc, 1, GL_FALSE, &transform[0][0]);
-
-    // Swap the front and back buffers on the window, effectively putting what we just "drew"
-    // onto the screen (whereas previously it only existed in memory)
-    glDrawArrays(GL_TRIANGLES, 0, object.vertexCount());
-
-        //drawing the second object
-
-    glm::mat4 trans2 = glm::mat4(1.0f);
-    trans2 = glm::translate(trans2, glm::vec3(2.0f,0.0f,0.0f)); //x,y,z
-    glUniform3f(colorLoc,1.0f,1.0f,1.0f);
-    glUniform1f(ambient, 1.0f);
-    MVP = MVP * trans2; 
-    MVPLoc = glGetUniformLocation(shader, "mvp");
-
-   // if (extraImage == 1){
-   //  glUniformMatrix4fv(MVPLoc, 1, GL_FALSE, &MVP[0][0]);
-   //  }
-   //  glDrawArrays(GL_TRIANGLES, 0, object2.vertexCount());
-
-
-     SDL_GL_SwapWindow(sdlWin);
-    
-}
+    Uint64 frameStart = SDL_GetPerformanceCounter();
+
+    // NOTE: In the low latency mode the GPU is allowed to fall at most maxFramesInFlight frames
+    //       behind, and the movement keys are sampled only after that wait, right before the
+    //       matrices are built
+    frameStats.frameQueueWaitMs = 0.0;
+    frameStats.latchedInputTicks = 0;
+    if(lowLatency)
+    {
+        frameStats.frameQueueWaitMs = frameQueue.waitForSlot();
+        latchInput();
+    }
+    frameStats.latchTicks = SDL_GetTicks();
+
+    // NOTE: The uniform block, clustered and deferred variants only cover the regular textures.
+    //       Deferred shading takes precedence over clustered, which takes it over uniform blocks
+    bool deferred = useDeferredShading && !useVirtualTexture && !useTextureAtlas;
+    bool clustered = useClusteredShading && !useVirtualTexture && !useTextureAtlas && !deferred;
+    bool uniformBlocks = useUniformBlocks && !useVirtualTexture && !useTextureAtlas && !clustered && !deferred;
+    // NOTE: The instances share one light list, picked around all of them, which only holds every
+    //       light that can reach them while there are no more than MAX_OBJECT_LIGHTS. Past that
+    //       they go through the clusters, so each fragment gets the lights around it rather than
+    //       those nearest the middle of the grid
+    bool clusteredInstances = showInstances && !useTextureAtlas &&
+                              (useClusteredShading || ((int)lights.size() > MAX_OBJECT_LIGHTS));
+    SimpleProgram* program = &shader;
+    if(useVirtualTexture)
+    {
+        program = &virtualTextureShader;
+    }
+    else if(useTextureAtlas)
+    {
+        program = &atlasShader;
+    }
+    else if(deferred)
+    {
+        program = &deferredShader;
+    }
+    else if(clustered)
+    {
+        program = &clusteredShader;
+    }
+    else if(uniformBlocks)
+    {
+        program = &uniformBlockShader;
+    }
+    glState.useProgram(program->program.id);
+    glState.bindVertexArray(objectMesh.vao);
+    // The scene objects bind their own materials to these units
+    glState.bindTexture(0, GL_TEXTURE_2D, diffuseMap);
+    glState.bindTexture(1, GL_TEXTURE_2D, normalMap);
 
+    if(useVirtualTexture)
+    {
+        virtualTexture.update();
+        virtualTexture.bind(program->program, program->virtualTexture);
+    }
+    else if(useTextureAtlas)
+    {
+        textureAtlas.bind(currentMaterial, ATLAS_DIFFUSE_UNIT, ATLAS_NORMAL_UNIT);
+        program->program.set(program->ourTexture, ATLAS_DIFFUSE_UNIT);
+        program->program.set(program->ourTextureMap, ATLAS_NORMAL_UNIT);
+        program->program.set(program->atlasRegion, textureAtlas.entry(currentMaterial).uvScaleOffset);
+    }
 
-void OpenGLWindow::resetVariables(){
-    this->radian = 45.0f;
-    this->r = 1.0f;
-    this->g = 1.0f;
-    this->b = 1.0f;
-    this->transx = 0.0f;
-    this->transy = 0.0f;
-    this->transz = 0.0f;
-    this->lightx = 2.0f;
-    this->lighty = 2.0f;
-    this->lightz = 2.0f;
-    this->lightx2 = -2.0f;
-    this->lighty2 = 2.0f;
-    this->lightz2 = 2.0f;
-    this->pan = 0.0f;
-    this-> rx = 0.0f;
-    this-> ry = 0.0f;
-    this-> rz = 0.0f;
-    this-> s = 1.0f;
-    this-> textureCount = 1;
-    this->addNormalMap = false;
-    
-    cameraPos   = glm::vec3(0.0f, 0.0f,  5.0f);
-    cameraFront = glm::vec3(0.0f, 0.0f, -3.0f);
-    cameraUp    = glm::vec3(0.0f, 1.0f,  0.0f);
-    rotateDirection = glm::vec3(1.0f, 0.0f, 0.0f);
+    // The geometry goes into the G-buffer, shadeDeferred() lights it into the window
+    if(deferred)
+    {
+        int width, height;
+        SDL_GL_GetDrawableSize(sdlWin, &width, &height);
+        gBuffer.resize(width, height);
+        gBuffer.begin();
+    }
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-}
-// The program will exit if this function returns false
-bool OpenGLWindow::handleEvent(SDL_Event e)
-{
-    // A list of keycode constants is available here: https://wiki.libsdl.org/SDL_Keycode
-    // Note that SDL provides both Scancodes (which correspond to physical positions on the keyboard)
-    // and Keycodes (which correspond to symbols on the keyboard, and might differ across layouts)
-    if(e.type == SDL_KEYDOWN)
+    // Only the matrices whose inputs changed since the last frame are rebuilt
+    transforms.setCamera(cameraPos, cameraFront, cameraUp);
+    transforms.setProjection(this->radian, 800.0f / 600.0f, NEAR_PLANE, FAR_PLANE); //change distance from camera
+    transforms.setModel(this->pan, rotateDirection);
+    transforms.setObject(glm::vec3(transx,transy,transz), glm::vec3(rx,ry,rz), s);
+    const glm::mat4& model = transforms.model();
+    const glm::mat4& view = transforms.view();
+    const glm::mat4& projection = transforms.projection();
+    const glm::mat4& transform = transforms.transform();
+    const glm::mat4& viewModel = transforms.viewModel();
+    const glm::mat4& MVP = transforms.mvp();
+    unsigned int changes = transforms.takeChanges();
+
+    if((int)objectOffsets.size() != stressObjectCount + 1)
     {
-        if(e.key.keysym.sym == SDLK_ESCAPE)
+        buildObjectOffsets(stressObjectCount, objectOffsets);
+        changes |= OBJECT_CHANGED;
+    }
+    int objectCount = objectOffsets.size();
+    frameStats.matrixRebuilds = transforms.rebuildCount;
+    transforms.rebuildCount = 0;
+    if(changes & OBJECT_CHANGED)
+    {
+        objectTransforms.resize(objectCount);
+        for(int i=0; i<objectCount; i++)
         {
-            return false;
+            objectTransforms[i] = objectOffsets[i] * transform;
         }
+        frameStats.matrixRebuilds += objectCount;
+    }
+    if(changes)
+    {
+        objectMvps.resize(objectCount);
+        for(int i=0; i<objectCount; i++)
+        {
+            objectMvps[i] = viewModel * objectTransforms[i];
+        }
+        frameStats.matrixRebuilds += objectCount;
     }
-    return true;
-}
 
+    // NOTE: The shaders light the vertices before the model matrix in front of the view is
+    //       applied, the camera is taken back into that space
+    lightingViewPos = glm::vec3(glm::inverse(model) * glm::vec4(cameraPos, 1.0f));
+    updateLights(changes, model, transform);
+    if(useClusteredShading || deferred || clusteredInstances)
+    {
+        // The lights are in the space the model matrix takes to the world
+        clusteredLights.build(lights, view * model, projection, NEAR_PLANE, FAR_PLANE);
+        clusteredLights.upload();
+    }
+    if(!uniformBlocks)
+    {
+        setSharedUniforms(program);
+    }
+    if(clustered)
+    {
+        bindClusters(program);
+    }
+    frameStats.drawCalls = 0;
+    frameStats.lightsShaded = 0;
+    frameStats.uniformWaitMs = 0.0;
 
+    // The scene objects' commands are built up front, the pre-pass draws them too
+    updateStaticBatches(transform * model);
+    if(scene.objectCount() > 0)
+    {
+        buildSceneObjects(model, viewModel, transform);
+    }
+    frameStats.prepassDraws = 0;
+    depthPrepassed = useDepthPrepass;
+    if(depthPrepassed)
+    {
+        drawDepthPrepass(model, viewModel, transform);
+        glState.useProgram(program->program.id);
+        glState.bindVertexArray(objectMesh.vao);
+    }
+    // Counts what the shading passes cost, the pre-pass left out
+    pipelineStats.begin();
 
+    if(uniformBlocks)
+    {
+        // Every block of the frame is written into the ring buffer up front, the draws then only
+        // select their range of it
+        size_t frameBytes = uniformRing.alignedSize(sizeof(CameraBlock))
+                          + objectCount*uniformRing.alignedSize(sizeof(ObjectBlock));
+        uniformRing.reserve(frameBytes);
+        uniformRing.begin();
+        frameStats.uniformWaitMs = uniformRing.lastWaitMs;
+
+        CameraBlock camera;
+        camera.view = view;
+        camera.projection = projection;
+        camera.viewPos = lightingViewPos;
+        GLintptr cameraBlock = uniformRing.push(&camera, sizeof(camera));
+
+        ObjectBlock block;
+        block.model = model;
+        block.objectColor = glm::vec3(r,g,b);
+        block.addNormalMap = addNormalMap;
+        block.atlasRegion = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+        objectBlocks.resize(objectCount);
+        for(int i=0; i<objectCount; i++)
+        {
+            block.trans = objectTransforms[i];
+            block.mvp = objectMvps[i];
+            memcpy(block.objectLights, objectLights[i].indices, sizeof(block.objectLights));
+            block.objectLightCount = objectLights[i].count;
+            objectBlocks[i] = uniformRing.push(&block, sizeof(block));
+        }
+        uniformRing.flush();
 
-void OpenGLWindow::handleCameraMovementEvent(SDL_Event e){
+        uniformRing.bindRange(CAMERA_BLOCK_BINDING, cameraBlock, sizeof(CameraBlock));
+        for(int i=0; i<objectCount; i++)
+        {
+            uniformRing.bindRange(OBJECT_BLOCK_BINDING, objectBlocks[i], sizeof(ObjectBlock));
+            glDrawArrays(GL_TRIANGLES, 0, object.vertexCount());
+            frameStats.drawCalls++;
+            frameStats.lightsShaded += objectLights[i].count;
+        }
+        uniformRing.end();
+    }
+    else
+    {
+        // NOTE: When nothing moved the setters find the same values as last frame and skip the
+        //       uploads (for the single object, the stress test copies share one location)
+        program->program.set(program->model, model);
+        for(int i=0; i<objectCount; i++)
+        {
+            program->program.set(program->mvp, objectMvps[i]);
+            program->program.set(program->trans, objectTransforms[i]);
+            setObjectLights(program, objectLights[i]);
+            glDrawArrays(GL_TRIANGLES, 0, object.vertexCount());
+            frameStats.drawCalls++;
+            frameStats.lightsShaded += objectLights[i].count;
+        }
+    }
 
-    if(e.type == SDL_KEYDOWN){
-        switch (e.key.keysym.sym){
-            case SDLK_q: //Move camera to the left
-                cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-                return;
-            case SDLK_e: //Move camera to the right
-                cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-                return;
-            case SDLK_w: //Rotate camera about the y axis 
-                rotateDirection = glm::vec3(1.0f, 0.0f, 0.0f);
-                pan += 1.0f;
-                return;
-            case SDLK_s: //Rotate camera about the y axis down
-                rotateDirection = glm::vec3(1.0f, 0.0f, 0.0f);
-                pan -= 1.0f;
-                return;
-            case SDLK_d: //Rotate camera about the object to the left
-                rotateDirection = glm::vec3(0.0f, 1.0f, 0.0f);
-                pan += 1.0f;
-                return;
-            case SDLK_a: //Rotate camera about the object to the left
-                rotateDirection = glm::vec3(0.0f, 1.0f, 0.0f);
-                pan -= 1.0f;
-                return;
-         }
-      }
-} 
+    // The instances of the scene share the object's transform, each placed by its own matrix
+    frameStats.instancesDrawn = 0;
+    if(showInstances)
+    {
+        SimpleProgram* instanced = &instancedShader;
+        if(useTextureAtlas)
+        {
+            instanced = &instancedAtlasShader;
+        }
+        else if(deferred)
+        {
+            instanced = &instancedDeferredShader;
+        }
+        else if(clusteredInstances)
+        {
+            instanced = &instancedClusteredShader;
+        }
+        glState.useProgram(instanced->program.id);
+        setSharedUniforms(instanced);
+        if(instanced == &instancedClusteredShader)
+        {
+            bindClusters(instanced);
+        }
+        if(useTextureAtlas)
+        {
+            // NOTE: Every material is expected on the same page, which holds for the 5 1024^2
+            //       material pairs in a 4096^2 page. Materials past the array size aren't passed
+            instanced->program.set(instanced->ourTexture, ATLAS_DIFFUSE_UNIT);
+            instanced->program.set(instanced->ourTextureMap, ATLAS_NORMAL_UNIT);
+            int regionCount = min(materialCount(), MAX_INSTANCE_MATERIALS);
+            glm::vec4 regions[MAX_INSTANCE_MATERIALS];
+            for(int i=0; i<regionCount; i++)
+            {
+                regions[i] = textureAtlas.entry(i).uvScaleOffset;
+            }
+            instanced->program.set(instanced->atlasRegions, regions, regionCount);
+        }
+        instanced->program.set(instanced->model, model);
+        instanced->program.set(instanced->mvp, viewModel);
+        instanced->program.set(instanced->trans, transform);
+        setObjectLights(instanced, instanceLights);
+        scene.draw();
+        frameStats.drawCalls += scene.drawCalls;
+        frameStats.lightsShaded += scene.drawCalls * instanceLights.count;
+        frameStats.instancesDrawn = scene.instanceCount();
+
+        glState.bindVertexArray(objectMesh.vao);
+        glState.useProgram(program->program.id);
+    }
 
-void OpenGLWindow::handleColorEvent(SDL_Event e){
+    frameStats.sceneObjectsDrawn = 0;
+    if(scene.objectCount() > 0)
+    {
+        // The scene objects always use the regular textures, see loadMaterialTextures()
+        SimpleProgram* objectShader = &shader;
+        if(deferred)
+        {
+            objectShader = &deferredShader;
+        }
+        else if(useClusteredShading)
+        {
+            objectShader = &clusteredShader;
+        }
+        drawSceneObjects(objectShader, model);
+        glState.bindVertexArray(objectMesh.vao);
+        glState.useProgram(program->program.id);
+        glState.bindTexture(0, GL_TEXTURE_2D, diffuseMap);
+        glState.bindTexture(1, GL_TEXTURE_2D, normalMap);
+    }
+    if(depthPrepassed)
+    {
+        setDepthEqual(false);
+    }
 
-    if(e.type == SDL_KEYDOWN){
-        switch (e.key.keysym.sym){
-            case SDLK_z: //color one
-                r = 0.5f;
-                g = 0.0f;
-                b = 0.0f; 
-                return;
-            case SDLK_x: //color two
-                r = 0.1f;
-                g = 0.5f;
-                b = 0.0f;
-                return;
-            case SDLK_c: //color three
-                r = 0.5f;
-                g = 0.0f;
-                b = 0.5f; 
-                return;
-            }
+    // The feedback pass draws the same geometry into a small offscreen buffer, recording which
+    // virtual texture pages were needed so they can be streamed in for the next frames
+    if(useVirtualTexture)
+    {
+        glState.useProgram(feedbackShader.program.id);
+        virtualTexture.beginFeedback();
+        virtualTexture.setFeedbackUniforms(feedbackShader.program, feedbackShader.virtualTexture);
+        feedbackShader.program.set(feedbackShader.model, model);
+        feedbackShader.program.set(feedbackShader.mvp, MVP);
+        feedbackShader.program.set(feedbackShader.trans, transform);
+        glDrawArrays(GL_TRIANGLES, 0, object.vertexCount());
+        virtualTexture.endFeedback();
+        glState.useProgram(program->program.id);
+    }
+
+    if(deferred)
+    {
+        shadeDeferred(viewModel);
+    }
+    pipelineStats.end();
+
+    frameStats.stateCallsIssued = glState.issuedCount;
+    frameStats.stateCallsFiltered = glState.filteredCount;
+    glState.resetCounters();
+
+    // Collect this frame's uniform traffic over every program
+    SimpleProgram* programs[14] = {&shader, &virtualTextureShader, &feedbackShader, &atlasShader,
+                                   &uniformBlockShader, &instancedShader, &instancedAtlasShader,
+                                   &clusteredShader, &instancedClusteredShader, &deferredShader,
+                                   &instancedDeferredShader, &deferredLightShader, &depthShader,
+                                   &instancedDepthShader};
+    frameStats.uniformUploads = 0;
+    frameStats.uniformsSkipped = 0;
+    for(int i=0; i<14; i++)
+    {
+        frameStats.uniformUploads += programs[i]->program.uploadCount;
+        frameStats.uniformsSkipped += programs[i]->program.skippedCount;
+        programs[i]->program.uploadCount = 0;
+        programs[i]->program.skippedCount = 0;
+    }
+    frameStats.submitMs = (SDL_GetPerformanceCounter() - frameStart) * 1000.0 / SDL_GetPerformanceFrequency();
 
+     SDL_GL_SwapWindow(sdlWin);
+    if(lowLatency)
+    {
+        frameQueue.frameSubmitted();
     }
 
 }
 
-void OpenGLWindow::handleObjectTranslationEvent(SDL_Event e){
 
-    if(e.type == SDL_KEYDOWN){
-        switch (e.key.keysym.sym){
-            case SDLK_h: //move up y axis
-                transy += 0.1f;
-                return;
-            case SDLK_n: //move down y axis
-                transy -= 0.1f;
-                return;
-            case SDLK_m: //move left x axis
-                transx += 0.1f;
-                return;
-            case SDLK_b: //move right x axis
-                transx -= 0.1f;
-                return;
-            case SDLK_g: //move out z axis
-                transz -= 0.1f;
-                return;
-            case SDLK_j: //move in z axis
-                transz += 0.1f;
-                return;
-            }
+// Applies the held movement keys, the same steps the key handlers take per key repeat
+void OpenGLWindow::latchInput()
+{
+    // Repeat events come in at roughly this rate, held keys move as fast as with the handlers
+    const float KEY_REPEAT_RATE = 30.0f;
 
-    }
+    SDL_PumpEvents();
+    const Uint8* keys = SDL_GetKeyboardState(NULL);
 
-}
+    // Key presses still in the queue are already part of this frame, for the latency stats
+    SDL_Event pending;
+    if(SDL_PeepEvents(&pending, 1, SDL_PEEKEVENT, SDL_KEYDOWN, SDL_KEYDOWN) > 0)
+    {
+        frameStats.latchedInputTicks = pending.key.timestamp;
+    }
 
-void OpenGLWindow::handleObjectRotationEvent(SDL_Event e){
+    Uint64 now = SDL_GetPerformanceCounter();
+    float steps = (now - lastLatchTime) * KEY_REPEAT_RATE / SDL_GetPerformanceFrequency();
+    steps = (steps > 3.0f) ? 3.0f : steps; // Don't jump after a stall
+    lastLatchTime = now;
+
+    glm::vec3 right = glm::normalize(glm::cross(cameraFront, cameraUp));
+    if(keys[SDL_SCANCODE_Q])
+    {
+        cameraPos -= right * cameraSpeed * steps;
+    }
+    if(keys[SDL_SCANCODE_E])
+    {
+        cameraPos += right * cameraSpeed * steps;
+    }
+    if(keys[SDL_SCANCODE_I])
+    {
+        cameraPos += cameraSpeed * cameraFront * steps;
+    }
+    if(keys[SDL_SCANCODE_O])
+    {
+        cameraPos -= cameraSpeed * cameraFront * steps;
+    }
+    if(keys[SDL_SCANCODE_W] || keys[SDL_SCANCODE_S])
+    {
+        rotateDirection = glm::vec3(1.0f, 0.0f, 0.0f);
+        pan += (keys[SDL_SCANCODE_W] ? steps : -steps);
+    }
+    if(keys[SDL_SCANCODE_D] || keys[SDL_SCANCODE_A])
+    {
+        rotateDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+        pan += (keys[SDL_SCANCODE_D] ? steps : -steps);
+    }
+    if(keys[SDL_SCANCODE_RIGHT])
+    {
+        ry += 0.4f * steps;
+    }
+    if(keys[SDL_SCANCODE_DOWN])
+    {
+        rx += 0.4f * steps;
+    }
+    if(keys[SDL_SCANCODE_LEFT])
+    {
+        rz += 0.4f * steps;
+    }
+    if(keys[SDL_SCANCODE_Y])
+    {
+        s += 0.2f * steps;
+    }
+    if(keys[SDL_SCANCODE_U])
+    {
+        s -= 0.2f * steps;
+    }
+}
+
+void OpenGLWindow::loadMaterialTextures()
+{
+    materialTextures.resize(2*materialCount());
+    for(int i=0; i<materialCount(); i++)
+    {
+        materialTextures[2*i] = textureFile(sceneFile.materials[i].diffuseFile);
+        materialTextures[2*i + 1] = textureFile(sceneFile.materials[i].normalFile);
+    }
+}
+
+// Creates the scene file's objects and instances, loading every mesh they use once
+void OpenGLWindow::populateScene()
+{
+    for(size_t i=0; i<sceneFile.placements.size(); i++)
+    {
+        const ScenePlacement& placement = sceneFile.placements[i];
+        int mesh = loadMesh(sceneFile.meshFiles[placement.mesh]);
+        if(placement.instanced)
+        {
+            scene.addInstance(mesh, placement.transform, placement.material);
+        }
+        else
+        {
+            int object = scene.addObject(mesh, placement.transform, placement.material);
+            scene.setOccluder(object, placement.occluder);
+            scene.setStatic(object, placement.isStatic);
+        }
+    }
+    // The grids fill one stress test grid one after the other, so they don't overlap
+    int gridCount = 0;
+    for(size_t i=0; i<sceneFile.grids.size(); i++)
+    {
+        gridCount += sceneFile.grids[i].count;
+    }
+    vector<glm::mat4> offsets;
+    buildObjectOffsets(gridCount, offsets);
+    int offset = 1;
+    for(size_t i=0; i<sceneFile.grids.size(); i++)
+    {
+        const SceneGrid& grid = sceneFile.grids[i];
+        int mesh = loadMesh(sceneFile.meshFiles[grid.mesh]);
+        for(int copy=0; copy<grid.count; copy++, offset++)
+        {
+            int material = (grid.material >= 0) ? grid.material : copy % materialCount();
+            if(grid.instanced)
+            {
+                scene.addInstance(mesh, offsets[offset], material);
+            }
+            else
+            {
+                scene.setStatic(scene.addObject(mesh, offsets[offset], material), grid.isStatic);
+            }
+        }
+    }
+    this->showInstances = (scene.instanceCount() > 0);
+
+    cout << "Scene " << sceneFile.filename << ": " << scene.meshCount() << " meshes, " << materialCount()
+         << " materials, " << scene.objectCount() << " objects, " << scene.instanceCount() << " instances" << endl;
+}
+
+// Applies or reverts the static batches as F7 asks. Batches baked for another transform are
+// reverted while it keeps changing and baked again once it's held still for a frame, so moving the
+// model doesn't rebuild them every frame
+void OpenGLWindow::updateStaticBatches(const glm::mat4& shared)
+{
+    bool settled = (shared == lastShared);
+    lastShared = shared;
+    bool changed = false;
+    if(useStaticBatching && (!staticBatches.isApplied() || staticBatches.isStale(scene, shared)))
+    {
+        if(settled && (scene.objectCount() > 0))
+        {
+            staticBatches.apply(scene, shared);
+            changed = true;
+        }
+        else if(staticBatches.isApplied())
+        {
+            staticBatches.revert(scene);
+            changed = true;
+        }
+    }
+    else if(!useStaticBatching && staticBatches.isApplied())
+    {
+        staticBatches.revert(scene);
+        changed = true;
+    }
+    // The picker's triangle BVHs are of the meshes the batches replaced
+    if(changed)
+    {
+        picker.clear();
+    }
+}
+
+// NOTE: The depth pre-pass. Everything the frame draws is drawn once beforehand with colour writes
+//       off, from the positions alone and with a fragment shader that does nothing, and the draws
+//       that follow only shade the fragments whose depth equals the nearest. The bump mapped
+//       shading then runs once a pixel whatever the overdraw, for transforming every vertex twice.
+//
+//       Objects drawn conditionally on an occlusion query are left out, the pre-pass can't know
+//       whether the query lets them through. Those are drawn with the regular depth test
+void OpenGLWindow::drawDepthPrepass(const glm::mat4& model, const glm::mat4& viewModel, const glm::mat4& transform)
+{
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glState.useProgram(depthShader.program.id);
+    depthShader.program.set(depthShader.model, model);
+    glState.bindVertexArray(objectMesh.depthVao);
+    for(size_t i=0; i<objectMvps.size(); i++)
+    {
+        depthShader.program.set(depthShader.mvp, objectMvps[i]);
+        depthShader.program.set(depthShader.trans, objectTransforms[i]);
+        glDrawArrays(GL_TRIANGLES, 0, object.vertexCount());
+        frameStats.prepassDraws++;
+    }
+
+    if(showInstances)
+    {
+        glState.useProgram(instancedDepthShader.program.id);
+        instancedDepthShader.program.set(instancedDepthShader.model, model);
+        instancedDepthShader.program.set(instancedDepthShader.mvp, viewModel);
+        instancedDepthShader.program.set(instancedDepthShader.trans, transform);
+        scene.draw(true);
+        frameStats.prepassDraws += scene.drawCalls;
+        glState.useProgram(depthShader.program.id);
+    }
+
+    // The render queue is only built when there are scene objects
+    int commandCount = (scene.objectCount() > 0) ? renderQueue.size() : 0;
+    if(useBufferArena)
+    {
+        glState.bindVertexArray(scene.bufferArena().depthVertexArray());
+    }
+    for(int i=0; i<commandCount; i++)
+    {
+        const DrawCommand& command = renderQueue[i];
+        int mesh = renderQueue.keyMesh(command.key);
+        if(useQueries && (scene.meshVertexCount(mesh) >= occlusionQueries.minVertexCount))
+        {
+            continue;
+        }
+        depthShader.program.set(depthShader.trans, drawList.objectTransform(command.object));
+        depthShader.program.set(depthShader.mvp, drawList.objectMvp(command.object));
+        if(useBufferArena)
+        {
+            scene.bufferArena().draw(scene.meshArenaHandle(mesh));
+        }
+        else
+        {
+            glState.bindVertexArray(scene.meshDepthVertexArray(mesh));
+            glDrawArrays(GL_TRIANGLES, 0, scene.meshVertexCount(mesh));
+        }
+        frameStats.prepassDraws++;
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    setDepthEqual(true);
+}
+
+// Between the pre-pass and the end of the frame's draws fragments only pass where their depth is
+// the pre-pass's, which is left as it is
+void OpenGLWindow::setDepthEqual(bool equal)
+{
+    glDepthFunc(equal ? GL_EQUAL : GL_LESS);
+    glDepthMask(equal ? GL_FALSE : GL_TRUE);
+}
+
+// Culls the scene objects and queues the visible ones with a key of their material, mesh and distance
+void OpenGLWindow::buildSceneObjects(const glm::mat4& model, const glm::mat4& viewModel, const glm::mat4& transform)
+{
+    if(materialTextures.empty())
+    {
+        loadMaterialTextures();
+    }
+
+    scene.updateTransforms();
+    frameStats.graphNodesUpdated = scene.graph().lastUpdatedCount;
+    frameStats.graphUpdateMs = scene.graph().lastUpdateMs;
+    drawList.build(scene, scene.meshBounds(), model, viewModel, transform, cameraPos, renderQueue);
+    renderQueue.sort();
+}
+
+// Draws the queued scene objects in the order of their keys, binding only what differs from the
+// previous draw
+void OpenGLWindow::drawSceneObjects(SimpleProgram* objectShader, const glm::mat4& model)
+{
+    glState.useProgram(objectShader->program.id);
+    setSharedUniforms(objectShader);
+    if(objectShader == &clusteredShader)
+    {
+        bindClusters(objectShader);
+    }
+    objectShader->program.set(objectShader->model, model);
+    if(useQueries)
+    {
+        occlusionQueries.resize(scene.objectCount());
+        occlusionQueries.collect();
+    }
+    int boundMaterial = -1;
+    int boundMesh = -1;
+    frameStats.materialSwitches = 0;
+    frameStats.meshSwitches = 0;
+    frameStats.vertexArrayBinds = 0;
+    // From the arena every mesh is drawn with the same vertex array, a mesh switch binds nothing
+    if(useBufferArena)
+    {
+        glState.bindVertexArray(scene.bufferArena().vertexArray());
+        frameStats.vertexArrayBinds++;
+    }
+    for(int i=0; i<renderQueue.size(); i++)
+    {
+        const DrawCommand& command = renderQueue[i];
+        int material = renderQueue.keyMaterial(command.key);
+        int mesh = renderQueue.keyMesh(command.key);
+        if(material != boundMaterial)
+        {
+            glState.bindTexture(0, GL_TEXTURE_2D, materialTextures[2*material]);
+            glState.bindTexture(1, GL_TEXTURE_2D, materialTextures[2*material + 1]);
+            boundMaterial = material;
+            frameStats.materialSwitches++;
+        }
+        if(mesh != boundMesh)
+        {
+            if(!useBufferArena)
+            {
+                glState.bindVertexArray(scene.meshVertexArray(mesh));
+                frameStats.vertexArrayBinds++;
+            }
+            boundMesh = mesh;
+            frameStats.meshSwitches++;
+        }
+
+        objectShader->program.set(objectShader->trans, drawList.objectTransform(command.object));
+        objectShader->program.set(objectShader->mvp, drawList.objectMvp(command.object));
+        setObjectLights(objectShader, drawList.objectLights(command.object));
+        frameStats.lightsShaded += drawList.objectLights(command.object).count;
+        bool queried = useQueries && (scene.meshVertexCount(mesh) >= occlusionQueries.minVertexCount);
+        if(queried)
+        {
+            // Not in the pre-pass, see drawDepthPrepass()
+            if(depthPrepassed)
+            {
+                setDepthEqual(false);
+            }
+            occlusionQueries.beginDraw(command.object);
+        }
+        if(useBufferArena)
+        {
+            scene.bufferArena().draw(scene.meshArenaHandle(mesh));
+        }
+        else
+        {
+            glDrawArrays(GL_TRIANGLES, 0, scene.meshVertexCount(mesh));
+        }
+        if(queried)
+        {
+            occlusionQueries.endDraw();
+            if(depthPrepassed)
+            {
+                setDepthEqual(true);
+            }
+        }
+    }
+
+    // With the whole frame's depth in place, the boxes of the large objects are tested against it
+    // for the next frame to draw them conditionally
+    frameStats.conditionalDraws = 0;
+    frameStats.queriesIssued = 0;
+    if(useQueries)
+    {
+        if(depthPrepassed)
+        {
+            setDepthEqual(false);
+        }
+        const vector<Bounds>& meshBounds = scene.meshBounds();
+        occlusionQueries.beginQueries(boundsShader.program, boundsShader.mvp);
+        for(int i=0; i<renderQueue.size(); i++)
+        {
+            const DrawCommand& command = renderQueue[i];
+            int mesh = renderQueue.keyMesh(command.key);
+            if(scene.meshVertexCount(mesh) < occlusionQueries.minVertexCount)
+            {
+                continue;
+            }
+            const Bounds& bounds = meshBounds[mesh];
+            glm::mat4 box = glm::translate(model, bounds.min);
+            box = glm::scale(box, bounds.max - bounds.min);
+            occlusionQueries.query(command.object, drawList.objectMvp(command.object) * box);
+        }
+        occlusionQueries.endQueries();
+        frameStats.conditionalDraws = occlusionQueries.conditionalDraws;
+        frameStats.queriesIssued = occlusionQueries.queriesIssued;
+        frameStats.queryResultsRead = occlusionQueries.resultsRead;
+        frameStats.queryResultsHidden = occlusionQueries.resultsHidden;
+        frameStats.queryResultsPending = occlusionQueries.resultsPending;
+    }
+    frameStats.drawCalls += renderQueue.size();
+    frameStats.sceneObjectsDrawn = renderQueue.size();
+    frameStats.sortMs = renderQueue.lastSortMs;
+    frameStats.drawListMs = drawList.lastBuildMs;
+    frameStats.sceneObjectCount = scene.objectCount();
+    frameStats.cullNsPerObject = drawList.lastCullNsPerObject;
+    frameStats.hierarchyUpdateMs = drawList.lastHierarchyUpdateMs;
+    frameStats.hierarchyNodesVisited = drawList.lastNodesVisited;
+    frameStats.occludedObjects = drawList.lastOccludedCount;
+    frameStats.occluderTriangles = drawList.lastOccluderTriangles;
+    frameStats.occlusionMs = drawList.lastOcclusionMs;
+}
+
+// The per frame uniforms every simple.vert/simple.frag variant without uniform blocks uses
+void OpenGLWindow::setSharedUniforms(SimpleProgram* program)
+{
+    program->program.set(program->objectColor, glm::vec3(r,g,b));
+    program->program.set(program->viewPos, lightingViewPos);
+    program->program.set(program->addNormalMap, (int)addNormalMap);
+}
+
+// The clustered variants' buffer textures and uniforms, with the program bound
+void OpenGLWindow::bindClusters(SimpleProgram* program)
+{
+    int width, height;
+    SDL_GL_GetDrawableSize(sdlWin, &width, &height);
+    clusteredLights.bind(program->program, CLUSTER_FIRST_UNIT, width, height);
+}
+
+// NOTE: The lighting pass of deferred shading. The G-buffer holds the albedo and bump mapped
+//       normal of the nearest surface of every pixel, and a fullscreen triangle shades each one
+//       with the lights of its view cluster, the same lists the clustered forward variants read.
+//       Every pixel is lit once, where the forward variants light every fragment drawn, hidden
+//       ones included
+void OpenGLWindow::shadeDeferred(const glm::mat4& viewModel)
+{
+    glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glState.useProgram(deferredLightShader.program.id);
+    setSharedUniforms(&deferredLightShader);
+    // The positions are taken back from the depth into the lights' space
+    deferredLightShader.program.set(deferredLightShader.clipToScene, glm::inverse(viewModel));
+    bindClusters(&deferredLightShader);
+    gBuffer.bindTextures();
+    glState.bindVertexArray(gBuffer.fullscreenVertexArray());
+    glState.disable(GL_DEPTH_TEST);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glState.enable(GL_DEPTH_TEST);
+    frameStats.drawCalls++;
+    glState.bindVertexArray(objectMesh.vao);
+}
+
+void OpenGLWindow::setObjectLights(SimpleProgram* program, const ObjectLights& lights)
+{
+    program->program.set(program->objectLights, lights.indices, MAX_OBJECT_LIGHTS);
+    program->program.set(program->objectLightCount, lights.count);
+}
+
+// NOTE: The lights are uploaded to their buffer only when one moved. The model's copies and the
+//       instances pick their lights again when they or the lights moved, the scene objects pick
+//       theirs while their draw commands are built
+void OpenGLWindow::updateLights(unsigned int changes, const glm::mat4& model, const glm::mat4& transform)
+{
+    bool moved = (lightsRevision != uploadedLightsRevision);
+    if(moved)
+    {
+        // Value initialized, which zeroes the unused lights and the padding
+        LightsBlock block = LightsBlock();
+        int count = min((int)lights.size(), MAX_LIGHTS);
+        for(int i=0; i<count; i++)
+        {
+            block.lights[i].position = lights[i].position;
+            block.lights[i].range = lights[i].range;
+            block.lights[i].color = lights[i].color;
+        }
+        // Each of the two lights used to add 0.1
+        block.ambientStrength = 0.2f;
+        block.lightCount = count;
+        glState.bindBuffer(GL_UNIFORM_BUFFER, lightsBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+        drawList.setLights(lights);
+        uploadedLightsRevision = lightsRevision;
+    }
+    glState.bindBufferRange(GL_UNIFORM_BUFFER, LIGHTS_BLOCK_BINDING, lightsBuffer, 0, sizeof(LightsBlock));
+
+    bool placed = moved || (changes & (MODEL_CHANGED | OBJECT_CHANGED));
+    if(placed || (objectLights.size() != objectTransforms.size()))
+    {
+        const Bounds& bounds = scene.meshBounds()[modelMesh];
+        objectLights.resize(objectTransforms.size());
+        for(size_t i=0; i<objectTransforms.size(); i++)
+        {
+            Bounds copyBounds = transformBounds(bounds, objectTransforms[i] * model);
+            selectLights(lights, copyBounds.min, copyBounds.max, objectLights[i]);
+        }
+    }
+    if(placed || (scene.instanceCount() != instanceLightsCount))
+    {
+        Bounds bounds = scene.instanceBounds(transform * model);
+        selectLights(lights, bounds.min, bounds.max, instanceLights);
+        instanceLightsCount = scene.instanceCount();
+    }
+}
+
+void OpenGLWindow::moveLight(int light, const glm::vec3& offset)
+{
+    if(light < (int)lights.size())
+    {
+        lights[light].position += offset;
+        lightsRevision++;
+    }
+}
+
+void OpenGLWindow::resetVariables(){
+    this->radian = 45.0f;
+    this->r = 1.0f;
+    this->g = 1.0f;
+    this->b = 1.0f;
+    this->transx = 0.0f;
+    this->transy = 0.0f;
+    this->transz = 0.0f;
+    // The keys move the first two lights of the scene file
+    this->lights = sceneFile.lights;
+    this->lightsRevision++;
+    this->instanceLightsCount = -1;
+    this->pan = 0.0f;
+    this-> rx = 0.0f;
+    this-> ry = 0.0f;
+    this-> rz = 0.0f;
+    this-> s = 1.0f;
+    this-> textureCount = 1;
+    this->currentMaterial = 0;
+    this->addNormalMap = false;
+    
+    cameraPos   = sceneFile.cameraPos;
+    cameraFront = sceneFile.cameraFront;
+    cameraUp    = glm::vec3(0.0f, 1.0f,  0.0f);
+    rotateDirection = glm::vec3(1.0f, 0.0f, 0.0f);
+
+}
+// The program will exit if this function returns false
+bool OpenGLWindow::handleEvent(SDL_Event e)
+{
+    // A list of keycode constants is available here: https://wiki.libsdl.org/SDL_Keycode
+    // Note that SDL provides both Scancodes (which correspond to physical positions on the keyboard)
+    // and Keycodes (which correspond to symbols on the keyboard, and might differ across layouts)
+    if(e.type == SDL_KEYDOWN)
+    {
+        if(e.key.keysym.sym == SDLK_ESCAPE)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+
+void OpenGLWindow::handleCameraMovementEvent(SDL_Event e){
+
+    // Sampled once per frame in latchInput() instead
+    if(lowLatency){
+        return;
+    }
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_q: //Move camera to the left
+                cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+                return;
+            case SDLK_e: //Move camera to the right
+                cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+                return;
+            case SDLK_w: //Rotate camera about the y axis 
+                rotateDirection = glm::vec3(1.0f, 0.0f, 0.0f);
+                pan += 1.0f;
+                return;
+            case SDLK_s: //Rotate camera about the y axis down
+                rotateDirection = glm::vec3(1.0f, 0.0f, 0.0f);
+                pan -= 1.0f;
+                return;
+            case SDLK_d: //Rotate camera about the object to the left
+                rotateDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+                pan += 1.0f;
+                return;
+            case SDLK_a: //Rotate camera about the object to the left
+                rotateDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+                pan -= 1.0f;
+                return;
+         }
+      }
+} 
+
+void OpenGLWindow::handleColorEvent(SDL_Event e){
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_z: //color one
+                r = 0.5f;
+                g = 0.0f;
+                b = 0.0f; 
+                return;
+            case SDLK_x: //color two
+                r = 0.1f;
+                g = 0.5f;
+                b = 0.0f;
+                return;
+            case SDLK_c: //color three
+                r = 0.5f;
+                g = 0.0f;
+                b = 0.5f; 
+                return;
+            }
+
+    }
+
+}
+
+void OpenGLWindow::handleObjectTranslationEvent(SDL_Event e){
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_h: //move up y axis
+                transy += 0.1f;
+                return;
+            case SDLK_n: //move down y axis
+                transy -= 0.1f;
+                return;
+            case SDLK_m: //move left x axis
+                transx += 0.1f;
+                return;
+            case SDLK_b: //move right x axis
+                transx -= 0.1f;
+                return;
+            case SDLK_g: //move out z axis
+                transz -= 0.1f;
+                return;
+            case SDLK_j: //move in z axis
+                transz += 0.1f;
+                return;
+            }
+
+    }
+
+}
+
+void OpenGLWindow::handleObjectRotationEvent(SDL_Event e){
+
+    // Sampled once per frame in latchInput() instead
+    if(lowLatency){
+        return;
+    }
 
     if(e.type == SDL_KEYDOWN){
         switch (e.key.keysym.sym){
@@ -479,22 +1422,203 @@ void OpenGLWindow::handleObjectRotationEvent(SDL_Event e){
             case SDLK_LEFT: //move left x axis
                 rz += 0.4f;
                 return;
-            
+            
+            }
+
+    }
+
+}
+
+void OpenGLWindow::handleObjectScaleEvent(SDL_Event e){
+
+    // Sampled once per frame in latchInput() instead
+    if(lowLatency){
+        return;
+    }
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_y: //move up y axis
+                s += 0.2f;
+                return;
+            case SDLK_u: //move down y axis
+                s -= 0.2f;
+                return;
+            }
+
+    }
+
+}
+
+void OpenGLWindow::addExtraObject(SDL_Event e){
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_t: 
+                //resetVariables();
+                this->addNormalMap = !addNormalMap;
+                return;
+
+            }
+
+    }
+
+}
+
+void OpenGLWindow::handleZoomEvent(SDL_Event e){
+
+    // Sampled once per frame in latchInput() instead
+    if(lowLatency){
+        return;
+    }
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_i: // zoom in
+                cameraPos += cameraSpeed * cameraFront;
+                return;
+            case SDLK_o: //zoom out
+                cameraPos -= cameraSpeed * cameraFront;
+                return;
+          
+            }
+
+    }
+
+
+}
+
+void OpenGLWindow::handleLightPositionEvent(SDL_Event e){
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_1: //move 1 + x axis
+                moveLight(0, glm::vec3(0.1f, 0.0f, 0.0f));
+                return;
+            case SDLK_2: //move 1 - x axis
+                moveLight(0, glm::vec3(-0.1f, 0.0f, 0.0f));
+                return;
+            case SDLK_3: //move 1 + y axis
+                moveLight(0, glm::vec3(0.0f, 0.1f, 0.0f));
+                return;
+            case SDLK_4: //move 1 - x axis
+                moveLight(0, glm::vec3(0.0f, -0.1f, 0.0f));
+                return;
+            case SDLK_5: //move 1 + z axis
+                moveLight(0, glm::vec3(0.1f, 0.0f, 0.0f));
+                return;
+            case SDLK_6: //move 1 - z axis
+                moveLight(0, glm::vec3(0.0f, -0.1f, 0.0f));
+                return;
+            case SDLK_g: //move 1 + y axis
+                moveLight(1, glm::vec3(0.1f, 0.0f, 0.0f));
+                return;
+            case SDLK_h: //move 1 - x axis
+                moveLight(1, glm::vec3(0.0f, 0.1f, 0.0f));
+                return;
+            case SDLK_j: //move 1 + z axis
+                moveLight(1, glm::vec3(0.0f, 0.0f, 0.1f));
+                return;
+            case SDLK_b: //move 1 + y axis
+                moveLight(1, glm::vec3(-0.1f, 0.0f, 0.0f));
+                return;
+            case SDLK_n: //move 1 - x axis
+                moveLight(1, glm::vec3(0.0f, -0.1f, 0.0f));
+                return;
+            case SDLK_m: //move 1 + z axis
+                moveLight(1, glm::vec3(0.0f, 0.0f, -0.1f));
+                return;
+            
+            }
+
+    }
+
+}
+
+void OpenGLWindow::handleTextureChangeEvent(SDL_Event e){
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_l: //cycle through the materials
+                loadMaterial(textureCount);
+                textureCount = (textureCount + 1) % materialCount();
+                return;
+            case SDLK_k: //toggle the texture atlas
+                if(!textureAtlas.isBuilt()){
+                    for(int i=0; i<materialCount(); i++){
+                        textureAtlas.addMaterial(sceneFile.materials[i].diffuseFile.c_str(), sceneFile.materials[i].normalFile.c_str());
+                    }
+                    glState.activeTexture(ATLAS_DIFFUSE_UNIT);
+                    if(!textureAtlas.build()){
+                        return;
+                    }
+                }
+                this->useTextureAtlas = !useTextureAtlas;
+                if(!useTextureAtlas){
+                    loadMaterial(currentMaterial);
+                }
+                return;
+
+            }
+
+    }
+
+}
+
+void OpenGLWindow::handleVirtualTextureEvent(SDL_Event e){
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_v: //toggle virtual texturing
+                if(!useVirtualTexture && !openVirtualTexture()){
+                    return;
+                }
+                this->useVirtualTexture = !useVirtualTexture;
+                if(!useVirtualTexture){
+                    virtualTexture.close();
+                }
+                return;
+            }
+
+    }
+
+}
+
+void OpenGLWindow::handleStatsEvent(SDL_Event e){
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_p: //print the last frame's stats
+                printStats();
+                return;
+            }
+
+    }
+
+}
+
+void OpenGLWindow::handleUniformBlockEvent(SDL_Event e){
+
+    if(e.type == SDL_KEYDOWN){
+        switch (e.key.keysym.sym){
+            case SDLK_f: //toggle the uniform block path
+                this->useUniformBlocks = !useUniformBlocks;
+                return;
             }
 
     }
 
 }
 
-void OpenGLWindow::handleObjectScaleEvent(SDL_Event e){
+void OpenGLWindow::handleInstanceEvent(SDL_Event e){
 
     if(e.type == SDL_KEYDOWN){
         switch (e.key.keysym.sym){
-            case SDLK_y: //move up y axis
-                s += 0.2f;
-                return;
-            case SDLK_u: //move down y axis
-                s -= 0.2f;
+            case SDLK_r: //toggle a grid of instances behind the object
+                if(scene.instanceCount() == 0){
+                    buildInstanceGrid(loadMesh("objFiles/teapot.obj"), 10000);
+                }
+                this->showInstances = !showInstances;
                 return;
             }
 
@@ -502,153 +1626,844 @@ void OpenGLWindow::handleObjectScaleEvent(SDL_Event e){
 
 }
 
-void OpenGLWindow::addExtraObject(SDL_Event e){
+// Places count instances of the mesh on the same grid as the stress test, cycling through the
+// materials
+void OpenGLWindow::buildInstanceGrid(int mesh, int count)
+{
+    scene.clearInstances();
+    vector<glm::mat4> offsets;
+    buildObjectOffsets(count, offsets);
+    for(int i=0; i<count; i++)
+    {
+        scene.addInstance(mesh, offsets[i + 1], i % materialCount());
+    }
+}
+
+void OpenGLWindow::handleLatencyEvent(SDL_Event e){
 
     if(e.type == SDL_KEYDOWN){
         switch (e.key.keysym.sym){
-            case SDLK_t: 
-                //resetVariables();
-                this->addNormalMap = !addNormalMap;
+            case SDLK_9: //toggle the low latency mode
+                setLowLatency(!lowLatency, frameQueue.getLimit());
+                cout << "Low latency mode " << (lowLatency ? "on" : "off") << endl;
                 return;
-
             }
 
     }
 
 }
 
-void OpenGLWindow::handleZoomEvent(SDL_Event e){
+void OpenGLWindow::handleStateCacheEvent(SDL_Event e){
 
     if(e.type == SDL_KEYDOWN){
         switch (e.key.keysym.sym){
-            case SDLK_i: // zoom in
-                cameraPos += cameraSpeed * cameraFront;
-                return;
-            case SDLK_o: //zoom out
-                cameraPos -= cameraSpeed * cameraFront;
+            case SDLK_8: //toggle dropping redundant GL state changes
+                glState.setFiltering(!glState.isFiltering());
+                cout << "GL state filtering " << (glState.isFiltering() ? "on" : "off") << endl;
                 return;
-          
             }
 
     }
 
-
 }
 
-void OpenGLWindow::handleLightPositionEvent(SDL_Event e){
+void OpenGLWindow::handleWorkerThreadEvent(SDL_Event e){
 
     if(e.type == SDL_KEYDOWN){
-        switch (e.key.keysym.sym){
-            case SDLK_1: //move 1 + x axis
-                lightx += 0.1f;
-                return;
-            case SDLK_2: //move 1 - x axis
-                lightx -= 0.1f;
-                return;
-            case SDLK_3: //move 1 + y axis
-                lighty += 0.1f;
-                return;
-            case SDLK_4: //move 1 - x axis
-                lighty -= 0.1f;
+        switch(e.key.keysym.sym){
+            case SDLK_7: //double the draw list worker threads, back to 1 past the core count
+            {
+                int maxThreads = thread::hardware_concurrency();
+                int threads = drawList.threadCount() * 2;
+                setWorkerThreads((drawList.threadCount() >= maxThreads) ? 1 : min(threads, maxThreads));
+                cout << "Draw list worker threads: " << drawList.threadCount() << endl;
                 return;
-            case SDLK_5: //move 1 + z axis
-                lightx += 0.1f;
+            }
+            }
+
+    }
+
+}
+
+void OpenGLWindow::handleCullingEvent(SDL_Event e){
+
+    if(e.type == SDL_KEYDOWN){
+        switch(e.key.keysym.sym){
+            case SDLK_F1: //switch between culling every object and culling through the scene BVH
+                drawList.useHierarchy = !drawList.useHierarchy;
+                cout << "Scene BVH culling " << (drawList.useHierarchy ? "on" : "off") << endl;
                 return;
-            case SDLK_6: //move 1 - z axis
-                lighty -= 0.1f;
+            case SDLK_F2: //test the scene objects against the occluders
+                drawList.useOcclusion = !drawList.useOcclusion;
+                cout << "Occlusion culling " << (drawList.useOcclusion ? "on" : "off") << endl;
                 return;
-            case SDLK_g: //move 1 + y axis
-                lightx2 += 0.1f;
+            case SDLK_F3: //draw the large objects only if their bounding box query passed last frame
+                useQueries = !useQueries;
+                cout << "Occlusion queries " << (useQueries ? "on" : "off") << " (" << occlusionQueries.targetName()
+                     << ")" << endl;
                 return;
-            case SDLK_h: //move 1 - x axis
-                lighty2 += 0.1f;
+            case SDLK_F4: //shade every fragment with the lights of its view cluster
+                useClusteredShading = !useClusteredShading;
+                cout << "Clustered shading " << (useClusteredShading ? "on" : "off") << endl;
                 return;
-            case SDLK_j: //move 1 + z axis
-                lightz2 += 0.1f;
+            case SDLK_F5: //draw into the G-buffer and light every pixel once afterwards
+                useDeferredShading = !useDeferredShading;
+                cout << "Deferred shading " << (useDeferredShading ? "on" : "off") << endl;
                 return;
-            case SDLK_b: //move 1 + y axis
-                lightx2 -= 0.1f;
+            case SDLK_F6: //lay the depth down first and only shade the nearest fragments
+                useDepthPrepass = !useDepthPrepass;
+                cout << "Depth pre-pass " << (useDepthPrepass ? "on" : "off") << endl;
                 return;
-            case SDLK_n: //move 1 - x axis
-                lighty2 -= 0.1f;
+            case SDLK_F7: //merge the static scene objects sharing a material into one mesh a grid cell
+                useStaticBatching = !useStaticBatching;
+                cout << "Static batching " << (useStaticBatching ? "on" : "off") << endl;
                 return;
-            case SDLK_m: //move 1 + z axis
-                lightz2 -= 0.1f;
+            case SDLK_F8: //draw the scene objects of every mesh from one shared vertex array
+                useBufferArena = !useBufferArena;
+                cout << "Buffer arena " << (useBufferArena ? "on" : "off") << endl;
                 return;
-            
             }
 
     }
 
 }
 
-void OpenGLWindow::handleTextureChangeEvent(SDL_Event e){
+// Reports the triangle under the mouse, on the model or a scene object, as drawn last frame
+void OpenGLWindow::handlePickEvent(SDL_Event e){
 
-    if(e.type == SDL_KEYDOWN){
-        switch (e.key.keysym.sym){
-            case SDLK_l: //color one
-                switch (textureCount){
-                    case 0:
-                        glActiveTexture(GL_TEXTURE0);
-                        diffuseMap = loadTexture("metal.jpg",textures[0]);
-                        glActiveTexture(GL_TEXTURE1);
-                        normalMap = loadTexture("metal_normal.jpg",textures[1]);
-                        glUniform1i(glGetUniformLocation(shader, "ourTexture"), 0); 
-                        glUniform1i(glGetUniformLocation(shader, "ourTextureMap"), 1);
-                        textureCount += 1;
-                        return;
-                    case 1:
-                        glActiveTexture(GL_TEXTURE0);
-                        diffuseMap = loadTexture("Abstract.jpg",textures[0]);
-                        glActiveTexture(GL_TEXTURE1);
-                        normalMap = loadTexture("Abstract_normal.jpg",textures[1]);
-                        glUniform1i(glGetUniformLocation(shader, "ourTexture"), 0); 
-                        glUniform1i(glGetUniformLocation(shader, "ourTextureMap"), 1);
-                        textureCount += 1;
-                        return;
-                    case 2:
-                        glActiveTexture(GL_TEXTURE0);
-                        diffuseMap = loadTexture("thatch.jpg",textures[0]);
-                        glActiveTexture(GL_TEXTURE1);
-                        normalMap = loadTexture("thatch_normal.jpg",textures[1]);
-                        glUniform1i(glGetUniformLocation(shader, "ourTexture"), 0); 
-                        glUniform1i(glGetUniformLocation(shader, "ourTextureMap"), 1);
-                        textureCount +=1;
-                        return;
-                    case 3:
-                        glActiveTexture(GL_TEXTURE0);
-                        diffuseMap = loadTexture("water.jpg",textures[0]);
-                        glActiveTexture(GL_TEXTURE1);
-                        normalMap = loadTexture("water_normal.jpg",textures[1]);
-                        glUniform1i(glGetUniformLocation(shader, "ourTexture"), 0); 
-                        glUniform1i(glGetUniformLocation(shader, "ourTextureMap"), 1);
-                        textureCount +=1;
-                        return;
-                    case 4:
-                        glActiveTexture(GL_TEXTURE0);
-                        diffuseMap = loadTexture("metal2.jpg",textures[0]);
-                        glActiveTexture(GL_TEXTURE1);
-                        normalMap = loadTexture("metal2_normal.jpg",textures[1]);
-                        glUniform1i(glGetUniformLocation(shader, "ourTexture"), 0); 
-                        glUniform1i(glGetUniformLocation(shader, "ourTextureMap"), 1);
-                        textureCount =0;
-                        return;
+    if((e.type != SDL_MOUSEBUTTONDOWN) || (e.button.button != SDL_BUTTON_LEFT)){
+        return;
+    }
 
-                }
+    int width, height;
+    SDL_GetWindowSize(sdlWin, &width, &height);
+    glm::vec3 origin, direction;
+    ScenePicker::unproject(e.button.x, e.button.y, width, height, transforms.view(), transforms.projection(), origin, direction);
+    const glm::mat4& model = transforms.model();
+    const glm::mat4& transform = transforms.transform();
+    SceneBVH& hierarchy = drawList.updateHierarchy(scene, scene.meshBounds(), model, transform);
+    PickResult result;
+    if(!picker.pick(scene, hierarchy, modelMesh, objectOffsets, model, transform, origin, direction, result)){
+        cout << "Nothing picked (" << picker.lastPickUs << " us)" << endl;
+        return;
+    }
 
-            }
+    if(result.object >= 0){
+        cout << "Picked object " << result.object << " (mesh " << result.mesh << ", material "
+             << scene.object(result.object).material << ")";
+    }
+    else{
+        cout << "Picked the model (copy " << result.copy << ")";
+    }
+    cout << ", triangle " << result.triangle << ", barycentrics (" << result.barycentrics.x << ", " << result.barycentrics.y
+         << ", " << result.barycentrics.z << "), uv (" << result.uv.x << ", " << result.uv.y << "), at (" << result.position.x
+         << ", " << result.position.y << ", " << result.position.z << "), " << result.distance << " away, in "
+         << picker.lastPickUs << " us through " << picker.lastObjectsTested << " meshes" << endl;
+    if(picker.lastBuildMs > 0.0){
+        cout << "\tTriangle BVHs built in " << picker.lastBuildMs << " ms" << endl;
+    }
+}
+
+void OpenGLWindow::setWorkerThreads(int threadCount)
+{
+    drawList.setThreadCount(threadCount);
+    clusteredLights.setThreadCount(threadCount);
+}
 
+void OpenGLWindow::setLowLatency(bool enabled, int maxFramesInFlight)
+{
+    this->lowLatency = enabled;
+    frameQueue.setLimit(maxFramesInFlight);
+    if(!enabled)
+    {
+        frameQueue.clear();
     }
+    lastLatchTime = SDL_GetPerformanceCounter();
+}
 
+const FrameStats& OpenGLWindow::stats()
+{
+    return frameStats;
+}
+
+void OpenGLWindow::printStats()
+{
+    cout << "Frame stats:" << endl;
+    cout << "\tUniform uploads: " << frameStats.uniformUploads
+         << " (" << frameStats.uniformsSkipped << " skipped as unchanged, 0 location lookups)" << endl;
+    if(lowLatency)
+    {
+        cout << "\tLow latency: " << frameStats.frameQueueWaitMs << " ms waiting for the GPU, at most "
+             << frameQueue.getLimit() << " frames in flight" << endl;
+    }
+    cout << "\tGL state changes: " << frameStats.stateCallsIssued << " issued, " << frameStats.stateCallsFiltered
+         << (glState.isFiltering() ? " dropped as redundant" : " redundant (filtering off)") << endl;
+    if(scene.objectCount() > 0)
+    {
+        cout << "\tFrustum culling: " << frameStats.sceneObjectsDrawn << " of " << frameStats.sceneObjectCount
+             << " objects visible, " << frameStats.cullNsPerObject << " ns per object (" << FrustumCuller::batchWidth()
+             << " at a time)" << endl;
+        if(scene.graph().nodeCount() > 0)
+        {
+            cout << "\tScene graph: " << frameStats.graphNodesUpdated << " of " << scene.graph().nodeCount()
+                 << " nodes updated in " << frameStats.graphUpdateMs << " ms" << endl;
+        }
+        if(drawList.useHierarchy)
+        {
+            cout << "\tScene BVH: " << frameStats.hierarchyNodesVisited << " nodes visited, updated in "
+                 << frameStats.hierarchyUpdateMs << " ms" << endl;
+        }
+        if(drawList.useOcclusion)
+        {
+            int tested = frameStats.sceneObjectsDrawn + frameStats.occludedObjects;
+            cout << "\tOcclusion culling: " << frameStats.occludedObjects << " of " << tested << " objects occluded ("
+                 << ((tested > 0) ? 100.0 * frameStats.occludedObjects / tested : 0.0) << "%) by "
+                 << frameStats.occluderTriangles << " triangles, " << frameStats.occlusionMs << " ms" << endl;
+        }
+        if(useQueries)
+        {
+            cout << "\tOcclusion queries: " << frameStats.conditionalDraws << " conditional draws, "
+                 << frameStats.queriesIssued << " queries issued, last frame's " << frameStats.queryResultsHidden
+                 << " of " << frameStats.queryResultsRead << " hidden (" << frameStats.queryResultsPending
+                 << " not ready, not waited for)" << endl;
+        }
+        cout << "\tScene objects: " << frameStats.sceneObjectsDrawn << " sorted " << RenderQueue::modeName(renderQueue.getMode())
+             << " in " << frameStats.sortMs << " ms, " << frameStats.materialSwitches << " material and "
+             << frameStats.meshSwitches << " mesh switches, " << frameStats.vertexArrayBinds << " vertex array binds"
+             << endl;
+        cout << "\tDraw list: built in " << frameStats.drawListMs << " ms on " << drawList.threadCount()
+             << " threads" << endl;
+    }
+    cout << "\tMatrices rebuilt: " << frameStats.matrixRebuilds << endl;
+    cout << "\tDraw calls: " << frameStats.drawCalls << ", submitted in " << frameStats.submitMs << " ms" << endl;
+    if(useBufferArena)
+    {
+        BufferArena& arena = scene.bufferArena();
+        cout << "\tBuffer arena: " << arena.meshCount() << " meshes in " << arena.verticesUsed() << "/"
+             << arena.vertexCapacity() << " vertices and " << arena.indicesUsed() << "/" << arena.indexCapacity()
+             << " indices, " << arena.freeRangeCount() << " free ranges, " << arena.fragmentation() * 100.0f
+             << "% fragmented, " << arena.defragmentations << " packs" << endl;
+    }
+    if(staticBatches.isApplied())
+    {
+        cout << "\tStatic batches: " << staticBatches.lastObjectCount << " objects merged into "
+             << staticBatches.lastBatchCount << " batches of " << staticBatches.lastVertexCount << " vertices, built in "
+             << staticBatches.lastBuildMs << " ms" << endl;
+    }
+    if(useDepthPrepass)
+    {
+        cout << "\tDepth pre-pass: " << frameStats.prepassDraws << " draws" << endl;
+    }
+    if(pipelineStats.isSupported())
+    {
+        cout << "\tShader invocations: " << pipelineStats.vertexInvocations << " vertex, "
+             << pipelineStats.fragmentInvocations << " fragment, without the pre-pass (" << pipelineStats.resultAge
+             << " frames ago)" << endl;
+    }
+    if(useDeferredShading)
+    {
+        cout << "\tDeferred shading: " << gBuffer.width << "x" << gBuffer.height << " G-buffer, 11 bytes a pixel"
+             << endl;
+    }
+    if(useClusteredShading || useDeferredShading)
+    {
+        int lit = clusteredLights.lastClustersLit;
+        cout << "\tClustered lights: " << clusteredLights.lastLightsInView << " of " << lights.size() << " in view, "
+             << lit << " of " << CLUSTER_COUNT << " clusters lit with "
+             << ((lit > 0) ? (double)clusteredLights.lastIndexCount / lit : 0.0) << " lights on average (at most "
+             << clusteredLights.lastMaxClusterLights << "), assigned in " << clusteredLights.lastBuildMs << " ms on "
+             << clusteredLights.threadCount() << " threads" << endl;
+    }
+    else
+    {
+        cout << "\tLights: " << lights.size() << " in the scene, "
+             << ((frameStats.drawCalls > 0) ? (double)frameStats.lightsShaded / frameStats.drawCalls : 0.0)
+             << " shaded per draw (at most " << MAX_OBJECT_LIGHTS << ")" << endl;
+    }
+    if(showInstances)
+    {
+        cout << "\tInstances: " << frameStats.instancesDrawn << " over " << scene.meshCount() << " meshes, "
+             << scene.verticesDrawn / 3 << " triangles" << endl;
+    }
+    if(useUniformBlocks)
+    {
+        cout << "\tUniform blocks: " << frameStats.uniformWaitMs << " ms waiting on ring buffer fences ("
+             << (uniformRing.isPersistent() ? "persistently mapped" : "mapped per frame") << ")" << endl;
+    }
+    if(useVirtualTexture)
+    {
+        cout << "\tVirtual texture pages: " << virtualTexture.pagesRequested << " requested, "
+             << virtualTexture.pagesUploaded << " uploaded, " << virtualTexture.pagesResident << " resident" << endl;
+    }
 }
 
 void OpenGLWindow::cleanup()
 {
-    glDeleteBuffers(1, &vertexBuffer);
-    glDeleteBuffers(1, &vertexBuffer2);
-    glDeleteBuffers(1, &normalBuffer);
-    glDeleteBuffers(1, &bitangentBuffer);
-    glDeleteBuffers(1, &tangentBuffer);
-    glDeleteVertexArrays(1, &vao);
+    objectMesh.destroy();
+    // The material textures are all in textureFiles, some of them more than once in materialTextures
+    for(map<string, GLuint>::iterator texture=textureFiles.begin(); texture!=textureFiles.end(); texture++)
+    {
+        glState.deleteTextures(1, &texture->second);
+    }
+    textureFiles.clear();
+    materialTextures.clear();
+    scene.clear();
+    staticBatches = StaticBatches();
+    meshFiles.clear();
+    picker.clear();
+    virtualTexture.close();
+    textureAtlas.clear();
+    glState.deleteProgram(shader.program.id);
+    glState.deleteProgram(virtualTextureShader.program.id);
+    glState.deleteProgram(feedbackShader.program.id);
+    glState.deleteProgram(atlasShader.program.id);
+    glState.deleteProgram(uniformBlockShader.program.id);
+    glState.deleteProgram(instancedShader.program.id);
+    glState.deleteProgram(instancedAtlasShader.program.id);
+    glState.deleteProgram(boundsShader.program.id);
+    glState.deleteProgram(clusteredShader.program.id);
+    glState.deleteProgram(instancedClusteredShader.program.id);
+    glState.deleteProgram(deferredShader.program.id);
+    glState.deleteProgram(instancedDeferredShader.program.id);
+    glState.deleteProgram(deferredLightShader.program.id);
+    glState.deleteProgram(depthShader.program.id);
+    glState.deleteProgram(instancedDepthShader.program.id);
+    pipelineStats.destroy();
+    clusteredLights.destroy();
+    gBuffer.destroy();
+    occlusionQueries.destroy();
+    uniformRing.destroy();
+    glState.deleteBuffers(1, &lightsBuffer);
+    frameQueue.clear();
     SDL_DestroyWindow(sdlWin);
 }
+
+// Renders the same scene through glUniform* and through the uniform ring buffer, with objectCount
+// copies of the object, and reports the average time per frame of both
+void OpenGLWindow::runUniformStressTest(int objectCount, int frameCount)
+{
+    // Without vsync the frame time is what the submission costs rather than the refresh rate
+    SDL_GL_SetSwapInterval(0);
+    stressObjectCount = objectCount;
+    cout << "Uniform stress test, " << objectCount + 1 << " objects, " << frameCount << " frames per path" << endl;
+
+    for(int path=0; path<2; path++)
+    {
+        useUniformBlocks = (path == 1);
+        double submitTotal = 0.0;
+        double waitTotal = 0.0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(int frame=0; frame<frameCount; frame++)
+        {
+            SDL_PumpEvents();
+            // Keep the scene moving so the matrices change every frame, as they would in a game
+            pan += 0.1f;
+            render();
+            submitTotal += frameStats.submitMs;
+            waitTotal += frameStats.uniformWaitMs;
+        }
+        glFinish();
+        double totalMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+        cout << "\t" << (useUniformBlocks ? "Uniform blocks: " : "glUniform*:     ")
+             << submitTotal / frameCount << " ms CPU per frame ("
+             << waitTotal / frameCount << " ms waiting on fences), "
+             << totalMs / frameCount << " ms per frame overall" << endl;
+    }
+
+    stressObjectCount = 0;
+    useUniformBlocks = false;
+    pan = 0.0f;
+    SDL_GL_SetSwapInterval(1);
+}
+
+// Draws instanceCount instances of a model for frameCount frames as fast as possible, and reports
+// the instance and triangle throughput
+void OpenGLWindow::runInstanceBenchmark(const char* objFilename, int instanceCount, int frameCount)
+{
+    SDL_GL_SetSwapInterval(0);
+    int mesh = loadMesh(objFilename);
+    buildInstanceGrid(mesh, instanceCount);
+    showInstances = true;
+
+    // The first frame uploads the instance buffer, leave it out of the measurement
+    render();
+    glFinish();
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    double submitTotal = 0.0;
+    for(int frame=0; frame<frameCount; frame++)
+    {
+        SDL_PumpEvents();
+        pan += 0.1f;
+        render();
+        submitTotal += frameStats.submitMs;
+    }
+    glFinish();
+    double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+    cout << "Instance benchmark, " << instanceCount << " x " << objFilename << " ("
+         << scene.geometry(mesh).vertexCount() / 3 << " triangles each), " << frameCount << " frames" << endl;
+    cout << "\t" << seconds * 1000.0 / frameCount << " ms per frame, "
+         << submitTotal / frameCount << " ms CPU, " << frameStats.drawCalls << " draw calls" << endl;
+    cout << "\t" << instanceCount * (double)frameCount / seconds << " instances/s, "
+         << (scene.verticesDrawn / 3) * (double)frameCount / seconds << " triangles/s" << endl;
+
+    showInstances = false;
+    scene.clearInstances();
+    SDL_GL_SetSwapInterval(1);
+}
+
+// Draws objectCount objects with random meshes and materials, in random order, through each sort
+// mode of the render queue, and compares the state changes and frame times
+void OpenGLWindow::runSortBenchmark(int objectCount, int frameCount)
+{
+    const int BENCH_MESH_COUNT = 4;
+    const char* meshFiles[BENCH_MESH_COUNT] = {"objFiles/suzanne.obj", "objFiles/teapot.obj",
+                                               "objFiles/cube.obj", "objFiles/sample-bunny.obj"};
+    SDL_GL_SetSwapInterval(0);
+    int meshes[BENCH_MESH_COUNT];
+    for(int i=0; i<BENCH_MESH_COUNT; i++)
+    {
+        meshes[i] = loadMesh(meshFiles[i]);
+    }
+    if(materialTextures.empty())
+    {
+        loadMaterialTextures();
+    }
+
+    // The grid positions are shuffled so the unsorted order is random in depth as well
+    vector<glm::mat4> offsets;
+    buildObjectOffsets(objectCount, offsets);
+    srand(1);
+    for(int i=objectCount; i>1; i--)
+    {
+        swap(offsets[i], offsets[1 + rand() % i]);
+    }
+    for(int i=0; i<objectCount; i++)
+    {
+        scene.addObject(meshes[rand() % BENCH_MESH_COUNT], offsets[i + 1], rand() % materialCount());
+    }
+
+    cout << "Render queue benchmark, " << objectCount << " objects over " << BENCH_MESH_COUNT << " meshes and "
+         << materialCount() << " materials, " << frameCount << " frames per mode" << endl;
+    for(int mode=0; mode<SORT_MODE_COUNT; mode++)
+    {
+        renderQueue.setMode((SortMode)mode);
+        render();
+        glFinish();
+
+        double submitTotal = 0.0;
+        double sortTotal = 0.0;
+        long long materialSwitches = 0;
+        long long meshSwitches = 0;
+        long long stateCalls = 0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(int frame=0; frame<frameCount; frame++)
+        {
+            SDL_PumpEvents();
+            render();
+            submitTotal += frameStats.submitMs;
+            sortTotal += frameStats.sortMs;
+            materialSwitches += frameStats.materialSwitches;
+            meshSwitches += frameStats.meshSwitches;
+            stateCalls += frameStats.stateCallsIssued;
+        }
+        glFinish();
+        double totalMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+        cout << "\t" << RenderQueue::modeName((SortMode)mode) << ": " << totalMs / frameCount << " ms per frame, "
+             << submitTotal / frameCount << " ms CPU (" << sortTotal / frameCount << " ms sorting), "
+             << materialSwitches / frameCount << " material / " << meshSwitches / frameCount << " mesh switches, "
+             << stateCalls / frameCount << " GL state calls" << endl;
+    }
+
+    scene.clearObjects();
+    renderQueue.setMode(SORT_STATE);
+    SDL_GL_SetSwapInterval(1);
+}
+
+// A wall with a doorway, marked as occluders, in front of objectCount objects alternating between
+// two meshes
+void OpenGLWindow::addWallScene(int objectCount, const char* meshFile, const char* otherMeshFile)
+{
+    int cube = loadMesh("objFiles/cube.obj");
+    int meshes[2] = {loadMesh(meshFile), loadMesh(otherMeshFile)};
+    if(materialTextures.empty())
+    {
+        loadMaterialTextures();
+    }
+
+    for(int side=-1; side<=1; side+=2)
+    {
+        glm::mat4 wall = glm::translate(glm::mat4(1.0f), glm::vec3(side * 3.375f, 0.0f, -2.0f));
+        wall = glm::scale(wall, glm::vec3(2.625f, 4.0f, 0.25f));
+        scene.setOccluder(scene.addObject(cube, wall, 0), true);
+    }
+    vector<glm::mat4> offsets;
+    buildObjectOffsets(objectCount, offsets);
+    for(int i=0; i<objectCount; i++)
+    {
+        scene.addObject(meshes[i % 2], offsets[i + 1], i % materialCount());
+    }
+}
+
+// An interior: a wall with a doorway in front of objectCount teapots and bunnies, drawn with and
+// without testing them against the wall
+void OpenGLWindow::runOcclusionBenchmark(int objectCount, int frameCount)
+{
+    SDL_GL_SetSwapInterval(0);
+    addWallScene(objectCount, "objFiles/teapot.obj", "objFiles/sample-bunny.obj");
+
+    cout << "Occlusion culling benchmark, " << objectCount << " objects behind a wall, " << frameCount
+         << " frames" << endl;
+    bool wasOccluding = drawList.useOcclusion;
+    for(int occluding=0; occluding<2; occluding++)
+    {
+        drawList.useOcclusion = (occluding == 1);
+        render();
+        glFinish();
+
+        long long drawn = 0;
+        long long occluded = 0;
+        double occlusionTotal = 0.0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(int frame=0; frame<frameCount; frame++)
+        {
+            SDL_PumpEvents();
+            render();
+            drawn += frameStats.sceneObjectsDrawn;
+            occluded += frameStats.occludedObjects;
+            occlusionTotal += frameStats.occlusionMs;
+        }
+        glFinish();
+        double totalMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+        cout << "\tOcclusion culling " << (occluding ? "on" : "off") << ": " << totalMs / frameCount << " ms per frame, "
+             << drawn / frameCount << " objects drawn, " << occluded / frameCount << " occluded ("
+             << 100.0 * occluded / max(1LL, drawn + occluded) << "%), " << occlusionTotal / frameCount
+             << " ms culling" << endl;
+    }
+
+    drawList.useOcclusion = wasOccluding;
+    scene.clearObjects();
+    SDL_GL_SetSwapInterval(1);
+}
+
+// The wall in front of objectCount dogs and bunnies, drawn with and without the hardware occlusion
+// queries. Runs on any GL 3.2 implementation, Mesa's llvmpipe included, see the README
+void OpenGLWindow::runQueryBenchmark(int objectCount, int frameCount)
+{
+    SDL_GL_SetSwapInterval(0);
+    addWallScene(objectCount, "objFiles/doggo.obj", "objFiles/sample-bunny.obj");
+
+    cout << "Occlusion query benchmark, " << objectCount << " objects behind a wall, " << frameCount
+         << " frames, " << occlusionQueries.targetName() << endl;
+    bool wasQuerying = useQueries;
+    for(int querying=0; querying<2; querying++)
+    {
+        useQueries = (querying == 1);
+        // The second frame is the first drawn conditionally
+        render();
+        render();
+        glFinish();
+
+        long long conditional = 0;
+        long long hidden = 0;
+        long long read = 0;
+        long long pending = 0;
+        double submitTotal = 0.0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(int frame=0; frame<frameCount; frame++)
+        {
+            SDL_PumpEvents();
+            render();
+            submitTotal += frameStats.submitMs;
+            conditional += frameStats.conditionalDraws;
+            hidden += frameStats.queryResultsHidden;
+            read += frameStats.queryResultsRead;
+            pending += frameStats.queryResultsPending;
+        }
+        glFinish();
+        double totalMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+        cout << "\tOcclusion queries " << (querying ? "on" : "off") << ": " << totalMs / frameCount << " ms per frame, "
+             << submitTotal / frameCount << " ms CPU, " << frameStats.sceneObjectsDrawn << " objects submitted";
+        if(querying)
+        {
+            cout << ", " << conditional / frameCount << " conditionally, " << 100.0 * hidden / max(1LL, read)
+                 << "% of the results read hidden, " << 100.0 * pending / max(1LL, read + pending)
+                 << "% not ready a frame later";
+        }
+        cout << endl;
+    }
+
+    useQueries = wasQuerying;
+    scene.clearObjects();
+    SDL_GL_SetSwapInterval(1);
+}
+
+// A floor under a growing number of small lights, drawn with the per object light lists, with
+// clustered forward shading and with deferred shading, the floor and lights of lights.scene
+void OpenGLWindow::runShadingBenchmark(int frameCount)
+{
+    SDL_GL_SetSwapInterval(0);
+    int cube = loadMesh("objFiles/cube.obj");
+    if(materialTextures.empty())
+    {
+        loadMaterialTextures();
+    }
+    glm::mat4 floor = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.6f, -10.0f));
+    floor = glm::scale(floor, glm::vec3(20.0f, 0.1f, 20.0f));
+    scene.addObject(cube, floor, 0);
+
+    glm::vec3 wasCameraPos = cameraPos;
+    glm::vec3 wasCameraFront = cameraFront;
+    cameraPos = glm::vec3(0.0f, 3.0f, 8.0f);
+    cameraFront = glm::vec3(0.0f, -0.25f, -1.0f);
+    vector<SceneLight> wasLights = lights;
+    bool wasClustered = useClusteredShading;
+    bool wasDeferred = useDeferredShading;
+
+    int width, height;
+    SDL_GL_GetDrawableSize(sdlWin, &width, &height);
+    cout << "Shading benchmark, " << width << "x" << height << ", " << frameCount << " frames per light count "
+         << "(forward only shades the first " << MAX_LIGHTS << " lights, at most " << MAX_OBJECT_LIGHTS
+         << " a draw)" << endl;
+    const int LIGHT_COUNTS[5] = {16, 64, 256, 1024, 4096};
+    const char* MODE_NAMES[3] = {"forward", "clustered", "deferred"};
+    for(int count=0; count<5; count++)
+    {
+        lights.clear();
+        scatterLights(lights, LIGHT_COUNTS[count], glm::vec3(0.0f, -1.2f, -10.0f), glm::vec3(40.0f, 0.6f, 40.0f),
+                      2.5f);
+        lightsRevision++;
+
+        cout << "\t" << LIGHT_COUNTS[count] << " lights:";
+        for(int mode=0; mode<3; mode++)
+        {
+            useClusteredShading = (mode == 1);
+            useDeferredShading = (mode == 2);
+            render();
+            glFinish();
+
+            double submitTotal = 0.0;
+            Uint64 start = SDL_GetPerformanceCounter();
+            for(int frame=0; frame<frameCount; frame++)
+            {
+                SDL_PumpEvents();
+                render();
+                submitTotal += frameStats.submitMs;
+            }
+            glFinish();
+            double totalMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+            cout << " " << MODE_NAMES[mode] << " " << totalMs / frameCount << " ms (" << submitTotal / frameCount
+                 << " CPU)" << (mode < 2 ? "," : "");
+        }
+        cout << endl;
+    }
+
+    useClusteredShading = wasClustered;
+    useDeferredShading = wasDeferred;
+    lights = wasLights;
+    lightsRevision++;
+    cameraPos = wasCameraPos;
+    cameraFront = wasCameraFront;
+    scene.clearObjects();
+    SDL_GL_SetSwapInterval(1);
+}
+
+// The wall in front of objectCount teapots and bunnies, drawn with and without the depth pre-pass,
+// with the fragment shader invocations when the driver counts them
+void OpenGLWindow::runPrepassBenchmark(int objectCount, int frameCount)
+{
+    SDL_GL_SetSwapInterval(0);
+    addWallScene(objectCount, "objFiles/teapot.obj", "objFiles/sample-bunny.obj");
+
+    cout << "Depth pre-pass benchmark, " << objectCount << " objects behind a wall, " << frameCount << " frames" << endl;
+    bool wasPrepassing = useDepthPrepass;
+    for(int prepassing=0; prepassing<2; prepassing++)
+    {
+        useDepthPrepass = (prepassing == 1);
+        render();
+        glFinish();
+
+        double submitTotal = 0.0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(int frame=0; frame<frameCount; frame++)
+        {
+            SDL_PumpEvents();
+            render();
+            submitTotal += frameStats.submitMs;
+        }
+        glFinish();
+        double totalMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+        cout << "\tDepth pre-pass " << (prepassing ? "on" : "off") << ": " << totalMs / frameCount << " ms per frame, "
+             << submitTotal / frameCount << " ms CPU";
+        if(pipelineStats.isSupported())
+        {
+            // Everything is finished, the last frame's counts are ready
+            pipelineStats.collect();
+            cout << ", " << pipelineStats.fragmentInvocations << " fragment and " << pipelineStats.vertexInvocations
+                 << " vertex shader invocations";
+        }
+        cout << endl;
+    }
+
+    useDepthPrepass = wasPrepassing;
+    scene.clearObjects();
+    SDL_GL_SetSwapInterval(1);
+}
+
+// Scene objects over a pool of meshes drawn from their own vertex arrays and then from the buffer
+// arena, then meshes of the pool loaded and unloaded at random to show how the arena fragments
+void OpenGLWindow::runArenaBenchmark(int objectCount, int frameCount)
+{
+    const int BENCH_MESH_COUNT = 4;
+    const int POOL_SIZE = 64;
+    const int CHURN_ROUNDS = 2000;
+    const char* meshFiles[BENCH_MESH_COUNT] = {"objFiles/suzanne.obj", "objFiles/teapot.obj",
+                                               "objFiles/cube.obj", "objFiles/sample-bunny.obj"};
+    SDL_GL_SetSwapInterval(0);
+    int meshes[BENCH_MESH_COUNT];
+    for(int i=0; i<BENCH_MESH_COUNT; i++)
+    {
+        meshes[i] = loadMesh(meshFiles[i]);
+    }
+    if(materialTextures.empty())
+    {
+        loadMaterialTextures();
+    }
+
+    // Copies of the meshes, each in a slot of its own, so consecutive draws rarely share a mesh
+    srand(1);
+    int pool[POOL_SIZE];
+    for(int i=0; i<POOL_SIZE; i++)
+    {
+        pool[i] = scene.addMesh(scene.geometry(meshes[i % BENCH_MESH_COUNT]));
+    }
+    vector<glm::mat4> offsets;
+    buildObjectOffsets(objectCount, offsets);
+    for(int i=0; i<objectCount; i++)
+    {
+        scene.addObject(pool[rand() % POOL_SIZE], offsets[i + 1], rand() % materialCount());
+    }
+
+    BufferArena& arena = scene.bufferArena();
+    cout << "Buffer arena benchmark, " << objectCount << " objects over " << POOL_SIZE << " meshes, " << frameCount
+         << " frames" << endl;
+    cout << "\t" << arena.meshCount() << " meshes in " << arena.verticesUsed() << " vertices ("
+         << arena.verticesMerged << " merged by the indexing) and " << arena.indicesUsed() << " indices" << endl;
+    bool wasUsingArena = useBufferArena;
+    for(int usingArena=0; usingArena<2; usingArena++)
+    {
+        useBufferArena = (usingArena == 1);
+        render();
+        glFinish();
+
+        double submitTotal = 0.0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(int frame=0; frame<frameCount; frame++)
+        {
+            SDL_PumpEvents();
+            render();
+            submitTotal += frameStats.submitMs;
+        }
+        glFinish();
+        double totalMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+        cout << "\tBuffer arena " << (usingArena ? "on" : "off") << ": " << frameStats.meshSwitches << " mesh switches, "
+             << frameStats.vertexArrayBinds << " vertex array binds, " << totalMs / frameCount << " ms per frame, "
+             << submitTotal / frameCount << " ms CPU" << endl;
+    }
+    useBufferArena = wasUsingArena;
+    scene.clearObjects();
+
+    // Every round empties a loaded slot or loads an empty one with another mesh
+    GeometryData empty;
+    empty.computeBounds();
+    Uint64 start = SDL_GetPerformanceCounter();
+    for(int round=1; round<=CHURN_ROUNDS; round++)
+    {
+        int slot = pool[rand() % POOL_SIZE];
+        bool loaded = (scene.meshArenaHandle(slot) >= 0);
+        scene.setMeshGeometry(slot, loaded ? empty : scene.geometry(meshes[rand() % BENCH_MESH_COUNT]));
+        if(round % (CHURN_ROUNDS / 4) == 0)
+        {
+            double churnMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+            cout << "\tAfter " << round << " loads/unloads (" << churnMs << " ms): " << arena.meshCount()
+                 << " meshes in " << arena.verticesUsed() << "/" << arena.vertexCapacity() << " vertices, "
+                 << arena.freeRangeCount() << " free ranges, " << arena.fragmentation() * 100.0f << "% fragmented, "
+                 << arena.defragmentations << " packs moving " << arena.bytesMoved / 1024 << " KB in "
+                 << arena.defragmentMs << " ms" << endl;
+        }
+    }
+    arena.defragment();
+    cout << "\tPacked: " << arena.freeRangeCount() << " free ranges, " << arena.fragmentation() * 100.0f
+         << "% fragmented" << endl;
+
+    for(int i=0; i<POOL_SIZE; i++)
+    {
+        scene.setMeshGeometry(pool[i], empty);
+    }
+    picker.clear();
+    SDL_GL_SetSwapInterval(1);
+}
+
+// Static cubes on the stress test grid, cycling through the materials, drawn one by one and then
+// merged into static batches
+void OpenGLWindow::runStaticBatchBenchmark(int objectCount, int frameCount)
+{
+    SDL_GL_SetSwapInterval(0);
+    int mesh = loadMesh("objFiles/cube.obj");
+    if(materialTextures.empty())
+    {
+        loadMaterialTextures();
+    }
+    vector<glm::mat4> offsets;
+    buildObjectOffsets(objectCount, offsets);
+    for(int i=0; i<objectCount; i++)
+    {
+        scene.setStatic(scene.addObject(mesh, offsets[i + 1], i % materialCount()), true);
+    }
+
+    cout << "Static batching benchmark, " << objectCount << " static objects over " << materialCount()
+         << " materials, " << frameCount << " frames" << endl;
+    bool wasBatching = useStaticBatching;
+    for(int batching=0; batching<2; batching++)
+    {
+        // The first frame bakes the batches, it's left out of the timings
+        useStaticBatching = (batching == 1);
+        render();
+        glFinish();
+
+        double submitTotal = 0.0;
+        int drawCalls = 0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(int frame=0; frame<frameCount; frame++)
+        {
+            SDL_PumpEvents();
+            render();
+            submitTotal += frameStats.submitMs;
+            drawCalls = frameStats.drawCalls;
+        }
+        glFinish();
+        double totalMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+        cout << "\tStatic batching " << (batching ? "on" : "off") << ": " << drawCalls << " draw calls, "
+             << totalMs / frameCount << " ms per frame, " << submitTotal / frameCount << " ms CPU" << endl;
+        if(batching)
+        {
+            cout << "\t" << staticBatches.lastObjectCount << " objects merged into " << staticBatches.lastBatchCount
+                 << " batches of " << staticBatches.lastVertexCount << " vertices in " << staticBatches.lastBuildMs
+                 << " ms" << endl;
+        }
+    }
+
+    useStaticBatching = false;
+    render();
+    useStaticBatching = wasBatching;
+    scene.clearObjects();
+    SDL_GL_SetSwapInterval(1);
+}
@@ -4,13 +4,96 @@
 #include <GL/glew.h>
 #include <glm/glm/gtc/matrix_transform.hpp>
 #include "geometry.h"
+#include "virtualtexture.h"
+#include "atlas.h"
+#include "shaderprogram.h"
+#include "uniformbuffer.h"
+#include "mesh.h"
+#include "scene.h"
+#include "transform.h"
+#include "framequeue.h"
+#include "renderqueue.h"
+#include "drawlist.h"
+#include "occlusionquery.h"
+#include "scenefile.h"
+#include "picking.h"
+#include "clusteredlights.h"
+#include "gbuffer.h"
+#include "pipelinestats.h"
+#include "staticbatch.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Uniform locations of the simple.vert/simple.frag programs (every variant), resolved once after
+// linking. Uniforms which a variant doesn't use are -1
+struct SimpleProgram
+{
+    ShaderProgram program;
+    GLint objectColor;
+    GLint viewPos;
+    GLint objectLights;
+    GLint objectLightCount;
+    GLint addNormalMap;
+    GLint model;
+    GLint mvp;
+    GLint trans;
+    GLint ourTexture;
+    GLint ourTextureMap;
+    GLint atlasRegion;
+    GLint atlasRegions;
+    GLint clipToScene;
+    VirtualTextureUniforms virtualTexture;
+
+    void load(const char* vertFilename, const char* fragFilename, const char* defines="");
+};
+
+struct FrameStats
+{
+    int uniformUploads;
+    int uniformsSkipped;
+    int drawCalls;
+    int instancesDrawn;
+    int matrixRebuilds;
+    Uint32 latchTicks;        // SDL time the frame sampled its input
+    Uint32 latchedInputTicks; // Oldest key press sampled before it was handled, 0 if none
+    double frameQueueWaitMs;  // Spent waiting for the GPU to catch up (low latency mode)
+    int stateCallsIssued;     // Binds/enables that reached GL
+    int stateCallsFiltered;   // Binds/enables found redundant by the state cache
+    int sceneObjectsDrawn;    // Those left after frustum culling
+    int sceneObjectCount;
+    double cullNsPerObject;
+    int graphNodesUpdated;     // World matrices recomputed, only below the nodes that changed
+    double graphUpdateMs;
+    double hierarchyUpdateMs;  // Refitting or rebuilding the scene BVH, 0 when nothing moved
+    int hierarchyNodesVisited;
+    int occludedObjects;       // Passed the frustum test but hidden behind the occluders
+    int occluderTriangles;
+    double occlusionMs;        // Rasterizing the occluders and testing against them
+    int conditionalDraws;      // Large objects drawn conditionally on last frame's box query
+    int queriesIssued;
+    int queryResultsHidden;    // Of the last frame's queries, read back without waiting
+    int queryResultsRead;
+    int queryResultsPending;   // Not ready yet when this frame started
+    int materialSwitches;     // Between consecutive scene object draws
+    int meshSwitches;
+    int vertexArrayBinds;     // By the scene objects' draws, 1 from the buffer arena
+    int lightsShaded;         // Summed over the draws, each shades at most MAX_OBJECT_LIGHTS
+    int prepassDraws;         // Depth only, not in drawCalls
+    double sortMs;
+    double drawListMs;        // Building the scene objects' commands, on the worker threads
+    double submitMs;       // CPU time spent in render() before the swap
+    double uniformWaitMs;  // Part of it spent waiting on uniform ring buffer fences
+};
 
 class OpenGLWindow
 {
 public:
     OpenGLWindow();
 
-    void initGL();
+    // The scene file lists the model, materials, objects and lights, see SceneFile
+    void initGL(bool hidden=false, const char* sceneFilename="default.scene");
     void render();
     void resetVariables();
     bool handleEvent(SDL_Event e);
@@ -23,26 +106,96 @@ public:
     void addExtraObject(SDL_Event e);
     void handleLightPositionEvent(SDL_Event e);
     void handleTextureChangeEvent(SDL_Event e);
+    void handleVirtualTextureEvent(SDL_Event e);
+    void handleStatsEvent(SDL_Event e);
+    void handleUniformBlockEvent(SDL_Event e);
+    void printStats();
+    void runUniformStressTest(int objectCount, int frameCount=300);
+    void handleInstanceEvent(SDL_Event e);
+    void handleLatencyEvent(SDL_Event e);
+    void handleStateCacheEvent(SDL_Event e);
+    void handleWorkerThreadEvent(SDL_Event e);
+    void handleCullingEvent(SDL_Event e);
+    void handlePickEvent(SDL_Event e);
+    void setWorkerThreads(int threadCount);
+    void setLowLatency(bool enabled, int maxFramesInFlight=1);
+    const FrameStats& stats();
+    void buildInstanceGrid(int mesh, int count);
+    void runInstanceBenchmark(const char* objFilename, int instanceCount, int frameCount=300);
+    void runSortBenchmark(int objectCount, int frameCount=200);
+    void runOcclusionBenchmark(int objectCount, int frameCount=200);
+    void runQueryBenchmark(int objectCount, int frameCount=200);
+    void runShadingBenchmark(int frameCount=100);
+    bool runVirtualTextureCheck();
+    void runPrepassBenchmark(int objectCount, int frameCount=200);
+    void runStaticBatchBenchmark(int objectCount, int frameCount=200);
+    void runArenaBenchmark(int objectCount, int frameCount=200);
     GLuint loadTexture(const char*,GLuint textureID);
+    GLuint textureFile(const std::string& filename);
+    int loadMesh(const std::string& objFilename);
+    int materialCount();
+    void loadMaterial(int material);
+    bool openVirtualTexture();
+    // Whether frames keep changing without input (virtual texture pages streaming in)
+    bool isAnimating();
     void cleanup();
 
 private:
+    void setSharedUniforms(SimpleProgram* program);
+    void setObjectLights(SimpleProgram* program, const ObjectLights& lights);
+    void bindClusters(SimpleProgram* program);
+    void shadeDeferred(const glm::mat4& viewModel);
+    void updateLights(unsigned int changes, const glm::mat4& model, const glm::mat4& transform);
+    void moveLight(int light, const glm::vec3& offset);
+    void latchInput();
+    void loadMaterialTextures();
+    void populateScene();
+    void addWallScene(int objectCount, const char* meshFile, const char* otherMeshFile);
+    void drawDepthPrepass(const glm::mat4& model, const glm::mat4& viewModel, const glm::mat4& transform);
+    void setDepthEqual(bool equal);
+    void updateStaticBatches(const glm::mat4& shared);
+    void buildSceneObjects(const glm::mat4& model, const glm::mat4& viewModel, const glm::mat4& transform);
+    void drawSceneObjects(SimpleProgram* objectShader, const glm::mat4& model);
+
     SDL_Window* sdlWin;
 
-    GLuint vao;
-    GLuint shader;
+    SimpleProgram shader;
+    SimpleProgram virtualTextureShader;
+    SimpleProgram feedbackShader;
+    SimpleProgram atlasShader;
+    SimpleProgram uniformBlockShader;
+    SimpleProgram instancedShader;
+    SimpleProgram instancedAtlasShader;
+    SimpleProgram boundsShader;
+    SimpleProgram clusteredShader;
+    SimpleProgram instancedClusteredShader;
+    SimpleProgram deferredShader;          // Writes the G-buffer
+    SimpleProgram instancedDeferredShader;
+    SimpleProgram deferredLightShader;     // The fullscreen lighting pass reading it
+    SimpleProgram depthShader;             // The depth pre-pass, positions only
+    SimpleProgram instancedDepthShader;
+    UniformRingBuffer uniformRing;
+    GLuint lightsBuffer; // The LightsBlock every program reads, uploaded when the lights change
+    FrameStats frameStats;
     GLuint diffuseMap;
     GLuint normalMap;
-    GLuint vertexBuffer;
-    GLuint normalBuffer;
-    GLuint vertexBuffer2;
-    GLuint bitangentBuffer;
-    GLuint textures[2];
-    GLuint tangentBuffer;
-    GLuint textureBuffer;
-    GLuint textureNormBuffer;
     GeometryData object;
-    GeometryData object2;
+    Mesh objectMesh;
+    int modelMesh; // The scene mesh the model was loaded into
+    Scene scene;
+    RenderQueue renderQueue;
+    DrawListBuilder drawList;
+    OcclusionQueries occlusionQueries;
+    bool useQueries;
+    ScenePicker picker;
+    std::vector<GLuint> materialTextures; // Diffuse and normal map of every material, for the scene objects
+    SceneFile sceneFile;
+    std::map<std::string, GLuint> textureFiles; // Every image loaded so far, by filename
+    std::map<std::string, int> meshFiles;       // Scene mesh of every OBJ file loaded so far
+    VirtualTexture virtualTexture;
+    TextureAtlas textureAtlas;
+    const char* diffuseFilename;
+    const char* normalFilename;
     float radian;
 
     const float cameraSpeed = 0.05f;
@@ -53,8 +206,20 @@ private:
 
     float pan;
     float r,g,b;
-    bool extraImage;
+    bool showInstances;
+    bool lowLatency;
+    FrameQueue frameQueue;
+    Uint64 lastLatchTime;
     bool addNormalMap;
+    bool useVirtualTexture;
+    bool useTextureAtlas;
+    bool useUniformBlocks;
+    int stressObjectCount;                // Extra copies of the object drawn around it
+    std::vector<glm::mat4> objectOffsets; // Per object translation, the first is the object itself
+    std::vector<GLintptr> objectBlocks;   // Ring buffer offset of every object's block this frame
+    std::vector<glm::mat4> objectTransforms; // Cached per object trans and mvp, see render()
+    std::vector<glm::mat4> objectMvps;
+    TransformCache transforms;
 
     float transx;
     float transy;
@@ -63,13 +228,26 @@ private:
     float ry;
     float rz;
     float s;
-    float lightx;
-    float lighty;
-    float lightz;
-    float lightx2;
-    float lighty2;
-    float lightz2;
+    std::vector<SceneLight> lights;        // In the space the objects are placed in, see simple.vert
+    int lightsRevision;                    // Changes whenever a light moves
+    int uploadedLightsRevision;
+    glm::vec3 lightingViewPos;             // The camera in the lights' space
+    std::vector<ObjectLights> objectLights; // Of the model and its copies, by objectOffsets index
+    ObjectLights instanceLights;           // Shared by all the instances, picked around all of them
+    int instanceLightsCount;               // Instances instanceLights was picked for
+    ClusteredLights clusteredLights;
+    bool useClusteredShading;
+    GBuffer gBuffer;
+    bool useDeferredShading;
+    bool useDepthPrepass;
+    bool depthPrepassed;       // This frame's draws test for the pre-pass's depths
+    PipelineStatistics pipelineStats;
+    StaticBatches staticBatches;
+    bool useStaticBatching;
+    bool useBufferArena;       // Scene objects drawn from the scene's buffer arena, see BufferArena
+    glm::mat4 lastShared;      // transform * model of the last frame, batches wait for it to settle
     int textureCount;
+    int currentMaterial;
 };
 
 #endif
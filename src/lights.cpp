@@ -0,0 +1,77 @@
+#include <math.h>
+
+#include <algorithm>
+
+#include "lights.h"
+
+using namespace std;
+
+void selectLights(const vector<SceneLight>& lights, const glm::vec3& boxMin, const glm::vec3& boxMax,
+                  ObjectLights& selected)
+{
+    // Unused entries are zeroed so lists with the same lights compare equal
+    float distances[MAX_OBJECT_LIGHTS];
+    selected.count = 0;
+    for(int i=0; i<MAX_OBJECT_LIGHTS; i++)
+    {
+        selected.indices[i] = 0;
+    }
+    int lightCount = min((int)lights.size(), MAX_LIGHTS);
+    for(int i=0; i<lightCount; i++)
+    {
+        const SceneLight& light = lights[i];
+        glm::vec3 offset = light.position - glm::max(boxMin, glm::min(light.position, boxMax));
+        float distance = glm::dot(offset, offset);
+        if((light.range > 0.0f) && (distance >= light.range * light.range))
+        {
+            continue;
+        }
+
+        // Insertion into the list sorted by distance, dropping the furthest when it's full
+        int slot = selected.count;
+        if(slot == MAX_OBJECT_LIGHTS)
+        {
+            if(distance >= distances[slot - 1])
+            {
+                continue;
+            }
+            slot--;
+        }
+        else
+        {
+            selected.count++;
+        }
+        while((slot > 0) && (distances[slot - 1] > distance))
+        {
+            distances[slot] = distances[slot - 1];
+            selected.indices[slot] = selected.indices[slot - 1];
+            slot--;
+        }
+        distances[slot] = distance;
+        selected.indices[slot] = i;
+    }
+}
+
+// The positions come from a hash of the light and axis rather than rand(), and the hues are spread
+// by the golden ratio so neighbours differ
+void scatterLights(vector<SceneLight>& lights, int count, const glm::vec3& center, const glm::vec3& size,
+                   float range)
+{
+    for(int i=0; i<count; i++)
+    {
+        SceneLight light;
+        for(int axis=0; axis<3; axis++)
+        {
+            unsigned int hash = (unsigned int)(i*3 + axis) * 2654435761u;
+            hash ^= hash >> 15;
+            hash *= 2246822519u;
+            hash ^= hash >> 13;
+            light.position[axis] = center[axis] + ((hash & 0xFFFF) / 65535.0f - 0.5f) * size[axis];
+        }
+        float hue = fmod(i * 0.618034f, 1.0f) * 6.0f;
+        light.color = glm::vec3(fabs(hue - 3.0f) - 1.0f, 2.0f - fabs(hue - 2.0f), 2.0f - fabs(hue - 4.0f));
+        light.color = glm::max(glm::vec3(0.0f), glm::min(light.color, glm::vec3(1.0f)));
+        light.range = range;
+        lights.push_back(light);
+    }
+}
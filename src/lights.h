@@ -0,0 +1,39 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+// Lights in the Lights block, and lights shaded by one draw. Both are also defined in the shaders
+const int MAX_LIGHTS = 64;
+const int MAX_OBJECT_LIGHTS = 8;
+
+// A point light in the space the objects are placed in (before the model matrix in front of the
+// view). Its contribution fades to nothing at range, a range of 0 reaches everything
+struct SceneLight
+{
+    glm::vec3 position;
+    glm::vec3 color;
+    float range;
+};
+
+// Indices into the scene's lights of those a draw shades, nearest first
+struct ObjectLights
+{
+    int count;
+    int indices[MAX_OBJECT_LIGHTS];
+};
+
+// NOTE: Picks the lights whose range reaches a box. When more than MAX_OBJECT_LIGHTS do, the
+//       nearest ones are kept, so a draw's shading cost only grows with the lights around it and
+//       is bounded whatever the scene holds. Only the first MAX_LIGHTS lights are considered
+void selectLights(const std::vector<SceneLight>& lights, const glm::vec3& boxMin, const glm::vec3& boxMax,
+                  ObjectLights& selected);
+
+// Adds count lights of the given range scattered through a box, in many colours. The same
+// arguments always give the same lights
+void scatterLights(std::vector<SceneLight>& lights, int count, const glm::vec3& center, const glm::vec3& size,
+                   float range);
+
+#endif
@@ -1,8 +1,12 @@
 #include "SDL.h"
 
 #include "glwindow.h"
+#include "framepacer.h"
 
 #include "iostream"
+#include <cmath>
+#include <string.h>
+#include <stdlib.h>
 
 // In order to make cross-platform development and deployment easy, SDL implements its own main
 // function, and instead calls out to our code at this SDL_main, however on linux this is not
@@ -15,6 +19,49 @@ int SDL_main(int argc, char** argv)
 #endif
 {
 
+    // Offline tiling of an image into a virtual texture page file, no window needed
+    if((argc >= 4) && (strcmp(argv[1], "--build-pages") == 0))
+    {
+        int pageSize = (argc >= 5) ? atoi(argv[4]) : 128;
+        return VirtualTexture::buildPageFile(argv[2], argv[3], pageSize) ? 0 : 1;
+    }
+
+    // Scaling of the draw list build with worker threads, over N objects, no window needed
+    if((argc >= 3) && (strcmp(argv[1], "--bench-drawlist") == 0))
+    {
+        DrawListBuilder::runBenchmark(atoi(argv[2]));
+        return 0;
+    }
+
+    // Build, refit and query times of the scene BVH over N objects, no window needed
+    if((argc >= 3) && (strcmp(argv[1], "--bench-bvh") == 0))
+    {
+        SceneBVH::runBenchmark(atoi(argv[2]));
+        return 0;
+    }
+
+    // World matrix updates of a scene graph of N nodes, no window needed
+    if((argc >= 3) && (strcmp(argv[1], "--bench-scenegraph") == 0))
+    {
+        SceneGraph::runBenchmark(atoi(argv[2]));
+        return 0;
+    }
+
+    // Triangle BVH build times and ray throughput over an OBJ file and synthetic meshes of a
+    // million triangles, no window needed
+    if((argc >= 2) && (strcmp(argv[1], "--bench-meshbvh") == 0))
+    {
+        MeshBVH::runBenchmark((argc >= 3) ? argv[2] : "objFiles/sample-bunny.obj");
+        return 0;
+    }
+
+    // Clustered assignment times of N moving lights over every thread count, no window needed
+    if((argc >= 3) && (strcmp(argv[1], "--bench-clusters") == 0))
+    {
+        ClusteredLights::runBenchmark(atoi(argv[2]));
+        return 0;
+    }
+
     if(SDL_Init(SDL_INIT_VIDEO) != 0)
     {
         std::cout << "Error: " << SDL_GetError() << std::endl;
@@ -22,16 +69,162 @@ int SDL_main(int argc, char** argv)
         return 1;
     } 
 
+    // --hidden never shows the window, for the benchmarks on a machine without a display (with a
+    // software GL, see the README). --scene loads another scene file than default.scene
+    bool hidden = false;
+    const char* sceneFilename = "default.scene";
+    for(int i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i], "--hidden") == 0)
+        {
+            hidden = true;
+        }
+        else if((strcmp(argv[i], "--scene") == 0) && (i+1 < argc))
+        {
+            sceneFilename = argv[i+1];
+        }
+    }
+
     OpenGLWindow window;
-    window.initGL();
+    window.initGL(hidden, sceneFilename);
+
+    // Compares glUniform* against the uniform ring buffer with N extra objects, then exits
+    if((argc >= 3) && (strcmp(argv[1], "--stress-ubo") == 0))
+    {
+        window.runUniformStressTest(atoi(argv[2]));
+        window.cleanup();
+        SDL_Quit();
+        return 0;
+    }
+
+    // Render queue sort modes with N objects over every material, then exits
+    if((argc >= 3) && (strcmp(argv[1], "--bench-sort") == 0))
+    {
+        window.runSortBenchmark(atoi(argv[2]));
+        window.cleanup();
+        SDL_Quit();
+        return 0;
+    }
+
+    // Software occlusion culling of N objects behind a wall, then exits
+    if((argc >= 3) && (strcmp(argv[1], "--bench-occlusion") == 0))
+    {
+        window.runOcclusionBenchmark(atoi(argv[2]));
+        window.cleanup();
+        SDL_Quit();
+        return 0;
+    }
+
+    // Hardware occlusion queries over N large objects behind a wall, then exits
+    if((argc >= 3) && (strcmp(argv[1], "--bench-queries") == 0))
+    {
+        window.runQueryBenchmark(atoi(argv[2]));
+        window.cleanup();
+        SDL_Quit();
+        return 0;
+    }
+
+    // The depth pre-pass over N objects behind a wall, then exits
+    if((argc >= 3) && (strcmp(argv[1], "--bench-prepass") == 0))
+    {
+        window.runPrepassBenchmark(atoi(argv[2]));
+        window.cleanup();
+        SDL_Quit();
+        return 0;
+    }
+
+    // N static objects drawn one by one and then merged into static batches, then exits
+    if((argc >= 3) && (strcmp(argv[1], "--bench-static") == 0))
+    {
+        window.runStaticBatchBenchmark(atoi(argv[2]));
+        window.cleanup();
+        SDL_Quit();
+        return 0;
+    }
+
+    // N objects drawn with and without the buffer arena, then mesh load/unload churn, then exits
+    if((argc >= 3) && (strcmp(argv[1], "--bench-arena") == 0))
+    {
+        window.runArenaBenchmark(atoi(argv[2]));
+        window.cleanup();
+        SDL_Quit();
+        return 0;
+    }
+
+    // Uploads two virtual texture pages in a row and checks both layers' caches, then exits
+    if((argc >= 2) && (strcmp(argv[1], "--check-vt") == 0))
+    {
+        bool passed = window.runVirtualTextureCheck();
+        window.cleanup();
+        SDL_Quit();
+        return passed ? 0 : 1;
+    }
+
+    // Forward, clustered and deferred shading of a floor under 16 to 4096 lights, then exits
+    if((argc >= 2) && (strcmp(argv[1], "--bench-shading") == 0))
+    {
+        window.runShadingBenchmark();
+        window.cleanup();
+        SDL_Quit();
+        return 0;
+    }
+
+    // Instanced throughput, N instances of an OBJ file, then exits
+    if((argc >= 4) && (strcmp(argv[1], "--bench-instances") == 0))
+    {
+        window.runInstanceBenchmark(argv[3], atoi(argv[2]));
+        window.cleanup();
+        SDL_Quit();
+        return 0;
+    }
     
+    // --loop vsync|on-demand|limited|uncapped, --fps N sets the limited mode's target
+    FramePacer pacer;
+    LoopMode loopMode = LOOP_VSYNC;
+    for(int i=1; i<argc-1; i++)
+    {
+        if(strcmp(argv[i], "--loop") == 0)
+        {
+            for(int mode=0; mode<LOOP_MODE_COUNT; mode++)
+            {
+                if(strcmp(argv[i+1], FramePacer::modeName((LoopMode)mode)) == 0)
+                {
+                    loopMode = (LoopMode)mode;
+                }
+            }
+        }
+        else if(strcmp(argv[i], "--fps") == 0)
+        {
+            char* end;
+            double fps = strtod(argv[i+1], &end);
+            if((end == argv[i+1]) || (*end != '\0') || !std::isfinite(fps) || (fps <= 0.0))
+            {
+                std::cout << "Invalid frame rate for --fps: " << argv[i+1] << ", keeping the default" << std::endl;
+            }
+            else
+            {
+                pacer.setTargetFrameTime(1000.0 / fps);
+            }
+        }
+        else if(strcmp(argv[i], "--low-latency") == 0)
+        {
+            window.setLowLatency(true, atoi(argv[i+1]));
+        }
+        else if(strcmp(argv[i], "--threads") == 0)
+        {
+            window.setWorkerThreads(atoi(argv[i+1]));
+        }
+    }
+    pacer.setMode(loopMode);
+
     bool running = true;
     while(running)
     {
         // Check for a quit event before passing to the GLWindow
         SDL_Event e;
-        while(SDL_PollEvent(&e))
+        while(pacer.nextEvent(e, window.isAnimating()))
         {
+            pacer.inputReceived(e);
             if(e.type == SDL_QUIT)
             {
                 running = false;
@@ -50,12 +243,37 @@ int SDL_main(int argc, char** argv)
             window.addExtraObject(e);
             window.handleLightPositionEvent(e);
             window.handleTextureChangeEvent(e);
-            
+            window.handleVirtualTextureEvent(e);
+            window.handleStatsEvent(e);
+            window.handleUniformBlockEvent(e);
+            window.handleInstanceEvent(e);
+            window.handleLatencyEvent(e);
+            window.handleStateCacheEvent(e);
+            window.handleWorkerThreadEvent(e);
+            window.handleCullingEvent(e);
+            window.handlePickEvent(e);
+
+            if(e.type == SDL_KEYDOWN)
+            {
+                if(e.key.keysym.sym == SDLK_p)
+                {
+                    pacer.printStats();
+                }
+                else if(e.key.keysym.sym == SDLK_0)
+                {
+                    // Report on the mode we're leaving, the stats restart with the next one
+                    pacer.printStats();
+                    pacer.setMode((LoopMode)((pacer.getMode() + 1) % LOOP_MODE_COUNT));
+                    std::cout << "Loop mode: " << FramePacer::modeName(pacer.getMode()) << std::endl;
+                }
+            }
         }
-        window.render();
 
-        // We sleep for 10ms here so as to prevent excessive CPU usage
-        SDL_Delay(10);
+        if(pacer.shouldRender())
+        {
+            window.render();
+            pacer.framePresented(window.stats().latchTicks, window.stats().latchedInputTicks);
+        }
     }
 
     window.cleanup();
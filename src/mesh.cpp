@@ -0,0 +1,92 @@
+#include <stddef.h>
+
+#include "mesh.h"
+#include "glstate.h"
+
+Mesh::Mesh()
+{
+    vao = 0;
+    depthVao = 0;
+    count = 0;
+    for(int i=0; i<5; i++)
+    {
+        buffers[i] = 0;
+    }
+}
+
+void Mesh::upload(GeometryData& geometry)
+{
+    destroy();
+    count = geometry.vertexCount();
+    if(count == 0)
+    {
+        return;
+    }
+
+    glGenVertexArrays(1, &vao);
+    glState.bindVertexArray(vao);
+    glGenBuffers(5, buffers);
+
+    void* data[5] = {geometry.vertexData(), geometry.normalData(), geometry.textureCoordData(),
+                     geometry.tangentData(), geometry.bitangentData()};
+    GLuint locations[5] = {POSITION_LOCATION, NORMAL_LOCATION, TEXTURE_LOCATION,
+                           TANGENT_LOCATION, BITANGENT_LOCATION};
+    int components[5] = {3, 3, 2, 3, 3};
+    for(int i=0; i<5; i++)
+    {
+        glState.bindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, count*sizeof(float)*components[i], data[i], GL_STATIC_DRAW);
+        glVertexAttribPointer(locations[i], components[i], GL_FLOAT, false, 0, 0);
+        glEnableVertexAttribArray(locations[i]);
+    }
+
+    glGenVertexArrays(1, &depthVao);
+    glState.bindVertexArray(depthVao);
+    glState.bindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+    glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, false, 0, 0);
+    glEnableVertexAttribArray(POSITION_LOCATION);
+    glState.bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Mesh::destroy()
+{
+    if(!vao)
+    {
+        return;
+    }
+    glState.deleteBuffers(5, buffers);
+    glState.deleteVertexArrays(1, &vao);
+    glState.deleteVertexArrays(1, &depthVao);
+    vao = 0;
+    depthVao = 0;
+    count = 0;
+}
+
+void Mesh::setInstanceBuffer(GLuint buffer)
+{
+    // The depth only array needs the transforms, not the materials
+    GLuint arrays[2] = {depthVao, vao};
+    for(int i=0; i<2; i++)
+    {
+        glState.bindVertexArray(arrays[i]);
+        glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+        for(int column=0; column<4; column++)
+        {
+            GLuint location = INSTANCE_TRANSFORM_LOCATION + column;
+            glVertexAttribPointer(location, 4, GL_FLOAT, false, sizeof(InstanceData),
+                                  (void*)(column*sizeof(glm::vec4)));
+            glVertexAttribDivisor(location, 1);
+            glEnableVertexAttribArray(location);
+        }
+    }
+    glVertexAttribPointer(INSTANCE_MATERIAL_LOCATION, 1, GL_FLOAT, false, sizeof(InstanceData),
+                          (void*)offsetof(InstanceData, material));
+    glVertexAttribDivisor(INSTANCE_MATERIAL_LOCATION, 1);
+    glEnableVertexAttribArray(INSTANCE_MATERIAL_LOCATION);
+    glState.bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int Mesh::vertexCount()
+{
+    return count;
+}
@@ -0,0 +1,49 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <GL/glew.h>
+#include <glm/glm/glm.hpp>
+
+#include "geometry.h"
+
+// Attribute locations, fixed by the layout qualifiers in simple.vert
+const GLuint POSITION_LOCATION = 0;
+const GLuint NORMAL_LOCATION = 1;
+const GLuint TEXTURE_LOCATION = 2;
+const GLuint TANGENT_LOCATION = 3;
+const GLuint BITANGENT_LOCATION = 4;
+const GLuint INSTANCE_TRANSFORM_LOCATION = 5; // A mat4 takes 4 locations, one per column
+const GLuint INSTANCE_MATERIAL_LOCATION = 9;
+
+// Per instance vertex attributes (INSTANCED variant of simple.vert)
+struct InstanceData
+{
+    glm::mat4 transform;
+    float material;
+};
+
+// NOTE: The GL side of a GeometryData, a vertex array with one buffer per attribute. An instance
+//       buffer of InstanceData can be attached, whose attributes advance once per instance
+//       rather than once per vertex. A second vertex array reads only the positions (and the
+//       instance transforms), so the depth pre-pass fetches 12 bytes a vertex instead of 56
+class Mesh
+{
+public:
+    Mesh();
+
+    void upload(GeometryData& geometry);
+    void destroy();
+
+    void setInstanceBuffer(GLuint buffer);
+
+    int vertexCount();
+
+    GLuint vao;
+    GLuint depthVao;
+
+private:
+    GLuint buffers[5];
+    int count;
+};
+
+#endif
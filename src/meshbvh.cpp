@@ -0,0 +1,886 @@
+#include <iostream>
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "SDL.h"
+
+#include "meshbvh.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MESH_BVH_SSE
+#endif
+
+using namespace std;
+
+// Centroid bins per axis when looking for the cheapest split
+const int BIN_COUNT = 16;
+// Ranges this small always become leaves, up to MAX_SAH_LEAF they do when splitting doesn't pay
+const int MIN_SPLIT_TRIANGLES = 4;
+const int MAX_SAH_LEAF = 16;
+// Costs of visiting a node and of testing a packet of triangles, relative to each other
+const float TRAVERSAL_COST = 1.0f;
+const float INTERSECTION_COST = 1.0f;
+// Below this depth ranges are split at the median instead, which bounds the depth of the tree
+// and so the traversal stack
+const int MAX_SAH_DEPTH = 64;
+const int TRAVERSAL_STACK = 128;
+// Ranges at least this big are binned by every worker, smaller ones by one thread
+const int PARALLEL_BIN_TRIANGLES = 65536;
+// With a pool the top levels are split until there are this many subtrees per worker, so a
+// worker done early can pick up another one
+const int SUBTREES_PER_WORKER = 4;
+const int MIN_SUBTREE_TRIANGLES = 4096;
+
+struct RangeBounds
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 centroidMin;
+    glm::vec3 centroidMax;
+};
+
+struct Bin
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    int count;
+};
+
+static double elapsedMs(Uint64 start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// Half the surface area, only ever compared
+static float halfArea(const glm::vec3& min, const glm::vec3& max)
+{
+    glm::vec3 size = max - min;
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static void emptyBounds(glm::vec3& min, glm::vec3& max)
+{
+    min = glm::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    max = glm::vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+static void growBounds(glm::vec3& min, glm::vec3& max, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    min = glm::min(min, boxMin);
+    max = glm::max(max, boxMax);
+}
+
+// 1/d, kept finite so a zero direction component never meets a zero coordinate in the slab test
+// as 0 * inf, a NaN that reads as a miss. A ray lying in a box's face plane then hits the box
+static float slabInverse(float d)
+{
+    return (fabs(d) > 1e-30f) ? 1.0f / d : copysignf(1e30f, d);
+}
+
+// Slab test without branches, with the origin already scaled by the inverse direction
+static bool rayHitsBox(const glm::vec3& scaledOrigin, const glm::vec3& inverseDirection, const glm::vec3& min,
+                       const glm::vec3& max, float maxDistance, float& entry)
+{
+    float x0 = min.x * inverseDirection.x - scaledOrigin.x;
+    float x1 = max.x * inverseDirection.x - scaledOrigin.x;
+    float y0 = min.y * inverseDirection.y - scaledOrigin.y;
+    float y1 = max.y * inverseDirection.y - scaledOrigin.y;
+    float z0 = min.z * inverseDirection.z - scaledOrigin.z;
+    float z1 = max.z * inverseDirection.z - scaledOrigin.z;
+    float enter = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+    float exit = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), maxDistance));
+    entry = enter;
+    return enter <= exit;
+}
+
+// Moeller-Trumbore on one triangle given as a vertex and two edges
+static bool rayHitsTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& v0,
+                            const glm::vec3& edge1, const glm::vec3& edge2, float& t, float& u, float& v)
+{
+    glm::vec3 p = glm::cross(direction, edge2);
+    float determinant = glm::dot(edge1, p);
+    if(fabs(determinant) < 1e-12f)
+    {
+        return false;
+    }
+    float inverse = 1.0f / determinant;
+    glm::vec3 toOrigin = origin - v0;
+    u = glm::dot(toOrigin, p) * inverse;
+    glm::vec3 q = glm::cross(toOrigin, edge1);
+    v = glm::dot(direction, q) * inverse;
+    t = glm::dot(edge2, q) * inverse;
+    return (u >= 0.0f) && (v >= 0.0f) && (u + v <= 1.0f) && (t > 0.0f);
+}
+
+MeshBVH::MeshBVH()
+{
+    lastBuildMs = 0.0;
+    triangles = 0;
+    treeDepth = 0;
+}
+
+void MeshBVH::build(GeometryData& geometry, WorkerPool* pool)
+{
+    build((const float*)geometry.vertexData(), geometry.vertexCount() / 3, pool);
+}
+
+void MeshBVH::build(const float* positions, int triangleCount, WorkerPool* pool)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    triangles = triangleCount;
+    treeDepth = 0;
+    nodes.clear();
+    packets.clear();
+    if(triangleCount <= 0)
+    {
+        triangles = 0;
+        lastBuildMs = elapsedMs(start);
+        return;
+    }
+
+    order.resize(triangleCount);
+    centroids.resize(triangleCount);
+    boxMins.resize(triangleCount);
+    boxMaxs.resize(triangleCount);
+    WorkerJob prepare = [&](int, int begin, int end)
+    {
+        for(int i=begin; i<end; i++)
+        {
+            const float* vertex = positions + i * 9;
+            glm::vec3 a(vertex[0], vertex[1], vertex[2]);
+            glm::vec3 b(vertex[3], vertex[4], vertex[5]);
+            glm::vec3 c(vertex[6], vertex[7], vertex[8]);
+            order[i] = i;
+            boxMins[i] = glm::min(a, glm::min(b, c));
+            boxMaxs[i] = glm::max(a, glm::max(b, c));
+            centroids[i] = (boxMins[i] + boxMaxs[i]) * 0.5f;
+        }
+    };
+    if(pool)
+    {
+        pool->run(triangleCount, prepare, MIN_SUBTREE_TRIANGLES);
+    }
+    else
+    {
+        prepare(0, 0, triangleCount);
+    }
+
+    nodes.assign(1, BVHNode());
+    BuildRange whole = {0, 0, triangleCount, 1};
+    int workers = pool ? pool->threadCount() : 1;
+    if(workers <= 1)
+    {
+        buildSubtree(nodes, whole, treeDepth);
+    }
+    else
+    {
+        // The top levels are split here, each split binned by every worker, until the ranges are
+        // small enough to hand out as subtrees
+        int subtreeSize = std::max(MIN_SUBTREE_TRIANGLES, triangleCount / (workers * SUBTREES_PER_WORKER));
+        vector<BuildRange> pending(1, whole);
+        vector<BuildRange> subtrees;
+        while(!pending.empty())
+        {
+            BuildRange range = pending.back();
+            pending.pop_back();
+            treeDepth = std::max(treeDepth, range.depth);
+            if(range.end - range.begin <= subtreeSize)
+            {
+                subtrees.push_back(range);
+                continue;
+            }
+            int middle;
+            if(split(nodes[range.node], range.begin, range.end, range.depth, middle, pool))
+            {
+                int left = nodes.size();
+                nodes.resize(left + 2);
+                nodes[range.node].first = left;
+                nodes[range.node].count = 0;
+                BuildRange leftRange = {left, range.begin, middle, range.depth + 1};
+                BuildRange rightRange = {left + 1, middle, range.end, range.depth + 1};
+                pending.push_back(leftRange);
+                pending.push_back(rightRange);
+            }
+            else
+            {
+                nodes[range.node].first = range.begin;
+                nodes[range.node].count = range.end - range.begin;
+            }
+        }
+
+        // Every worker takes the next subtree left, building it into its own array with the
+        // subtree's root first
+        vector<vector<BVHNode> > trees(subtrees.size());
+        vector<int> depths(subtrees.size(), 0);
+        atomic<int> next(0);
+        pool->run(workers, [&](int, int, int)
+        {
+            for(int i=next++; i<(int)subtrees.size(); i=next++)
+            {
+                BuildRange range = subtrees[i];
+                range.node = 0;
+                trees[i].assign(1, BVHNode());
+                buildSubtree(trees[i], range, depths[i]);
+            }
+        });
+
+        // Each subtree's root replaces its placeholder and the rest is appended, with the child
+        // indices moved along
+        for(size_t i=0; i<subtrees.size(); i++)
+        {
+            int offset = (int)nodes.size() - 1;
+            for(size_t j=0; j<trees[i].size(); j++)
+            {
+                BVHNode node = trees[i][j];
+                if(node.count == 0)
+                {
+                    node.first += offset;
+                }
+                if(j == 0)
+                {
+                    nodes[subtrees[i].node] = node;
+                }
+                else
+                {
+                    nodes.push_back(node);
+                }
+            }
+            treeDepth = std::max(treeDepth, depths[i]);
+        }
+    }
+
+    makePackets(positions);
+
+    vector<int>().swap(order);
+    vector<glm::vec3>().swap(centroids);
+    vector<glm::vec3>().swap(boxMins);
+    vector<glm::vec3>().swap(boxMaxs);
+    lastBuildMs = elapsedMs(start);
+}
+
+void MeshBVH::buildSubtree(vector<BVHNode>& tree, const BuildRange& range, int& maxDepth)
+{
+    vector<BuildRange> pending(1, range);
+    while(!pending.empty())
+    {
+        BuildRange current = pending.back();
+        pending.pop_back();
+        maxDepth = std::max(maxDepth, current.depth);
+        int middle;
+        if(split(tree[current.node], current.begin, current.end, current.depth, middle, NULL))
+        {
+            int left = tree.size();
+            tree.resize(left + 2);
+            tree[current.node].first = left;
+            tree[current.node].count = 0;
+            BuildRange leftRange = {left, current.begin, middle, current.depth + 1};
+            BuildRange rightRange = {left + 1, middle, current.end, current.depth + 1};
+            pending.push_back(leftRange);
+            pending.push_back(rightRange);
+        }
+        else
+        {
+            tree[current.node].first = current.begin;
+            tree[current.node].count = current.end - current.begin;
+        }
+    }
+}
+
+// Sets the node's bounds to the range's and returns whether it should be split, reordering the
+// range so the left child's triangles come before middle
+bool MeshBVH::split(BVHNode& node, int begin, int end, int depth, int& middle, WorkerPool* pool)
+{
+    int count = end - begin;
+    bool parallel = pool && (pool->threadCount() > 1) && (count >= PARALLEL_BIN_TRIANGLES);
+    int workers = parallel ? pool->threadCount() : 1;
+
+    // Workers left without a slice don't run, their partial bounds and bins stay empty
+    vector<RangeBounds> partialBounds(workers);
+    for(int i=0; i<workers; i++)
+    {
+        emptyBounds(partialBounds[i].min, partialBounds[i].max);
+        emptyBounds(partialBounds[i].centroidMin, partialBounds[i].centroidMax);
+    }
+    WorkerJob measure = [&](int worker, int sliceBegin, int sliceEnd)
+    {
+        RangeBounds& bounds = partialBounds[worker];
+        for(int i=begin+sliceBegin; i<begin+sliceEnd; i++)
+        {
+            int triangle = order[i];
+            growBounds(bounds.min, bounds.max, boxMins[triangle], boxMaxs[triangle]);
+            growBounds(bounds.centroidMin, bounds.centroidMax, centroids[triangle], centroids[triangle]);
+        }
+    };
+    if(parallel)
+    {
+        pool->run(count, measure);
+    }
+    else
+    {
+        measure(0, 0, count);
+    }
+    RangeBounds bounds = partialBounds[0];
+    for(int i=1; i<workers; i++)
+    {
+        growBounds(bounds.min, bounds.max, partialBounds[i].min, partialBounds[i].max);
+        growBounds(bounds.centroidMin, bounds.centroidMax, partialBounds[i].centroidMin, partialBounds[i].centroidMax);
+    }
+    node.min = bounds.min;
+    node.max = bounds.max;
+    if(count <= MIN_SPLIT_TRIANGLES)
+    {
+        return false;
+    }
+
+    glm::vec3 extent = bounds.centroidMax - bounds.centroidMin;
+    int longest = (extent.x >= extent.y) ? ((extent.x >= extent.z) ? 0 : 2) : ((extent.y >= extent.z) ? 1 : 2);
+    if((extent[longest] > 0.0f) && (depth < MAX_SAH_DEPTH))
+    {
+        // Every worker bins its slice along all three axes, then the bins are added up
+        glm::vec3 scale;
+        for(int axis=0; axis<3; axis++)
+        {
+            scale[axis] = (extent[axis] > 0.0f) ? BIN_COUNT / extent[axis] : 0.0f;
+        }
+        vector<Bin> partialBins(workers * 3 * BIN_COUNT);
+        for(size_t i=0; i<partialBins.size(); i++)
+        {
+            emptyBounds(partialBins[i].min, partialBins[i].max);
+            partialBins[i].count = 0;
+        }
+        WorkerJob bin = [&](int worker, int sliceBegin, int sliceEnd)
+        {
+            Bin* bins = &partialBins[worker * 3 * BIN_COUNT];
+            for(int i=begin+sliceBegin; i<begin+sliceEnd; i++)
+            {
+                int triangle = order[i];
+                for(int axis=0; axis<3; axis++)
+                {
+                    int index = std::min(BIN_COUNT - 1, (int)((centroids[triangle][axis] - bounds.centroidMin[axis]) * scale[axis]));
+                    Bin& target = bins[axis * BIN_COUNT + index];
+                    growBounds(target.min, target.max, boxMins[triangle], boxMaxs[triangle]);
+                    target.count++;
+                }
+            }
+        };
+        if(parallel)
+        {
+            pool->run(count, bin);
+        }
+        else
+        {
+            bin(0, 0, count);
+        }
+        for(int worker=1; worker<workers; worker++)
+        {
+            for(int i=0; i<3*BIN_COUNT; i++)
+            {
+                Bin& from = partialBins[worker * 3 * BIN_COUNT + i];
+                growBounds(partialBins[i].min, partialBins[i].max, from.min, from.max);
+                partialBins[i].count += from.count;
+            }
+        }
+
+        // Sweeps from both ends give the cost of every plane between two bins
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        int bestPlane = 0;
+        for(int axis=0; axis<3; axis++)
+        {
+            if(extent[axis] <= 0.0f)
+            {
+                continue;
+            }
+            const Bin* bins = &partialBins[axis * BIN_COUNT];
+            float rightCosts[BIN_COUNT];
+            glm::vec3 min, max;
+            emptyBounds(min, max);
+            int rightCount = 0;
+            for(int plane=BIN_COUNT-1; plane>0; plane--)
+            {
+                growBounds(min, max, bins[plane].min, bins[plane].max);
+                rightCount += bins[plane].count;
+                rightCosts[plane] = (rightCount > 0) ? halfArea(min, max) * rightCount : 0.0f;
+            }
+            emptyBounds(min, max);
+            int leftCount = 0;
+            for(int plane=1; plane<BIN_COUNT; plane++)
+            {
+                growBounds(min, max, bins[plane - 1].min, bins[plane - 1].max);
+                leftCount += bins[plane - 1].count;
+                if((leftCount == 0) || (leftCount == count))
+                {
+                    continue;
+                }
+                float cost = halfArea(min, max) * leftCount + rightCosts[plane];
+                if(cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestPlane = plane;
+                }
+            }
+        }
+
+        if(bestAxis >= 0)
+        {
+            // Triangles are tested a packet of 4 at a time, so a leaf costs its packet count
+            float splitCost = TRAVERSAL_COST + bestCost / halfArea(bounds.min, bounds.max) * INTERSECTION_COST / 4.0f;
+            float leafCost = ((count + 3) / 4) * INTERSECTION_COST;
+            if((count <= MAX_SAH_LEAF) && (splitCost >= leafCost))
+            {
+                return false;
+            }
+            float axisMin = bounds.centroidMin[bestAxis];
+            float axisScale = scale[bestAxis];
+            int* partition = std::partition(&order[0] + begin, &order[0] + end, [&](int triangle)
+            {
+                return std::min(BIN_COUNT - 1, (int)((centroids[triangle][bestAxis] - axisMin) * axisScale)) < bestPlane;
+            });
+            middle = partition - &order[0];
+            return true;
+        }
+    }
+
+    // All the centroids in one place or the tree getting too deep, the range is halved along
+    // its longest axis
+    if(count <= MAX_SAH_LEAF)
+    {
+        return false;
+    }
+    middle = begin + count / 2;
+    std::nth_element(&order[0] + begin, &order[0] + middle, &order[0] + end, [&](int a, int b)
+    {
+        return centroids[a][longest] < centroids[b][longest];
+    });
+    return true;
+}
+
+// Copies the leaf triangles into packets, leaf by leaf, and points the leaves at their packets
+void MeshBVH::makePackets(const float* positions)
+{
+    int packetCount = 0;
+    for(size_t i=0; i<nodes.size(); i++)
+    {
+        packetCount += (nodes[i].count + 3) / 4;
+    }
+    packets.resize(packetCount);
+
+    int packet = 0;
+    for(size_t i=0; i<nodes.size(); i++)
+    {
+        BVHNode& node = nodes[i];
+        if(node.count == 0)
+        {
+            continue;
+        }
+        int first = node.first;
+        node.first = packet;
+        for(int j=0; j<node.count; j+=4, packet++)
+        {
+            TrianglePacket& target = packets[packet];
+            for(int lane=0; lane<4; lane++)
+            {
+                int triangle = (j + lane < node.count) ? order[first + j + lane] : -1;
+                target.triangles[lane] = triangle;
+                for(int axis=0; axis<3; axis++)
+                {
+                    // Padding is a point triangle, its determinant is 0 and it is never hit
+                    const float* vertex = positions + std::max(triangle, 0) * 9;
+                    float v0 = (triangle >= 0) ? vertex[axis] : 0.0f;
+                    target.v0[axis][lane] = v0;
+                    target.edge1[axis][lane] = (triangle >= 0) ? vertex[3 + axis] - v0 : 0.0f;
+                    target.edge2[axis][lane] = (triangle >= 0) ? vertex[6 + axis] - v0 : 0.0f;
+                }
+            }
+        }
+    }
+}
+
+bool MeshBVH::raycast(const glm::vec3& origin, const glm::vec3& direction, TriangleHit& hit, float maxDistance) const
+{
+    return traverse(origin, direction, hit, maxDistance, false);
+}
+
+bool MeshBVH::intersects(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+{
+    TriangleHit hit;
+    return traverse(origin, direction, hit, maxDistance, true);
+}
+
+bool MeshBVH::traverse(const glm::vec3& origin, const glm::vec3& direction, TriangleHit& hit, float maxDistance,
+                       bool anyHit) const
+{
+    hit.triangle = -1;
+    hit.distance = maxDistance;
+    if(nodes.empty())
+    {
+        return false;
+    }
+    glm::vec3 inverseDirection(slabInverse(direction.x), slabInverse(direction.y), slabInverse(direction.z));
+    glm::vec3 scaledOrigin = origin * inverseDirection;
+
+#if defined(MESH_BVH_SSE)
+    __m128 originX = _mm_set1_ps(origin.x);
+    __m128 originY = _mm_set1_ps(origin.y);
+    __m128 originZ = _mm_set1_ps(origin.z);
+    __m128 directionX = _mm_set1_ps(direction.x);
+    __m128 directionY = _mm_set1_ps(direction.y);
+    __m128 directionZ = _mm_set1_ps(direction.z);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 epsilon = _mm_set1_ps(1e-12f);
+    __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+#endif
+
+    // Nodes waiting with the distance their box is entered at, nearer children are visited first
+    int stack[TRAVERSAL_STACK];
+    float entries[TRAVERSAL_STACK];
+    int top = 0;
+    float entry;
+    if(!rayHitsBox(scaledOrigin, inverseDirection, nodes[0].min, nodes[0].max, hit.distance, entry))
+    {
+        return false;
+    }
+    stack[top] = 0;
+    entries[top++] = entry;
+    while(top > 0)
+    {
+        top--;
+        if(entries[top] > hit.distance)
+        {
+            continue;
+        }
+        const BVHNode& node = nodes[stack[top]];
+        if(node.count > 0)
+        {
+            int packetEnd = node.first + (node.count + 3) / 4;
+            for(int p=node.first; p<packetEnd; p++)
+            {
+                const TrianglePacket& packet = packets[p];
+#if defined(MESH_BVH_SSE)
+                __m128 edge1X = _mm_loadu_ps(packet.edge1[0]);
+                __m128 edge1Y = _mm_loadu_ps(packet.edge1[1]);
+                __m128 edge1Z = _mm_loadu_ps(packet.edge1[2]);
+                __m128 edge2X = _mm_loadu_ps(packet.edge2[0]);
+                __m128 edge2Y = _mm_loadu_ps(packet.edge2[1]);
+                __m128 edge2Z = _mm_loadu_ps(packet.edge2[2]);
+
+                __m128 pX = _mm_sub_ps(_mm_mul_ps(directionY, edge2Z), _mm_mul_ps(directionZ, edge2Y));
+                __m128 pY = _mm_sub_ps(_mm_mul_ps(directionZ, edge2X), _mm_mul_ps(directionX, edge2Z));
+                __m128 pZ = _mm_sub_ps(_mm_mul_ps(directionX, edge2Y), _mm_mul_ps(directionY, edge2X));
+                __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, pX), _mm_mul_ps(edge1Y, pY)), _mm_mul_ps(edge1Z, pZ));
+                __m128 valid = _mm_cmpgt_ps(_mm_and_ps(determinant, absMask), epsilon);
+                __m128 inverse = _mm_div_ps(one, determinant);
+
+                __m128 toOriginX = _mm_sub_ps(originX, _mm_loadu_ps(packet.v0[0]));
+                __m128 toOriginY = _mm_sub_ps(originY, _mm_loadu_ps(packet.v0[1]));
+                __m128 toOriginZ = _mm_sub_ps(originZ, _mm_loadu_ps(packet.v0[2]));
+                __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(toOriginX, pX), _mm_mul_ps(toOriginY, pY)), _mm_mul_ps(toOriginZ, pZ)), inverse);
+
+                __m128 qX = _mm_sub_ps(_mm_mul_ps(toOriginY, edge1Z), _mm_mul_ps(toOriginZ, edge1Y));
+                __m128 qY = _mm_sub_ps(_mm_mul_ps(toOriginZ, edge1X), _mm_mul_ps(toOriginX, edge1Z));
+                __m128 qZ = _mm_sub_ps(_mm_mul_ps(toOriginX, edge1Y), _mm_mul_ps(toOriginY, edge1X));
+                __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qX), _mm_mul_ps(directionY, qY)), _mm_mul_ps(directionZ, qZ)), inverse);
+                __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)), _mm_mul_ps(edge2Z, qZ)), inverse);
+
+                valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+                valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+                valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+                valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, zero));
+                valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(hit.distance)));
+                int lanes = _mm_movemask_ps(valid);
+                if(lanes == 0)
+                {
+                    continue;
+                }
+                if(anyHit)
+                {
+                    return true;
+                }
+                float distances[4], us[4], vs[4];
+                _mm_storeu_ps(distances, t);
+                _mm_storeu_ps(us, u);
+                _mm_storeu_ps(vs, v);
+                for(int lane=0; lane<4; lane++)
+                {
+                    if((lanes & (1 << lane)) && (distances[lane] < hit.distance))
+                    {
+                        hit.triangle = packet.triangles[lane];
+                        hit.distance = distances[lane];
+                        hit.u = us[lane];
+                        hit.v = vs[lane];
+                    }
+                }
+#else
+                for(int lane=0; lane<4; lane++)
+                {
+                    if(packet.triangles[lane] < 0)
+                    {
+                        continue;
+                    }
+                    glm::vec3 v0(packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane]);
+                    glm::vec3 edge1(packet.edge1[0][lane], packet.edge1[1][lane], packet.edge1[2][lane]);
+                    glm::vec3 edge2(packet.edge2[0][lane], packet.edge2[1][lane], packet.edge2[2][lane]);
+                    float t, u, v;
+                    if(rayHitsTriangle(origin, direction, v0, edge1, edge2, t, u, v) && (t < hit.distance))
+                    {
+                        if(anyHit)
+                        {
+                            return true;
+                        }
+                        hit.triangle = packet.triangles[lane];
+                        hit.distance = t;
+                        hit.u = u;
+                        hit.v = v;
+                    }
+                }
+#endif
+            }
+            continue;
+        }
+
+        float leftEntry, rightEntry;
+        bool left = rayHitsBox(scaledOrigin, inverseDirection, nodes[node.first].min, nodes[node.first].max, hit.distance, leftEntry);
+        bool right = rayHitsBox(scaledOrigin, inverseDirection, nodes[node.first + 1].min, nodes[node.first + 1].max, hit.distance, rightEntry);
+        if(left && right)
+        {
+            bool leftNearer = leftEntry <= rightEntry;
+            stack[top] = leftNearer ? node.first + 1 : node.first;
+            entries[top++] = leftNearer ? rightEntry : leftEntry;
+            stack[top] = leftNearer ? node.first : node.first + 1;
+            entries[top++] = leftNearer ? leftEntry : rightEntry;
+        }
+        else if(left || right)
+        {
+            stack[top] = left ? node.first : node.first + 1;
+            entries[top++] = left ? leftEntry : rightEntry;
+        }
+    }
+    return hit.triangle >= 0;
+}
+
+int MeshBVH::nodeCount() const
+{
+    return nodes.size();
+}
+
+int MeshBVH::triangleCount() const
+{
+    return triangles;
+}
+
+int MeshBVH::depth() const
+{
+    return treeDepth;
+}
+
+float MeshBVH::sahCost() const
+{
+    if(nodes.empty())
+    {
+        return 0.0f;
+    }
+    // Every node is visited by the share of rays hitting its parent its area is, and leaves add
+    // their packet tests
+    double cost = 0.0;
+    float rootArea = halfArea(nodes[0].min, nodes[0].max);
+    for(size_t i=0; i<nodes.size(); i++)
+    {
+        float share = (rootArea > 0.0f) ? halfArea(nodes[i].min, nodes[i].max) / rootArea : 1.0f;
+        cost += share * ((nodes[i].count > 0) ? ((nodes[i].count + 3) / 4) * INTERSECTION_COST : TRAVERSAL_COST);
+    }
+    return cost;
+}
+
+const BVHNode& MeshBVH::root() const
+{
+    return nodes[0];
+}
+
+static float randomFloat(float min, float max)
+{
+    return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+// A terrain of a million well shaped triangles
+static void makeTerrain(vector<float>& positions)
+{
+    const int GRID = 708;
+    positions.clear();
+    positions.reserve(GRID * GRID * 18);
+    for(int z=0; z<GRID; z++)
+    {
+        for(int x=0; x<GRID; x++)
+        {
+            float corners[4][3];
+            for(int i=0; i<4; i++)
+            {
+                float cornerX = x + (i & 1);
+                float cornerZ = z + (i >> 1);
+                corners[i][0] = cornerX * 0.1f;
+                corners[i][1] = sinf(cornerX * 0.05f) * cosf(cornerZ * 0.07f) * 5.0f + sinf(cornerX * 0.31f + cornerZ * 0.23f) * 0.5f;
+                corners[i][2] = cornerZ * 0.1f;
+            }
+            const int indices[6] = {0, 2, 1, 1, 2, 3};
+            for(int i=0; i<6; i++)
+            {
+                positions.insert(positions.end(), corners[indices[i]], corners[indices[i]] + 3);
+            }
+        }
+    }
+}
+
+// A million small triangles scattered through a box, nothing for the splits to follow
+static void makeSoup(vector<float>& positions)
+{
+    const int TRIANGLES = 1000000;
+    positions.resize(TRIANGLES * 9);
+    for(int i=0; i<TRIANGLES; i++)
+    {
+        glm::vec3 center(randomFloat(-50.0f, 50.0f), randomFloat(-50.0f, 50.0f), randomFloat(-50.0f, 50.0f));
+        for(int j=0; j<9; j++)
+        {
+            positions[i * 9 + j] = center[j % 3] + randomFloat(-0.5f, 0.5f);
+        }
+    }
+}
+
+void MeshBVH::runBenchmark(const char* objFilename)
+{
+    const int RAY_COUNT = 1000000;
+    const int CHECKED_RAYS = 200;
+    srand(1);
+
+    int maxThreads = thread::hardware_concurrency();
+    maxThreads = (maxThreads < 1) ? 1 : maxThreads;
+    cout << "Mesh BVH benchmark, up to " << maxThreads << " threads, " << RAY_COUNT << " rays a mesh, "
+         << BIN_COUNT << " bins, "
+#if defined(MESH_BVH_SSE)
+         << "SSE"
+#else
+         << "scalar"
+#endif
+         << " triangle tests" << endl;
+
+    const int MESH_COUNT = 3;
+    vector<float> meshes[MESH_COUNT];
+    string names[MESH_COUNT] = {objFilename, "terrain", "triangle soup"};
+    GeometryData geometry;
+    geometry.loadFromOBJFile(objFilename);
+    const float* objPositions = (const float*)geometry.vertexData();
+    meshes[0].assign(objPositions, objPositions + (geometry.vertexCount() / 3) * 9);
+    makeTerrain(meshes[1]);
+    makeSoup(meshes[2]);
+
+    WorkerPool pool;
+    MeshBVH bvh;
+    for(int mesh=0; mesh<MESH_COUNT; mesh++)
+    {
+        const vector<float>& positions = meshes[mesh];
+        int triangleCount = positions.size() / 9;
+        if(triangleCount == 0)
+        {
+            cout << names[mesh] << ": no triangles, skipped" << endl;
+            continue;
+        }
+        cout << names[mesh] << ", " << triangleCount << " triangles" << endl;
+
+        double singleThreadMs = 0.0;
+        int threads = 1;
+        while(true)
+        {
+            pool.create(threads);
+            bvh.build(&positions[0], triangleCount, &pool);
+            if(threads == 1)
+            {
+                singleThreadMs = bvh.lastBuildMs;
+            }
+            cout << "\t" << threads << " threads: " << bvh.lastBuildMs << " ms build, " << singleThreadMs / bvh.lastBuildMs << "x" << endl;
+            pool.destroy();
+            if(threads >= maxThreads)
+            {
+                break;
+            }
+            threads = min(threads*2, maxThreads);
+        }
+        cout << "\t" << bvh.nodeCount() << " nodes, depth " << bvh.depth() << ", SAH cost " << bvh.sahCost()
+             << " against " << (triangleCount + 3) / 4 << " for testing every packet" << endl;
+
+        // Rays from a sphere around the mesh toward random points inside its box, a mix of hits,
+        // misses and grazing rays
+        const BVHNode& root = bvh.root();
+        glm::vec3 center = (root.min + root.max) * 0.5f;
+        float radius = glm::length(root.max - root.min);
+        vector<glm::vec3> origins(RAY_COUNT);
+        vector<glm::vec3> directions(RAY_COUNT);
+        for(int i=0; i<RAY_COUNT; i++)
+        {
+            glm::vec3 around(randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f));
+            origins[i] = center + glm::normalize(around + glm::vec3(0.0f, 0.0f, 1e-6f)) * radius;
+            glm::vec3 target(randomFloat(root.min.x, root.max.x), randomFloat(root.min.y, root.max.y), randomFloat(root.min.z, root.max.z));
+            directions[i] = glm::normalize(target - origins[i]);
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        int hits = 0;
+        for(int i=0; i<RAY_COUNT; i++)
+        {
+            TriangleHit hit;
+            hits += bvh.raycast(origins[i], directions[i], hit) ? 1 : 0;
+        }
+        double singleRayMs = elapsedMs(start);
+        cout << "\t1 thread: " << RAY_COUNT / (singleRayMs * 1000.0) << " Mrays/s, " << hits * 100.0 / RAY_COUNT << "% hit" << endl;
+
+        if(maxThreads > 1)
+        {
+            pool.create(maxThreads);
+            vector<int> workerHits(maxThreads, 0);
+            start = SDL_GetPerformanceCounter();
+            pool.run(RAY_COUNT, [&](int worker, int begin, int end)
+            {
+                for(int i=begin; i<end; i++)
+                {
+                    TriangleHit hit;
+                    workerHits[worker] += bvh.raycast(origins[i], directions[i], hit) ? 1 : 0;
+                }
+            });
+            double rayMs = elapsedMs(start);
+            pool.destroy();
+            cout << "\t" << maxThreads << " threads: " << RAY_COUNT / (rayMs * 1000.0) << " Mrays/s, "
+                 << singleRayMs / rayMs << "x" << endl;
+        }
+
+        // The closest hits against testing every triangle
+        int mismatches = 0;
+        for(int i=0; i<CHECKED_RAYS; i++)
+        {
+            TriangleHit hit;
+            bool found = bvh.raycast(origins[i], directions[i], hit);
+            float closest = FLT_MAX;
+            for(int triangle=0; triangle<triangleCount; triangle++)
+            {
+                const float* vertex = &positions[triangle * 9];
+                glm::vec3 v0(vertex[0], vertex[1], vertex[2]);
+                glm::vec3 edge1 = glm::vec3(vertex[3], vertex[4], vertex[5]) - v0;
+                glm::vec3 edge2 = glm::vec3(vertex[6], vertex[7], vertex[8]) - v0;
+                float t, u, v;
+                if(rayHitsTriangle(origins[i], directions[i], v0, edge1, edge2, t, u, v) && (t < closest))
+                {
+                    closest = t;
+                }
+            }
+            bool expected = closest < FLT_MAX;
+            if((found != expected) || (found && (fabs(hit.distance - closest) > 1e-4f * std::max(1.0f, closest))))
+            {
+                mismatches++;
+            }
+        }
+        cout << "\t" << mismatches << " of " << CHECKED_RAYS << " rays differing from testing every triangle" << endl;
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef MESH_BVH_H
+#define MESH_BVH_H
+
+#include <stdint.h>
+#include <float.h>
+
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+#include "geometry.h"
+#include "bvh.h"
+#include "workerpool.h"
+
+// The closest triangle along a ray. u and v weight the triangle's second and third vertices, the
+// first gets 1 - u - v
+struct TriangleHit
+{
+    int triangle;
+    float distance; // In units of the ray direction
+    float u;
+    float v;
+};
+
+// NOTE: A bounding volume hierarchy over the triangles of a mesh, for ray queries (picking,
+//       baking, collision). The nodes are the same 32 byte BVHNode as the scene BVH, children
+//       allocated together. The leaf triangles are copied into packets of 4 in SoA layout, a
+//       vertex and two edges each, so a ray is tested against 4 triangles at once with SSE.
+//
+//       The tree is built top down with a binned surface area heuristic: the centroids are
+//       binned along each axis and the split with the lowest estimated traversal cost is taken,
+//       or a leaf when splitting doesn't pay. Given a worker pool, the top levels are split on
+//       the calling thread (binning in parallel) until there are enough independent subtrees,
+//       which the workers then build on their own and are merged back into one array.
+//
+//       Queries don't touch the tree, several threads can trace rays through it at once
+class MeshBVH
+{
+public:
+    MeshBVH();
+
+    // positions are 3 floats a vertex, 3 vertices a triangle, as GeometryData keeps them
+    void build(const float* positions, int triangleCount, WorkerPool* pool=NULL);
+    void build(GeometryData& geometry, WorkerPool* pool=NULL);
+
+    // The closest hit within maxDistance, in units of the direction which doesn't need to be
+    // normalized. Both sides of the triangles are hit
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, TriangleHit& hit, float maxDistance=FLT_MAX) const;
+    // Whether anything is hit within maxDistance, stops at the first triangle found
+    bool intersects(const glm::vec3& origin, const glm::vec3& direction, float maxDistance=FLT_MAX) const;
+
+    int nodeCount() const;
+    int triangleCount() const;
+    int depth() const;
+    // Estimated cost of a ray through the tree, in node visits and packet tests, against
+    // triangleCount()/4 for testing every packet
+    float sahCost() const;
+    const BVHNode& root() const;
+
+    double lastBuildMs;
+
+    // Build times with every thread count up to the number of cores, and ray throughput, over an
+    // OBJ file and synthetic million triangle meshes, no window needed
+    static void runBenchmark(const char* objFilename);
+
+private:
+    struct TrianglePacket
+    {
+        float v0[3][4];  // x, y, z of 4 triangles
+        float edge1[3][4];
+        float edge2[3][4];
+        int triangles[4]; // -1 for padding, which can't be hit
+    };
+
+    struct BuildRange
+    {
+        int node;
+        int begin;
+        int end;
+        int depth;
+    };
+
+    bool traverse(const glm::vec3& origin, const glm::vec3& direction, TriangleHit& hit, float maxDistance,
+                  bool anyHit) const;
+    void buildSubtree(std::vector<BVHNode>& tree, const BuildRange& range, int& maxDepth);
+    bool split(BVHNode& node, int begin, int end, int depth, int& middle, WorkerPool* pool);
+    void makePackets(const float* positions);
+
+    std::vector<BVHNode> nodes;
+    std::vector<TrianglePacket> packets;
+    int triangles;
+    int treeDepth;
+
+    // Only used while building, by triangle
+    std::vector<int> order;
+    std::vector<glm::vec3> centroids;
+    std::vector<glm::vec3> boxMins;
+    std::vector<glm::vec3> boxMaxs;
+};
+
+#endif
@@ -0,0 +1,306 @@
+#include <math.h>
+#include <float.h>
+
+#include <algorithm>
+
+#include "SDL.h"
+#include "occlusion.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+using namespace std;
+
+const int TILE_SIZE = 32;
+
+OcclusionCuller::OcclusionCuller()
+{
+    triangleCount = 0;
+    lastRasterizeMs = 0.0;
+    width = 0;
+    height = 0;
+    tilesX = 0;
+    tilesY = 0;
+    setResolution(256, 192);
+}
+
+// Both sides are rounded up to whole tiles. The buffer doesn't need the window's aspect ratio,
+// clip space is stretched over whatever size it has
+void OcclusionCuller::setResolution(int width, int height)
+{
+    tilesX = max(1, (width + TILE_SIZE - 1) / TILE_SIZE);
+    tilesY = max(1, (height + TILE_SIZE - 1) / TILE_SIZE);
+    this->width = tilesX * TILE_SIZE;
+    this->height = tilesY * TILE_SIZE;
+    tileTriangles.assign(tilesX * tilesY, vector<int>());
+
+    levels.clear();
+    levelWidths.clear();
+    levelHeights.clear();
+    int levelWidth = this->width;
+    int levelHeight = this->height;
+    while(true)
+    {
+        levels.push_back(vector<float>(levelWidth * levelHeight, 1.0f));
+        levelWidths.push_back(levelWidth);
+        levelHeights.push_back(levelHeight);
+        if((levelWidth == 1) && (levelHeight == 1))
+        {
+            break;
+        }
+        levelWidth = (levelWidth + 1) / 2;
+        levelHeight = (levelHeight + 1) / 2;
+    }
+}
+
+void OcclusionCuller::begin(const glm::mat4& viewProjection)
+{
+    this->viewProjection = viewProjection;
+    triangles.clear();
+    for(size_t i=0; i<tileTriangles.size(); i++)
+    {
+        tileTriangles[i].clear();
+    }
+    fill(levels[0].begin(), levels[0].end(), 1.0f);
+    triangleCount = 0;
+}
+
+void OcclusionCuller::addOccluder(const float* positions, int vertexCount, const glm::mat4& clipTransform)
+{
+    for(int first=0; first+2<vertexCount; first+=3)
+    {
+        ScreenTriangle triangle;
+        bool clipped = false;
+        float minX = FLT_MAX;
+        float minY = FLT_MAX;
+        float maxX = -FLT_MAX;
+        float maxY = -FLT_MAX;
+        for(int vertex=0; vertex<3; vertex++)
+        {
+            const float* position = &positions[3*(first + vertex)];
+            glm::vec4 clip = clipTransform * glm::vec4(position[0], position[1], position[2], 1.0f);
+            if((clip.w <= 0.0f) || (clip.z < -clip.w))
+            {
+                clipped = true;
+                break;
+            }
+            float inverseW = 1.0f / clip.w;
+            triangle.x[vertex] = (clip.x * inverseW * 0.5f + 0.5f) * width;
+            triangle.y[vertex] = (clip.y * inverseW * 0.5f + 0.5f) * height;
+            triangle.z[vertex] = clip.z * inverseW * 0.5f + 0.5f;
+            minX = min(minX, triangle.x[vertex]);
+            minY = min(minY, triangle.y[vertex]);
+            maxX = max(maxX, triangle.x[vertex]);
+            maxY = max(maxY, triangle.y[vertex]);
+        }
+        if(clipped || (maxX <= 0.0f) || (maxY <= 0.0f) || (minX >= width) || (minY >= height))
+        {
+            continue;
+        }
+
+        int index = triangles.size();
+        triangles.push_back(triangle);
+        int tileX0 = max(0, (int)minX / TILE_SIZE);
+        int tileY0 = max(0, (int)minY / TILE_SIZE);
+        int tileX1 = min(tilesX - 1, (int)maxX / TILE_SIZE);
+        int tileY1 = min(tilesY - 1, (int)maxY / TILE_SIZE);
+        for(int tileY=tileY0; tileY<=tileY1; tileY++)
+        {
+            for(int tileX=tileX0; tileX<=tileX1; tileX++)
+            {
+                tileTriangles[tileY*tilesX + tileX].push_back(index);
+            }
+        }
+    }
+    triangleCount = triangles.size();
+}
+
+void OcclusionCuller::rasterize(WorkerPool& pool)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    pool.run(tilesX * tilesY, [&](int, int begin, int end)
+    {
+        for(int tile=begin; tile<end; tile++)
+        {
+            rasterizeTile(tile);
+        }
+    });
+    buildPyramid();
+    lastRasterizeMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// Edge functions and the depth plane are evaluated at the pixel centres. Only this tile's pixels
+// are written, so tiles can be rasterized in parallel without locking
+void OcclusionCuller::rasterizeTile(int tile)
+{
+    int tileLeft = (tile % tilesX) * TILE_SIZE;
+    int tileTop = (tile / tilesX) * TILE_SIZE;
+    float* depth = &levels[0][0];
+    const vector<int>& binned = tileTriangles[tile];
+    for(size_t i=0; i<binned.size(); i++)
+    {
+        const ScreenTriangle& triangle = triangles[binned[i]];
+        const float* x = triangle.x;
+        const float* y = triangle.y;
+        const float* z = triangle.z;
+        float area = (x[1] - x[0])*(y[2] - y[0]) - (x[2] - x[0])*(y[1] - y[0]);
+        if(area == 0.0f)
+        {
+            continue;
+        }
+
+        // Oriented so the inside is positive for either winding, both sides of an occluder count
+        float sign = (area > 0.0f) ? 1.0f : -1.0f;
+        float edgeA[3], edgeB[3], edgeC[3];
+        for(int edge=0; edge<3; edge++)
+        {
+            int next = (edge + 1) % 3;
+            edgeA[edge] = sign * (y[edge] - y[next]);
+            edgeB[edge] = sign * (x[next] - x[edge]);
+            edgeC[edge] = sign * (x[edge]*y[next] - x[next]*y[edge]);
+        }
+        float depthA = ((z[1] - z[0])*(y[2] - y[0]) - (z[2] - z[0])*(y[1] - y[0])) / area;
+        float depthB = ((x[1] - x[0])*(z[2] - z[0]) - (x[2] - x[0])*(z[1] - z[0])) / area;
+        float depthC = z[0] - depthA*x[0] - depthB*y[0];
+
+        // The start is rounded down to 4 pixels for the SIMD loop, the tile is a multiple of 4
+        int left = max(tileLeft, (int)min(min(x[0], x[1]), x[2])) & ~3;
+        int right = min(tileLeft + TILE_SIZE, (int)ceil(max(max(x[0], x[1]), x[2])));
+        int top = max(tileTop, (int)min(min(y[0], y[1]), y[2]));
+        int bottom = min(tileTop + TILE_SIZE, (int)ceil(max(max(y[0], y[1]), y[2])));
+        for(int row=top; row<bottom; row++)
+        {
+            float pixelY = row + 0.5f;
+            float* depthRow = &depth[row * width];
+#if defined(OCCLUSION_SSE)
+            const __m128 zero = _mm_setzero_ps();
+            __m128 rowE0 = _mm_set1_ps(edgeB[0]*pixelY + edgeC[0]);
+            __m128 rowE1 = _mm_set1_ps(edgeB[1]*pixelY + edgeC[1]);
+            __m128 rowE2 = _mm_set1_ps(edgeB[2]*pixelY + edgeC[2]);
+            __m128 rowDepth = _mm_set1_ps(depthB*pixelY + depthC);
+            for(int column=left; column<right; column+=4)
+            {
+                __m128 pixelX = _mm_add_ps(_mm_set1_ps((float)column), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[0]), pixelX), rowE0);
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[1]), pixelX), rowE1);
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[2]), pixelX), rowE2);
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(e0, zero), _mm_cmpgt_ps(e1, zero)), _mm_cmpgt_ps(e2, zero));
+                if(_mm_movemask_ps(inside) == 0)
+                {
+                    continue;
+                }
+                __m128 pixelDepth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthA), pixelX), rowDepth);
+                __m128 current = _mm_loadu_ps(&depthRow[column]);
+                __m128 nearest = _mm_min_ps(current, pixelDepth);
+                _mm_storeu_ps(&depthRow[column], _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+            }
+#else
+            for(int column=left; column<right; column++)
+            {
+                float pixelX = column + 0.5f;
+                bool inside = true;
+                for(int edge=0; edge<3; edge++)
+                {
+                    inside = inside && (edgeA[edge]*pixelX + edgeB[edge]*pixelY + edgeC[edge] > 0.0f);
+                }
+                if(inside)
+                {
+                    depthRow[column] = min(depthRow[column], depthA*pixelX + depthB*pixelY + depthC);
+                }
+            }
+#endif
+        }
+    }
+}
+
+void OcclusionCuller::buildPyramid()
+{
+    for(size_t level=1; level<levels.size(); level++)
+    {
+        const vector<float>& source = levels[level - 1];
+        int sourceWidth = levelWidths[level - 1];
+        int sourceHeight = levelHeights[level - 1];
+        vector<float>& destination = levels[level];
+        for(int y=0; y<levelHeights[level]; y++)
+        {
+            int y0 = 2*y;
+            int y1 = min(2*y + 1, sourceHeight - 1);
+            for(int x=0; x<levelWidths[level]; x++)
+            {
+                int x0 = 2*x;
+                int x1 = min(2*x + 1, sourceWidth - 1);
+                destination[y*levelWidths[level] + x] = max(max(source[y0*sourceWidth + x0], source[y0*sourceWidth + x1]),
+                                                            max(source[y1*sourceWidth + x0], source[y1*sourceWidth + x1]));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::isVisible(const glm::vec3& min, const glm::vec3& max)
+{
+    if(triangles.empty())
+    {
+        return true;
+    }
+
+    float minX = FLT_MAX;
+    float minY = FLT_MAX;
+    float maxX = -FLT_MAX;
+    float maxY = -FLT_MAX;
+    float nearest = FLT_MAX;
+    for(int corner=0; corner<8; corner++)
+    {
+        glm::vec4 position((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z, 1.0f);
+        glm::vec4 clip = viewProjection * position;
+        if((clip.w <= 0.0f) || (clip.z < -clip.w))
+        {
+            return true;
+        }
+        float inverseW = 1.0f / clip.w;
+        float screenX = (clip.x * inverseW * 0.5f + 0.5f) * width;
+        float screenY = (clip.y * inverseW * 0.5f + 0.5f) * height;
+        minX = std::min(minX, screenX);
+        minY = std::min(minY, screenY);
+        maxX = std::max(maxX, screenX);
+        maxY = std::max(maxY, screenY);
+        nearest = std::min(nearest, clip.z * inverseW * 0.5f + 0.5f);
+    }
+
+    // Boxes entirely off screen are left to the frustum culler, for the others only the part on
+    // screen needs to be hidden
+    if((maxX < 0.0f) || (maxY < 0.0f) || (minX >= width) || (minY >= height))
+    {
+        return true;
+    }
+    minX = std::max(minX, 0.0f);
+    minY = std::max(minY, 0.0f);
+    maxX = std::min(maxX, width - 1.0f);
+    maxY = std::min(maxY, height - 1.0f);
+
+    // Go up the pyramid until the rectangle covers at most 2x2 texels
+    int x0 = (int)minX;
+    int y0 = (int)minY;
+    int x1 = (int)maxX;
+    int y1 = (int)maxY;
+    size_t level = 0;
+    while(((x1 - x0 >= 2) || (y1 - y0 >= 2)) && (level + 1 < levels.size()))
+    {
+        x0 /= 2;
+        y0 /= 2;
+        x1 /= 2;
+        y1 /= 2;
+        level++;
+    }
+
+    float farthest = 0.0f;
+    for(int y=y0; y<=y1; y++)
+    {
+        for(int x=x0; x<=x1; x++)
+        {
+            farthest = std::max(farthest, levels[level][y*levelWidths[level] + x]);
+        }
+    }
+    return nearest <= farthest;
+}
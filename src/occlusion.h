@@ -0,0 +1,65 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+#include "workerpool.h"
+
+// NOTE: Software occlusion culling against a few large occluder meshes. The occluders' triangles
+//       are transformed and binned into 32x32 pixel tiles of a small depth buffer, the tiles are
+//       rasterized in parallel (4 pixels at a time with SSE2), and a pyramid of the farthest
+//       depth of every 2x2 block is built on top of it. An object is then occluded when the
+//       nearest point of its box is behind every depth of the pyramid texels its screen rectangle
+//       covers, at the level where that rectangle is about 2 texels across.
+//
+//       Everything errs towards visible: occluder triangles crossing the near plane are dropped,
+//       pixels are only covered when their centre is strictly inside a triangle, and boxes
+//       crossing the near plane or leaving the screen are never occluded
+class OcclusionCuller
+{
+public:
+    OcclusionCuller();
+
+    void setResolution(int width, int height);
+
+    // Clears the depth buffer, boxes are then given in the space the matrix projects from
+    void begin(const glm::mat4& viewProjection);
+    // positions are 3 floats a vertex, 3 vertices a triangle. clipTransform takes them to clip space
+    void addOccluder(const float* positions, int vertexCount, const glm::mat4& clipTransform);
+    // Rasterizes the binned triangles, a tile per job, and builds the depth pyramid
+    void rasterize(WorkerPool& pool);
+
+    // Whether the box may be visible, safe to call from several threads at once
+    bool isVisible(const glm::vec3& min, const glm::vec3& max);
+
+    // Of the last frame
+    int triangleCount;
+    double lastRasterizeMs;
+
+private:
+    struct ScreenTriangle
+    {
+        float x[3];
+        float y[3];
+        float z[3];
+    };
+
+    void rasterizeTile(int tile);
+    void buildPyramid();
+
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    glm::mat4 viewProjection;
+    std::vector<ScreenTriangle> triangles;
+    std::vector<std::vector<int> > tileTriangles;
+    // Level 0 is the depth buffer, every level after holds the farthest depth of 2x2 of the last
+    std::vector<std::vector<float> > levels;
+    std::vector<int> levelWidths;
+    std::vector<int> levelHeights;
+};
+
+#endif
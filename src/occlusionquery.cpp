@@ -0,0 +1,222 @@
+#include "SDL.h"
+#include "occlusionquery.h"
+#include "mesh.h"
+#include "glstate.h"
+
+using namespace std;
+
+// The 0..1 cube as 12 triangles, drawn with face culling off so the winding doesn't matter
+static const float BOX_VERTICES[36*3] = {
+    0,0,0, 1,0,0, 1,1,0,  0,0,0, 1,1,0, 0,1,0,
+    0,0,1, 1,0,1, 1,1,1,  0,0,1, 1,1,1, 0,1,1,
+    0,0,0, 0,1,0, 0,1,1,  0,0,0, 0,1,1, 0,0,1,
+    1,0,0, 1,1,0, 1,1,1,  1,0,0, 1,1,1, 1,0,1,
+    0,0,0, 1,0,0, 1,0,1,  0,0,0, 1,0,1, 0,0,1,
+    0,1,0, 1,1,0, 1,1,1,  0,1,0, 1,1,1, 0,1,1
+};
+
+OcclusionQueries::OcclusionQueries()
+{
+    // NOTE: 3000 triangles, doggo.obj and sample-bunny.obj are queried, the teapot and suzanne
+    //       are cheap enough that the box would cost about as much as the object
+    minVertexCount = 9000;
+    queriesIssued = 0;
+    conditionalDraws = 0;
+    resultsRead = 0;
+    resultsHidden = 0;
+    resultsPending = 0;
+    lastCollectMs = 0.0;
+    queryTarget = GL_SAMPLES_PASSED;
+    boxArray = 0;
+    boxBuffer = 0;
+    frame = 0;
+    program = NULL;
+    mvpLocation = -1;
+    conditional = false;
+}
+
+void OcclusionQueries::create()
+{
+    destroy();
+
+    // NOTE: The conservative target lets the implementation answer from its hierarchical depth
+    //       without rasterizing the box fully. Without it any samples is as good, the sample
+    //       count of the GL 1.5 target is only ever compared with 0
+    if(GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility)
+    {
+        queryTarget = GL_ANY_SAMPLES_PASSED_CONSERVATIVE;
+    }
+    else if(GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2)
+    {
+        queryTarget = GL_ANY_SAMPLES_PASSED;
+    }
+    else
+    {
+        queryTarget = GL_SAMPLES_PASSED;
+    }
+
+    glGenVertexArrays(1, &boxArray);
+    glState.bindVertexArray(boxArray);
+    glGenBuffers(1, &boxBuffer);
+    glState.bindBuffer(GL_ARRAY_BUFFER, boxBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(BOX_VERTICES), BOX_VERTICES, GL_STATIC_DRAW);
+    glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, false, 0, 0);
+    glEnableVertexAttribArray(POSITION_LOCATION);
+    glState.bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void OcclusionQueries::destroy()
+{
+    resize(0);
+    if(boxArray)
+    {
+        glState.deleteBuffers(1, &boxBuffer);
+        glState.deleteVertexArrays(1, &boxArray);
+        boxArray = 0;
+        boxBuffer = 0;
+    }
+}
+
+void OcclusionQueries::resize(int objectCount)
+{
+    if(objectCount == (int)queries.size())
+    {
+        return;
+    }
+    for(size_t i=0; i<queries.size(); i++)
+    {
+        if(queries[i].id)
+        {
+            glDeleteQueries(1, &queries[i].id);
+        }
+    }
+    ObjectQuery empty;
+    empty.id = 0;
+    empty.issuedFrame = -1;
+    empty.unread = false;
+    queries.assign(objectCount, empty);
+    issued.clear();
+}
+
+void OcclusionQueries::collect()
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    frame++;
+    queriesIssued = 0;
+    conditionalDraws = 0;
+    resultsRead = 0;
+    resultsHidden = 0;
+    resultsPending = 0;
+
+    // A result that isn't ready is left alone, the query is reissued this frame and its answer lost
+    for(size_t i=0; i<issued.size(); i++)
+    {
+        ObjectQuery& query = queries[issued[i]];
+        if(!query.unread)
+        {
+            continue;
+        }
+        GLuint available = 0;
+        glGetQueryObjectuiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+        {
+            resultsPending++;
+            continue;
+        }
+        GLuint samples = 0;
+        glGetQueryObjectuiv(query.id, GL_QUERY_RESULT, &samples);
+        query.unread = false;
+        resultsRead++;
+        if(samples == 0)
+        {
+            resultsHidden++;
+        }
+    }
+    issued.clear();
+    lastCollectMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+bool OcclusionQueries::beginDraw(int object)
+{
+    conditional = (queries[object].issuedFrame == frame - 1);
+    if(conditional)
+    {
+        glBeginConditionalRender(queries[object].id, GL_QUERY_NO_WAIT);
+        conditionalDraws++;
+    }
+    return conditional;
+}
+
+void OcclusionQueries::endDraw()
+{
+    if(conditional)
+    {
+        glEndConditionalRender();
+        conditional = false;
+    }
+}
+
+void OcclusionQueries::beginQueries(ShaderProgram& program, GLint mvpLocation)
+{
+    this->program = &program;
+    this->mvpLocation = mvpLocation;
+    glState.useProgram(program.id);
+    glState.bindVertexArray(boxArray);
+    glState.disable(GL_CULL_FACE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+}
+
+void OcclusionQueries::query(int object, const glm::mat4& boxMvp)
+{
+    // Clipped at the near plane the box could miss every sample of an object right in front of
+    // the camera, those are drawn unconditionally instead
+    for(int corner=0; corner<8; corner++)
+    {
+        glm::vec4 clip = boxMvp * glm::vec4((float)(corner & 1), (float)((corner >> 1) & 1), (float)(corner >> 2), 1.0f);
+        if((clip.w <= 0.0f) || (clip.z < -clip.w))
+        {
+            return;
+        }
+    }
+
+    ObjectQuery& query = queries[object];
+    if(!query.id)
+    {
+        glGenQueries(1, &query.id);
+    }
+    program->set(mvpLocation, boxMvp);
+    glBeginQuery(queryTarget, query.id);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glEndQuery(queryTarget);
+    query.issuedFrame = frame;
+    query.unread = true;
+    issued.push_back(object);
+    queriesIssued++;
+}
+
+void OcclusionQueries::endQueries()
+{
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    glState.enable(GL_CULL_FACE);
+    program = NULL;
+}
+
+GLenum OcclusionQueries::target()
+{
+    return queryTarget;
+}
+
+const char* OcclusionQueries::targetName()
+{
+    switch(queryTarget)
+    {
+    case GL_ANY_SAMPLES_PASSED_CONSERVATIVE:
+        return "GL_ANY_SAMPLES_PASSED_CONSERVATIVE";
+    case GL_ANY_SAMPLES_PASSED:
+        return "GL_ANY_SAMPLES_PASSED";
+    default:
+        return "GL_SAMPLES_PASSED";
+    }
+}
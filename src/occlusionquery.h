@@ -0,0 +1,83 @@
+#ifndef OCCLUSION_QUERY_H
+#define OCCLUSION_QUERY_H
+
+#include <GL/glew.h>
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+#include "shaderprogram.h"
+
+// NOTE: Hardware occlusion queries for the expensive scene objects. After the frame's draws the
+//       bounding box of every queried object is drawn with colour and depth writes off inside an
+//       occlusion query, and the next frame draws the object inside glBeginConditionalRender on
+//       that query, so the GPU drops the draw if none of the box's samples passed the depth test.
+//
+//       The conditional render uses GL_QUERY_NO_WAIT: a result the GPU doesn't have yet counts as
+//       visible, so nothing ever waits on a query. The CPU only reads results for the stats, and
+//       only those GL_QUERY_RESULT_AVAILABLE says are ready.
+//
+//       An object drawn conditionally is one frame behind its query, so one that comes out from
+//       behind an occluder appears a frame late. Objects whose box crosses the near plane (the
+//       camera is in or right next to it) aren't queried, and neither are those that weren't
+//       queried the frame before, those draw unconditionally
+class OcclusionQueries
+{
+public:
+    OcclusionQueries();
+
+    // Picks the best query target the context has, and creates the box to draw
+    void create();
+    void destroy();
+
+    // Forgets the queries when the number of objects changes
+    void resize(int objectCount);
+
+    // Starts the frame, reads back whichever of the last frame's results are ready
+    void collect();
+
+    // Wrap an object's draw, the draw is conditional on the object's query of the last frame
+    bool beginDraw(int object);
+    void endDraw();
+
+    // Draws the boxes with colour and depth writes off, the depth test on. mvpLocation is the
+    // program's clip transform uniform, boxMvp takes the 0..1 cube to the object's box in clip space
+    void beginQueries(ShaderProgram& program, GLint mvpLocation);
+    void query(int object, const glm::mat4& boxMvp);
+    void endQueries();
+
+    GLenum target();
+    const char* targetName();
+
+    // Objects with at least this many vertices are queried
+    int minVertexCount;
+
+    // Of the last frame
+    int queriesIssued;
+    int conditionalDraws;
+    // Of the results read back in the last collect(), those found hidden and those not ready
+    int resultsRead;
+    int resultsHidden;
+    int resultsPending;
+    double lastCollectMs;
+
+private:
+    struct ObjectQuery
+    {
+        GLuint id;
+        int issuedFrame;
+        bool unread;
+    };
+
+    GLenum queryTarget;
+    GLuint boxArray;
+    GLuint boxBuffer;
+    int frame;
+    std::vector<ObjectQuery> queries;
+    std::vector<int> issued; // Objects queried in the last frame
+    ShaderProgram* program;
+    GLint mvpLocation;
+    bool conditional;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include <float.h>
+
+#include <thread>
+
+#include "SDL.h"
+
+#include "picking.h"
+
+using namespace std;
+
+ScenePicker::ScenePicker()
+{
+    lastPickUs = 0.0;
+    lastBuildMs = 0.0;
+    lastObjectsTested = 0;
+}
+
+void ScenePicker::unproject(int x, int y, int width, int height, const glm::mat4& view, const glm::mat4& projection,
+                            glm::vec3& origin, glm::vec3& direction)
+{
+    // Through the pixel's center, y pointing up in normalized device coordinates
+    float ndcX = (x + 0.5f) / width * 2.0f - 1.0f;
+    float ndcY = 1.0f - (y + 0.5f) / height * 2.0f;
+    glm::mat4 inverse = glm::inverse(projection * view);
+    glm::vec4 nearPoint = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverse * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    origin = glm::vec3(nearPoint) / nearPoint.w;
+    direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
+
+bool ScenePicker::pick(Scene& scene, SceneBVH& hierarchy, int modelMesh, const vector<glm::mat4>& modelCopies,
+                       const glm::mat4& model, const glm::mat4& transform, const glm::vec3& origin,
+                       const glm::vec3& direction, PickResult& result)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    lastBuildMs = 0.0;
+    lastObjectsTested = 0;
+    if((int)meshBVHs.size() < scene.meshCount())
+    {
+        meshBVHs.resize(scene.meshCount());
+        built.resize(scene.meshCount(), false);
+    }
+
+    // Into the space of the scene BVH's boxes, an affine change which keeps distances along the
+    // ray in units of the direction
+    placeTransform = transform * model;
+    glm::mat4 inverseModel = glm::inverse(model);
+    glm::vec3 placedOrigin(inverseModel * glm::vec4(origin, 1.0f));
+    glm::vec3 placedDirection(inverseModel * glm::vec4(direction, 0.0f));
+
+    float distance = FLT_MAX;
+    TriangleHit hit;
+    result.object = -1;
+    result.copy = -1;
+    result.mesh = -1;
+
+    // The model's copies are few, a copy the ray misses is rejected by the root of its BVH
+    if(modelMesh >= 0)
+    {
+        for(size_t copy=0; copy<modelCopies.size(); copy++)
+        {
+            if(pickPlaced(scene, modelMesh, modelCopies[copy], placedOrigin, placedDirection, distance, hit))
+            {
+                result.copy = copy;
+                result.mesh = modelMesh;
+            }
+        }
+    }
+
+    int object = hierarchy.raycast(placedOrigin, placedDirection, distance, [&](int index, float, float& searchDistance)
+    {
+        const SceneObject& sceneObject = scene.object(index);
+        return pickPlaced(scene, sceneObject.mesh, sceneObject.transform, placedOrigin, placedDirection, searchDistance, hit);
+    });
+    if(object >= 0)
+    {
+        result.object = object;
+        result.copy = -1;
+        result.mesh = scene.object(object).mesh;
+    }
+
+    if(result.mesh >= 0)
+    {
+        result.triangle = hit.triangle;
+        result.barycentrics = glm::vec3(1.0f - hit.u - hit.v, hit.u, hit.v);
+        const float* uvs = (const float*)scene.geometry(result.mesh).textureCoordData() + hit.triangle * 6;
+        result.uv = glm::vec2(uvs[0], uvs[1]) * result.barycentrics.x + glm::vec2(uvs[2], uvs[3]) * result.barycentrics.y
+                  + glm::vec2(uvs[4], uvs[5]) * result.barycentrics.z;
+        result.distance = distance;
+        result.position = origin + direction * distance;
+    }
+    lastPickUs = (SDL_GetPerformanceCounter() - start) * 1000000.0 / SDL_GetPerformanceFrequency() - lastBuildMs * 1000.0;
+    return result.mesh >= 0;
+}
+
+bool ScenePicker::pickPlaced(Scene& scene, int mesh, const glm::mat4& placement, const glm::vec3& origin,
+                             const glm::vec3& direction, float& distance, TriangleHit& hit)
+{
+    lastObjectsTested++;
+    glm::mat4 inverse = glm::inverse(placement * placeTransform);
+    glm::vec3 meshOrigin(inverse * glm::vec4(origin, 1.0f));
+    glm::vec3 meshDirection(inverse * glm::vec4(direction, 0.0f));
+    TriangleHit meshHit;
+    if(!meshBVH(scene, mesh).raycast(meshOrigin, meshDirection, meshHit, distance))
+    {
+        return false;
+    }
+    hit = meshHit;
+    distance = meshHit.distance;
+    return true;
+}
+
+const MeshBVH& ScenePicker::meshBVH(Scene& scene, int mesh)
+{
+    if(!built[mesh])
+    {
+        int threads = thread::hardware_concurrency();
+        if((threads > 1) && (pool.threadCount() != threads))
+        {
+            pool.create(threads);
+        }
+        meshBVHs[mesh].build(scene.geometry(mesh), &pool);
+        built[mesh] = true;
+        lastBuildMs += meshBVHs[mesh].lastBuildMs;
+    }
+    return meshBVHs[mesh];
+}
+
+void ScenePicker::clear()
+{
+    meshBVHs.clear();
+    built.clear();
+}
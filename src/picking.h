@@ -0,0 +1,75 @@
+#ifndef PICKING_H
+#define PICKING_H
+
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+#include "scene.h"
+#include "bvh.h"
+#include "meshbvh.h"
+#include "workerpool.h"
+
+struct PickResult
+{
+    int object;             // Scene object, -1 for the model
+    int copy;               // Of the model, 0 for the model itself and then its stress test copies,
+                            // -1 for scene objects
+    int mesh;               // Scene mesh
+    int triangle;
+    glm::vec3 barycentrics; // Weights of the triangle's three vertices
+    glm::vec2 uv;           // Texture coordinates at the hit
+    glm::vec3 position;     // Where the hit is drawn
+    float distance;         // From the ray origin, in units of the ray direction
+};
+
+// NOTE: Finds the triangle under the mouse on the CPU, without reading anything back from the
+//       GPU. The ray is unprojected through the frame's view and projection, the scene objects
+//       whose boxes it enters are found through the draw list's scene BVH (nearest first), and
+//       each of them is searched through the triangle BVH of its mesh with the ray moved into the
+//       mesh's own space, which also leaves the ray distance unchanged. The first closer hit
+//       shortens the search for the rest.
+//
+//       Everything is drawn at model * placement * transform * model * vertex (the model matrix
+//       appearing twice, see simple.vert), where the placement is a scene object's transform or
+//       the offset of one of the model's copies. The scene BVH keeps its boxes without the model
+//       matrix in front, so the ray is taken into that space first.
+//
+//       The triangle BVH of a mesh is built on the first pick that reaches it, on a worker pool
+//       of every core. The instances are not picked
+class ScenePicker
+{
+public:
+    ScenePicker();
+
+    // The ray through a window position (in pixels, from the top left) from the near plane
+    static void unproject(int x, int y, int width, int height, const glm::mat4& view, const glm::mat4& projection,
+                          glm::vec3& origin, glm::vec3& direction);
+
+    // modelCopies are the model's placements, the first being the model itself. Returns false when
+    // nothing is hit
+    bool pick(Scene& scene, SceneBVH& hierarchy, int modelMesh, const std::vector<glm::mat4>& modelCopies,
+              const glm::mat4& model, const glm::mat4& transform, const glm::vec3& origin, const glm::vec3& direction,
+              PickResult& result);
+
+    // Drops the triangle BVHs, for when the scene's meshes change
+    void clear();
+
+    // Of the last pick
+    double lastPickUs;
+    double lastBuildMs;    // Building the triangle BVHs it needed, 0 if they all existed
+    int lastObjectsTested; // Whose triangles were searched
+
+private:
+    // Searches a mesh placed by placement * transform * model, shortening distance on a closer hit
+    bool pickPlaced(Scene& scene, int mesh, const glm::mat4& placement, const glm::vec3& origin,
+                    const glm::vec3& direction, float& distance, TriangleHit& hit);
+    const MeshBVH& meshBVH(Scene& scene, int mesh);
+
+    std::vector<MeshBVH> meshBVHs; // By scene mesh, empty until first needed
+    std::vector<bool> built;
+    WorkerPool pool;
+    glm::mat4 placeTransform; // transform * model of the pick in progress
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include "pipelinestats.h"
+
+PipelineStatistics::PipelineStatistics()
+{
+    supported = false;
+    vertexInvocations = 0;
+    fragmentInvocations = 0;
+    resultAge = 0;
+    frame = 0;
+    activeSlot = -1;
+    for(int i=0; i<PIPELINE_STATS_FRAMES; i++)
+    {
+        queries[i][0] = queries[i][1] = 0;
+        queryFrames[i] = -1;
+    }
+}
+
+void PipelineStatistics::create()
+{
+    destroy();
+    supported = GLEW_ARB_pipeline_statistics_query;
+    if(!supported)
+    {
+        return;
+    }
+    for(int i=0; i<PIPELINE_STATS_FRAMES; i++)
+    {
+        glGenQueries(2, queries[i]);
+        queryFrames[i] = -1;
+    }
+}
+
+void PipelineStatistics::destroy()
+{
+    if(supported)
+    {
+        for(int i=0; i<PIPELINE_STATS_FRAMES; i++)
+        {
+            glDeleteQueries(2, queries[i]);
+            queries[i][0] = queries[i][1] = 0;
+        }
+        supported = false;
+    }
+}
+
+bool PipelineStatistics::isSupported()
+{
+    return supported;
+}
+
+void PipelineStatistics::collect()
+{
+    if(!supported)
+    {
+        return;
+    }
+    // The oldest frames first, so the counts end up those of the latest one ready
+    for(int age=PIPELINE_STATS_FRAMES; age>0; age--)
+    {
+        int slot = (frame - age + PIPELINE_STATS_FRAMES) % PIPELINE_STATS_FRAMES;
+        if(queryFrames[slot] < 0)
+        {
+            continue;
+        }
+        // The fragment query ends last
+        GLuint available = 0;
+        glGetQueryObjectuiv(queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+        {
+            continue;
+        }
+        glGetQueryObjectuiv(queries[slot][0], GL_QUERY_RESULT, &vertexInvocations);
+        glGetQueryObjectuiv(queries[slot][1], GL_QUERY_RESULT, &fragmentInvocations);
+        resultAge = frame - queryFrames[slot];
+        queryFrames[slot] = -1;
+    }
+}
+
+void PipelineStatistics::begin()
+{
+    activeSlot = -1;
+    if(!supported)
+    {
+        return;
+    }
+    collect();
+    int slot = frame % PIPELINE_STATS_FRAMES;
+    if(queryFrames[slot] < 0)
+    {
+        glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, queries[slot][0]);
+        glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, queries[slot][1]);
+        activeSlot = slot;
+    }
+}
+
+void PipelineStatistics::end()
+{
+    if(activeSlot >= 0)
+    {
+        glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+        glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+        queryFrames[activeSlot] = frame;
+        activeSlot = -1;
+    }
+    frame++;
+}
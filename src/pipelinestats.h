@@ -0,0 +1,45 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <GL/glew.h>
+
+// Frames whose queries can be in flight at once
+const int PIPELINE_STATS_FRAMES = 4;
+
+// NOTE: Vertex and fragment shader invocation counts from GL_ARB_pipeline_statistics_query (core
+//       in GL 4.6), over a span of every frame. Like the occlusion query results, the counts are
+//       only read once GL_QUERY_RESULT_AVAILABLE says they're ready, a few frames later, and a
+//       frame whose queries are all still in flight isn't measured. Without the extension
+//       isSupported() is false and nothing is queried.
+//
+//       A fragment shader invocation is counted for every fragment shaded, also the ones the
+//       depth test then discards, so the counts show how much shading overdraw costs
+class PipelineStatistics
+{
+public:
+    PipelineStatistics();
+
+    void create();
+    void destroy();
+    bool isSupported();
+
+    // Wrap the part of the frame to count. Only one span a frame
+    void begin();
+    void end();
+    // Reads back every frame whose results are ready, begin() does it too
+    void collect();
+
+    // Of the latest frame read back, and how many frames ago it was begun
+    GLuint vertexInvocations;
+    GLuint fragmentInvocations;
+    int resultAge;
+
+private:
+    bool supported;
+    GLuint queries[PIPELINE_STATS_FRAMES][2];
+    int queryFrames[PIPELINE_STATS_FRAMES]; // Frame the queries were issued in, -1 if read
+    int frame;
+    int activeSlot;
+};
+
+#endif
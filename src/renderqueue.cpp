@@ -0,0 +1,164 @@
+#include <string.h>
+
+#include "SDL.h"
+#include "renderqueue.h"
+
+using namespace std;
+
+const int PASS_BITS = 4;
+const int PROGRAM_BITS = 8;
+const int MATERIAL_BITS = 12;
+const int MESH_BITS = 16;
+const int DEPTH_BITS = 24;
+
+static uint64_t field(int value, int bits)
+{
+    return (uint64_t)value & ((1ull << bits) - 1);
+}
+
+RenderQueue::RenderQueue()
+{
+    mode = SORT_STATE;
+    lastSortMs = 0.0;
+}
+
+const char* RenderQueue::modeName(SortMode mode)
+{
+    switch(mode)
+    {
+    case SORT_NONE:
+        return "unsorted";
+    case SORT_STATE:
+        return "by state";
+    case SORT_DEPTH:
+        return "front to back";
+    default:
+        return "unknown";
+    }
+}
+
+void RenderQueue::setMode(SortMode mode)
+{
+    this->mode = mode;
+}
+
+SortMode RenderQueue::getMode()
+{
+    return mode;
+}
+
+uint64_t RenderQueue::makeKey(int pass, int program, int material, int mesh, float depth)
+{
+    depth = (depth < 0.0f) ? 0.0f : ((depth > 1.0f) ? 1.0f : depth);
+    uint64_t quantizedDepth = (uint64_t)(depth * ((1 << DEPTH_BITS) - 1));
+    uint64_t key = field(pass, PASS_BITS) << (64 - PASS_BITS);
+    if(mode == SORT_DEPTH)
+    {
+        key |= quantizedDepth << (MESH_BITS + MATERIAL_BITS + PROGRAM_BITS);
+        key |= field(program, PROGRAM_BITS) << (MESH_BITS + MATERIAL_BITS);
+        key |= field(material, MATERIAL_BITS) << MESH_BITS;
+        key |= field(mesh, MESH_BITS);
+    }
+    else
+    {
+        key |= field(program, PROGRAM_BITS) << (DEPTH_BITS + MESH_BITS + MATERIAL_BITS);
+        key |= field(material, MATERIAL_BITS) << (DEPTH_BITS + MESH_BITS);
+        key |= field(mesh, MESH_BITS) << DEPTH_BITS;
+        key |= quantizedDepth;
+    }
+    return key;
+}
+
+int RenderQueue::keyProgram(uint64_t key)
+{
+    int shift = (mode == SORT_DEPTH) ? (MESH_BITS + MATERIAL_BITS) : (DEPTH_BITS + MESH_BITS + MATERIAL_BITS);
+    return (int)field((int)(key >> shift), PROGRAM_BITS);
+}
+
+int RenderQueue::keyMaterial(uint64_t key)
+{
+    int shift = (mode == SORT_DEPTH) ? MESH_BITS : (DEPTH_BITS + MESH_BITS);
+    return (int)field((int)(key >> shift), MATERIAL_BITS);
+}
+
+int RenderQueue::keyMesh(uint64_t key)
+{
+    int shift = (mode == SORT_DEPTH) ? 0 : DEPTH_BITS;
+    return (int)field((int)(key >> shift), MESH_BITS);
+}
+
+void RenderQueue::clear()
+{
+    commands.clear();
+}
+
+void RenderQueue::push(uint64_t key, uint32_t object)
+{
+    DrawCommand command;
+    command.key = key;
+    command.object = object;
+    commands.push_back(command);
+}
+
+void RenderQueue::append(const std::vector<DrawCommand>& list)
+{
+    commands.insert(commands.end(), list.begin(), list.end());
+}
+
+// LSD radix sort, one byte of the key per pass. Bytes every key has the same value in (unused
+// fields, a single pass or program) are skipped, which is most of them in practice
+void RenderQueue::sort()
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    size_t count = commands.size();
+    if((mode != SORT_NONE) && (count > 1))
+    {
+        scratch.resize(count);
+        DrawCommand* source = &commands[0];
+        DrawCommand* destination = &scratch[0];
+        for(int byte=0; byte<8; byte++)
+        {
+            int shift = byte * 8;
+            size_t histogram[256];
+            memset(histogram, 0, sizeof(histogram));
+            for(size_t i=0; i<count; i++)
+            {
+                histogram[(source[i].key >> shift) & 0xFF]++;
+            }
+            if(histogram[(source[0].key >> shift) & 0xFF] == count)
+            {
+                continue;
+            }
+
+            size_t offset = 0;
+            for(int digit=0; digit<256; digit++)
+            {
+                size_t digitCount = histogram[digit];
+                histogram[digit] = offset;
+                offset += digitCount;
+            }
+            for(size_t i=0; i<count; i++)
+            {
+                destination[histogram[(source[i].key >> shift) & 0xFF]++] = source[i];
+            }
+            DrawCommand* swap = source;
+            source = destination;
+            destination = swap;
+        }
+        if(source != &commands[0])
+        {
+            commands.swap(scratch);
+        }
+    }
+    lastSortMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+int RenderQueue::size()
+{
+    return commands.size();
+}
+
+const DrawCommand& RenderQueue::operator[](int index)
+{
+    return commands[index];
+}
@@ -0,0 +1,66 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <stdint.h>
+
+#include <vector>
+
+enum SortMode
+{
+    SORT_NONE,  // Submit in the order the draws were pushed
+    SORT_STATE, // pass, program, material, mesh, then front to back
+    SORT_DEPTH, // pass, front to back, then program, material, mesh
+    SORT_MODE_COUNT
+};
+
+// A draw, the object is an index the renderer looks the rest up with
+struct DrawCommand
+{
+    uint64_t key;
+    uint32_t object;
+};
+
+// NOTE: Draws are pushed in any order with a 64 bit key holding the state they need, and sorted
+//       with an LSD radix sort on the key before submission. Sorting by state puts draws sharing
+//       a program/material/mesh next to each other so the binds between them are skipped, sorting
+//       by depth draws opaque geometry front to back so the depth test rejects hidden fragments
+//       before the bump-mapped fragment shader runs.
+//
+//       Key layouts, from the most significant bit:
+//           SORT_STATE: pass 4 | program 8 | material 12 | mesh 16 | depth 24
+//           SORT_DEPTH: pass 4 | depth 24 | program 8 | material 12 | mesh 16
+class RenderQueue
+{
+public:
+    RenderQueue();
+
+    void setMode(SortMode mode);
+    SortMode getMode();
+
+    // depth is the normalized distance from the camera, [0,1]
+    uint64_t makeKey(int pass, int program, int material, int mesh, float depth);
+    int keyProgram(uint64_t key);
+    int keyMaterial(uint64_t key);
+    int keyMesh(uint64_t key);
+
+    void clear();
+    void push(uint64_t key, uint32_t object);
+    // Adds a list of commands built elsewhere, e.g. by a worker thread
+    void append(const std::vector<DrawCommand>& list);
+    void sort();
+
+    int size();
+    const DrawCommand& operator[](int index);
+
+    static const char* modeName(SortMode mode);
+
+    // Time taken by the last sort() in ms
+    double lastSortMs;
+
+private:
+    SortMode mode;
+    std::vector<DrawCommand> commands;
+    std::vector<DrawCommand> scratch;
+};
+
+#endif
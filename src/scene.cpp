@@ -0,0 +1,366 @@
+#include <algorithm>
+
+#include "scene.h"
+#include "glstate.h"
+#include "culling.h"
+
+using namespace std;
+
+Scene::Scene()
+{
+    drawCalls = 0;
+    verticesDrawn = 0;
+    revision = 0;
+}
+
+int Scene::addMesh(const char* objFilename)
+{
+    geometries.push_back(GeometryData());
+    geometries.back().loadFromOBJFile(objFilename);
+    return uploadLastMesh();
+}
+
+int Scene::addMesh(const GeometryData& geometry)
+{
+    geometries.push_back(geometry);
+    return uploadLastMesh();
+}
+
+int Scene::uploadLastMesh()
+{
+    bounds.push_back(geometries.back().bounds());
+
+    MeshInstances entry;
+    entry.mesh.upload(geometries.back());
+    entry.arenaHandle = arena.add(geometries.back());
+    glGenBuffers(1, &entry.instanceBuffer);
+    entry.instanceCapacity = 0;
+    entry.dirty = false;
+    if(entry.mesh.vertexCount() > 0)
+    {
+        entry.mesh.setInstanceBuffer(entry.instanceBuffer);
+    }
+    meshes.push_back(entry);
+    return meshes.size() - 1;
+}
+
+int Scene::addInstance(int mesh, const glm::mat4& transform, int material)
+{
+    InstanceData instance;
+    instance.transform = transform;
+    instance.material = (float)material;
+    meshes[mesh].instances.push_back(instance);
+    meshes[mesh].dirty = true;
+    return meshes[mesh].instances.size() - 1;
+}
+
+void Scene::setMeshGeometry(int mesh, const GeometryData& geometry)
+{
+    geometries[mesh] = geometry;
+    bounds[mesh] = geometries[mesh].bounds();
+    meshes[mesh].mesh.upload(geometries[mesh]);
+    arena.remove(meshes[mesh].arenaHandle);
+    meshes[mesh].arenaHandle = arena.add(geometries[mesh]);
+    if(meshes[mesh].mesh.vertexCount() > 0)
+    {
+        meshes[mesh].mesh.setInstanceBuffer(meshes[mesh].instanceBuffer);
+    }
+}
+
+void Scene::clearInstances()
+{
+    for(size_t i=0; i<meshes.size(); i++)
+    {
+        meshes[i].instances.clear();
+        meshes[i].dirty = true;
+    }
+}
+
+void Scene::clear()
+{
+    for(size_t i=0; i<meshes.size(); i++)
+    {
+        meshes[i].mesh.destroy();
+        glState.deleteBuffers(1, &meshes[i].instanceBuffer);
+    }
+    meshes.clear();
+    arena.destroy();
+    geometries.clear();
+    bounds.clear();
+    objects.clear();
+    occluderObjects.clear();
+    nodeObjects.clear();
+    sceneGraph.clear();
+    revision++;
+}
+
+int Scene::addObject(int mesh, const glm::mat4& transform, int material)
+{
+    SceneObject object;
+    object.mesh = mesh;
+    object.material = material;
+    object.transform = transform;
+    object.occluder = false;
+    object.node = -1;
+    object.isStatic = false;
+    objects.push_back(object);
+    revision++;
+    return objects.size() - 1;
+}
+
+void Scene::setObjectTransform(int index, const glm::mat4& transform)
+{
+    objects[index].transform = transform;
+    revision++;
+}
+
+void Scene::setOccluder(int index, bool occluder)
+{
+    if(objects[index].occluder == occluder)
+    {
+        return;
+    }
+    objects[index].occluder = occluder;
+    if(occluder)
+    {
+        occluderObjects.push_back(index);
+    }
+    else
+    {
+        occluderObjects.erase(find(occluderObjects.begin(), occluderObjects.end(), index));
+    }
+}
+
+void Scene::setStatic(int index, bool isStatic)
+{
+    objects[index].isStatic = isStatic;
+}
+
+const vector<int>& Scene::occluders()
+{
+    return occluderObjects;
+}
+
+void Scene::setObjectNode(int index, int node)
+{
+    if(objects[index].node == node)
+    {
+        return;
+    }
+    if(objects[index].node < 0)
+    {
+        nodeObjects.push_back(index);
+    }
+    else if(node < 0)
+    {
+        nodeObjects.erase(find(nodeObjects.begin(), nodeObjects.end(), index));
+    }
+    objects[index].node = node;
+    if(node >= 0)
+    {
+        // Up to date unless the node changed since the last update, then the next one copies it
+        objects[index].transform = sceneGraph.world(node);
+        revision++;
+    }
+}
+
+SceneGraph& Scene::graph()
+{
+    return sceneGraph;
+}
+
+void Scene::updateTransforms()
+{
+    sceneGraph.update();
+    if(sceneGraph.lastUpdatedCount == 0)
+    {
+        return;
+    }
+    for(size_t i=0; i<nodeObjects.size(); i++)
+    {
+        SceneObject& object = objects[nodeObjects[i]];
+        if(sceneGraph.wasUpdated(object.node))
+        {
+            object.transform = sceneGraph.world(object.node);
+            revision++;
+        }
+    }
+}
+
+void Scene::clearObjects()
+{
+    objects.clear();
+    occluderObjects.clear();
+    nodeObjects.clear();
+    revision++;
+}
+
+void Scene::removeObjects(const vector<int>& indices)
+{
+    // New index of every object, -1 for the removed ones
+    vector<int> remap(objects.size(), 0);
+    for(size_t i=0; i<indices.size(); i++)
+    {
+        remap[indices[i]] = -1;
+    }
+    size_t kept = 0;
+    for(size_t i=0; i<objects.size(); i++)
+    {
+        if(remap[i] >= 0)
+        {
+            remap[i] = kept;
+            objects[kept++] = objects[i];
+        }
+    }
+    objects.resize(kept);
+
+    vector<int>* lists[2] = {&occluderObjects, &nodeObjects};
+    for(int list=0; list<2; list++)
+    {
+        vector<int>& entries = *lists[list];
+        size_t keptEntries = 0;
+        for(size_t i=0; i<entries.size(); i++)
+        {
+            if(remap[entries[i]] >= 0)
+            {
+                entries[keptEntries++] = remap[entries[i]];
+            }
+        }
+        entries.resize(keptEntries);
+    }
+    revision++;
+}
+
+int Scene::objectRevision()
+{
+    return revision;
+}
+
+int Scene::objectCount()
+{
+    return objects.size();
+}
+
+const SceneObject& Scene::object(int index)
+{
+    return objects[index];
+}
+
+void Scene::draw(bool depthOnly)
+{
+    drawCalls = 0;
+    verticesDrawn = 0;
+    for(size_t i=0; i<meshes.size(); i++)
+    {
+        MeshInstances& entry = meshes[i];
+        if(entry.instances.empty() || !entry.mesh.vertexCount())
+        {
+            continue;
+        }
+
+        if(entry.dirty)
+        {
+            // The buffer only grows, the attribute pointers into it stay valid
+            size_t bytes = entry.instances.size()*sizeof(InstanceData);
+            glState.bindBuffer(GL_ARRAY_BUFFER, entry.instanceBuffer);
+            if(entry.instances.size() > entry.instanceCapacity)
+            {
+                glBufferData(GL_ARRAY_BUFFER, bytes, &entry.instances[0], GL_DYNAMIC_DRAW);
+                entry.instanceCapacity = entry.instances.size();
+            }
+            else
+            {
+                glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &entry.instances[0]);
+            }
+            glState.bindBuffer(GL_ARRAY_BUFFER, 0);
+            entry.dirty = false;
+        }
+
+        glState.bindVertexArray(depthOnly ? entry.mesh.depthVao : entry.mesh.vao);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, entry.mesh.vertexCount(), entry.instances.size());
+        drawCalls++;
+        verticesDrawn += (long long)entry.mesh.vertexCount() * entry.instances.size();
+    }
+}
+
+int Scene::meshCount()
+{
+    return meshes.size();
+}
+
+int Scene::instanceCount()
+{
+    int count = 0;
+    for(size_t i=0; i<meshes.size(); i++)
+    {
+        count += meshes[i].instances.size();
+    }
+    return count;
+}
+
+int Scene::instanceCount(int mesh)
+{
+    return meshes[mesh].instances.size();
+}
+
+Bounds Scene::instanceBounds(const glm::mat4& shared)
+{
+    Bounds result;
+    result.min = glm::vec3(0.0f);
+    result.max = glm::vec3(0.0f);
+    bool empty = true;
+    for(size_t mesh=0; mesh<meshes.size(); mesh++)
+    {
+        const vector<InstanceData>& instances = meshes[mesh].instances;
+        if(instances.empty())
+        {
+            continue;
+        }
+        Bounds placedMesh = transformBounds(bounds[mesh], shared);
+        for(size_t i=0; i<instances.size(); i++)
+        {
+            Bounds placed = transformBounds(placedMesh, instances[i].transform);
+            result.min = empty ? placed.min : glm::min(result.min, placed.min);
+            result.max = empty ? placed.max : glm::max(result.max, placed.max);
+            empty = false;
+        }
+    }
+    result.center = (result.min + result.max) * 0.5f;
+    result.radius = glm::length(result.max - result.center);
+    return result;
+}
+
+GeometryData& Scene::geometry(int mesh)
+{
+    return geometries[mesh];
+}
+
+const vector<Bounds>& Scene::meshBounds()
+{
+    return bounds;
+}
+
+GLuint Scene::meshVertexArray(int mesh)
+{
+    return meshes[mesh].mesh.vao;
+}
+
+GLuint Scene::meshDepthVertexArray(int mesh)
+{
+    return meshes[mesh].mesh.depthVao;
+}
+
+int Scene::meshVertexCount(int mesh)
+{
+    return meshes[mesh].mesh.vertexCount();
+}
+
+BufferArena& Scene::bufferArena()
+{
+    return arena;
+}
+
+int Scene::meshArenaHandle(int mesh)
+{
+    return meshes[mesh].arenaHandle;
+}
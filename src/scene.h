@@ -0,0 +1,117 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <GL/glew.h>
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+#include "bufferarena.h"
+#include "geometry.h"
+#include "mesh.h"
+#include "scenegraph.h"
+
+// A single draw of a mesh, for objects that go through the render queue one by one
+struct SceneObject
+{
+    int mesh;
+    int material;
+    glm::mat4 transform;
+    bool occluder;  // Rasterized by the software occlusion culler, see OcclusionCuller
+    int node;       // Scene graph node the transform follows, -1 if it's set directly
+    bool isStatic;  // Never moves, can be merged into a static batch, see StaticBatches
+};
+
+// NOTE: Instances of a set of meshes. Each mesh keeps its instances in one InstanceData buffer
+//       attached to its vertex array, so drawing all of them is a single glDrawArraysInstanced
+//       per mesh whatever the instance count. The buffers are re-uploaded on the next draw after
+//       instances were added.
+//
+//       Every mesh is also indexed into bufferArena(), where the scene objects of all the meshes
+//       can be drawn from a single vertex array
+class Scene
+{
+public:
+    Scene();
+
+    // Loads an OBJ file, returns the mesh index
+    int addMesh(const char* objFilename);
+    // A mesh built in memory, with its bounds computed
+    int addMesh(const GeometryData& geometry);
+    // Replaces the geometry of a mesh, an empty one frees it but keeps the index
+    void setMeshGeometry(int mesh, const GeometryData& geometry);
+    // The material is an index into the materials the shader has been given, see atlasRegions
+    int addInstance(int mesh, const glm::mat4& transform, int material);
+
+    void clearInstances();
+    void clear();
+
+    int addObject(int mesh, const glm::mat4& transform, int material);
+    void setObjectTransform(int index, const glm::mat4& transform);
+    void setOccluder(int index, bool occluder);
+    void setStatic(int index, bool isStatic);
+    const std::vector<int>& occluders();
+    // The object's transform follows the world matrix of a node of graph(), -1 detaches it
+    void setObjectNode(int index, int node);
+    void clearObjects();
+    // The objects after the removed ones move down to fill their indices, in the same order
+    void removeObjects(const std::vector<int>& indices);
+    int objectCount();
+    const SceneObject& object(int index);
+    // Changes whenever objects are added, removed or moved
+    int objectRevision();
+
+    // Nodes are kept when the objects are cleared, clear() drops them
+    SceneGraph& graph();
+    // Updates the graph and copies the recomputed world matrices to the objects attached to them
+    void updateTransforms();
+
+    // Issues one instanced draw per mesh with instances, with the program already bound. The depth
+    // only draw reads just the positions and transforms, for the depth pre-pass
+    void draw(bool depthOnly=false);
+
+    int meshCount();
+    int instanceCount();
+    int instanceCount(int mesh);
+    // Around every instance placed by its own transform and then by shared, empty without instances
+    Bounds instanceBounds(const glm::mat4& shared);
+    GeometryData& geometry(int mesh);
+    // The bounds of every mesh, by mesh index
+    const std::vector<Bounds>& meshBounds();
+    GLuint meshVertexArray(int mesh);
+    GLuint meshDepthVertexArray(int mesh);
+    int meshVertexCount(int mesh);
+    BufferArena& bufferArena();
+    // The mesh's handle in bufferArena(), -1 while it's empty
+    int meshArenaHandle(int mesh);
+
+    // Draw calls and vertices submitted by the last draw()
+    int drawCalls;
+    long long verticesDrawn;
+
+private:
+    // Creates the GL side of the geometry added last
+    int uploadLastMesh();
+
+    struct MeshInstances
+    {
+        Mesh mesh;
+        int arenaHandle;
+        GLuint instanceBuffer;
+        size_t instanceCapacity;
+        bool dirty;
+        std::vector<InstanceData> instances;
+    };
+
+    std::vector<GeometryData> geometries;
+    std::vector<Bounds> bounds;
+    std::vector<MeshInstances> meshes;
+    BufferArena arena;
+    std::vector<SceneObject> objects;
+    std::vector<int> occluderObjects;
+    std::vector<int> nodeObjects;
+    SceneGraph sceneGraph;
+    int revision;
+};
+
+#endif
@@ -0,0 +1,328 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include "scenefile.h"
+
+using namespace std;
+
+// Diffuse/normal map pairs of the built-in scene
+const int DEFAULT_MATERIAL_COUNT = 5;
+const char* DEFAULT_MATERIALS[DEFAULT_MATERIAL_COUNT][3] = {
+    {"metal", "metal.jpg", "metal_normal.jpg"},
+    {"abstract", "Abstract.jpg", "Abstract_normal.jpg"},
+    {"thatch", "thatch.jpg", "thatch_normal.jpg"},
+    {"water", "water.jpg", "water_normal.jpg"},
+    {"metal2", "metal2.jpg", "metal2_normal.jpg"}
+};
+
+// NOTE: All the grids share one stress test grid, so they're bounded together. Far past anything
+//       that draws at interactive rates, and their total stays well within an int
+const int MAX_GRID_OBJECTS = 1000000;
+
+// A translation, then optionally x/y/z rotations in degrees, then a uniform or x/y/z scale,
+// composed like the object's transform
+static bool parseTransform(istringstream& line, glm::mat4& transform)
+{
+    vector<float> values;
+    float value;
+    while(line >> value)
+    {
+        values.push_back(value);
+    }
+    if(!line.eof() || ((values.size() != 3) && (values.size() != 6) && (values.size() != 7) && (values.size() != 9)))
+    {
+        return false;
+    }
+
+    transform = glm::translate(glm::mat4(1.0f), glm::vec3(values[0], values[1], values[2]));
+    if(values.size() >= 6)
+    {
+        transform = glm::rotate(transform, glm::radians(values[3]), glm::vec3(1.0f, 0.0f, 0.0f));
+        transform = glm::rotate(transform, glm::radians(values[4]), glm::vec3(0.0f, 1.0f, 0.0f));
+        transform = glm::rotate(transform, glm::radians(values[5]), glm::vec3(0.0f, 0.0f, 1.0f));
+    }
+    if(values.size() == 7)
+    {
+        transform = glm::scale(transform, glm::vec3(values[6], values[6], values[6]));
+    }
+    else if(values.size() == 9)
+    {
+        transform = glm::scale(transform, glm::vec3(values[6], values[7], values[8]));
+    }
+    return true;
+}
+
+static bool parseVector(istringstream& line, glm::vec3& vector)
+{
+    return (bool)(line >> vector.x >> vector.y >> vector.z);
+}
+
+SceneFile::SceneFile()
+{
+    filename = "(built-in)";
+    model = addMesh("suzanne", "objFiles/suzanne.obj");
+    for(int i=0; i<DEFAULT_MATERIAL_COUNT; i++)
+    {
+        SceneMaterial material;
+        material.name = DEFAULT_MATERIALS[i][0];
+        material.diffuseFile = DEFAULT_MATERIALS[i][1];
+        material.normalFile = DEFAULT_MATERIALS[i][2];
+        materials.push_back(material);
+    }
+    SceneLight light;
+    light.range = 0.0f;
+    light.position = glm::vec3(2.0f, 2.0f, 2.0f);
+    light.color = glm::vec3(1.0f, 0.0f, 0.0f);
+    lights.push_back(light);
+    light.position = glm::vec3(-2.0f, 2.0f, 2.0f);
+    light.color = glm::vec3(0.0f, 0.0f, 1.0f);
+    lights.push_back(light);
+    hasCamera = false;
+    cameraPos = glm::vec3(0.0f, 0.0f, 5.0f);
+    cameraFront = glm::vec3(0.0f, 0.0f, -3.0f);
+}
+
+int SceneFile::addMesh(const string& name, const string& file)
+{
+    map<string, int>::iterator existing = meshFileIndices.find(file);
+    int mesh = (existing != meshFileIndices.end()) ? existing->second : (int)meshFiles.size();
+    if(mesh == (int)meshFiles.size())
+    {
+        meshFiles.push_back(file);
+        meshFileIndices[file] = mesh;
+    }
+    meshNames[name] = mesh;
+    return mesh;
+}
+
+int SceneFile::findMesh(const string& name)
+{
+    map<string, int>::iterator mesh = meshNames.find(name);
+    return (mesh != meshNames.end()) ? mesh->second : -1;
+}
+
+int SceneFile::findMaterial(const string& name)
+{
+    for(size_t i=0; i<materials.size(); i++)
+    {
+        if(materials[i].name == name)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool SceneFile::load(const char* filename)
+{
+    ifstream file(filename);
+    if(!file)
+    {
+        cout << "Unable to open scene file " << filename << ", using the built-in scene" << endl;
+        return false;
+    }
+
+    SceneFile parsed;
+    parsed.filename = filename;
+    parsed.meshFiles.clear();
+    parsed.meshNames.clear();
+    parsed.meshFileIndices.clear();
+    parsed.materials.clear();
+    parsed.lights.clear();
+    parsed.model = -1;
+
+    string text;
+    int lineNumber = 0;
+    while(getline(file, text))
+    {
+        lineNumber++;
+        text = text.substr(0, text.find('#'));
+        istringstream line(text);
+        string directive;
+        if(!(line >> directive))
+        {
+            continue;
+        }
+
+        string error;
+        if(directive == "mesh")
+        {
+            string name, meshFile;
+            if(line >> name >> meshFile)
+            {
+                parsed.addMesh(name, meshFile);
+            }
+            else
+            {
+                error = "expected a name and an OBJ file";
+            }
+        }
+        else if(directive == "material")
+        {
+            SceneMaterial material;
+            if(!(line >> material.name >> material.diffuseFile >> material.normalFile))
+            {
+                error = "expected a name, a diffuse and a normal map";
+            }
+            else if(parsed.findMaterial(material.name) >= 0)
+            {
+                error = "material " + material.name + " declared twice";
+            }
+            else
+            {
+                parsed.materials.push_back(material);
+            }
+        }
+        else if(directive == "model")
+        {
+            string name;
+            line >> name;
+            parsed.model = parsed.findMesh(name);
+            if(parsed.model < 0)
+            {
+                error = "unknown mesh " + name;
+            }
+        }
+        else if((directive == "object") || (directive == "occluder") || (directive == "instance") ||
+                (directive == "static"))
+        {
+            string meshName, materialName;
+            ScenePlacement placement;
+            line >> meshName >> materialName;
+            placement.mesh = parsed.findMesh(meshName);
+            placement.material = parsed.findMaterial(materialName);
+            placement.instanced = (directive == "instance");
+            placement.occluder = (directive == "occluder");
+            placement.isStatic = (directive == "static");
+            if(placement.mesh < 0)
+            {
+                error = "unknown mesh " + meshName;
+            }
+            else if(placement.material < 0)
+            {
+                error = "unknown material " + materialName;
+            }
+            else if(!parseTransform(line, placement.transform))
+            {
+                error = "expected x y z [rx ry rz [s | sx sy sz]]";
+            }
+            else
+            {
+                parsed.placements.push_back(placement);
+            }
+        }
+        else if(directive == "grid")
+        {
+            string kind, meshName, materialName, extra;
+            SceneGrid grid;
+            line >> kind >> meshName >> materialName >> grid.count;
+            int gridObjects = 0;
+            for(size_t i=0; i<parsed.grids.size(); i++)
+            {
+                gridObjects += parsed.grids[i].count;
+            }
+            grid.instanced = (kind == "instance");
+            grid.isStatic = (kind == "static");
+            grid.mesh = parsed.findMesh(meshName);
+            grid.material = (materialName == "*") ? -1 : parsed.findMaterial(materialName);
+            if(!line || ((kind != "object") && (kind != "instance") && (kind != "static")) ||
+               (line >> extra))
+            {
+                error = "expected object|instance|static, a mesh, a material or * and a count";
+            }
+            else if((grid.count <= 0) || (grid.count > MAX_GRID_OBJECTS - gridObjects))
+            {
+                error = "expected a count above 0, with at most 1000000 copies over all grids";
+            }
+            else if(grid.mesh < 0)
+            {
+                error = "unknown mesh " + meshName;
+            }
+            else if((grid.material < 0) && (materialName != "*"))
+            {
+                error = "unknown material " + materialName;
+            }
+            else
+            {
+                parsed.grids.push_back(grid);
+            }
+        }
+        else if(directive == "light")
+        {
+            SceneLight light;
+            light.range = 0.0f;
+            if(parseVector(line, light.position) && parseVector(line, light.color))
+            {
+                line >> light.range;
+                parsed.lights.push_back(light);
+            }
+            else
+            {
+                error = "expected a position, a colour and optionally a range";
+            }
+        }
+        else if(directive == "lights")
+        {
+            int count = 0;
+            glm::vec3 center, size;
+            float range = 0.0f;
+            line >> count;
+            if(parseVector(line, center) && parseVector(line, size) && (line >> range) && (count > 0))
+            {
+                scatterLights(parsed.lights, count, center, size, range);
+            }
+            else
+            {
+                error = "expected a count, a center, a size and a range";
+            }
+        }
+        else if(directive == "camera")
+        {
+            if(parseVector(line, parsed.cameraPos))
+            {
+                parsed.hasCamera = true;
+                parseVector(line, parsed.cameraFront);
+            }
+            else
+            {
+                error = "expected a position and optionally a front vector";
+            }
+        }
+        else
+        {
+            error = "unknown directive " + directive;
+        }
+
+        if(!error.empty())
+        {
+            cout << filename << ":" << lineNumber << ": " << error << ", line skipped" << endl;
+        }
+    }
+
+    // Whatever the file leaves out comes from the built-in scene. Nothing can refer to a built-in
+    // mesh or material, those are only kept when the file declares none
+    SceneFile builtIn;
+    if(parsed.meshFiles.empty())
+    {
+        parsed.meshFiles = builtIn.meshFiles;
+        parsed.meshNames = builtIn.meshNames;
+        parsed.meshFileIndices = builtIn.meshFileIndices;
+    }
+    if(parsed.model < 0)
+    {
+        parsed.model = 0;
+    }
+    if(parsed.materials.empty())
+    {
+        parsed.materials = builtIn.materials;
+    }
+    if(parsed.lights.empty())
+    {
+        parsed.lights = builtIn.lights;
+    }
+    *this = parsed;
+    return true;
+}
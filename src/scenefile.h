@@ -0,0 +1,92 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <glm/glm/glm.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "lights.h"
+
+struct SceneMaterial
+{
+    std::string name;
+    std::string diffuseFile;
+    std::string normalFile;
+};
+
+// A mesh placed in the scene, through the render queue or as an instance
+struct ScenePlacement
+{
+    int mesh;
+    int material;
+    glm::mat4 transform;
+    bool instanced;
+    bool occluder;
+    bool isStatic; // Never moves, see StaticBatches
+};
+
+// count copies on the stress test grid behind the model, material -1 cycles through all of them.
+// The grids of a scene continue one another
+struct SceneGrid
+{
+    int mesh;
+    int material;
+    int count;
+    bool instanced;
+    bool isStatic;
+};
+
+// NOTE: A text scene description, one directive a line and # comments:
+//
+//           mesh <name> <obj file>
+//           material <name> <diffuse image> <normal image>
+//           model <mesh>                          the object the keys move around
+//           object <mesh> <material> <transform>  drawn on its own through the render queue
+//           occluder <mesh> <material> <transform>
+//           instance <mesh> <material> <transform>
+//           static <mesh> <material> <transform>  an object that never moves, can be batched
+//           grid object|instance|static <mesh> <material>|* <count>
+//           light <x y z> <r g b> [<range>]
+//           lights <count> <x y z> <size x y z> <range>  scattered through a box, in many colours
+//           camera <x y z> [<front x y z>]
+//
+//       where a transform is a translation, optionally followed by x/y/z rotations in degrees and
+//       then a uniform or x/y/z scale. Meshes and materials are referred to by name and have to
+//       be declared before they are used. Mesh names sharing a file share one mesh, so every
+//       file is loaded once (materials sharing images share textures the same way, see
+//       OpenGLWindow::textureFile). The materials are cycled through with L in the order given.
+//
+//       Nothing here touches GL, the window creates what the description lists
+class SceneFile
+{
+public:
+    // The built-in scene, suzanne with the five materials and two lights
+    SceneFile();
+
+    // Replaces the description with the file's, returns false (keeping the built-in scene) if it
+    // can't be read. Lines with errors are reported and skipped
+    bool load(const char* filename);
+
+    std::string filename;
+    std::vector<std::string> meshFiles; // By mesh index, each file once
+    std::vector<SceneMaterial> materials;
+    int model;
+    std::vector<ScenePlacement> placements;
+    std::vector<SceneGrid> grids;
+    std::vector<SceneLight> lights;
+    bool hasCamera;
+    glm::vec3 cameraPos;
+    glm::vec3 cameraFront;
+
+private:
+    int addMesh(const std::string& name, const std::string& file);
+    int findMesh(const std::string& name);
+    int findMaterial(const std::string& name);
+
+    std::map<std::string, int> meshNames;
+    std::map<std::string, int> meshFileIndices;
+};
+
+#endif
@@ -0,0 +1,518 @@
+#include <iostream>
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "SDL.h"
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include "scenegraph.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define GRAPH_SSE
+#endif
+
+using namespace std;
+
+// Local matrices are built into a small buffer a batch at a time, rather than kept for every node
+const int LOCAL_BATCH = 64;
+
+static double elapsedMs(Uint64 start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+template<typename T>
+static void permute(vector<T>& values, const vector<int>& from)
+{
+    vector<T> sorted(values.size());
+    for(size_t i=0; i<from.size(); i++)
+    {
+        sorted[i] = values[from[i]];
+    }
+    values.swap(sorted);
+}
+
+// Quaternions as x, y, z, w
+static glm::vec4 multiplyQuaternions(const glm::vec4& a, const glm::vec4& b)
+{
+    return glm::vec4(a.w*b.x + a.x*b.w + a.y*b.z - a.z*b.y,
+                     a.w*b.y - a.x*b.z + a.y*b.w + a.z*b.x,
+                     a.w*b.z + a.x*b.y - a.y*b.x + a.z*b.w,
+                     a.w*b.w - a.x*b.x - a.y*b.y - a.z*b.z);
+}
+
+// parent * local, with SSE2 a column of the result is the parent's columns weighted by the local's
+static void multiplyMatrices(const glm::mat4& parent, const glm::mat4& local, glm::mat4& result)
+{
+#if defined(GRAPH_SSE)
+    const float* a = &parent[0][0];
+    const float* b = &local[0][0];
+    float* r = &result[0][0];
+    __m128 a0 = _mm_loadu_ps(a);
+    __m128 a1 = _mm_loadu_ps(a + 4);
+    __m128 a2 = _mm_loadu_ps(a + 8);
+    __m128 a3 = _mm_loadu_ps(a + 12);
+    for(int column=0; column<4; column++)
+    {
+        const float* c = b + 4*column;
+        __m128 sum = _mm_mul_ps(a0, _mm_set1_ps(c[0]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(c[1])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(c[2])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(c[3])));
+        _mm_storeu_ps(r + 4*column, sum);
+    }
+#else
+    result = parent * local;
+#endif
+}
+
+SceneGraph::SceneGraph()
+{
+    lastUpdatedCount = 0;
+    lastUpdateMs = 0.0;
+    lastSortMs = 0.0;
+    updateStamp = 1;
+    firstDirty = 0;
+    needsSort = false;
+}
+
+int SceneGraph::addNode(int parent)
+{
+    int handle = indices.size();
+    int index = handles.size();
+    translationX.push_back(0.0f);
+    translationY.push_back(0.0f);
+    translationZ.push_back(0.0f);
+    rotationX.push_back(0.0f);
+    rotationY.push_back(0.0f);
+    rotationZ.push_back(0.0f);
+    rotationW.push_back(1.0f);
+    scaleX.push_back(1.0f);
+    scaleY.push_back(1.0f);
+    scaleZ.push_back(1.0f);
+    parents.push_back((parent >= 0) ? indices[parent] : -1);
+    subtreeEnds.push_back(index + 1);
+    dirty.push_back(0);
+    updateStamps.push_back(0);
+    worlds.push_back(glm::mat4(1.0f));
+    handles.push_back(handle);
+    indices.push_back(index);
+    parentHandles.push_back(parent);
+
+    // Right after the parent's last descendant the node extends the ranges of all its ancestors,
+    // which all end where the parent's does
+    if(parent >= 0)
+    {
+        if(subtreeEnds[indices[parent]] == index)
+        {
+            for(int ancestor=indices[parent]; ancestor>=0; ancestor=parents[ancestor])
+            {
+                subtreeEnds[ancestor] = index + 1;
+            }
+        }
+        else
+        {
+            needsSort = true;
+        }
+    }
+    markDirty(index);
+    return handle;
+}
+
+void SceneGraph::setParent(int node, int parent)
+{
+    for(int ancestor=parent; ancestor>=0; ancestor=parentHandles[ancestor])
+    {
+        if(ancestor == node)
+        {
+            cout << "Scene graph node " << node << " can't be moved under its own descendant " << parent << endl;
+            return;
+        }
+    }
+    parentHandles[node] = parent;
+    needsSort = true;
+}
+
+int SceneGraph::parent(int node)
+{
+    return parentHandles[node];
+}
+
+int SceneGraph::nodeCount()
+{
+    return handles.size();
+}
+
+void SceneGraph::clear()
+{
+    *this = SceneGraph();
+}
+
+void SceneGraph::setTranslation(int node, const glm::vec3& translation)
+{
+    int index = indices[node];
+    translationX[index] = translation.x;
+    translationY[index] = translation.y;
+    translationZ[index] = translation.z;
+    markDirty(index);
+}
+
+void SceneGraph::setRotation(int node, const glm::vec3& degrees)
+{
+    glm::vec3 half(glm::radians(degrees.x) * 0.5f, glm::radians(degrees.y) * 0.5f, glm::radians(degrees.z) * 0.5f);
+    glm::vec4 x(sin(half.x), 0.0f, 0.0f, cos(half.x));
+    glm::vec4 y(0.0f, sin(half.y), 0.0f, cos(half.y));
+    glm::vec4 z(0.0f, 0.0f, sin(half.z), cos(half.z));
+    glm::vec4 rotation = multiplyQuaternions(multiplyQuaternions(x, y), z);
+
+    int index = indices[node];
+    rotationX[index] = rotation.x;
+    rotationY[index] = rotation.y;
+    rotationZ[index] = rotation.z;
+    rotationW[index] = rotation.w;
+    markDirty(index);
+}
+
+void SceneGraph::setScale(int node, const glm::vec3& scale)
+{
+    int index = indices[node];
+    scaleX[index] = scale.x;
+    scaleY[index] = scale.y;
+    scaleZ[index] = scale.z;
+    markDirty(index);
+}
+
+const glm::mat4& SceneGraph::world(int node)
+{
+    return worlds[indices[node]];
+}
+
+bool SceneGraph::wasUpdated(int node)
+{
+    return updateStamps[indices[node]] == updateStamp;
+}
+
+void SceneGraph::markDirty(int index)
+{
+    dirty[index] = 1;
+    firstDirty = min(firstDirty, index);
+}
+
+// Depth first from the roots, children in their current order
+void SceneGraph::sortNodes()
+{
+    int count = handles.size();
+    vector<int> childStart(count + 1, 0);
+    for(int i=0; i<count; i++)
+    {
+        int parent = parentHandles[handles[i]];
+        if(parent >= 0)
+        {
+            childStart[parent + 1]++;
+        }
+    }
+    for(int i=0; i<count; i++)
+    {
+        childStart[i + 1] += childStart[i];
+    }
+    vector<int> childEnd(childStart.begin(), childStart.end() - 1);
+    vector<int> children(count);
+    for(int i=0; i<count; i++)
+    {
+        int parent = parentHandles[handles[i]];
+        if(parent >= 0)
+        {
+            children[childEnd[parent]++] = handles[i];
+        }
+    }
+
+    vector<int> order;
+    order.reserve(count);
+    vector<int> stack;
+    for(int i=0; i<count; i++)
+    {
+        if(parentHandles[handles[i]] >= 0)
+        {
+            continue;
+        }
+        stack.push_back(handles[i]);
+        while(!stack.empty())
+        {
+            int node = stack.back();
+            stack.pop_back();
+            order.push_back(node);
+            for(int child=childEnd[node]-1; child>=childStart[node]; child--)
+            {
+                stack.push_back(children[child]);
+            }
+        }
+    }
+
+    vector<int> from(count);
+    for(int i=0; i<count; i++)
+    {
+        from[i] = indices[order[i]];
+    }
+    permute(translationX, from);
+    permute(translationY, from);
+    permute(translationZ, from);
+    permute(rotationX, from);
+    permute(rotationY, from);
+    permute(rotationZ, from);
+    permute(rotationW, from);
+    permute(scaleX, from);
+    permute(scaleY, from);
+    permute(scaleZ, from);
+    handles = order;
+    for(int i=0; i<count; i++)
+    {
+        indices[order[i]] = i;
+    }
+    for(int i=0; i<count; i++)
+    {
+        int parent = parentHandles[order[i]];
+        parents[i] = (parent >= 0) ? indices[parent] : -1;
+        subtreeEnds[i] = i + 1;
+    }
+    for(int i=count-1; i>=0; i--)
+    {
+        if(parents[i] >= 0)
+        {
+            subtreeEnds[parents[i]] = max(subtreeEnds[parents[i]], subtreeEnds[i]);
+        }
+    }
+
+    // The world matrices are stale in the new order, everything is recomputed
+    dirty.assign(count, 1);
+    firstDirty = 0;
+}
+
+void SceneGraph::update()
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    lastUpdatedCount = 0;
+    lastSortMs = 0.0;
+    updateStamp++;
+    if(needsSort)
+    {
+        sortNodes();
+        lastSortMs = elapsedMs(start);
+        needsSort = false;
+    }
+
+    int count = handles.size();
+    int index = firstDirty;
+    while(index < count)
+    {
+        if(dirty[index])
+        {
+            updateRange(index, subtreeEnds[index]);
+            lastUpdatedCount += subtreeEnds[index] - index;
+            index = subtreeEnds[index];
+        }
+        else
+        {
+            index++;
+        }
+    }
+    firstDirty = count;
+    lastUpdateMs = elapsedMs(start);
+}
+
+void SceneGraph::updateRange(int begin, int end)
+{
+    glm::mat4 locals[LOCAL_BATCH];
+    for(int batch=begin; batch<end; batch+=LOCAL_BATCH)
+    {
+        int count = min(LOCAL_BATCH, end - batch);
+        buildLocals(batch, count, locals);
+        for(int i=0; i<count; i++)
+        {
+            // The parent comes first, it is either above the range or already done in it
+            int index = batch + i;
+            int parent = parents[index];
+            if(parent >= 0)
+            {
+                multiplyMatrices(worlds[parent], locals[i], worlds[index]);
+            }
+            else
+            {
+                worlds[index] = locals[i];
+            }
+            dirty[index] = 0;
+            updateStamps[index] = updateStamp;
+        }
+    }
+}
+
+// translate * rotate * scale of count nodes from begin. Each column of the rotation scaled by the
+// matching scale, the translation in the last
+void SceneGraph::buildLocals(int begin, int count, glm::mat4* locals)
+{
+    int i = 0;
+#if defined(GRAPH_SSE)
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 zero = _mm_setzero_ps();
+    for(; i+4<=count; i+=4)
+    {
+        int index = begin + i;
+        __m128 x = _mm_loadu_ps(&rotationX[index]);
+        __m128 y = _mm_loadu_ps(&rotationY[index]);
+        __m128 z = _mm_loadu_ps(&rotationZ[index]);
+        __m128 w = _mm_loadu_ps(&rotationW[index]);
+        __m128 sx = _mm_loadu_ps(&scaleX[index]);
+        __m128 sy = _mm_loadu_ps(&scaleY[index]);
+        __m128 sz = _mm_loadu_ps(&scaleZ[index]);
+
+        __m128 xx = _mm_mul_ps(x, x);
+        __m128 yy = _mm_mul_ps(y, y);
+        __m128 zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y);
+        __m128 xz = _mm_mul_ps(x, z);
+        __m128 yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x);
+        __m128 wy = _mm_mul_ps(w, y);
+        __m128 wz = _mm_mul_ps(w, z);
+
+        // columns[c][r] holds row r of column c for all 4 nodes
+        __m128 columns[4][4];
+        columns[0][0] = _mm_mul_ps(sx, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+        columns[0][1] = _mm_mul_ps(sx, _mm_mul_ps(two, _mm_add_ps(xy, wz)));
+        columns[0][2] = _mm_mul_ps(sx, _mm_mul_ps(two, _mm_sub_ps(xz, wy)));
+        columns[0][3] = zero;
+        columns[1][0] = _mm_mul_ps(sy, _mm_mul_ps(two, _mm_sub_ps(xy, wz)));
+        columns[1][1] = _mm_mul_ps(sy, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+        columns[1][2] = _mm_mul_ps(sy, _mm_mul_ps(two, _mm_add_ps(yz, wx)));
+        columns[1][3] = zero;
+        columns[2][0] = _mm_mul_ps(sz, _mm_mul_ps(two, _mm_add_ps(xz, wy)));
+        columns[2][1] = _mm_mul_ps(sz, _mm_mul_ps(two, _mm_sub_ps(yz, wx)));
+        columns[2][2] = _mm_mul_ps(sz, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+        columns[2][3] = zero;
+        columns[3][0] = _mm_loadu_ps(&translationX[index]);
+        columns[3][1] = _mm_loadu_ps(&translationY[index]);
+        columns[3][2] = _mm_loadu_ps(&translationZ[index]);
+        columns[3][3] = one;
+
+        // Transposed, each register is then one column of one node's matrix
+        for(int column=0; column<4; column++)
+        {
+            _MM_TRANSPOSE4_PS(columns[column][0], columns[column][1], columns[column][2], columns[column][3]);
+            for(int node=0; node<4; node++)
+            {
+                _mm_storeu_ps(&locals[i + node][column][0], columns[column][node]);
+            }
+        }
+    }
+#endif
+    for(; i<count; i++)
+    {
+        int index = begin + i;
+        float x = rotationX[index];
+        float y = rotationY[index];
+        float z = rotationZ[index];
+        float w = rotationW[index];
+        glm::mat4& local = locals[i];
+        local[0] = glm::vec4(scaleX[index] * (1.0f - 2.0f*(y*y + z*z)), scaleX[index] * 2.0f*(x*y + w*z),
+                             scaleX[index] * 2.0f*(x*z - w*y), 0.0f);
+        local[1] = glm::vec4(scaleY[index] * 2.0f*(x*y - w*z), scaleY[index] * (1.0f - 2.0f*(x*x + z*z)),
+                             scaleY[index] * 2.0f*(y*z + w*x), 0.0f);
+        local[2] = glm::vec4(scaleZ[index] * 2.0f*(x*z + w*y), scaleZ[index] * 2.0f*(y*z - w*x),
+                             scaleZ[index] * (1.0f - 2.0f*(x*x + y*y)), 0.0f);
+        local[3] = glm::vec4(translationX[index], translationY[index], translationZ[index], 1.0f);
+    }
+}
+
+static float randomFloat(float low, float high)
+{
+    return low + (high - low) * (rand() / (float)RAND_MAX);
+}
+
+void SceneGraph::runBenchmark(int nodeCount, int frameCount)
+{
+    // Characters of 64 nodes, each joint under a random earlier joint of its character, so the
+    // nodes come out of order and the first update sorts them
+    const int GROUP_SIZE = 64;
+    const int MOVED_PER_FRAME = max(1, nodeCount / 100);
+
+    srand(1);
+    SceneGraph graph;
+    vector<int> parents(nodeCount);
+    vector<glm::vec3> translations(nodeCount);
+    vector<glm::vec3> rotations(nodeCount);
+    vector<glm::vec3> scales(nodeCount);
+    for(int i=0; i<nodeCount; i++)
+    {
+        int joint = i % GROUP_SIZE;
+        parents[i] = (joint == 0) ? -1 : (i - joint) + rand() % joint;
+        translations[i] = glm::vec3(randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f));
+        rotations[i] = glm::vec3(randomFloat(-180.0f, 180.0f), randomFloat(-180.0f, 180.0f), randomFloat(-180.0f, 180.0f));
+        scales[i] = glm::vec3(randomFloat(0.9f, 1.1f), randomFloat(0.9f, 1.1f), randomFloat(0.9f, 1.1f));
+        graph.addNode(parents[i]);
+        graph.setTranslation(i, translations[i]);
+        graph.setRotation(i, rotations[i]);
+        graph.setScale(i, scales[i]);
+    }
+    cout << "Scene graph benchmark, " << nodeCount << " nodes in characters of " << GROUP_SIZE << ", "
+         << frameCount << " frames" << endl;
+
+    graph.update();
+    cout << "\tFirst update: " << graph.lastSortMs << " ms sorting, " << graph.lastUpdateMs - graph.lastSortMs
+         << " ms for all " << graph.lastUpdatedCount << " nodes ("
+         << (graph.lastUpdateMs - graph.lastSortMs) * 1000000.0 / max(1, nodeCount) << " ns per node)" << endl;
+
+    // The same matrices the way the object's transform is built, every node every frame
+    vector<glm::mat4> reference(nodeCount);
+    double referenceMs = 0.0;
+    double updateMs = 0.0;
+    long long updated = 0;
+    for(int frame=0; frame<frameCount; frame++)
+    {
+        for(int i=0; i<MOVED_PER_FRAME; i++)
+        {
+            int node = rand() % nodeCount;
+            rotations[node] += glm::vec3(1.0f, 2.0f, 3.0f);
+            graph.setRotation(node, rotations[node]);
+        }
+        graph.update();
+        updateMs += graph.lastUpdateMs;
+        updated += graph.lastUpdatedCount;
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(int i=0; i<nodeCount; i++)
+        {
+            glm::mat4 local = glm::translate(glm::mat4(1.0f), translations[i]);
+            local = glm::rotate(local, glm::radians(rotations[i].x), glm::vec3(1.0f, 0.0f, 0.0f));
+            local = glm::rotate(local, glm::radians(rotations[i].y), glm::vec3(0.0f, 1.0f, 0.0f));
+            local = glm::rotate(local, glm::radians(rotations[i].z), glm::vec3(0.0f, 0.0f, 1.0f));
+            local = glm::scale(local, scales[i]);
+            reference[i] = (parents[i] >= 0) ? reference[parents[i]] * local : local;
+        }
+        referenceMs += elapsedMs(start);
+    }
+
+    graph.update();
+    double idleMs = graph.lastUpdateMs;
+
+    float maxError = 0.0f;
+    for(int i=0; i<nodeCount; i++)
+    {
+        const glm::mat4& world = graph.world(i);
+        for(int column=0; column<4; column++)
+        {
+            for(int row=0; row<4; row++)
+            {
+                maxError = max(maxError, (float)fabs(world[column][row] - reference[i][column][row]));
+            }
+        }
+    }
+
+    cout << "\tMoving " << MOVED_PER_FRAME << " nodes a frame: " << updateMs / max(1, frameCount) << " ms, "
+         << updated / max(1, frameCount) << " nodes recomputed" << endl;
+    cout << "\tNothing moving: " << idleMs << " ms" << endl;
+    cout << "\tglm, every node every frame: " << referenceMs / max(1, frameCount) << " ms, largest difference "
+         << maxError << endl;
+}
@@ -0,0 +1,86 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm/glm.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+// NOTE: A transform hierarchy kept as flat arrays. Every node has a parent and a local
+//       translation, rotation (unit quaternion) and scale, each component in its own array, and
+//       the nodes are stored depth first: a parent comes before its children and every subtree
+//       is one contiguous range. update() then walks the array once, and for every changed node
+//       recomputes its whole range in order, building the local matrices 4 at a time with SSE2
+//       and multiplying them onto the already updated parent's world matrix. Unchanged subtrees
+//       are skipped over.
+//
+//       Nodes are referred to by handles which stay the same when the arrays are reordered.
+//       Adding children in depth first order (each after its parent's last descendant so far)
+//       keeps the order, anything else marks it for a sort on the next update
+class SceneGraph
+{
+public:
+    SceneGraph();
+
+    // Returns the new node's handle, parent is a handle or -1 for a root. Nodes start at identity
+    int addNode(int parent=-1);
+    // Moves a node and its subtree under another parent, or makes it a root with -1
+    void setParent(int node, int parent);
+    int parent(int node);
+    int nodeCount();
+    void clear();
+
+    void setTranslation(int node, const glm::vec3& translation);
+    // Rotations about x, then y, then z in degrees, composed like the object's rx/ry/rz
+    void setRotation(int node, const glm::vec3& degrees);
+    void setScale(int node, const glm::vec3& scale);
+
+    // Recomputes the world matrices of the changed nodes and everything below them
+    void update();
+    const glm::mat4& world(int node);
+    // Whether the last update() recomputed the node's world matrix
+    bool wasUpdated(int node);
+
+    // Of the last update()
+    int lastUpdatedCount;
+    double lastUpdateMs;
+    double lastSortMs; // 0 unless the nodes had to be reordered
+
+    // Sorts and updates nodeCount nodes, then updates them with a few percent of them moving every
+    // frame, compared against composing the same matrices with glm, no window needed
+    static void runBenchmark(int nodeCount, int frameCount=20);
+
+private:
+    void markDirty(int index);
+    void sortNodes();
+    void updateRange(int begin, int end);
+    void buildLocals(int begin, int count, glm::mat4* locals);
+
+    // By index, depth first
+    std::vector<float> translationX;
+    std::vector<float> translationY;
+    std::vector<float> translationZ;
+    std::vector<float> rotationX;
+    std::vector<float> rotationY;
+    std::vector<float> rotationZ;
+    std::vector<float> rotationW;
+    std::vector<float> scaleX;
+    std::vector<float> scaleY;
+    std::vector<float> scaleZ;
+    std::vector<int> parents;     // Index of the parent, always lower than the node's own
+    std::vector<int> subtreeEnds; // One past the node's last descendant
+    std::vector<uint8_t> dirty;
+    std::vector<uint32_t> updateStamps;
+    std::vector<glm::mat4> worlds;
+    std::vector<int> handles;
+
+    // By handle
+    std::vector<int> indices;
+    std::vector<int> parentHandles;
+
+    uint32_t updateStamp;
+    int firstDirty;
+    bool needsSort;
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include <string.h>
+
+#include "shaderprogram.h"
+
+using namespace std;
+
+const int SHADOW_FLOATS = 16;
+
+// Array uniforms are reported as "name[0]", we look them up by their plain name
+static string variableName(const char* name, GLsizei length)
+{
+    string result(name, length);
+    size_t bracket = result.find('[');
+    if(bracket != string::npos)
+    {
+        result.resize(bracket);
+    }
+    return result;
+}
+
+ShaderProgram::ShaderProgram()
+{
+    id = 0;
+    uploadCount = 0;
+    skippedCount = 0;
+}
+
+void ShaderProgram::reflect(GLuint program)
+{
+    id = program;
+    uniforms.clear();
+    attributes.clear();
+    locationUniforms.clear();
+    if(!program)
+    {
+        return;
+    }
+
+    GLint count = 0;
+    GLint maxLength = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    vector<char> name(maxLength + 1);
+    for(GLint i=0; i<count; i++)
+    {
+        ProgramVariable uniform;
+        GLsizei length = 0;
+        glGetActiveUniform(program, i, maxLength + 1, &length, &uniform.size, &uniform.type, &name[0]);
+        uniform.name = variableName(&name[0], length);
+        // NOTE: Members of uniform blocks have no location, those are set through buffers
+        uniform.location = glGetUniformLocation(program, uniform.name.c_str());
+        uniforms.push_back(uniform);
+
+        if(uniform.location >= (GLint)locationUniforms.size())
+        {
+            locationUniforms.resize(uniform.location + 1, -1);
+        }
+        if(uniform.location >= 0)
+        {
+            locationUniforms[uniform.location] = uniforms.size() - 1;
+        }
+    }
+    shadowValues.assign(uniforms.size() * SHADOW_FLOATS, 0.0f);
+    shadowValid.assign(uniforms.size(), false);
+
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+    name.resize(maxLength + 1);
+    for(GLint i=0; i<count; i++)
+    {
+        ProgramVariable attribute;
+        GLsizei length = 0;
+        glGetActiveAttrib(program, i, maxLength + 1, &length, &attribute.size, &attribute.type, &name[0]);
+        attribute.name = variableName(&name[0], length);
+        attribute.location = glGetAttribLocation(program, attribute.name.c_str());
+        attributes.push_back(attribute);
+    }
+}
+
+GLint ShaderProgram::uniformLocation(const char* name)
+{
+    for(size_t i=0; i<uniforms.size(); i++)
+    {
+        if(uniforms[i].name == name)
+        {
+            return uniforms[i].location;
+        }
+    }
+    return -1;
+}
+
+GLint ShaderProgram::attributeLocation(const char* name)
+{
+    for(size_t i=0; i<attributes.size(); i++)
+    {
+        if(attributes[i].name == name)
+        {
+            return attributes[i].location;
+        }
+    }
+    return -1;
+}
+
+void ShaderProgram::bindUniformBlock(const char* name, GLuint binding)
+{
+    GLuint index = glGetUniformBlockIndex(id, name);
+    if(index != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding(id, index, binding);
+    }
+}
+
+float* ShaderProgram::shadowValue(GLint location)
+{
+    if((location < 0) || (location >= (GLint)locationUniforms.size()) || (locationUniforms[location] < 0))
+    {
+        return NULL;
+    }
+    return &shadowValues[locationUniforms[location] * SHADOW_FLOATS];
+}
+
+// Updates the shadow copy, returns false if the value is the same as the last one uploaded.
+// Inactive uniforms (location -1) are never uploaded, GL would ignore them anyway
+bool ShaderProgram::changed(GLint location, const void* value, size_t bytes)
+{
+    float* shadow = shadowValue(location);
+    if(!shadow)
+    {
+        return false;
+    }
+
+    int uniform = locationUniforms[location];
+    if(shadowValid[uniform] && (memcmp(shadow, value, bytes) == 0))
+    {
+        skippedCount++;
+        return false;
+    }
+    memcpy(shadow, value, bytes);
+    shadowValid[uniform] = true;
+    uploadCount++;
+    return true;
+}
+
+void ShaderProgram::set(GLint location, int value)
+{
+    if(changed(location, &value, sizeof(value)))
+    {
+        glUniform1i(location, value);
+    }
+}
+
+void ShaderProgram::set(GLint location, float value)
+{
+    if(changed(location, &value, sizeof(value)))
+    {
+        glUniform1f(location, value);
+    }
+}
+
+void ShaderProgram::set(GLint location, const glm::vec3& value)
+{
+    if(changed(location, &value[0], 3*sizeof(float)))
+    {
+        glUniform3fv(location, 1, &value[0]);
+    }
+}
+
+void ShaderProgram::set(GLint location, const glm::vec4& value)
+{
+    if(changed(location, &value[0], 4*sizeof(float)))
+    {
+        glUniform4fv(location, 1, &value[0]);
+    }
+}
+
+void ShaderProgram::set(GLint location, const glm::mat4& value)
+{
+    if(changed(location, &value[0][0], 16*sizeof(float)))
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+    }
+}
+
+void ShaderProgram::set(GLint location, const glm::vec4* values, int count)
+{
+    if(location >= 0)
+    {
+        glUniform4fv(location, count, &values[0][0]);
+        uploadCount++;
+    }
+}
+
+void ShaderProgram::set(GLint location, const int* values, int count)
+{
+    size_t bytes = count*sizeof(int);
+    if(bytes <= SHADOW_FLOATS*sizeof(float))
+    {
+        if(changed(location, values, bytes))
+        {
+            glUniform1iv(location, count, values);
+        }
+    }
+    else if(location >= 0)
+    {
+        glUniform1iv(location, count, values);
+        uploadCount++;
+    }
+}
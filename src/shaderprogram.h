@@ -0,0 +1,66 @@
+#ifndef SHADER_PROGRAM_H
+#define SHADER_PROGRAM_H
+
+#include <GL/glew.h>
+#include <glm/glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+struct ProgramVariable
+{
+    std::string name;
+    GLint location;
+    GLenum type;
+    GLint size;
+};
+
+// NOTE: Reflection of a linked program. The active uniforms and attributes are enumerated once
+//       after linking, so nothing needs to query the driver for locations per frame.
+//
+//       The setters keep a shadow copy of every uniform's value and skip the upload when it
+//       hasn't changed. They upload to the currently bound program, so the program needs to be
+//       bound (the same as with plain glUniform*) and all its uniforms must go through here,
+//       otherwise the shadow copy goes stale
+class ShaderProgram
+{
+public:
+    ShaderProgram();
+
+    void reflect(GLuint program);
+
+    // Both return -1 if the variable isn't active in this program
+    GLint uniformLocation(const char* name);
+    GLint attributeLocation(const char* name);
+
+    // Assigns a uniform block to a buffer binding point, does nothing if the block isn't active
+    void bindUniformBlock(const char* name, GLuint binding);
+
+    void set(GLint location, int value);
+    void set(GLint location, float value);
+    void set(GLint location, const glm::vec3& value);
+    void set(GLint location, const glm::vec4& value);
+    void set(GLint location, const glm::mat4& value);
+    // NOTE: vec4 arrays have no shadow copy, they're uploaded on every call. Int arrays of up to
+    //       16 values have one
+    void set(GLint location, const glm::vec4* values, int count);
+    void set(GLint location, const int* values, int count);
+
+    GLuint id;
+    std::vector<ProgramVariable> uniforms;
+    std::vector<ProgramVariable> attributes;
+
+    // Uniform uploads issued/skipped since the last reset
+    int uploadCount;
+    int skippedCount;
+
+private:
+    float* shadowValue(GLint location);
+    bool changed(GLint location, const void* value, size_t bytes);
+
+    std::vector<int> locationUniforms; // Index into uniforms of every location
+    std::vector<float> shadowValues;   // 16 floats per uniform
+    std::vector<bool> shadowValid;
+};
+
+#endif
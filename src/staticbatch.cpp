@@ -0,0 +1,145 @@
+#include <math.h>
+#include <stdint.h>
+
+#include <map>
+
+#include "SDL.h"
+#include "staticbatch.h"
+#include "culling.h"
+
+using namespace std;
+
+StaticBatches::StaticBatches()
+{
+    cellSize = 10.0f;
+    lastObjectCount = 0;
+    lastBatchCount = 0;
+    lastVertexCount = 0;
+    lastBuildMs = 0.0;
+    firstBatchObject = 0;
+    appliedObjectCount = 0;
+    bakedShared = glm::mat4(1.0f);
+    applied = false;
+}
+
+void StaticBatches::apply(Scene& scene, const glm::mat4& shared)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    if(applied)
+    {
+        revert(scene);
+    }
+
+    // NOTE: The key is the material and then the cell, so the batches come out grouped by
+    //       material. 16 bits a cell coordinate reach 327680 units either way with 10 unit cells
+    const vector<Bounds>& meshBounds = scene.meshBounds();
+    map<uint64_t, vector<int> > groups;
+    vector<int> batched;
+    originals.clear();
+    for(int i=0; i<scene.objectCount(); i++)
+    {
+        const SceneObject& object = scene.object(i);
+        if(!object.isStatic || object.occluder || (object.node >= 0))
+        {
+            continue;
+        }
+        Bounds placed = transformBounds(meshBounds[object.mesh], object.transform * shared);
+        uint64_t key = (uint64_t)object.material << 48;
+        for(int axis=0; axis<3; axis++)
+        {
+            int cell = (int)floor(placed.center[axis] / cellSize);
+            key |= (uint64_t)((cell + 32768) & 0xFFFF) << (32 - 16*axis);
+        }
+        groups[key].push_back(i);
+        batched.push_back(i);
+        originals.push_back(object);
+    }
+
+    glm::mat4 toShared = glm::inverse(shared);
+    vector<int> materials;
+    lastVertexCount = 0;
+    for(map<uint64_t, vector<int> >::iterator group=groups.begin(); group!=groups.end(); group++)
+    {
+        GeometryData merged;
+        for(size_t i=0; i<group->second.size(); i++)
+        {
+            const SceneObject& object = scene.object(group->second[i]);
+            merged.append(scene.geometry(object.mesh), toShared * object.transform * shared);
+        }
+        merged.computeBounds();
+        lastVertexCount += merged.vertexCount();
+
+        int batch = materials.size();
+        if(batch < (int)batchMeshes.size())
+        {
+            scene.setMeshGeometry(batchMeshes[batch], merged);
+        }
+        else
+        {
+            batchMeshes.push_back(scene.addMesh(merged));
+        }
+        materials.push_back((int)(group->first >> 48));
+    }
+
+    scene.removeObjects(batched);
+    firstBatchObject = scene.objectCount();
+    for(size_t batch=0; batch<materials.size(); batch++)
+    {
+        scene.addObject(batchMeshes[batch], glm::mat4(1.0f), materials[batch]);
+    }
+
+    lastObjectCount = batched.size();
+    lastBatchCount = materials.size();
+    appliedObjectCount = scene.objectCount();
+    bakedShared = shared;
+    applied = true;
+    lastBuildMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+void StaticBatches::revert(Scene& scene)
+{
+    if(!applied)
+    {
+        return;
+    }
+
+    // Nothing to put back if the objects were cleared in the meantime
+    bool batchesInPlace = (scene.objectCount() >= firstBatchObject + lastBatchCount);
+    for(int i=0; batchesInPlace && (i<lastBatchCount); i++)
+    {
+        batchesInPlace = (scene.object(firstBatchObject + i).mesh == batchMeshes[i]);
+    }
+    if(batchesInPlace)
+    {
+        vector<int> batches;
+        for(int i=0; i<lastBatchCount; i++)
+        {
+            batches.push_back(firstBatchObject + i);
+        }
+        scene.removeObjects(batches);
+        for(size_t i=0; i<originals.size(); i++)
+        {
+            int index = scene.addObject(originals[i].mesh, originals[i].transform, originals[i].material);
+            scene.setStatic(index, true);
+        }
+    }
+    originals.clear();
+
+    GeometryData empty;
+    empty.computeBounds();
+    for(int i=0; i<lastBatchCount; i++)
+    {
+        scene.setMeshGeometry(batchMeshes[i], empty);
+    }
+    applied = false;
+}
+
+bool StaticBatches::isApplied()
+{
+    return applied;
+}
+
+bool StaticBatches::isStale(Scene& scene, const glm::mat4& shared)
+{
+    return (shared != bakedShared) || (scene.objectCount() != appliedObjectCount);
+}
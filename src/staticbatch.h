@@ -0,0 +1,55 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+#include "scene.h"
+
+// NOTE: Static batching. Scene objects marked static never move, so the ones sharing a material
+//       can be merged into a single mesh with their transforms baked into the vertices, and
+//       drawn with one draw call. The objects are grouped by material and by the cell of a
+//       uniform grid their bounds are centred in, so the batches stay small enough for the
+//       culling to leave out the ones off screen. The batches are regular scene objects, culled,
+//       sorted and picked like any other.
+//
+//       The shaders place an object's vertices by the model matrix and the shared object
+//       transform before its own transform, so what gets baked depends on them: a batch holds
+//       its objects' vertices placed by inverse(shared) * transform * shared, and is only right
+//       for the shared transform it was baked for. Occluders and objects following a scene graph
+//       node are never batched
+class StaticBatches
+{
+public:
+    StaticBatches();
+
+    // Replaces the static objects of the scene by the batches, baked for shared (the object
+    // transform * model)
+    void apply(Scene& scene, const glm::mat4& shared);
+    // Puts the static objects back in place of the batches, after the scene's other objects
+    void revert(Scene& scene);
+    bool isApplied();
+    // Whether the batches were baked for another shared transform, or objects were added or
+    // cleared since. Objects moving don't make them stale, static ones don't move
+    bool isStale(Scene& scene, const glm::mat4& shared);
+
+    // Of the grid the objects are grouped on, in the space their bounds are placed in
+    float cellSize;
+
+    // Of the last apply()
+    int lastObjectCount; // Merged into the batches
+    int lastBatchCount;
+    int lastVertexCount;
+    double lastBuildMs;
+
+private:
+    std::vector<SceneObject> originals;
+    std::vector<int> batchMeshes; // Scene meshes of the batches, emptied rather than removed
+    int firstBatchObject;
+    int appliedObjectCount; // Of the scene, right after apply()
+    glm::mat4 bakedShared;
+    bool applied;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include "transform.h"
+
+TransformCache::TransformCache()
+{
+    rebuildCount = 0;
+    cameraPosition = glm::vec3(0.0f);
+    cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
+    cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+    fovDegrees = 45.0f;
+    aspect = 1.0f;
+    nearPlane = 0.1f;
+    farPlane = 100.0f;
+    modelAngle = 0.0f;
+    modelAxis = glm::vec3(1.0f, 0.0f, 0.0f);
+    translation = glm::vec3(0.0f);
+    rotationDegrees = glm::vec3(0.0f);
+    scale = 1.0f;
+
+    // Nothing has been computed yet
+    changes = CAMERA_CHANGED | PROJECTION_CHANGED | MODEL_CHANGED | OBJECT_CHANGED;
+    dirty = (1 << MATRIX_COUNT) - 1;
+}
+
+void TransformCache::invalidate(unsigned int inputs)
+{
+    changes |= inputs;
+    if(inputs & CAMERA_CHANGED)
+    {
+        dirty |= (1 << VIEW) | (1 << VIEW_MODEL) | (1 << MVP);
+    }
+    if(inputs & PROJECTION_CHANGED)
+    {
+        dirty |= (1 << PROJECTION) | (1 << VIEW_MODEL) | (1 << MVP);
+    }
+    if(inputs & MODEL_CHANGED)
+    {
+        dirty |= (1 << MODEL) | (1 << VIEW_MODEL) | (1 << MVP);
+    }
+    if(inputs & OBJECT_CHANGED)
+    {
+        dirty |= (1 << TRANSFORM) | (1 << MVP);
+    }
+}
+
+// Clears the dirty bit of the matrix, returns whether it was set
+bool TransformCache::needsRebuild(Matrix matrix)
+{
+    if(!(dirty & (1 << matrix)))
+    {
+        return false;
+    }
+    dirty &= ~(1 << matrix);
+    rebuildCount++;
+    return true;
+}
+
+void TransformCache::setCamera(const glm::vec3& position, const glm::vec3& front, const glm::vec3& up)
+{
+    if((position != cameraPosition) || (front != cameraFront) || (up != cameraUp))
+    {
+        cameraPosition = position;
+        cameraFront = front;
+        cameraUp = up;
+        invalidate(CAMERA_CHANGED);
+    }
+}
+
+void TransformCache::setProjection(float fovDegrees, float aspect, float nearPlane, float farPlane)
+{
+    if((fovDegrees != this->fovDegrees) || (aspect != this->aspect) ||
+       (nearPlane != this->nearPlane) || (farPlane != this->farPlane))
+    {
+        this->fovDegrees = fovDegrees;
+        this->aspect = aspect;
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+        invalidate(PROJECTION_CHANGED);
+    }
+}
+
+void TransformCache::setModel(float angleDegrees, const glm::vec3& axis)
+{
+    if((angleDegrees != modelAngle) || (axis != modelAxis))
+    {
+        modelAngle = angleDegrees;
+        modelAxis = axis;
+        invalidate(MODEL_CHANGED);
+    }
+}
+
+void TransformCache::setObject(const glm::vec3& translation, const glm::vec3& rotationDegrees, float scale)
+{
+    if((translation != this->translation) || (rotationDegrees != this->rotationDegrees) || (scale != this->scale))
+    {
+        this->translation = translation;
+        this->rotationDegrees = rotationDegrees;
+        this->scale = scale;
+        invalidate(OBJECT_CHANGED);
+    }
+}
+
+const glm::mat4& TransformCache::view()
+{
+    if(needsRebuild(VIEW))
+    {
+        matrices[VIEW] = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
+    }
+    return matrices[VIEW];
+}
+
+const glm::mat4& TransformCache::projection()
+{
+    if(needsRebuild(PROJECTION))
+    {
+        matrices[PROJECTION] = glm::perspective(glm::radians(fovDegrees), aspect, nearPlane, farPlane);
+    }
+    return matrices[PROJECTION];
+}
+
+const glm::mat4& TransformCache::model()
+{
+    if(needsRebuild(MODEL))
+    {
+        matrices[MODEL] = glm::rotate(glm::mat4(1.0f), glm::radians(modelAngle), modelAxis);
+    }
+    return matrices[MODEL];
+}
+
+const glm::mat4& TransformCache::transform()
+{
+    if(needsRebuild(TRANSFORM))
+    {
+        // translation * rotatex * rotatey * rotatez * scale, composed in place
+        glm::mat4 result = glm::translate(glm::mat4(1.0f), translation);
+        result = glm::rotate(result, glm::radians(rotationDegrees.x), glm::vec3(1.0f, 0.0f, 0.0f));
+        result = glm::rotate(result, glm::radians(rotationDegrees.y), glm::vec3(0.0f, 1.0f, 0.0f));
+        result = glm::rotate(result, glm::radians(rotationDegrees.z), glm::vec3(0.0f, 0.0f, 1.0f));
+        matrices[TRANSFORM] = glm::scale(result, glm::vec3(scale));
+    }
+    return matrices[TRANSFORM];
+}
+
+const glm::mat4& TransformCache::viewModel()
+{
+    if(dirty & (1 << VIEW_MODEL))
+    {
+        glm::mat4 result = projection() * view() * model();
+        needsRebuild(VIEW_MODEL);
+        matrices[VIEW_MODEL] = result;
+    }
+    return matrices[VIEW_MODEL];
+}
+
+const glm::mat4& TransformCache::mvp()
+{
+    if(dirty & (1 << MVP))
+    {
+        glm::mat4 result = viewModel() * transform();
+        needsRebuild(MVP);
+        matrices[MVP] = result;
+    }
+    return matrices[MVP];
+}
+
+unsigned int TransformCache::takeChanges()
+{
+    unsigned int result = changes;
+    changes = 0;
+    return result;
+}
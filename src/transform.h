@@ -0,0 +1,73 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <glm/glm/glm.hpp>
+
+// Inputs of the matrices, marked when a setter receives a different value
+const unsigned int CAMERA_CHANGED = 1;
+const unsigned int PROJECTION_CHANGED = 2;
+const unsigned int MODEL_CHANGED = 4;
+const unsigned int OBJECT_CHANGED = 8;
+
+// NOTE: The matrices render() needs, each recomputed only when one of the inputs it depends on
+//       has changed. The setters are cheap to call every frame, they only compare the inputs
+//       against the last ones, and the getters rebuild whatever was invalidated on first use
+class TransformCache
+{
+public:
+    TransformCache();
+
+    void setCamera(const glm::vec3& position, const glm::vec3& front, const glm::vec3& up);
+    void setProjection(float fovDegrees, float aspect, float nearPlane, float farPlane);
+    // Rotation of the scene about an axis (the camera orbit)
+    void setModel(float angleDegrees, const glm::vec3& axis);
+    // Translation, x/y/z rotations and uniform scale of the object
+    void setObject(const glm::vec3& translation, const glm::vec3& rotationDegrees, float scale);
+
+    const glm::mat4& view();
+    const glm::mat4& projection();
+    const glm::mat4& model();
+    const glm::mat4& transform();
+    const glm::mat4& viewModel(); // projection * view * model
+    const glm::mat4& mvp();       // viewModel * transform
+
+    // Returns the inputs changed since the last call (*_CHANGED bits)
+    unsigned int takeChanges();
+
+    // Matrices rebuilt since the last reset
+    int rebuildCount;
+
+private:
+    enum Matrix
+    {
+        VIEW,
+        PROJECTION,
+        MODEL,
+        TRANSFORM,
+        VIEW_MODEL,
+        MVP,
+        MATRIX_COUNT
+    };
+
+    void invalidate(unsigned int inputs);
+    bool needsRebuild(Matrix matrix);
+
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraFront;
+    glm::vec3 cameraUp;
+    float fovDegrees;
+    float aspect;
+    float nearPlane;
+    float farPlane;
+    float modelAngle;
+    glm::vec3 modelAxis;
+    glm::vec3 translation;
+    glm::vec3 rotationDegrees;
+    float scale;
+
+    unsigned int changes;
+    unsigned int dirty;                 // Bit per Matrix
+    glm::mat4 matrices[MATRIX_COUNT];
+};
+
+#endif
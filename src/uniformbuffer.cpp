@@ -0,0 +1,179 @@
+#include <iostream>
+#include <string.h>
+
+#include <algorithm>
+
+#include "SDL.h"
+#include "uniformbuffer.h"
+#include "glstate.h"
+
+using namespace std;
+
+UniformRingBuffer::UniformRingBuffer()
+{
+    lastWaitMs = 0.0;
+    buffer = 0;
+    persistent = false;
+    regionSize = 0;
+    regionCount = 0;
+    offsetAlignment = 256;
+    persistentData = NULL;
+    regionData = NULL;
+    currentRegion = 0;
+    regionOffset = 0;
+}
+
+size_t UniformRingBuffer::alignedSize(size_t size)
+{
+    return ((size + offsetAlignment - 1) / offsetAlignment) * offsetAlignment;
+}
+
+bool UniformRingBuffer::isPersistent()
+{
+    return persistent;
+}
+
+void UniformRingBuffer::create(size_t regionSize, int regionCount)
+{
+    destroy();
+
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+    this->regionSize = alignedSize(regionSize);
+    this->regionCount = regionCount;
+    fences.assign(regionCount, (GLsync)0);
+    currentRegion = regionCount - 1;
+    size_t totalSize = this->regionSize * regionCount;
+
+    glGenBuffers(1, &buffer);
+    glState.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+    persistent = GLEW_ARB_buffer_storage || GLEW_VERSION_4_4;
+    if(persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, totalSize, NULL, flags);
+        persistentData = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, totalSize, flags);
+        if(!persistentData)
+        {
+            // The storage is immutable, so start over with a buffer we map every frame
+            cout << "Unable to persistently map the uniform ring buffer, mapping it every frame" << endl;
+            persistent = false;
+            glState.bindBuffer(GL_UNIFORM_BUFFER, 0);
+            glState.deleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glState.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        }
+    }
+    if(!persistent)
+    {
+        glBufferData(GL_UNIFORM_BUFFER, totalSize, NULL, GL_STREAM_DRAW);
+    }
+    glState.bindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformRingBuffer::destroy()
+{
+    if(!buffer)
+    {
+        return;
+    }
+    for(size_t i=0; i<fences.size(); i++)
+    {
+        if(fences[i])
+        {
+            glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            glDeleteSync(fences[i]);
+        }
+    }
+    fences.clear();
+
+    glState.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+    if(persistentData)
+    {
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+    }
+    glState.bindBuffer(GL_UNIFORM_BUFFER, 0);
+    glState.deleteBuffers(1, &buffer);
+    buffer = 0;
+    persistentData = NULL;
+    regionData = NULL;
+}
+
+void UniformRingBuffer::reserve(size_t bytesPerFrame)
+{
+    if(alignedSize(bytesPerFrame) > regionSize)
+    {
+        // Grow by at least half again, so a slowly growing scene doesn't recreate every frame
+        create(max(alignedSize(bytesPerFrame), regionSize + regionSize/2), max(regionCount, 3));
+    }
+}
+
+void UniformRingBuffer::begin()
+{
+    currentRegion = (currentRegion + 1) % regionCount;
+    regionOffset = 0;
+
+    lastWaitMs = 0.0;
+    if(fences[currentRegion])
+    {
+        Uint64 waitStart = SDL_GetPerformanceCounter();
+        GLenum result = glClientWaitSync(fences[currentRegion], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while((result != GL_ALREADY_SIGNALED) && (result != GL_CONDITION_SATISFIED) && (result != GL_WAIT_FAILED))
+        {
+            result = glClientWaitSync(fences[currentRegion], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+        glDeleteSync(fences[currentRegion]);
+        fences[currentRegion] = 0;
+        lastWaitMs = (SDL_GetPerformanceCounter() - waitStart) * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+
+    if(persistent)
+    {
+        regionData = persistentData + currentRegion*regionSize;
+    }
+    else
+    {
+        glState.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        regionData = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, currentRegion*regionSize, regionSize,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+}
+
+GLintptr UniformRingBuffer::push(const void* data, size_t size)
+{
+    size_t blockSize = alignedSize(size);
+    if(!regionData || (regionOffset + blockSize > regionSize))
+    {
+        cout << "Uniform ring buffer region overflow, call reserve() before begin()" << endl;
+        return -1;
+    }
+
+    memcpy(regionData + regionOffset, data, size);
+    GLintptr offset = currentRegion*regionSize + regionOffset;
+    regionOffset += blockSize;
+    return offset;
+}
+
+void UniformRingBuffer::bindRange(GLuint binding, GLintptr offset, size_t size)
+{
+    if(offset >= 0)
+    {
+        glState.bindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+    }
+}
+
+void UniformRingBuffer::flush()
+{
+    // NOTE: The persistent mapping is coherent, so only the fallback has anything to do here
+    if(!persistent && regionData)
+    {
+        glState.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glState.bindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    regionData = NULL;
+}
+
+void UniformRingBuffer::end()
+{
+    fences[currentRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,107 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <GL/glew.h>
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+#include "lights.h"
+
+// Binding points of the uniform blocks in simple.vert/simple.frag (UNIFORM_BLOCKS variant)
+const GLuint CAMERA_BLOCK_BINDING = 0;
+const GLuint LIGHTS_BLOCK_BINDING = 1;
+const GLuint OBJECT_BLOCK_BINDING = 2;
+
+// NOTE: These mirror the std140 layout of the blocks in the shaders, a vec3 takes 16 bytes
+//       unless it is followed by a scalar which fills its last 4
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 viewPos;
+    float pad0;
+};
+
+// Every light of the scene, in its own buffer shared by all the programs rather than the ring
+struct LightData
+{
+    glm::vec3 position;
+    float range;
+    glm::vec3 color;
+    float pad0;
+};
+
+struct LightsBlock
+{
+    LightData lights[MAX_LIGHTS];
+    float ambientStrength;
+    int lightCount;
+    float pad0;
+    float pad1;
+};
+
+struct ObjectBlock
+{
+    glm::mat4 model;
+    glm::mat4 mvp;
+    glm::mat4 trans;
+    glm::vec3 objectColor;
+    int addNormalMap;
+    glm::vec4 atlasRegion;
+    int objectLights[MAX_OBJECT_LIGHTS]; // ivec4s in the shader, an int array would take 16 bytes an entry
+    int objectLightCount;
+    int pad0[3];
+};
+
+// NOTE: A uniform buffer split into one region per frame in flight. Each frame writes its blocks
+//       into the next region with plain memcpy and binds them with glBindBufferRange, and a fence
+//       placed after the frame's draws guards the region until the GPU is done reading it.
+//
+//       With GL_ARB_buffer_storage the buffer is mapped once, persistently and coherently. Without
+//       it every frame maps its region unsynchronized (the fence already guarantees the GPU isn't
+//       using it), which means all the blocks must be pushed before flush() and the first draw
+class UniformRingBuffer
+{
+public:
+    UniformRingBuffer();
+
+    void create(size_t regionSize, int regionCount=3);
+    void destroy();
+
+    // Grows the regions if a frame needs more than they hold, must be called before begin()
+    void reserve(size_t bytesPerFrame);
+
+    // Waits on the fence of the next region and starts writing into it
+    void begin();
+    // Copies a block into the current region, returns its offset in the buffer (suitable for
+    // glBindBufferRange)
+    GLintptr push(const void* data, size_t size);
+    void bindRange(GLuint binding, GLintptr offset, size_t size);
+    // Makes the writes visible to the GPU, called once all of the frame's blocks are pushed
+    void flush();
+    // Fences the region once the frame's draws have been issued
+    void end();
+
+    // Rounds a block size up to the offset alignment
+    size_t alignedSize(size_t size);
+
+    bool isPersistent();
+
+    // Time spent waiting on fences in the last begin(), in ms
+    double lastWaitMs;
+
+private:
+    GLuint buffer;
+    bool persistent;
+    size_t regionSize;
+    int regionCount;
+    GLint offsetAlignment;
+    unsigned char* persistentData;
+    unsigned char* regionData;
+    int currentRegion;
+    size_t regionOffset;
+    std::vector<GLsync> fences;
+};
+
+#endif
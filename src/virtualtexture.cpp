@@ -0,0 +1,821 @@
+#include <iostream>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "virtualtexture.h"
+#include "glstate.h"
+#include "stb_image.h"
+
+using namespace std;
+
+const char VIRTUAL_TEXTURE_MAGIC[4] = {'V', 'T', 'P', 'F'};
+const uint32_t VIRTUAL_TEXTURE_VERSION = 1;
+const int VIRTUAL_TEXTURE_BORDER = 1;
+const int VIRTUAL_TEXTURE_CHANNELS = 3;
+
+// NOTE: Feedback pixels store the page coordinates in 8 bit channels, so we can address at most
+//       256x256 pages at mip 0 (32k texels with the default page size)
+const int MAX_VIRTUAL_PAGES = 256;
+
+// NOTE: Only a sanity bound for the headers we read, page buffers and the cache are sized from it
+const uint32_t MAX_VIRTUAL_PAGE_SIZE = 1024;
+
+// NOTE: Bounds the time we spend in glTexSubImage2D per frame, the rest is picked up next frame
+const int MAX_UPLOADS_PER_FRAME = 8;
+
+// NOTE: Page files for 32k textures are several GB, so we need 64-bit offsets
+static int seekFile(FILE* file, int64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET);
+#else
+    return fseeko(file, offset, SEEK_SET);
+#endif
+}
+
+static int wrapCoord(int coord, int size)
+{
+    coord %= size;
+    return (coord < 0) ? coord + size : coord;
+}
+
+// Resamples the source image to the (square, power of 2) virtual size with bilinear filtering
+static void resampleImage(const unsigned char* source, int sourceWidth, int sourceHeight,
+                          unsigned char* dest, int destSize)
+{
+    for(int y=0; y<destSize; y++)
+    {
+        float sourceY = ((y + 0.5f) * sourceHeight / destSize) - 0.5f;
+        int y0 = (int)floor(sourceY);
+        float fy = sourceY - y0;
+        int row0 = min(max(y0, 0), sourceHeight-1);
+        int row1 = min(max(y0+1, 0), sourceHeight-1);
+        for(int x=0; x<destSize; x++)
+        {
+            float sourceX = ((x + 0.5f) * sourceWidth / destSize) - 0.5f;
+            int x0 = (int)floor(sourceX);
+            float fx = sourceX - x0;
+            int col0 = min(max(x0, 0), sourceWidth-1);
+            int col1 = min(max(x0+1, 0), sourceWidth-1);
+            for(int c=0; c<VIRTUAL_TEXTURE_CHANNELS; c++)
+            {
+                float top = source[(row0*sourceWidth + col0)*VIRTUAL_TEXTURE_CHANNELS + c]*(1.0f-fx) +
+                            source[(row0*sourceWidth + col1)*VIRTUAL_TEXTURE_CHANNELS + c]*fx;
+                float bottom = source[(row1*sourceWidth + col0)*VIRTUAL_TEXTURE_CHANNELS + c]*(1.0f-fx) +
+                               source[(row1*sourceWidth + col1)*VIRTUAL_TEXTURE_CHANNELS + c]*fx;
+                dest[((size_t)y*destSize + x)*VIRTUAL_TEXTURE_CHANNELS + c] =
+                        (unsigned char)(top*(1.0f-fy) + bottom*fy + 0.5f);
+            }
+        }
+    }
+}
+
+bool VirtualTexture::buildPageFile(const char* imageFilename, const char* pageFilename, int pageSize)
+{
+    int width, height, nrChannels;
+    unsigned char* data = stbi_load(imageFilename, &width, &height, &nrChannels, VIRTUAL_TEXTURE_CHANNELS);
+    if(!data)
+    {
+        cout << "Failed to load texture " << imageFilename << endl;
+        return false;
+    }
+
+    int pagesNeeded = (max(width, height) + pageSize - 1) / pageSize;
+    int virtualPages = 1;
+    int mipCount = 1;
+    while(virtualPages < pagesNeeded)
+    {
+        virtualPages *= 2;
+        mipCount++;
+    }
+    if(virtualPages > MAX_VIRTUAL_PAGES)
+    {
+        cout << "Virtual texture " << imageFilename << " needs " << virtualPages
+             << " pages per side, use a larger page size" << endl;
+        stbi_image_free(data);
+        return false;
+    }
+
+    FILE* pageFile = fopen(pageFilename, "wb");
+    if(!pageFile)
+    {
+        cout << "Unable to open page file: " << pageFilename << endl;
+        stbi_image_free(data);
+        return false;
+    }
+
+    // NOTE: The virtual texture always covers the full [0,1] UV range, so if the image isn't a
+    //       power of 2 multiple of the page size we stretch it to the virtual size
+    int levelSize = virtualPages * pageSize;
+    vector<unsigned char> level((size_t)levelSize * levelSize * VIRTUAL_TEXTURE_CHANNELS);
+    if((width == levelSize) && (height == levelSize))
+    {
+        memcpy(&level[0], data, level.size());
+    }
+    else
+    {
+        resampleImage(data, width, height, &level[0], levelSize);
+    }
+    stbi_image_free(data);
+
+    VirtualTextureHeader header = {};
+    memcpy(header.magic, VIRTUAL_TEXTURE_MAGIC, 4);
+    header.version = VIRTUAL_TEXTURE_VERSION;
+    header.pageSize = pageSize;
+    header.border = VIRTUAL_TEXTURE_BORDER;
+    header.virtualPages = virtualPages;
+    header.mipCount = mipCount;
+    header.channels = VIRTUAL_TEXTURE_CHANNELS;
+    fwrite(&header, sizeof(header), 1, pageFile);
+
+    int paddedSize = pageSize + 2*VIRTUAL_TEXTURE_BORDER;
+    vector<unsigned char> page((size_t)paddedSize * paddedSize * VIRTUAL_TEXTURE_CHANNELS);
+    for(int mip=0; mip<mipCount; mip++)
+    {
+        int pages = virtualPages >> mip;
+        for(int pageY=0; pageY<pages; pageY++)
+        {
+            for(int pageX=0; pageX<pages; pageX++)
+            {
+                // NOTE: The border wraps around, matching the GL_REPEAT wrapping of the
+                //       regular textures
+                unsigned char* out = &page[0];
+                for(int y=-VIRTUAL_TEXTURE_BORDER; y<pageSize+VIRTUAL_TEXTURE_BORDER; y++)
+                {
+                    int sourceY = wrapCoord(pageY*pageSize + y, levelSize);
+                    for(int x=-VIRTUAL_TEXTURE_BORDER; x<pageSize+VIRTUAL_TEXTURE_BORDER; x++)
+                    {
+                        int sourceX = wrapCoord(pageX*pageSize + x, levelSize);
+                        memcpy(out, &level[((size_t)sourceY*levelSize + sourceX)*VIRTUAL_TEXTURE_CHANNELS],
+                               VIRTUAL_TEXTURE_CHANNELS);
+                        out += VIRTUAL_TEXTURE_CHANNELS;
+                    }
+                }
+                fwrite(&page[0], 1, page.size(), pageFile);
+            }
+        }
+
+        // Box filter the level down for the next mip
+        int nextSize = levelSize / 2;
+        for(int y=0; y<nextSize; y++)
+        {
+            for(int x=0; x<nextSize; x++)
+            {
+                for(int c=0; c<VIRTUAL_TEXTURE_CHANNELS; c++)
+                {
+                    int sum = level[((size_t)(2*y)*levelSize + 2*x)*VIRTUAL_TEXTURE_CHANNELS + c] +
+                              level[((size_t)(2*y)*levelSize + 2*x+1)*VIRTUAL_TEXTURE_CHANNELS + c] +
+                              level[((size_t)(2*y+1)*levelSize + 2*x)*VIRTUAL_TEXTURE_CHANNELS + c] +
+                              level[((size_t)(2*y+1)*levelSize + 2*x+1)*VIRTUAL_TEXTURE_CHANNELS + c];
+                    level[((size_t)y*nextSize + x)*VIRTUAL_TEXTURE_CHANNELS + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        levelSize = nextSize;
+    }
+
+    fclose(pageFile);
+    cout << "Built page file " << pageFilename << " with " << virtualPages << "x" << virtualPages
+         << " pages and " << mipCount << " mips" << endl;
+    return true;
+}
+
+VirtualTexture::VirtualTexture()
+{
+    feedbackWidth = 160;
+    feedbackHeight = 120;
+    pagesRequested = 0;
+    pagesUploaded = 0;
+    pagesResident = 0;
+    totalPages = 0;
+    firstTextureUnit = 0;
+    cachePagesWide = 0;
+    frameIndex = 0;
+    indirectionDirty = false;
+    indirectionTexture = 0;
+    feedbackFramebuffer = 0;
+    feedbackColor = 0;
+    feedbackDepth = 0;
+    feedbackPBOs[0] = 0;
+    feedbackPBOs[1] = 0;
+    feedbackFrame = 0;
+    stopStreaming = false;
+}
+
+VirtualTexture::~VirtualTexture()
+{
+    close();
+}
+
+int VirtualTexture::pageCount(int mip)
+{
+    int pages = header.virtualPages >> mip;
+    return pages * pages;
+}
+
+int VirtualTexture::pageIndex(int mip, int x, int y)
+{
+    return mipOffsets[mip] + y*(header.virtualPages >> mip) + x;
+}
+
+int VirtualTexture::paddedPageSize()
+{
+    return header.pageSize + 2*header.border;
+}
+
+bool VirtualTexture::isOpen()
+{
+    return !layerFiles.empty();
+}
+
+// The page reads and uploads are sized from the header, so it has to describe what
+// buildPageFile() writes: RGB pages on a power of 2 grid with one mip per halving
+static bool isValidHeader(const VirtualTextureHeader& header)
+{
+    if((header.channels != (uint32_t)VIRTUAL_TEXTURE_CHANNELS) || (header.pageSize == 0) ||
+       (header.pageSize > MAX_VIRTUAL_PAGE_SIZE) || (header.border >= header.pageSize) ||
+       (header.virtualPages == 0) || (header.virtualPages > (uint32_t)MAX_VIRTUAL_PAGES) ||
+       ((header.virtualPages & (header.virtualPages - 1)) != 0))
+    {
+        return false;
+    }
+    uint32_t mipCount = 1;
+    while((header.virtualPages >> (mipCount - 1)) > 1)
+    {
+        mipCount++;
+    }
+    return header.mipCount == mipCount;
+}
+
+bool VirtualTexture::open(const vector<const char*>& pageFilenames, int firstTextureUnit, int cachePagesWide)
+{
+    close();
+
+    for(size_t layer=0; layer<pageFilenames.size(); layer++)
+    {
+        FILE* file = fopen(pageFilenames[layer], "rb");
+        VirtualTextureHeader layerHeader;
+        if(!file || (fread(&layerHeader, sizeof(layerHeader), 1, file) != 1) ||
+           (memcmp(layerHeader.magic, VIRTUAL_TEXTURE_MAGIC, 4) != 0) ||
+           (layerHeader.version != VIRTUAL_TEXTURE_VERSION) || !isValidHeader(layerHeader))
+        {
+            cout << "Unable to open page file: " << pageFilenames[layer] << endl;
+            if(file)
+            {
+                fclose(file);
+            }
+            close();
+            return false;
+        }
+
+        if(layer == 0)
+        {
+            header = layerHeader;
+        }
+        else if((layerHeader.pageSize != header.pageSize) ||
+                (layerHeader.virtualPages != header.virtualPages) ||
+                (layerHeader.border != header.border))
+        {
+            cout << "Page file " << pageFilenames[layer] << " doesn't match the layout of "
+                 << pageFilenames[0] << endl;
+            fclose(file);
+            close();
+            return false;
+        }
+        layerFiles.push_back(file);
+    }
+    if(layerFiles.empty())
+    {
+        return false;
+    }
+
+    mipOffsets.resize(header.mipCount);
+    totalPages = 0;
+    for(uint32_t mip=0; mip<header.mipCount; mip++)
+    {
+        mipOffsets[mip] = totalPages;
+        totalPages += pageCount(mip);
+    }
+
+    this->firstTextureUnit = firstTextureUnit;
+    this->cachePagesWide = cachePagesWide;
+    int slotCount = cachePagesWide * cachePagesWide;
+    pageSlots.assign(totalPages, -1);
+    pagePending.assign(totalPages, false);
+    pageFailed.assign(totalPages, false);
+    pageSeenFrame.assign(totalPages, 0);
+    slotPages.assign(slotCount, -1);
+    slotLastUsed.assign(slotCount, 0);
+    indirectionData.assign(totalPages*4, 0);
+    frameIndex = 1;
+
+    // Indirection texture, sampled with nearest filtering since entries can't be interpolated
+    glState.activeTexture(firstTextureUnit);
+    glGenTextures(1, &indirectionTexture);
+    glState.bindTexture(GL_TEXTURE_2D, indirectionTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.mipCount-1);
+    for(uint32_t mip=0; mip<header.mipCount; mip++)
+    {
+        int pages = header.virtualPages >> mip;
+        glTexImage2D(GL_TEXTURE_2D, mip, GL_RGBA8, pages, pages, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     &indirectionData[mipOffsets[mip]*4]);
+    }
+
+    // Physical page caches, one per layer
+    int cacheSize = cachePagesWide * paddedPageSize();
+    cacheTextures.resize(layerFiles.size());
+    glGenTextures(cacheTextures.size(), &cacheTextures[0]);
+    for(size_t layer=0; layer<cacheTextures.size(); layer++)
+    {
+        glState.bindTexture(firstTextureUnit + 1 + layer, GL_TEXTURE_2D, cacheTextures[layer]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, cacheSize, cacheSize, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    }
+
+    // Feedback target
+    glGenTextures(1, &feedbackColor);
+    glState.bindTexture(GL_TEXTURE_2D, feedbackColor);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, feedbackWidth, feedbackHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glGenRenderbuffers(1, &feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+    glGenFramebuffers(1, &feedbackFramebuffer);
+    glState.bindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        cout << "Virtual texture feedback framebuffer is incomplete" << endl;
+    }
+    glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(2, feedbackPBOs);
+    for(int i=0; i<2; i++)
+    {
+        glState.bindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBOs[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, feedbackWidth*feedbackHeight*4, NULL, GL_STREAM_READ);
+    }
+    glState.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    feedbackFrame = 0;
+
+    // The coarsest mip is loaded up front and never evicted, so there is always something to
+    // fall back to
+    PageData topPage;
+    if(!readPage(pageIndex(header.mipCount-1, 0, 0), &topPage))
+    {
+        close();
+        return false;
+    }
+    uploadPage(&topPage);
+    slotLastUsed[pageSlots[topPage.pageIndex]] = 0xFFFFFFFF;
+    rebuildIndirection();
+
+    stopStreaming = false;
+    streamer = thread(&VirtualTexture::streamingThread, this);
+
+    cout << "Opened virtual texture with " << header.virtualPages << "x" << header.virtualPages
+         << " pages, " << totalPages << " pages in total, " << slotCount << " cache slots" << endl;
+    return true;
+}
+
+void VirtualTexture::close()
+{
+    if(streamer.joinable())
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopStreaming = true;
+        }
+        queueCondition.notify_all();
+        streamer.join();
+    }
+    requestQueue.clear();
+    for(size_t i=0; i<completedQueue.size(); i++)
+    {
+        delete completedQueue[i];
+    }
+    completedQueue.clear();
+
+    for(size_t layer=0; layer<layerFiles.size(); layer++)
+    {
+        fclose(layerFiles[layer]);
+    }
+    layerFiles.clear();
+
+    if(indirectionTexture)
+    {
+        glState.deleteTextures(1, &indirectionTexture);
+        glState.deleteTextures(cacheTextures.size(), &cacheTextures[0]);
+        glState.deleteTextures(1, &feedbackColor);
+        glDeleteRenderbuffers(1, &feedbackDepth);
+        glState.deleteFramebuffers(1, &feedbackFramebuffer);
+        glState.deleteBuffers(2, feedbackPBOs);
+        indirectionTexture = 0;
+        cacheTextures.clear();
+    }
+}
+
+bool VirtualTexture::readPage(int pageIndex, PageData* page)
+{
+    size_t pageBytes = (size_t)paddedPageSize() * paddedPageSize() * header.channels;
+    page->pageIndex = pageIndex;
+    page->valid = false;
+    page->texels.resize(pageBytes * layerFiles.size());
+    for(size_t layer=0; layer<layerFiles.size(); layer++)
+    {
+        int64_t offset = sizeof(VirtualTextureHeader) + (int64_t)pageIndex * pageBytes;
+        if((seekFile(layerFiles[layer], offset) != 0) ||
+           (fread(&page->texels[layer*pageBytes], 1, pageBytes, layerFiles[layer]) != pageBytes))
+        {
+            cout << "Failed to read virtual texture page " << pageIndex << endl;
+            return false;
+        }
+    }
+    page->valid = true;
+    return true;
+}
+
+void VirtualTexture::streamingThread()
+{
+    while(true)
+    {
+        int pageIndex;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            while(requestQueue.empty() && !stopStreaming)
+            {
+                queueCondition.wait(lock);
+            }
+            if(stopStreaming)
+            {
+                return;
+            }
+            pageIndex = requestQueue.front();
+            requestQueue.pop_front();
+        }
+
+        // A page that failed to read is still handed back, so it stops being pending
+        PageData* page = new PageData();
+        readPage(pageIndex, page);
+
+        lock_guard<mutex> lock(queueMutex);
+        completedQueue.push_back(page);
+    }
+}
+
+int VirtualTexture::allocateSlot()
+{
+    int bestSlot = -1;
+    for(size_t slot=0; slot<slotPages.size(); slot++)
+    {
+        if(slotPages[slot] < 0)
+        {
+            return slot;
+        }
+        if((bestSlot < 0) || (slotLastUsed[slot] < slotLastUsed[bestSlot]))
+        {
+            bestSlot = slot;
+        }
+    }
+
+    // NOTE: Don't evict pages which were sampled this frame, otherwise a too small cache would
+    //       just thrash
+    if(slotLastUsed[bestSlot] >= frameIndex)
+    {
+        return -1;
+    }
+    pageSlots[slotPages[bestSlot]] = -1;
+    slotPages[bestSlot] = -1;
+    return bestSlot;
+}
+
+void VirtualTexture::uploadPage(PageData* page)
+{
+    // Left out of the cache
+    if(!page->valid)
+    {
+        return;
+    }
+    int slot = allocateSlot();
+    if(slot < 0)
+    {
+        return;
+    }
+
+    int padded = paddedPageSize();
+    size_t pageBytes = (size_t)padded * padded * header.channels;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(size_t layer=0; layer<cacheTextures.size(); layer++)
+    {
+        glState.bindTexture(firstTextureUnit + 1 + layer, GL_TEXTURE_2D, cacheTextures[layer]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cachePagesWide)*padded, (slot / cachePagesWide)*padded,
+                        padded, padded, GL_RGB, GL_UNSIGNED_BYTE, &page->texels[layer*pageBytes]);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    pageSlots[page->pageIndex] = slot;
+    slotPages[slot] = page->pageIndex;
+    slotLastUsed[slot] = frameIndex;
+    indirectionDirty = true;
+    pagesUploaded++;
+}
+
+void VirtualTexture::rebuildIndirection()
+{
+    // Every page that isn't resident inherits the entry of its parent, so we walk from the
+    // coarsest mip down
+    for(int mip=header.mipCount-1; mip>=0; mip--)
+    {
+        int pages = header.virtualPages >> mip;
+        for(int y=0; y<pages; y++)
+        {
+            for(int x=0; x<pages; x++)
+            {
+                int index = pageIndex(mip, x, y);
+                unsigned char* entry = &indirectionData[index*4];
+                int slot = pageSlots[index];
+                if(slot >= 0)
+                {
+                    entry[0] = slot % cachePagesWide;
+                    entry[1] = slot / cachePagesWide;
+                    entry[2] = mip;
+                    entry[3] = 255;
+                }
+                else if(mip == (int)header.mipCount-1)
+                {
+                    memset(entry, 0, 4);
+                }
+                else
+                {
+                    memcpy(entry, &indirectionData[pageIndex(mip+1, x/2, y/2)*4], 4);
+                }
+            }
+        }
+    }
+
+    glState.bindTexture(firstTextureUnit, GL_TEXTURE_2D, indirectionTexture);
+    for(uint32_t mip=0; mip<header.mipCount; mip++)
+    {
+        int pages = header.virtualPages >> mip;
+        glTexSubImage2D(GL_TEXTURE_2D, mip, 0, 0, pages, pages, GL_RGBA, GL_UNSIGNED_BYTE,
+                        &indirectionData[mipOffsets[mip]*4]);
+    }
+    indirectionDirty = false;
+}
+
+void VirtualTexture::beginFeedback()
+{
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, previousClearColor);
+    glState.bindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    glViewport(0, 0, feedbackWidth, feedbackHeight);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::endFeedback()
+{
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glState.bindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBOs[feedbackFrame % 2]);
+    glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+    // NOTE: Mapping the PBO we issued the read into last frame, so the copy has (almost always)
+    //       completed and mapping it doesn't stall
+    if(feedbackFrame > 0)
+    {
+        glState.bindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBOs[(feedbackFrame + 1) % 2]);
+        const unsigned char* pixels = (const unsigned char*)glMapBufferRange(
+                GL_PIXEL_PACK_BUFFER, 0, feedbackWidth*feedbackHeight*4, GL_MAP_READ_BIT);
+        if(pixels)
+        {
+            processFeedback(pixels, feedbackWidth*feedbackHeight);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+    }
+    glState.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    feedbackFrame++;
+
+    glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    glClearColor(previousClearColor[0], previousClearColor[1], previousClearColor[2], previousClearColor[3]);
+}
+
+void VirtualTexture::processFeedback(const unsigned char* pixels, int pixelCount)
+{
+    vector<int> newRequests;
+    for(int i=0; i<pixelCount; i++)
+    {
+        const unsigned char* pixel = &pixels[i*4];
+        if(pixel[3] == 0)
+        {
+            continue;
+        }
+
+        // Walk up the mip chain, so the coarser pages get requested (and arrive) first, stopping
+        // at the first page we already know about
+        int x = pixel[0];
+        int y = pixel[1];
+        for(int mip=min((int)pixel[2], (int)header.mipCount-1); mip<(int)header.mipCount; mip++)
+        {
+            int index = pageIndex(mip, x, y);
+            if(pageSeenFrame[index] == frameIndex)
+            {
+                break;
+            }
+            pageSeenFrame[index] = frameIndex;
+
+            if(pageSlots[index] >= 0)
+            {
+                slotLastUsed[pageSlots[index]] = max(slotLastUsed[pageSlots[index]], frameIndex);
+            }
+            else if(!pagePending[index] && !pageFailed[index])
+            {
+                pagePending[index] = true;
+                newRequests.push_back(index);
+            }
+            x /= 2;
+            y /= 2;
+        }
+    }
+
+    // Page indices of coarser mips are higher, so this puts them at the front of the queue
+    sort(newRequests.begin(), newRequests.end(), greater<int>());
+    pagesRequested = newRequests.size();
+
+    lock_guard<mutex> lock(queueMutex);
+    // NOTE: Requests still queued from a previous frame may not be needed anymore (the camera moved),
+    //       we drop them and only keep what this frame's feedback asked for
+    for(size_t i=0; i<requestQueue.size(); i++)
+    {
+        if(pageSeenFrame[requestQueue[i]] != frameIndex)
+        {
+            pagePending[requestQueue[i]] = false;
+        }
+    }
+    requestQueue.erase(remove_if(requestQueue.begin(), requestQueue.end(),
+                                 [this](int index) { return !pagePending[index]; }),
+                       requestQueue.end());
+    requestQueue.insert(requestQueue.end(), newRequests.begin(), newRequests.end());
+    if(!requestQueue.empty())
+    {
+        queueCondition.notify_one();
+    }
+}
+
+void VirtualTexture::update()
+{
+    pagesUploaded = 0;
+
+    vector<PageData*> pages;
+    {
+        lock_guard<mutex> lock(queueMutex);
+        while(!completedQueue.empty() && (pages.size() < (size_t)MAX_UPLOADS_PER_FRAME))
+        {
+            pages.push_back(completedQueue.front());
+            completedQueue.pop_front();
+        }
+    }
+
+    for(size_t i=0; i<pages.size(); i++)
+    {
+        pagePending[pages[i]->pageIndex] = false;
+        // Read once and reported once, the coarser pages stand in for it from then on
+        pageFailed[pages[i]->pageIndex] = !pages[i]->valid;
+        uploadPage(pages[i]);
+        delete pages[i];
+    }
+
+    if(indirectionDirty)
+    {
+        rebuildIndirection();
+    }
+
+    pagesResident = 0;
+    for(size_t slot=0; slot<slotPages.size(); slot++)
+    {
+        if(slotPages[slot] >= 0)
+        {
+            pagesResident++;
+        }
+    }
+    frameIndex++;
+}
+
+bool VirtualTexture::checkPageUploads()
+{
+    // Two pages of mip 0 that aren't resident, filled with a value of their own for every layer
+    int padded = paddedPageSize();
+    size_t pageBytes = (size_t)padded * padded * header.channels;
+    PageData pages[2];
+    int uploaded = 0;
+    for(int index=0; (index < pageCount(0)) && (uploaded < 2); index++)
+    {
+        if(pageSlots[index] >= 0)
+        {
+            continue;
+        }
+        PageData& page = pages[uploaded];
+        page.pageIndex = index;
+        page.valid = true;
+        page.texels.resize(pageBytes * cacheTextures.size());
+        for(size_t layer=0; layer<cacheTextures.size(); layer++)
+        {
+            memset(&page.texels[layer*pageBytes], 16 + 32*uploaded + 64*layer, pageBytes);
+        }
+        uploadPage(&page);
+        uploaded++;
+    }
+
+    bool passed = (uploaded == 2) && (pageSlots[pages[0].pageIndex] >= 0) && (pageSlots[pages[1].pageIndex] >= 0);
+    int cacheSize = cachePagesWide * padded;
+    vector<unsigned char> cache((size_t)cacheSize * cacheSize * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for(size_t layer=0; passed && (layer<cacheTextures.size()); layer++)
+    {
+        glState.bindTexture(firstTextureUnit + 1 + layer, GL_TEXTURE_2D, cacheTextures[layer]);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, &cache[0]);
+        for(int i=0; i<2; i++)
+        {
+            int slot = pageSlots[pages[i].pageIndex];
+            int x = (slot % cachePagesWide) * padded;
+            int y = (slot / cachePagesWide) * padded;
+            unsigned char expected = 16 + 32*i + 64*layer;
+            for(int row=0; passed && (row<padded); row++)
+            {
+                const unsigned char* texels = &cache[((size_t)(y + row)*cacheSize + x) * 3];
+                for(int j=0; j<padded*3; j++)
+                {
+                    if(texels[j] != expected)
+                    {
+                        cout << "Page " << i << " of layer " << layer << " wasn't written into its cache" << endl;
+                        passed = false;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    // The made up pages are dropped again, their slots read as empty
+    for(int i=0; i<uploaded; i++)
+    {
+        int slot = pageSlots[pages[i].pageIndex];
+        if(slot >= 0)
+        {
+            pageSlots[pages[i].pageIndex] = -1;
+            slotPages[slot] = -1;
+        }
+    }
+    rebuildIndirection();
+    return passed;
+}
+
+void VirtualTextureUniforms::lookUp(ShaderProgram& program)
+{
+    indirection = program.uniformLocation("vtIndirection");
+    diffuseCache = program.uniformLocation("ourTexture");
+    normalCache = program.uniformLocation("ourTextureMap");
+    params = program.uniformLocation("vtParams");
+    cacheSize = program.uniformLocation("vtCacheSize");
+    feedbackBias = program.uniformLocation("vtFeedbackBias");
+}
+
+void VirtualTexture::bind(ShaderProgram& program, const VirtualTextureUniforms& uniforms)
+{
+    glState.bindTexture(firstTextureUnit, GL_TEXTURE_2D, indirectionTexture);
+    program.set(uniforms.indirection, firstTextureUnit);
+    for(size_t layer=0; layer<cacheTextures.size(); layer++)
+    {
+        glState.bindTexture(firstTextureUnit + 1 + layer, GL_TEXTURE_2D, cacheTextures[layer]);
+    }
+    program.set(uniforms.diffuseCache, firstTextureUnit + 1);
+    program.set(uniforms.normalCache, firstTextureUnit + 2);
+
+    program.set(uniforms.params, glm::vec4(header.virtualPages * header.pageSize,
+                header.mipCount - 1, header.pageSize, header.border));
+    program.set(uniforms.cacheSize, (float)(cachePagesWide * paddedPageSize()));
+}
+
+void VirtualTexture::setFeedbackUniforms(ShaderProgram& program, const VirtualTextureUniforms& uniforms)
+{
+    program.set(uniforms.params, glm::vec4(header.virtualPages * header.pageSize,
+                header.mipCount - 1, header.pageSize, header.border));
+
+    // NOTE: The feedback buffer is smaller than the window, which makes the UV derivatives larger,
+    //       so we bias the mip back to what the full resolution pass will pick
+    float bias = -log2((float)previousViewport[2] / feedbackWidth);
+    program.set(uniforms.feedbackBias, bias);
+}
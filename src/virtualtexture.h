@@ -0,0 +1,147 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <GL/glew.h>
+#include "shaderprogram.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// NOTE: A virtual texture splits a (potentially huge) image into fixed size pages, stored on disk
+//       in a page file, and only keeps the pages that were actually sampled in a physical page
+//       cache texture. An indirection texture (one texel per page, one mip per virtual mip level)
+//       maps each virtual page to its slot in the cache, falling back to the closest resident
+//       coarser page while the requested one is still streaming in.
+//
+//       Each virtual texture can have several layers (in our case diffuse and normal map) which
+//       share the same page layout, so they also share the indirection texture and the cache
+//       slots, and are always streamed in together.
+
+struct VirtualTextureHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t pageSize;      // Size of the page content in texels
+    uint32_t border;        // Texels of border on each side of a page, for bilinear filtering
+    uint32_t virtualPages;  // Pages along each side of the virtual texture at mip 0
+    uint32_t mipCount;
+    uint32_t channels;
+    uint32_t reserved;
+};
+
+struct PageData
+{
+    int pageIndex;
+    std::vector<unsigned char> texels; // One padded page per layer, back to back
+    bool valid;                        // False if reading it failed, it isn't uploaded then
+};
+
+// Locations of the uniforms a program reads the virtual texture through, -1 for those it doesn't
+// have. Looked up once after the program is linked, like the rest of its uniforms
+struct VirtualTextureUniforms
+{
+    GLint indirection;
+    GLint diffuseCache;
+    GLint normalCache;
+    GLint params;
+    GLint cacheSize;
+    GLint feedbackBias;
+
+    void lookUp(ShaderProgram& program);
+};
+
+class VirtualTexture
+{
+public:
+    VirtualTexture();
+    ~VirtualTexture();
+
+    // Offline step: tiles an image into a page file (including all of its mip levels)
+    static bool buildPageFile(const char* imageFilename, const char* pageFilename, int pageSize=128);
+
+    // All the page files need to have been built with the same page size and virtual size
+    bool open(const std::vector<const char*>& pageFilenames, int firstTextureUnit, int cachePagesWide=16);
+    void close();
+    bool isOpen();
+
+    // Feedback pass: the feedback buffer is rendered at a reduced resolution, and read back
+    // asynchronously through a pair of PBOs, so we only ever map last frame's results
+    void beginFeedback();
+    void endFeedback();
+
+    // Uploads pages which the streaming thread has finished reading, and rebuilds the
+    // indirection texture if anything changed. Must be called on the GL thread
+    void update();
+
+    // Binds the indirection texture and physical caches (starting at the texture unit given to
+    // open) and sets the matching sampler/parameter uniforms on the program. The physical caches
+    // take the place of ourTexture/ourTextureMap
+    void bind(ShaderProgram& program, const VirtualTextureUniforms& uniforms);
+    void setFeedbackUniforms(ShaderProgram& program, const VirtualTextureUniforms& uniforms);
+
+    // Uploads two made up pages in a row and reads the page caches back, false if a layer of
+    // either page landed anywhere but in its own layer's cache. The cache is left as it was
+    bool checkPageUploads();
+
+    int feedbackWidth;
+    int feedbackHeight;
+
+    // Stats for the last frame
+    int pagesRequested;
+    int pagesUploaded;
+    int pagesResident;
+
+private:
+    int pageCount(int mip);
+    int pageIndex(int mip, int x, int y);
+    int paddedPageSize();
+    bool readPage(int pageIndex, PageData* page);
+    void uploadPage(PageData* page);
+    void processFeedback(const unsigned char* pixels, int pixelCount);
+    int allocateSlot();
+    void rebuildIndirection();
+    void streamingThread();
+
+    VirtualTextureHeader header;
+    std::vector<FILE*> layerFiles;
+    std::vector<int> mipOffsets;     // Index of the first page of each mip in the page file
+    int totalPages;
+
+    int firstTextureUnit;
+    int cachePagesWide;
+    std::vector<int> pageSlots;      // Cache slot of every virtual page, -1 if not resident
+    std::vector<int> slotPages;      // Virtual page held by every cache slot, -1 if empty
+    std::vector<unsigned int> slotLastUsed;
+    std::vector<bool> pagePending;
+    std::vector<bool> pageFailed;    // Couldn't be read, never requested again
+    std::vector<unsigned int> pageSeenFrame;
+    unsigned int frameIndex;
+    bool indirectionDirty;
+
+    GLuint indirectionTexture;
+    std::vector<GLuint> cacheTextures;
+    std::vector<unsigned char> indirectionData; // RGBA per page, laid out like the page file
+
+    GLuint feedbackFramebuffer;
+    GLuint feedbackColor;
+    GLuint feedbackDepth;
+    GLuint feedbackPBOs[2];
+    int feedbackFrame;
+    GLint previousViewport[4];
+    GLfloat previousClearColor[4];
+
+    std::thread streamer;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<int> requestQueue;
+    std::deque<PageData*> completedQueue;
+    bool stopStreaming;
+};
+
+#endif
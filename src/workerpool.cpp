@@ -0,0 +1,123 @@
+#include "workerpool.h"
+
+using namespace std;
+
+WorkerPool::WorkerPool()
+{
+    workers = 1;
+    job = NULL;
+    itemCount = 0;
+    activeWorkers = 1;
+    generation = 0;
+    pending = 0;
+    stopping = false;
+}
+
+WorkerPool::~WorkerPool()
+{
+    destroy();
+}
+
+void WorkerPool::create(int threadCount)
+{
+    destroy();
+    workers = (threadCount < 1) ? 1 : threadCount;
+    stopping = false;
+    for(int i=1; i<workers; i++)
+    {
+        threads.push_back(thread(&WorkerPool::workerThread, this, i, generation));
+    }
+}
+
+void WorkerPool::destroy()
+{
+    {
+        lock_guard<mutex> lock(poolMutex);
+        stopping = true;
+    }
+    startCondition.notify_all();
+    for(size_t i=0; i<threads.size(); i++)
+    {
+        threads[i].join();
+    }
+    threads.clear();
+    workers = 1;
+}
+
+int WorkerPool::threadCount()
+{
+    return workers;
+}
+
+void WorkerPool::slice(int worker, int& begin, int& end)
+{
+    if(worker >= activeWorkers)
+    {
+        begin = end = itemCount;
+        return;
+    }
+    begin = (int)((long long)itemCount * worker / activeWorkers);
+    end = (int)((long long)itemCount * (worker + 1) / activeWorkers);
+}
+
+void WorkerPool::run(int itemCount, const WorkerJob& job, int minItemsPerWorker)
+{
+    int active = itemCount / ((minItemsPerWorker < 1) ? 1 : minItemsPerWorker);
+    active = (active < 1) ? 1 : ((active > workers) ? workers : active);
+    if(active == 1)
+    {
+        job(0, 0, itemCount);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(poolMutex);
+        this->job = &job;
+        this->itemCount = itemCount;
+        activeWorkers = active;
+        pending = threads.size();
+        generation++;
+    }
+    startCondition.notify_all();
+
+    int begin, end;
+    slice(0, begin, end);
+    job(0, begin, end);
+
+    unique_lock<mutex> lock(poolMutex);
+    doneCondition.wait(lock, [this]{ return pending == 0; });
+    this->job = NULL;
+}
+
+void WorkerPool::workerThread(int worker, int startGeneration)
+{
+    int seenGeneration = startGeneration;
+    while(true)
+    {
+        int begin, end;
+        const WorkerJob* currentJob;
+        {
+            unique_lock<mutex> lock(poolMutex);
+            startCondition.wait(lock, [&]{ return stopping || (generation != seenGeneration); });
+            if(stopping)
+            {
+                return;
+            }
+            seenGeneration = generation;
+            currentJob = job;
+            slice(worker, begin, end);
+        }
+
+        if(begin < end)
+        {
+            (*currentJob)(worker, begin, end);
+        }
+
+        lock_guard<mutex> lock(poolMutex);
+        pending--;
+        if(pending == 0)
+        {
+            doneCondition.notify_one();
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Runs a job over a range of items, given the worker index and its contiguous [begin, end)
+typedef std::function<void(int worker, int begin, int end)> WorkerJob;
+
+// NOTE: A fixed set of threads which are woken for every run() and each handle one contiguous
+//       slice of the items. The calling thread takes the first slice itself, so a pool of one
+//       thread runs the job inline without any synchronisation
+class WorkerPool
+{
+public:
+    WorkerPool();
+    ~WorkerPool();
+
+    void create(int threadCount);
+    void destroy();
+    int threadCount();
+
+    // Returns once every slice is done. Fewer workers are used when there would be less than
+    // minItemsPerWorker items for each, the rest get an empty slice
+    void run(int itemCount, const WorkerJob& job, int minItemsPerWorker=1);
+
+private:
+    void workerThread(int worker, int startGeneration);
+    void slice(int worker, int& begin, int& end);
+
+    int workers;
+    std::vector<std::thread> threads;
+    std::mutex poolMutex;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+    const WorkerJob* job;
+    int itemCount;
+    int activeWorkers;
+    int generation;
+    int pending;
+    bool stopping;
+};
+
+#endif